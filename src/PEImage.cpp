@@ -5,37 +5,28 @@
 // see file LICENSE for further details
 
 #include "PEImage.h"
+#include "fileio.h"
+#include "memreport.h"
 
 extern "C" {
 #include "mscvpdb.h"
 }
 
 #include <stdio.h>
-#include <io.h>
-#include <fcntl.h>
+#include <string.h>
 #include <ctype.h>
-#include <direct.h>
-#include <share.h>
-#include <sys/stat.h>
+#include <algorithm>
 #include <vector>
 
-#ifdef UNICODE
-#define T_sopen	_wsopen
-#define T_open	_wopen
-#else
-#define T_sopen	sopen
-#define T_open	open
-#endif
-
 ///////////////////////////////////////////////////////////////////////
-PEImage::PEImage(const TCHAR* iname)
+PEImage::PEImage(const char* iname)
 : dump_base(0)
 , dump_total_len(0)
 , dirHeader(0)
 , hdr32(0)
 , hdr64(0)
 , fd(-1)
-, debug_aranges(0)
+, debug_aranges(0), debug_aranges_length(0)
 , debug_pubnames(0)
 , debug_pubtypes(0)
 , debug_info(0), debug_info_length(0)
@@ -53,6 +44,8 @@ PEImage::PEImage(const TCHAR* iname)
 , symtable(0)
 , strtable(0)
 , bigobj(false)
+, symHashBuilt(false)
+, sectionsShareStart(false)
 {
 	if(iname)
 		loadExe(iname);
@@ -63,16 +56,19 @@ PEImage::~PEImage()
 	if(fd != -1)
 		close(fd);
 	if(dump_base)
+	{
 		free_aligned(dump_base);
+		memTrack(kMemImage, dump_total_len, 0);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////
-bool PEImage::readAll(const TCHAR* iname)
+bool PEImage::readAll(const char* iname)
 {
 	if (fd != -1)
 		return setError("file already open");
 
-	fd = T_sopen(iname, O_RDONLY | O_BINARY, SH_DENYWR);
+	fd = openFileRead(iname);
 	if (fd == -1)
 		return setError("Can't open file");
 
@@ -84,6 +80,7 @@ bool PEImage::readAll(const TCHAR* iname)
 	dump_base = alloc_aligned(dump_total_len, 0x1000);
 	if (!dump_base)
 		return setError("Out of memory");
+	memTrack(kMemImage, 0, dump_total_len);
 	if (read(fd, dump_base, dump_total_len) != dump_total_len)
 		return setError("Cannot read file");
 
@@ -93,7 +90,7 @@ bool PEImage::readAll(const TCHAR* iname)
 }
 
 ///////////////////////////////////////////////////////////////////////
-bool PEImage::loadExe(const TCHAR* iname)
+bool PEImage::loadExe(const char* iname)
 {
     if (!readAll(iname))
         return false;
@@ -102,7 +99,7 @@ bool PEImage::loadExe(const TCHAR* iname)
 }
 
 ///////////////////////////////////////////////////////////////////////
-bool PEImage::loadObj(const TCHAR* iname)
+bool PEImage::loadObj(const char* iname)
 {
     if (!readAll(iname))
         return false;
@@ -111,7 +108,7 @@ bool PEImage::loadObj(const TCHAR* iname)
 }
 
 ///////////////////////////////////////////////////////////////////////
-bool PEImage::save(const TCHAR* oname)
+bool PEImage::save(const char* oname)
 {
 	if (fd != -1)
 		return setError("file already open");
@@ -119,7 +116,7 @@ bool PEImage::save(const TCHAR* oname)
 	if (!dump_base)
 		return setError("no data to dump");
 
-	fd = T_open(oname, O_WRONLY | O_CREAT | O_BINARY | O_TRUNC, S_IREAD | S_IWRITE | S_IEXEC);
+	fd = openFileWrite(oname, true);
 	if (fd == -1)
 		return setError("Can't create file");
 
@@ -238,7 +235,11 @@ bool PEImage::replaceDebugSection (const void* data, int datalen, bool initCV)
 	dbgDir->SizeOfData = sec[s].SizeOfRawData - sizeof(IMAGE_DEBUG_DIRECTORY);
 #endif
 
+	nsec = s + 1;
+	initSectionIndex();
+
 	free_aligned(dump_base);
+	memTrack(kMemImage, dump_total_len, dump_total_len + fill + xdatalen);
 	dump_base = newdata;
 	dump_total_len += fill + xdatalen;
 
@@ -275,6 +276,7 @@ bool PEImage::initCVPtr(bool initDbgDir)
     symtable = DPV<char>(IMGHDR(FileHeader.PointerToSymbolTable));
     nsym = IMGHDR(FileHeader.NumberOfSymbols);
 	strtable = symtable + nsym * IMAGE_SIZEOF_SYMBOL;
+	initSectionIndex();
 
 	if(IMGHDR(OptionalHeader.NumberOfRvaAndSizes) <= IMAGE_DIRECTORY_ENTRY_DEBUG)
 		return setError("too few entries in data directory");
@@ -341,6 +343,7 @@ bool PEImage::initDWARFPtr(bool initDbgDir)
 	symtable = DPV<char>(IMGHDR(FileHeader.PointerToSymbolTable));
     nsym = IMGHDR(FileHeader.NumberOfSymbols);
 	strtable = symtable + nsym * IMAGE_SIZEOF_SYMBOL;
+	initSectionIndex();
 	initDWARFSegments();
 
 	setError(0);
@@ -382,6 +385,7 @@ bool PEImage::initDWARFObject()
     if (!symtable || !strtable)
 	    return setError("Unknown object file format");
 
+    initSectionIndex();
     initDWARFSegments();
     setError(0);
     return true;
@@ -405,7 +409,7 @@ void PEImage::initDWARFSegments()
 			name = strtable + off;
 		}
 		if(strcmp(name, ".debug_aranges") == 0)
-			debug_aranges = DPV<char>(sec[s].PointerToRawData, sizeInImage(sec[s]));
+			debug_aranges = DPV<char>(sec[s].PointerToRawData, debug_aranges_length = sizeInImage(sec[s]));
 		if(strcmp(name, ".debug_pubnames") == 0)
 			debug_pubnames = DPV<char>(sec[s].PointerToRawData, sizeInImage(sec[s]));
 		if(strcmp(name, ".debug_pubtypes") == 0)
@@ -454,7 +458,7 @@ bool PEImage::relocateDebugLineInfo(unsigned int img_base)
 
 				if(type == 3) // HIGHLOW
 				{
-					*(long*) (p + off) += img_base;
+					*(unsigned int*) (p + off) += img_base;
 				}
 			}
 		}
@@ -472,34 +476,46 @@ int PEImage::getRelocationInLineSegment(unsigned int offset) const
 
 int PEImage::getRelocationInSegment(int segment, unsigned int offset) const
 {
-    if (segment < 0)
+    if (segment < 0 || segment >= nsec)
+        return -1;
+
+    const std::vector<PERelocTarget>& index = relocationIndex(segment);
+    PERelocTarget key = { offset, 0 };
+    std::vector<PERelocTarget>::const_iterator it = std::lower_bound(index.begin(), index.end(), key);
+    if (it == index.end() || it->offset != offset)
         return -1;
+    return it->section;
+}
+
+const std::vector<PERelocTarget>& PEImage::relocationIndex(int segment) const
+{
+    if (relocIndex.empty())
+    {
+        relocIndex.resize(nsec);
+        relocIndexBuilt.resize(nsec, false);
+    }
+    std::vector<PERelocTarget>& index = relocIndex[segment];
+    if (relocIndexBuilt[segment])
+        return index;
+    relocIndexBuilt[segment] = true;
 
     int cnt = sec[segment].NumberOfRelocations;
     IMAGE_RELOCATION* rel = DPV<IMAGE_RELOCATION>(sec[segment].PointerToRelocations, cnt * sizeof(IMAGE_RELOCATION));
     if (!rel)
-        return -1;
+        return index;
 
+    index.resize(cnt);
     for (int i = 0; i < cnt; i++)
-        if (rel[i].VirtualAddress == offset)
-        {
-            if (bigobj)
-            {
-                IMAGE_SYMBOL_EX* sym = (IMAGE_SYMBOL_EX*)(symtable + rel[i].SymbolTableIndex * sizeof(IMAGE_SYMBOL_EX));
-                if (!sym)
-                    return -1;
-                return sym->SectionNumber;
-            }
-            else
-            {
-                IMAGE_SYMBOL* sym = (IMAGE_SYMBOL*)(symtable + rel[i].SymbolTableIndex * IMAGE_SIZEOF_SYMBOL);
-                if (!sym)
-                    return -1;
-                return sym->SectionNumber;
-            }
-        }
-
-    return -1;
+    {
+        index[i].offset = rel[i].VirtualAddress;
+        if (bigobj)
+            index[i].section = ((IMAGE_SYMBOL_EX*)(symtable + rel[i].SymbolTableIndex * sizeof(IMAGE_SYMBOL_EX)))->SectionNumber;
+        else
+            index[i].section = ((IMAGE_SYMBOL*)(symtable + rel[i].SymbolTableIndex * IMAGE_SIZEOF_SYMBOL))->SectionNumber;
+    }
+    // stable, so the first relocation at an address is found as before
+    std::stable_sort(index.begin(), index.end());
+    return index;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -652,36 +668,119 @@ int PEImage::dumpDebugLineInfoOMF()
 int PEImage::findSection(unsigned int off) const
 {
 	off -= IMGHDR(OptionalHeader.ImageBase);
+	int i = findSectionInterval(off, off + 1, false);
+	return i < 0 ? -1 : sectionIntervals[i].section;
+}
+
+void PEImage::initSectionIndex()
+{
+	sectionIntervals.resize(nsec);
+	for(int s = 0; s < nsec; s++)
+	{
+		PESectionInterval& iv = sectionIntervals[s];
+		iv.start = sec[s].VirtualAddress;
+		iv.endRaw = iv.start + sec[s].SizeOfRawData;
+		iv.endVirtual = iv.start + sec[s].Misc.VirtualSize;
+		iv.rawPointer = sec[s].PointerToRawData;
+		iv.section = s;
+	}
+	std::stable_sort(sectionIntervals.begin(), sectionIntervals.end());
+	sectionsShareStart = nsec > 1;
+	for(int s = 1; s < nsec && sectionsShareStart; s++)
+		sectionsShareStart = sectionIntervals[s].start == sectionIntervals[0].start;
 	for(int s = 0; s < nsec; s++)
-		if(sec[s].VirtualAddress <= off && off < sec[s].VirtualAddress + sec[s].Misc.VirtualSize)
-			return s;
-	return -1;
+	{
+		PESectionInterval& iv = sectionIntervals[s];
+		iv.maxEndRaw = s > 0 && sectionIntervals[s - 1].maxEndRaw > iv.endRaw ? sectionIntervals[s - 1].maxEndRaw : iv.endRaw;
+		iv.maxEndVirtual = s > 0 && sectionIntervals[s - 1].maxEndVirtual > iv.endVirtual ? sectionIntervals[s - 1].maxEndVirtual : iv.endVirtual;
+	}
+
+	if (bigobj)
+		t_initSectionSymbols<IMAGE_SYMBOL_EX>();
+	else
+		t_initSectionSymbols<IMAGE_SYMBOL>();
+
+	// derived from the previous section and symbol tables
+	relocIndex.clear();
+	relocIndexBuilt.clear();
+	symHashBuilt = false;
+}
+
+// index into sectionIntervals of the first section in the section table containing lo..hi
+int PEImage::findSectionInterval(unsigned int lo, unsigned int hi, bool raw) const
+{
+	if (sectionsShareStart)
+	{
+		// object files have all sections at 0, the first section in the table containing lo..hi
+		// is the first one where the running maximum of the ends reaches hi
+		if (lo < sectionIntervals[0].start)
+			return -1;
+		size_t first = 0, last = sectionIntervals.size();
+		while (first < last)
+		{
+			size_t mid = (first + last) / 2;
+			if ((raw ? sectionIntervals[mid].maxEndRaw : sectionIntervals[mid].maxEndVirtual) < hi)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+		return first < sectionIntervals.size() ? (int) first : -1;
+	}
+
+	PESectionInterval key;
+	key.start = lo;
+	size_t i = std::upper_bound(sectionIntervals.begin(), sectionIntervals.end(), key) - sectionIntervals.begin();
+
+	// sections of images don't overlap, the walk usually stops after the interval containing lo
+	int best = -1;
+	while (i > 0 && (raw ? sectionIntervals[i - 1].maxEndRaw : sectionIntervals[i - 1].maxEndVirtual) >= hi)
+	{
+		i--;
+		const PESectionInterval& iv = sectionIntervals[i];
+		if ((raw ? iv.endRaw : iv.endVirtual) >= hi && (best < 0 || iv.section < sectionIntervals[best].section))
+			best = i;
+	}
+	return best;
 }
 
 template<typename SYM>
-const char* PEImage::t_findSectionSymbolName(int s) const
+void PEImage::t_initSectionSymbols()
 {
+	sectionSymbol.assign(nsec + 1, -1);
+	if (!symtable)
+		return;
+
 	SYM* sym = 0;
 	for(int i = 0; i < nsym; i += 1 + sym->NumberOfAuxSymbols)
 	{
 		sym = (SYM*) symtable + i;
-        if (sym->SectionNumber == s && sym->StorageClass == IMAGE_SYM_CLASS_EXTERNAL)
-        {
-            static char sname[10] = { 0 };
-
-		    if (sym->N.Name.Short == 0)
-                return strtable + sym->N.Name.Long;
-            return strncpy (sname, (char*)sym->N.ShortName, 8);
-        }
+		int s = sym->SectionNumber;
+		if (s >= 0 && s <= nsec && sectionSymbol[s] < 0 && sym->StorageClass == IMAGE_SYM_CLASS_EXTERNAL)
+			sectionSymbol[s] = i;
 	}
-    return 0;
 }
 
+template<typename SYM>
+const char* PEImage::t_findSectionSymbolName(int s) const
+{
+	int i = s < (int) sectionSymbol.size() ? sectionSymbol[s] : -1;
+	if (i < 0)
+		return 0;
+
+	SYM* sym = (SYM*) symtable + i;
+	static char sname[10] = { 0 };
+
+	if (sym->N.Name.Short == 0)
+		return strtable + sym->N.Name.Long;
+	return strncpy (sname, (char*)sym->N.ShortName, 8);
+}
+
+// s is the 1-based section number used by symbols and relocations
 const char* PEImage::findSectionSymbolName(int s) const
 {
-    if (s < 0 || s >= nsec)
+    if (s <= 0 || s > nsec)
         return 0;
-    if (!(sec[s].Characteristics & IMAGE_SCN_LNK_COMDAT))
+    if (!(sec[s - 1].Characteristics & IMAGE_SCN_LNK_COMDAT))
         return 0;
 
     if (bigobj)
@@ -690,20 +789,109 @@ const char* PEImage::findSectionSymbolName(int s) const
         return t_findSectionSymbolName<IMAGE_SYMBOL> (s);
 }
 
-int PEImage::findSymbol(const char* name, unsigned long& off) const
+// short names are not 0-terminated if they use all 8 characters
+template<typename SYM>
+static const char* symbolName(const SYM* sym, const char* strtable, size_t& maxlen)
+{
+	if (sym->N.Name.Short == 0)
+	{
+		maxlen = ~(size_t) 0;
+		return strtable + sym->N.Name.Long;
+	}
+	maxlen = 8;
+	return (const char*) sym->N.ShortName;
+}
+
+static bool symbolNameEquals(const char* symname, size_t maxlen, const char* name)
+{
+	size_t len = strlen(name);
+	if (len > maxlen)
+		return false;
+	return strncmp(symname, name, len) == 0 && (len == maxlen || symname[len] == 0);
+}
+
+static unsigned int hashSymbolName(const char* name, size_t maxlen)
 {
-    int sizeof_sym = bigobj ? sizeof(IMAGE_SYMBOL_EX) : IMAGE_SIZEOF_SYMBOL;
-	for(int i = 0; i < nsym; i++)
+	unsigned int h = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < maxlen && name[i]; i++)
+		h = (h ^ (unsigned char) name[i]) * 16777619u;
+	return h;
+}
+
+template<typename SYM>
+void PEImage::t_buildSymbolHash() const
+{
+	size_t buckets = 1;
+	while (buckets < (size_t) nsym)
+		buckets *= 2;
+	symHashBuckets.assign(buckets, -1);
+	symHashNext.assign(nsym, -1);
+
+	std::vector<int> entries; // without auxiliary records
+	SYM* sym = 0;
+	for (int i = 0; i < nsym; i += 1 + sym->NumberOfAuxSymbols)
 	{
-		IMAGE_SYMBOL* sym = (IMAGE_SYMBOL*) (symtable + i * sizeof_sym);
-		const char* symname = sym->N.Name.Short == 0 ? strtable + sym->N.Name.Long : (char*)sym->N.ShortName;
-		if(strcmp(symname, name) == 0 || (symname[0] == '_' && strcmp(symname + 1, name) == 0))
+		sym = (SYM*) symtable + i;
+		entries.push_back(i);
+	}
+
+	// link in reverse, so each chain lists the symbols in table order
+	for (size_t e = entries.size(); e-- > 0; )
+	{
+		int i = entries[e];
+		size_t maxlen;
+		const char* symname = symbolName((SYM*) symtable + i, strtable, maxlen);
+		if (maxlen > 0 && symname[0] == '_')
+			symname++, maxlen--;
+		unsigned int h = hashSymbolName(symname, maxlen) & (buckets - 1);
+		symHashNext[i] = symHashBuckets[h];
+		symHashBuckets[h] = i;
+	}
+}
+
+template<typename SYM>
+int PEImage::t_findSymbol(const char* name, unsigned long& off) const
+{
+	if (!symHashBuilt)
+	{
+		t_buildSymbolHash<SYM>();
+		symHashBuilt = true;
+	}
+	size_t mask = symHashBuckets.size() - 1;
+
+	// a symbol matches both name and _name, "name" is hashed as name without a leading
+	// underscore, "_name" as name, so look in both chains and take the first symbol in the table
+	const char* keys[2] = { name, name[0] == '_' ? name + 1 : 0 };
+	int found = -1;
+	for (int k = 0; k < 2 && keys[k]; k++)
+	{
+		unsigned int h = hashSymbolName(keys[k], ~(size_t) 0) & mask;
+		for (int i = symHashBuckets[h]; i >= 0 && (found < 0 || i < found); i = symHashNext[i])
 		{
-			off = sym->Value;
-			return bigobj ? ((IMAGE_SYMBOL_EX*)sym)->SectionNumber : sym->SectionNumber;
+			size_t maxlen;
+			const char* symname = symbolName((SYM*) symtable + i, strtable, maxlen);
+			if (symbolNameEquals(symname, maxlen, name) ||
+			    (maxlen > 0 && symname[0] == '_' && symbolNameEquals(symname + 1, maxlen - 1, name)))
+			{
+				found = i;
+				break;
+			}
 		}
 	}
-	return -1;
+	if (found < 0)
+		return -1;
+
+	SYM* sym = (SYM*) symtable + found;
+	off = sym->Value;
+	return sym->SectionNumber;
+}
+
+int PEImage::findSymbol(const char* name, unsigned long& off) const
+{
+    if (bigobj)
+        return t_findSymbol<IMAGE_SYMBOL_EX> (name, off);
+    else
+        return t_findSymbol<IMAGE_SYMBOL> (name, off);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -8,18 +8,38 @@
 #define __PEIMAGE_H__
 
 #include "LastError.h"
+#include "pecoff.h"
 
-#include <windows.h>
+#include <vector>
 
 struct OMFDirHeader;
 struct OMFDirEntry;
 
+struct PERelocTarget
+{
+	unsigned int offset;  // VirtualAddress of the relocation
+	int section;          // section number of the target symbol
+	bool operator<(const PERelocTarget& other) const { return offset < other.offset; }
+};
+
+struct PESectionInterval
+{
+	unsigned int start;         // VirtualAddress
+	unsigned int endRaw;        // start + SizeOfRawData
+	unsigned int endVirtual;    // start + VirtualSize
+	unsigned int rawPointer;    // PointerToRawData
+	int section;
+	unsigned int maxEndRaw;     // maximum endRaw of this and all preceding intervals
+	unsigned int maxEndVirtual; // maximum endVirtual of this and all preceding intervals
+	bool operator<(const PESectionInterval& other) const { return start < other.start; }
+};
+
 #define IMGHDR(x) (hdr32 ? hdr32->x : hdr64->x)
 
 class PEImage : public LastError
 {
 public:
-	PEImage(const TCHAR* iname = 0);
+	PEImage(const char* iname = 0);
 	~PEImage();
 
 	template<class P> P* DP(int off) const
@@ -43,23 +63,18 @@ public:
 
 	template<class P> P* RVA(unsigned long rva, int len)
 	{
-		IMAGE_DOS_HEADER *dos = DPV<IMAGE_DOS_HEADER> (0);
-		IMAGE_NT_HEADERS32* hdr = DPV<IMAGE_NT_HEADERS32> (dos->e_lfanew);
-		IMAGE_SECTION_HEADER* sec = IMAGE_FIRST_SECTION(hdr);
-
-		for (int i = 0; i < hdr->FileHeader.NumberOfSections; i++)
-		{
-			if (rva       >= sec[i].VirtualAddress &&
-				rva + len <= sec[i].VirtualAddress + sec[i].SizeOfRawData)
-				return DPV<P>(sec[i].PointerToRawData + rva - sec[i].VirtualAddress, len);
-		}
-		return 0;
+		int i = findSectionInterval(rva, rva + len, true);
+		if (i < 0)
+			return 0;
+		const PESectionInterval& iv = sectionIntervals[i];
+		return DPV<P>(iv.rawPointer + rva - iv.start, len);
 	}
 
-	bool readAll(const TCHAR* iname);
-	bool loadExe(const TCHAR* iname);
-	bool loadObj(const TCHAR* iname);
-	bool save(const TCHAR* oname);
+	// file names are UTF-8
+	bool readAll(const char* iname);
+	bool loadExe(const char* iname);
+	bool loadObj(const char* iname);
+	bool save(const char* oname);
 
 	bool replaceDebugSection (const void* data, int datalen, bool initCV);
 	bool initCVPtr(bool initDbgDir);
@@ -94,6 +109,12 @@ public:
 
 private:
     template<typename SYM> const char* t_findSectionSymbolName(int s) const;
+    template<typename SYM> int t_findSymbol(const char* name, unsigned long& off) const;
+    template<typename SYM> void t_buildSymbolHash() const;
+    template<typename SYM> void t_initSectionSymbols();
+    void initSectionIndex();
+    int findSectionInterval(unsigned int lo, unsigned int hi, bool raw) const;
+    const std::vector<PERelocTarget>& relocationIndex(int segment) const;
 
 	int fd;
 	void* dump_base;
@@ -113,9 +134,23 @@ private:
     const char* strtable;
     bool bigobj;
 
+    // hash chains over the symbol names without leading underscore, built by the first findSymbol
+    mutable std::vector<int> symHashBuckets; // first symbol index per bucket, -1 if empty
+    mutable std::vector<int> symHashNext;    // next symbol index in the same bucket, ascending
+    mutable bool symHashBuilt;
+
+    // relocations per section sorted by address, built by the first getRelocationInSegment for the section
+    mutable std::vector<std::vector<PERelocTarget> > relocIndex;
+    mutable std::vector<bool> relocIndexBuilt;
+
+    // built by initSectionIndex when the section table is set up
+    std::vector<PESectionInterval> sectionIntervals; // sorted by start
+    bool sectionsShareStart; // all sections start at the same address (object files), sectionIntervals is in table order
+    std::vector<int> sectionSymbol; // first external symbol per section number, -1 if none
+
 public:
 	//dwarf
-	char* debug_aranges;
+	char* debug_aranges;  unsigned long debug_aranges_length;
 	char* debug_pubnames;
 	char* debug_pubtypes;
 	char* debug_info;     unsigned long debug_info_length;
@@ -0,0 +1,336 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+// generates synthetic images and measures the time spent in the individual conversion phases
+
+#include "PEImage.h"
+#include "cv2pdb.h"
+#include "readDwarf.h"
+#include "synthimage.h"
+#include "demangle.h"
+#include "symutil.h"
+#include "fileio.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifdef UNICODE
+#define T_strcpy	wcscpy
+#define T_strcat	wcscat
+#define T_strlen	wcslen
+#define T_strncmp	wcsncmp
+#define T_atoi		_wtoi
+#define T_unlink	_wremove
+#define T_main		wmain
+#define T_fname(s)	utf8FileName(s).c_str()
+#define SARG		"%S"
+#else
+#define T_strcpy	strcpy
+#define T_strcat	strcat
+#define T_strlen	strlen
+#define T_strncmp	strncmp
+#define T_atoi		atoi
+#define T_unlink	unlink
+#define T_main		main
+#define T_fname(s)	(s)
+#define SARG		"%s"
+#endif
+
+// defined in dwarf2pdb.cpp
+Location findBestCFA(const PEImage& img, unsigned int pclo, unsigned int pchi);
+Location findBestCFA(const PEImage& img, const CFIIndex& index, unsigned int pclo, unsigned int pchi);
+
+void fatal(const char *message, ...)
+{
+	va_list argptr;
+	va_start(argptr, message);
+	vprintf(message, argptr);
+	va_end(argptr);
+	printf("\n");
+	exit(1);
+}
+
+///////////////////////////////////////////////////////////////////////
+struct PhaseTimer
+{
+	const char* name;
+	double best;
+	double total;
+	int runs;
+
+	PhaseTimer(const char* n) : name(n), best(0), total(0), runs(0) {}
+
+	void add(double ms)
+	{
+		if (runs == 0 || ms < best)
+			best = ms;
+		total += ms;
+		runs++;
+	}
+	void print() const
+	{
+		if (runs)
+			printf("%-22s %10.3f %10.3f\n", name, best, total / runs);
+		else
+			printf("%-22s    skipped\n", name);
+	}
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void loadImage(PEImage& img, const TCHAR* exe)
+{
+	if (!img.loadExe(T_fname(exe)))
+		fatal(SARG ": %s", exe, img.getLastError());
+}
+
+// the phases of createDWARFModules and addDWARFLines, with a single global module or a module per compilation unit
+static void benchDWARF(const TCHAR* exe, const TCHAR* pdb, int repeat, bool globalModule,
+                       PhaseTimer& tMap, PhaseTimer& tCreate, PhaseTimer& tLines)
+{
+	for (int r = 0; r < repeat; r++)
+	{
+		PEImage img;
+		loadImage(img, exe);
+
+		CV2PDB cv2pdb(img);
+		cv2pdb.useGlobalMod = globalModule;
+		T_unlink(pdb);
+		bool hasPDB = cv2pdb.openPDB(T_fname(pdb), 0);
+
+		if (!cv2pdb.initDWARFTypes())
+			fatal("initDWARFTypes: %s", cv2pdb.getLastError());
+		if (hasPDB && !cv2pdb.addDWARFSections())
+			fatal("addDWARFSections: %s", cv2pdb.getLastError());
+
+		Clock::time_point start = Clock::now();
+		if (!cv2pdb.buildDIEIndex())
+			fatal("buildDIEIndex: %s", cv2pdb.getLastError());
+		tMap.add(elapsed(start));
+
+		// createTypes opens the modules per compilation unit in the PDB, the global module
+		// is only needed for the line info
+		if (hasPDB || globalModule)
+		{
+			start = Clock::now();
+			if (!cv2pdb.createTypes())
+				fatal("createTypes: %s", cv2pdb.getLastError());
+			tCreate.add(elapsed(start));
+		}
+		if (hasPDB)
+		{
+			start = Clock::now();
+			if (!cv2pdb.addDWARFLines())
+				fatal("addDWARFLines: %s", cv2pdb.getLastError());
+			tLines.add(elapsed(start));
+		}
+		else if (r == 0)
+			printf("cannot open PDB (%s), skipping %saddDWARFLines\n", cv2pdb.getLastError(), globalModule ? "" : "createTypes and ");
+	}
+	T_unlink(pdb);
+}
+
+static void benchCFA(const SynthImage& synth, const SynthParams& params, const TCHAR* exe,
+                     int repeat, PhaseTimer& tCFA, PhaseTimer& tCFAIndex)
+{
+	for (int r = 0; r < repeat; r++)
+	{
+		PEImage img;
+		loadImage(img, exe);
+
+		Clock::time_point start = Clock::now();
+		for (int f = 0; f < params.funcs; f++)
+			findBestCFA(img, synth.funcAddr(f), synth.funcAddr(f + 1));
+		tCFA.add(elapsed(start));
+
+		start = Clock::now();
+		CFIIndex index;
+		index.build(img);
+		for (int f = 0; f < params.funcs; f++)
+			findBestCFA(img, index, synth.funcAddr(f), synth.funcAddr(f + 1));
+		tCFAIndex.add(elapsed(start));
+	}
+}
+
+static void benchCV(const TCHAR* exe, int repeat, PhaseTimer& tTypes, PhaseTimer& tSymbols)
+{
+	for (int r = 0; r < repeat; r++)
+	{
+		PEImage img;
+		loadImage(img, exe);
+
+		CV2PDB cv2pdb(img);
+		if (!cv2pdb.initGlobalSymbols())
+			fatal("initGlobalSymbols: %s", cv2pdb.getLastError());
+
+		Clock::time_point start = Clock::now();
+		if (!cv2pdb.initGlobalTypes())
+			fatal("initGlobalTypes: %s", cv2pdb.getLastError());
+		tTypes.add(elapsed(start));
+
+		// same buffer as addSymbols when using the global module
+		DWORD* data = new DWORD[2 * img.getCVSize() + 1000];
+		int databytes = 0;
+		start = Clock::now();
+		for (int m = 0; m < cv2pdb.countEntries; m++)
+		{
+			OMFDirEntry* entry = img.getCVEntry(m);
+			if (entry->SubSection == sstAlignSym)
+			{
+				BYTE* symbols = img.CVP<BYTE>(entry->lfo);
+				databytes = cv2pdb.copySymbols(symbols + 4, entry->cb - 4, (BYTE*) (data + 4), databytes);
+			}
+		}
+		tSymbols.add(elapsed(start));
+		delete [] data;
+	}
+}
+
+// demangles the names of the demangler unit test, without and with the cache
+static void benchDemangle(int repeat, int passes, PhaseTimer& tDemangle, PhaseTimer& tCached)
+{
+	char buf[kMaxNameLen];
+	for (int r = 0; r < repeat; r++)
+	{
+		Clock::time_point start = Clock::now();
+		for (int p = 0; p < passes; p++)
+			for (int t = 0; t < numDemangleTests; t++)
+				d_demangle(demangleTests[t].mangled, buf, sizeof(buf), false, false);
+		tDemangle.add(elapsed(start));
+
+		d_demangle_clear_cache();
+		start = Clock::now();
+		for (int p = 0; p < passes; p++)
+			for (int t = 0; t < numDemangleTests; t++)
+				d_demangle(demangleTests[t].mangled, buf, sizeof(buf), false);
+		tCached.add(elapsed(start));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+int T_main(int argc, TCHAR* argv[])
+{
+	SynthParams params;
+	int repeat = 5;
+	int demanglePasses = 10000;
+	bool keep = false;
+
+	static const struct { const TCHAR* opt; int SynthParams::*field; } sizeOptions[] =
+	{
+		{ TEXT("cu"), &SynthParams::cus },
+		{ TEXT("types"), &SynthParams::types },
+		{ TEXT("funcs"), &SynthParams::funcs },
+		{ TEXT("lines"), &SynthParams::lines },
+		{ TEXT("fdes"), &SynthParams::fdes },
+		{ TEXT("locs"), &SynthParams::locs },
+		{ TEXT("globals"), &SynthParams::globals },
+		{ TEXT("inlines"), &SynthParams::inlines },
+		{ TEXT("classes"), &SynthParams::classes },
+	};
+	const int numSizeOptions = sizeof(sizeOptions) / sizeof(sizeOptions[0]);
+
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		argv++;
+		argc--;
+		if (argv[0][1] == '-')
+			break;
+		int o;
+		for (o = 0; o < numSizeOptions; o++)
+		{
+			size_t len = T_strlen(sizeOptions[o].opt);
+			if (T_strncmp(argv[0] + 1, sizeOptions[o].opt, len) == 0 && argv[0][len + 1] >= '0' && argv[0][len + 1] <= '9')
+			{
+				params.*sizeOptions[o].field = T_atoi(argv[0] + len + 1);
+				break;
+			}
+		}
+		if (o < numSizeOptions)
+			continue;
+		if (argv[0][1] == 'n' && argv[0][2])
+			repeat = T_atoi(argv[0] + 2);
+		else if (argv[0][1] == 'd' && argv[0][2] >= '0' && argv[0][2] <= '9')
+			demanglePasses = T_atoi(argv[0] + 2);
+		else if (argv[0][1] == 'k')
+			keep = true;
+		else
+			fatal("unknown option: " SARG, argv[0]);
+	}
+
+	if (repeat < 1)
+		repeat = 1;
+	if (params.cus < 1)
+		params.cus = 1;
+
+	if (argc < 2)
+	{
+		printf("Benchmark the conversion phases of cv2pdb on synthetic debug information\n");
+		printf("\n");
+		printf("usage: " SARG " [-cuN|-typesN|-funcsN|-linesN|-fdesN|-locsN|-globalsN|-inlinesN|-classesN|-nRepeat|-dPasses|-k] <base-name>\n", argv[0]);
+		printf("\n");
+		printf("writes <base-name>_dwarf.exe and <base-name>_cv.exe, -k keeps them after the run\n");
+		printf("-dPasses demangles the names of the demangler unit test Passes times per run\n");
+		return -1;
+	}
+
+	TCHAR dwarfExe[260], cvExe[260], pdb[260];
+	T_strcpy(dwarfExe, argv[1]);
+	T_strcat(dwarfExe, TEXT("_dwarf.exe"));
+	T_strcpy(cvExe, argv[1]);
+	T_strcat(cvExe, TEXT("_cv.exe"));
+	T_strcpy(pdb, argv[1]);
+	T_strcat(pdb, TEXT("_dwarf.pdb"));
+
+	SynthImage synth(params);
+	if (!synth.writeDWARF(T_fname(dwarfExe)))
+		fatal(SARG ": %s", dwarfExe, synth.getLastError());
+	if (!synth.writeCV(T_fname(cvExe)))
+		fatal(SARG ": %s", cvExe, synth.getLastError());
+
+	printf("%d compilation units, %d types, %d functions, %d lines, %d FDEs, %d location lists, %d globals, %d inlined, %d classes\n",
+	       params.cus, params.types, params.funcs, params.lines, params.fdes, params.locs, params.globals, params.inlines, params.classes);
+	printf("%d demangled names\n", demanglePasses * numDemangleTests);
+	printf("best of %d runs\n\n", repeat);
+
+	PhaseTimer tMap("buildDIEIndex"), tCreate("createTypes"), tLines("addDWARFLines");
+	PhaseTimer tMapUnits("buildDIEIndex units"), tCreateUnits("createTypes units"), tLinesUnits("addDWARFLines units");
+	PhaseTimer tCFA("findBestCFA"), tCFAIndex("CFIIndex");
+	PhaseTimer tTypes("initGlobalTypes"), tSymbols("copySymbols");
+	PhaseTimer tDemangle("d_demangle"), tDemangleCached("d_demangle cached");
+
+	benchDWARF(dwarfExe, pdb, repeat, true, tMap, tCreate, tLines);
+	benchDWARF(dwarfExe, pdb, repeat, false, tMapUnits, tCreateUnits, tLinesUnits);
+	benchCFA(synth, params, dwarfExe, repeat, tCFA, tCFAIndex);
+	benchCV(cvExe, repeat, tTypes, tSymbols);
+	benchDemangle(repeat, demanglePasses, tDemangle, tDemangleCached);
+
+	printf("%-22s %10s %10s\n", "phase", "best [ms]", "avg [ms]");
+	tMap.print();
+	tCreate.print();
+	tLines.print();
+	tMapUnits.print();
+	tCreateUnits.print();
+	tLinesUnits.print();
+	tCFA.print();
+	tCFAIndex.print();
+	tTypes.print();
+	tSymbols.print();
+	tDemangle.print();
+	tDemangleCached.print();
+
+	if (!keep)
+	{
+		T_unlink(dwarfExe);
+		T_unlink(cvExe);
+	}
+	return 0;
+}
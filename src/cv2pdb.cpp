@@ -8,15 +8,21 @@
 #include "PEImage.h"
 #include "symutil.h"
 #include "cvutil.h"
+#include "memreport.h"
+#include "trace.h"
+#include "taskgraph.h"
 
 #include <stdio.h>
-#include <direct.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include <thread>
 
 #define REMOVE_LF_DERIVED  1  // types wrong by DMD
 #define PRINT_INTERFACEVERSON 0
 
 CV2PDB::CV2PDB(PEImage& image)
-: img(image), pdb(0), dbi(0), libraries(0), rsds(0), modules(0), globmod(0)
+: img(image), pdb(0), dbi(0), tpi(0), libraries(0), rsds(0), modules(0), globmod(0)
 , segMap(0), segMapDesc(0), segFrame2Index(0), globalTypeHeader(0)
 , globalTypes(0), cbGlobalTypes(0), allocGlobalTypes(0)
 , userTypes(0), cbUserTypes(0), allocUserTypes(0)
@@ -34,6 +40,7 @@ CV2PDB::CV2PDB(PEImage& image)
 	memset(typedefs, 0, sizeof(typedefs));
 	memset(translatedTypedefs, 0, sizeof(translatedTypedefs));
 	cntTypedefs = 0;
+	typePropsReadOnly = false;
 	nextUserType = 0x1000;
 	nextDwarfType = 0x1000;
 
@@ -41,9 +48,16 @@ CV2PDB::CV2PDB(PEImage& image)
 	addStringViewHelper = false;
 	useTypedefEnum = false;
 	useGlobalMod = true;
+	threads = std::thread::hardware_concurrency();
 	thisIsNotRef = true;
 	v3 = true;
-	countEntries = img.countCVEntries();
+	indexCVEntries();
+
+	dwarfLinesDecoded = false;
+	maxMemory = 0;
+	memset(&spillUserTypes, 0, sizeof(spillUserTypes));
+	memset(&spillDwarfTypes, 0, sizeof(spillDwarfTypes));
+	memset(&spillUdtSymbols, 0, sizeof(spillUdtSymbols));
 }
 
 CV2PDB::~CV2PDB()
@@ -69,7 +83,10 @@ bool CV2PDB::cleanup(bool commit)
 	if (tpi)
 		tpi->Close();
 	if (pdb)
+	{
+		TraceSpan span("Commit");
 		pdb->Commit();
+	}
 	if (pdb)
 		pdb->Close();
 
@@ -83,7 +100,30 @@ bool CV2PDB::cleanup(bool commit)
 		free(udtSymbols);
 	if (dwarfTypes)
 		free(dwarfTypes);
+	memTrack(kMemGlobalTypes, allocGlobalTypes, 0);
+	memTrack(kMemUserTypes, allocUserTypes, 0);
+	memTrack(kMemUdtSymbols, allocUdtSymbols, 0);
+	memTrack(kMemDwarfTypes, allocDwarfTypes, 0);
 	delete [] pointerTypes;
+	dieIndex.clear();
+	std::vector<int>().swap(dieCVType);
+	std::vector<DWARFTypeFixup>().swap(dwarfTypeFixups);
+	std::vector<DWARFPublic>().swap(dwarfPublics);
+	std::vector<DWARF_LineBlock>().swap(dwarfLineBlocks);
+	dwarfLinesDecoded = false;
+	cfiIndex.clear();
+	std::vector<unsigned long>().swap(dwarfUnitOffsets);
+	std::vector<int>().swap(dwarfUnitSymbolEnd);
+	std::vector<bool>().swap(dwarfUnitContrib);
+	dwarfLineUnits.clear();
+	SpillFile* spills[3] = { &spillUserTypes, &spillDwarfTypes, &spillUdtSymbols };
+	for (int s = 0; s < 3; s++)
+	{
+		if (spills[s]->fp)
+			fclose(spills[s]->fp);
+		spills[s]->fp = 0;
+		spills[s]->cb = 0;
+	}
 
 	for(int i = 0; i < srcLineSections; i++)
 		delete [] srcLineStart[i];
@@ -107,6 +147,7 @@ bool CV2PDB::cleanup(bool commit)
 	udtSymbols = 0;
 	cbUdtSymbols = 0;
 	allocUdtSymbols = 0;
+	dwarfTypes = 0;
 	cbDwarfTypes = 0;
 	allocDwarfTypes = 0;
 	modules = 0;
@@ -122,25 +163,30 @@ bool CV2PDB::cleanup(bool commit)
 	memset(typedefs, 0, sizeof(typedefs));
 	memset(translatedTypedefs, 0, sizeof(translatedTypedefs));
 	cntTypedefs = 0;
+	typeProps.clear();
+	appendedTypes.clear();
+	globalFieldLists.clear();
+	nestedGlobalTypes.clear();
+	cvEntries.clear();
+	libraryNames.clear();
 
 	return true;
 }
 
-bool CV2PDB::openPDB(const TCHAR* pdbname, const TCHAR* pdbref)
+bool CV2PDB::openPDB(const char* pdbname, const char* pdbref)
 {
-#ifdef UNICODE
-	const wchar_t* pdbnameW = pdbname;
-	char pdbnameA[260]; // = L"c:\\tmp\\aa\\ddoc4.pdb";
-	WideCharToMultiByte(CP_UTF8, 0, pdbref ? pdbref : pdbname, -1, pdbnameA, 260, 0, 0);
-	//  wcstombs (pdbnameA, pdbname, 260);
-#else
+	TraceSpan span("openPDB");
 	const char* pdbnameA = pdbref ? pdbref : pdbname;
 	wchar_t pdbnameW[260]; // = L"c:\\tmp\\aa\\ddoc4.pdb";
+#ifdef _WIN32
+	MultiByteToWideChar(CP_UTF8, 0, pdbname, -1, pdbnameW, 260);
+#else
 	mbstowcs (pdbnameW, pdbname, 260);
 #endif
 
 	if (!initMsPdb ())
 		return setError("cannot load PDB helper DLL");
+#ifdef _WIN32
 	if (debug)
 	{
 		extern HMODULE modMsPdb;
@@ -148,6 +194,7 @@ bool CV2PDB::openPDB(const TCHAR* pdbname, const TCHAR* pdbref)
 		GetModuleFileNameA(modMsPdb, modpath, 260);
 		printf("Loaded PDB helper DLL: %s\n", modpath);
 	}
+#endif
 	pdb = CreatePDB (pdbnameW);
 	if (!pdb)
 		return setError("cannot create PDB file");
@@ -195,63 +242,62 @@ bool CV2PDB::setError(const char* msg)
 
 bool CV2PDB::createModules()
 {
+	TraceSpan span("createModules");
 	// assumes libraries and segMap initialized
 	countEntries = img.countCVEntries();
 	modules = new mspdb::Mod* [countEntries];
 	memset (modules, 0, countEntries * sizeof(*modules));
 
-	for (int m = 0; m < countEntries; m++)
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstModule);
+	for (size_t e = 0; e < entries.size(); e++)
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if (entry->SubSection == sstModule)
+		OMFDirEntry* entry = entries[e];
+		OMFModule* module   = img.CVP<OMFModule>(entry->lfo);
+		OMFSegDesc* segDesc = img.CVP<OMFSegDesc>(entry->lfo + sizeof(OMFModule));
+		BYTE* pname         = img.CVP<BYTE>(entry->lfo + sizeof(OMFModule) + sizeof(OMFSegDesc) * module->cSeg);
+		char *name = p2c(pname);
+		const BYTE* plib = getLibrary (module->iLib);
+		const char* lib = (!plib || !*plib ? name : p2c(plib, 1));
+
+		mspdb::Mod* mod;
+		if (useGlobalMod)
 		{
-			OMFModule* module   = img.CVP<OMFModule>(entry->lfo);
-			OMFSegDesc* segDesc = img.CVP<OMFSegDesc>(entry->lfo + sizeof(OMFModule));
-			BYTE* pname         = img.CVP<BYTE>(entry->lfo + sizeof(OMFModule) + sizeof(OMFSegDesc) * module->cSeg);
-			char *name = p2c(pname);
-			const BYTE* plib = getLibrary (module->iLib);
-			const char* lib = (!plib || !*plib ? name : p2c(plib, 1));
-
-			mspdb::Mod* mod;
-			if (useGlobalMod)
-			{
-				mod = globalMod();
-				if(!mod)
-					return false;
-			}
-			else
+			mod = globalMod();
+			if(!mod)
+				return false;
+		}
+		else
+		{
+			if (modules[entry->iMod])
 			{
-				if (modules[entry->iMod])
-				{
-					modules[entry->iMod]->Close();
-					modules[entry->iMod] = 0;
-				}
-				int rc = dbi->OpenMod(name, lib, &modules[entry->iMod]);
-				if (rc <= 0 || !modules[entry->iMod])
-					return setError("cannot create mod");
-				mod = modules[entry->iMod];
+				modules[entry->iMod]->Close();
+				modules[entry->iMod] = 0;
 			}
+			int rc = dbi->OpenMod(name, lib, &modules[entry->iMod]);
+			if (rc <= 0 || !modules[entry->iMod])
+				return setError("cannot create mod");
+			mod = modules[entry->iMod];
+		}
 #if PRINT_INTERFACEVERSON
-			static bool once;
-			if(!once)
-			{
-				printf("Mod::QueryInterfaceVersion() = %d\n", mod->QueryInterfaceVersion());
-				printf("Mod::QueryImplementationVersion() = %d\n", mod->QueryImplementationVersion());
-				once = true;
-			}
+		static bool once;
+		if(!once)
+		{
+			printf("Mod::QueryInterfaceVersion() = %d\n", mod->QueryInterfaceVersion());
+			printf("Mod::QueryImplementationVersion() = %d\n", mod->QueryImplementationVersion());
+			once = true;
+		}
 #endif
 
-			for (int s = 0; s < module->cSeg; s++)
-			{
-				int segIndex = segDesc[s].Seg;
-				int segFlags = 0;
-				if (segMap && segIndex < segMap->cSeg)
-					segFlags = segMapDesc[segIndex].flags;
-				segFlags = 0x60101020; // 0x40401040, 0x60500020; // TODO
-				int rc = mod->AddSecContrib(segIndex, segDesc[s].Off, segDesc[s].cbSeg, segFlags);
-				if (rc <= 0)
-					return setError("cannot add section contribution to module");
-			}
+		for (int s = 0; s < module->cSeg; s++)
+		{
+			int segIndex = segDesc[s].Seg;
+			int segFlags = 0;
+			if (segMap && segIndex < segMap->cSeg)
+				segFlags = segMapDesc[segIndex].flags;
+			segFlags = 0x60101020; // 0x40401040, 0x60500020; // TODO
+			int rc = mod->AddSecContrib(segIndex, segDesc[s].Off, segDesc[s].cbSeg, segFlags);
+			if (rc <= 0)
+				return setError("cannot add section contribution to module");
 		}
 	}
 	return true;
@@ -270,50 +316,75 @@ mspdb::Mod* CV2PDB::globalMod()
 
 bool CV2PDB::initLibraries()
 {
+	TraceSpan span("initLibraries");
 	libraries = 0;
-	for (int m = 0; m < countEntries; m++)
-		if (img.getCVEntry(m)->SubSection == sstLibraries)
-			libraries = img.CVP<BYTE> (img.getCVEntry(m)->lfo);
+	libraryNames.clear();
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstLibraries);
+	if (entries.empty())
+		return true;
+
+	// the last entry wins, remember where each of its names starts
+	OMFDirEntry* entry = entries.back();
+	libraries = img.CVP<BYTE> (entry->lfo);
+	if (!libraries)
+		return true;
+	const BYTE* end = libraries + entry->cb;
+	for (const BYTE* p = libraries; p < end; p += *p + 1)
+		libraryNames.push_back(p);
 
 	return true;
 }
 
 const BYTE* CV2PDB::getLibrary(int i)
 {
-	if (!libraries)
+	if (i < 0 || i >= (int) libraryNames.size())
 		return 0;
-	const BYTE* p = libraries;
-	for (int j = 0; j < i; j++)
-		p += *p + 1;
-	return p;
+	return libraryNames[i];
 }
 
-bool CV2PDB::initSegMap()
+// buckets the CodeView directory entries by subsection, so every pass only visits its own entries
+void CV2PDB::indexCVEntries()
 {
+	cvEntries.clear();
+	countEntries = img.countCVEntries();
 	for (int m = 0; m < countEntries; m++)
 	{
 		OMFDirEntry* entry = img.getCVEntry(m);
-		switch(entry->SubSection)
-		{
-		case sstSegMap:
-			segMap = img.CVP<OMFSegMap>(entry->lfo);
-			segMapDesc = img.CVP<OMFSegMapDesc>(entry->lfo + sizeof(OMFSegMap));
-			int maxframe = -1;
-			for (int s = 0; s < segMap->cSeg; s++)
-			{
-				int rc = dbi->AddSec(segMapDesc[s].frame, segMapDesc[s].flags, segMapDesc[s].offset, segMapDesc[s].cbSeg);
-				if (rc <= 0)
-					return setError("cannot add section");
-				if (segMapDesc[s].frame > maxframe)
-					maxframe = segMapDesc[s].frame;
-			}
+		cvEntries[entry->SubSection].push_back(entry);
+	}
+}
 
-			segFrame2Index = new int[maxframe + 1];
-			memset(segFrame2Index, -1, (maxframe + 1) * sizeof(*segFrame2Index));
-			for (int s = 0; s < segMap->cSeg; s++)
-				segFrame2Index[segMapDesc[s].frame] = s;
-			break;
+// directory entries of the subsection in directory order
+const std::vector<OMFDirEntry*>& CV2PDB::getCVEntries(int subSection) const
+{
+	static const std::vector<OMFDirEntry*> none;
+	std::map<int, std::vector<OMFDirEntry*> >::const_iterator it = cvEntries.find(subSection);
+	return it != cvEntries.end() ? it->second : none;
+}
+
+bool CV2PDB::initSegMap()
+{
+	TraceSpan span("initSegMap");
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstSegMap);
+	for (size_t e = 0; e < entries.size(); e++)
+	{
+		OMFDirEntry* entry = entries[e];
+		segMap = img.CVP<OMFSegMap>(entry->lfo);
+		segMapDesc = img.CVP<OMFSegMapDesc>(entry->lfo + sizeof(OMFSegMap));
+		int maxframe = -1;
+		for (int s = 0; s < segMap->cSeg; s++)
+		{
+			int rc = dbi->AddSec(segMapDesc[s].frame, segMapDesc[s].flags, segMapDesc[s].offset, segMapDesc[s].cbSeg);
+			if (rc <= 0)
+				return setError("cannot add section");
+			if (segMapDesc[s].frame > maxframe)
+				maxframe = segMapDesc[s].frame;
 		}
+
+		segFrame2Index = new int[maxframe + 1];
+		memset(segFrame2Index, -1, (maxframe + 1) * sizeof(*segFrame2Index));
+		for (int s = 0; s < segMap->cSeg; s++)
+			segFrame2Index[segMapDesc[s].frame] = s;
 	}
 	return true;
 }
@@ -342,25 +413,19 @@ static int copy_p2dsym(unsigned char* dp, int& dpos, const unsigned char* p, int
 	int plen = pstrlen(q);
 	int len = dsym2c(q, plen, (char*) dp + dpos, maxdlen - dpos);
 	dpos += len + 1;
-	pos = q - p + len;
+	pos = q - p + plen;
 	return len;
 }
 
-// if dfieldlist == 0, count fields
-int CV2PDB::_doFields(int cmd, codeview_reftype* dfieldlist, const codeview_reftype* fieldlist, int arg)
+// decodes the entries of a field list, skipping the padding and the friend functions that are not converted
+bool CV2PDB::decodeFields(const codeview_reftype* fieldlist, std::vector<FieldEntry>& fields)
 {
-	int maxdlen = (cmd == kCmdAdd ? arg : 0);
+	fields.clear();
 	int len = fieldlist->fieldlist.len - 2;
 	const unsigned char* p = fieldlist->fieldlist.list;
-	unsigned char* dp = dfieldlist ? dfieldlist->fieldlist.list : 0;
-	int pos = 0, dpos = 0;
+	int pos = 0;
 	int leaf_len, value;
-	int nested_types = 0;
-	int base_classes = 0;
-	int test_nested_type = (cmd == kCmdNestedTypes ? arg : 0);
 
-	int cntFields = 0;
-	int prev = pos;
 	while (pos < len && !hadError())
 	{
 		if (p[pos] >= 0xf1)       /* LF_PAD... */
@@ -369,224 +434,142 @@ int CV2PDB::_doFields(int cmd, codeview_reftype* dfieldlist, const codeview_reft
 			continue;
 		}
 		if(pos & 3)
-		{
-			setError("bad field alignment!");
-			break;
-		}
+			return setError("bad field alignment!");
 
-		prev = pos;
 		const codeview_fieldtype* fieldtype = (const codeview_fieldtype*)(p + pos);
-		codeview_fieldtype* dfieldtype = (codeview_fieldtype*)(dp + dpos);
-		int copylen = 0;
-
-		switch (fieldtype->generic.id)
+		FieldEntry field;
+		field.kind = fieldtype->generic.id;
+		field.attribute = 0;
+		field.type = 0;
+		field.type2 = 0;
+		field.offset = 0;
+		field.pos = pos;
+		field.name = -1;
+
+		switch (field.kind)
 		{
 		case LF_ENUMERATE_V1:
-			if (dp && v3)
-			{
-				dfieldtype->enumerate_v3.id = LF_ENUMERATE_V3;
-				dfieldtype->enumerate_v3.attribute = fieldtype->enumerate_v1.attribute;
-				pos += sizeof(fieldtype->enumerate_v1) - sizeof(fieldtype->enumerate_v1.value);
-				dpos += sizeof(fieldtype->enumerate_v3) - sizeof(fieldtype->enumerate_v3.value);
-				copy_leaf(dp, dpos, p, pos);
-				copy_p2dsym(dp, dpos, p, pos, maxdlen);
-			}
-			else
-			{
-				leaf_len = numeric_leaf(&value, &fieldtype->enumerate_v1.value);
-				copylen = 2 + 2 + leaf_len + pstrmemlen(p + pos + 4 + leaf_len); // id,attr,value,name
-			}
+			field.attribute = fieldtype->enumerate_v1.attribute;
+			field.tail = pos + sizeof(fieldtype->enumerate_v1) - sizeof(fieldtype->enumerate_v1.value);
+			field.name = field.tail + numeric_leaf(&field.offset, &fieldtype->enumerate_v1.value);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_ENUMERATE_V3:
-			leaf_len = numeric_leaf(&value, &fieldtype->enumerate_v3.value);
-			copylen = 2 + 2 + leaf_len + strlen((const char*) p + pos + 4 + leaf_len) + 1; // id,attr,value,name
+			field.attribute = fieldtype->enumerate_v3.attribute;
+			field.tail = pos + sizeof(fieldtype->enumerate_v3) - sizeof(fieldtype->enumerate_v3.value);
+			field.name = field.tail + numeric_leaf(&field.offset, &fieldtype->enumerate_v3.value);
+			field.len = field.name - pos + strlen((const char*) p + field.name) + 1;
 			break;
 
 		case LF_MEMBER_V1:
-			if (dp)
-			{
-				dfieldtype->member_v2.id = v3 ? LF_MEMBER_V3 : LF_MEMBER_V2;
-				dfieldtype->member_v2.attribute = fieldtype->member_v1.attribute;
-				dfieldtype->member_v2.type = translateType(fieldtype->member_v1.type);
-				dpos += sizeof(dfieldtype->member_v2.id) + sizeof(dfieldtype->member_v2.attribute) + sizeof(dfieldtype->member_v2.type);
-			}
-			pos  += sizeof(dfieldtype->member_v1.id) + sizeof(dfieldtype->member_v1.attribute) + sizeof(dfieldtype->member_v1.type);
-			if (dp && v3)
-			{
-				copy_leaf(dp, dpos, p, pos);
-				copy_p2dsym(dp, dpos, p, pos, maxdlen);
-			}
-			else
-			{
-				leaf_len = numeric_leaf(&value, &fieldtype->member_v1.offset);
-				copylen = leaf_len + pstrmemlen(p + pos + leaf_len); // value,name
-			}
+			field.attribute = fieldtype->member_v1.attribute;
+			field.type = fieldtype->member_v1.type;
+			field.tail = pos + sizeof(fieldtype->member_v1) - sizeof(fieldtype->member_v1.offset);
+			field.name = field.tail + numeric_leaf(&field.offset, &fieldtype->member_v1.offset);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_MEMBER_V2:
-			leaf_len = numeric_leaf(&value, &fieldtype->member_v1.offset);
-			copylen = sizeof(dfieldtype->member_v2) - sizeof(dfieldtype->member_v2.offset);
-			copylen += leaf_len + pstrmemlen(p + pos + copylen + leaf_len); // value,name
+			field.attribute = fieldtype->member_v2.attribute;
+			field.type = fieldtype->member_v2.type;
+			field.tail = pos + sizeof(fieldtype->member_v2) - sizeof(fieldtype->member_v2.offset);
+			field.name = field.tail + numeric_leaf(&field.offset, &fieldtype->member_v2.offset);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_MEMBER_V3:
-			leaf_len = numeric_leaf(&value, &fieldtype->member_v3.offset);
-			copylen = sizeof(dfieldtype->member_v3) - sizeof(dfieldtype->member_v3.offset);
-			copylen += leaf_len + strlen((const char*) p + pos + copylen + leaf_len) + 1; // value,name
+			field.attribute = fieldtype->member_v3.attribute;
+			field.type = fieldtype->member_v3.type;
+			field.tail = pos + sizeof(fieldtype->member_v3) - sizeof(fieldtype->member_v3.offset);
+			field.name = field.tail + numeric_leaf(&field.offset, &fieldtype->member_v3.offset);
+			field.len = field.name - pos + strlen((const char*) p + field.name) + 1;
 			break;
 
 		case LF_BCLASS_V1:
-			base_classes++;
-			if (dp)
-			{
-				dfieldtype->bclass_v2.id = LF_BCLASS_V2;
-				dfieldtype->bclass_v2.attribute = fieldtype->bclass_v1.attribute;
-				dfieldtype->bclass_v2.type = translateType(fieldtype->bclass_v1.type);
-			}
-			pos  += sizeof(fieldtype->bclass_v1) - sizeof(fieldtype->bclass_v1.offset);
-#if 1
-			copylen = numeric_leaf(&value, &fieldtype->bclass_v1.offset);
-			if (dp)
-			{
-				dpos += sizeof(dfieldtype->bclass_v2) - sizeof(fieldtype->bclass_v2.offset);
-				memcpy (dp + dpos, p + pos, copylen);
-				dpos += copylen;
-				// dp[dpos++] = 0;
-			}
-			pos += copylen;
-			copylen = 0;
-#else
-			dfieldtype->member_v2.id = LF_MEMBER_V2;
-			dfieldtype->member_v2.attribute = 0;
-			dfieldtype->member_v2.type = fieldtype->bclass_v1.type;
-			dfieldtype->member_v2.offset = fieldtype->bclass_v1.offset;
-			//memcpy (&dfieldtype->member_v2 + 1, "\0", 1);
-			//dpos += sizeof(dfieldtype->member_v2) + 1;
-			memcpy (&dfieldtype->member_v2 + 1, "\004base", 5);
-			dpos += sizeof(dfieldtype->member_v2) + 5;
-
-			pos += numeric_leaf(&value, &fieldtype->bclass_v1.offset);
-#endif
+			field.attribute = fieldtype->bclass_v1.attribute;
+			field.type = fieldtype->bclass_v1.type;
+			field.tail = pos + sizeof(fieldtype->bclass_v1) - sizeof(fieldtype->bclass_v1.offset);
+			field.len = field.tail - pos + numeric_leaf(&field.offset, &fieldtype->bclass_v1.offset);
 			break;
 
 		case LF_BCLASS_V2:
-			base_classes++;
-			leaf_len = numeric_leaf(&value, &fieldtype->bclass_v2.offset);
-			copylen = sizeof(dfieldtype->bclass_v2) - 2 + leaf_len;
+			field.attribute = fieldtype->bclass_v2.attribute;
+			field.type = fieldtype->bclass_v2.type;
+			field.tail = pos + sizeof(fieldtype->bclass_v2) - sizeof(fieldtype->bclass_v2.offset);
+			field.len = field.tail - pos + numeric_leaf(&field.offset, &fieldtype->bclass_v2.offset);
 			break;
 
 		case LF_METHOD_V1:
-			if (dp)
-			{
-				dfieldtype->method_v2.id = v3 ? LF_METHOD_V3 : LF_METHOD_V2;
-				dfieldtype->method_v2.count = fieldtype->method_v1.count;
-				dfieldtype->method_v2.mlist = fieldtype->method_v1.mlist;
-				dpos += sizeof(dfieldtype->method_v2) - sizeof(dfieldtype->method_v2.p_name);
-			}
-			pos  += sizeof(dfieldtype->method_v1) - sizeof(dfieldtype->method_v1.p_name);
-			if (v3 && dp)
-				copy_p2dsym(dp, dpos, p, pos, maxdlen);
-			else
-				copylen = pstrmemlen(&fieldtype->method_v1.p_name.namelen);
-
-			if(cmd == kCmdOffsetFirstVirtualMethod)
-				if(const codeview_type* cvtype = getTypeData(fieldtype->method_v1.mlist))
-					if (cvtype->generic.id == LF_METHODLIST_V1 && cvtype->generic.len > 2)
-					{
-						// just check the first entry
-						const unsigned short *pattr = (const unsigned short*)(&cvtype->generic + 1);
-						int mode =(*pattr >> 2) & 7;
-						if(mode == 4 || mode == 6)
-							return *(const unsigned*)(&pattr[2]);
-					}
+			field.type = fieldtype->method_v1.mlist;
+			field.type2 = fieldtype->method_v1.count;
+			field.tail = field.name = pos + sizeof(fieldtype->method_v1) - sizeof(fieldtype->method_v1.p_name);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_METHOD_V2:
-			copylen = sizeof(dfieldtype->method_v2) - sizeof(dfieldtype->method_v2.p_name);
-			copylen += pstrmemlen(&fieldtype->method_v2.p_name.namelen);
+			field.type = fieldtype->method_v2.mlist;
+			field.type2 = fieldtype->method_v2.count;
+			field.tail = field.name = pos + sizeof(fieldtype->method_v2) - sizeof(fieldtype->method_v2.p_name);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_METHOD_V3:
-			copylen = sizeof(dfieldtype->method_v3);
-			copylen += strlen((const char*) p + pos + copylen) + 1;
+			field.type = fieldtype->method_v3.mlist;
+			field.type2 = fieldtype->method_v3.count;
+			field.tail = field.name = pos + sizeof(fieldtype->method_v3) - sizeof(fieldtype->method_v3.name);
+			field.len = field.name - pos + strlen((const char*) p + field.name) + 1;
 			break;
 
 		case LF_STMEMBER_V1:
-			if (dp)
-			{
-				dfieldtype->stmember_v2.id = v3 ? LF_STMEMBER_V3 : LF_STMEMBER_V2;
-				dfieldtype->stmember_v2.attribute = fieldtype->stmember_v1.attribute;
-				dfieldtype->stmember_v2.type = translateType(fieldtype->stmember_v1.type);
-				dpos += sizeof(dfieldtype->stmember_v2) - sizeof(dfieldtype->stmember_v2.p_name);
-			}
-			pos  += sizeof(dfieldtype->stmember_v1) - sizeof(dfieldtype->stmember_v1.p_name);
-			if (v3 && dp)
-				copy_p2dsym(dp, dpos, p, pos, maxdlen);
-			else
-				copylen = pstrmemlen(&fieldtype->stmember_v1.p_name.namelen);
+			field.attribute = fieldtype->stmember_v1.attribute;
+			field.type = fieldtype->stmember_v1.type;
+			field.tail = field.name = pos + sizeof(fieldtype->stmember_v1) - sizeof(fieldtype->stmember_v1.p_name);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_STMEMBER_V2:
-			copylen = sizeof(dfieldtype->stmember_v2) - sizeof(dfieldtype->stmember_v2.p_name);
-			copylen += pstrmemlen(&fieldtype->stmember_v2.p_name.namelen);
+			field.attribute = fieldtype->stmember_v2.attribute;
+			field.type = fieldtype->stmember_v2.type;
+			field.tail = field.name = pos + sizeof(fieldtype->stmember_v2) - sizeof(fieldtype->stmember_v2.p_name);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_STMEMBER_V3:
-			copylen = sizeof(dfieldtype->stmember_v3) - sizeof(dfieldtype->stmember_v3.name);
-			copylen += strlen(fieldtype->stmember_v3.name) + 1;
+			field.attribute = fieldtype->stmember_v3.attribute;
+			field.type = fieldtype->stmember_v3.type;
+			field.tail = field.name = pos + sizeof(fieldtype->stmember_v3) - sizeof(fieldtype->stmember_v3.name);
+			field.len = field.name - pos + strlen((const char*) p + field.name) + 1;
 			break;
 
 		case LF_NESTTYPE_V1:
-			if (dp)
-			{
-				dfieldtype->nesttype_v2.id = v3 ? LF_NESTTYPE_V3 : LF_NESTTYPE_V2;
-				dfieldtype->nesttype_v2.type = translateType(fieldtype->nesttype_v1.type);
-				dfieldtype->nesttype_v2._pad0 = 0;
-				dpos += sizeof(dfieldtype->nesttype_v2) - sizeof(dfieldtype->nesttype_v2.p_name);
-			}
-			pos  += sizeof(dfieldtype->nesttype_v1) - sizeof(dfieldtype->nesttype_v1.p_name);
-			if (v3 && dp)
-				copy_p2dsym(dp, dpos, p, pos, maxdlen);
-			else
-				copylen = pstrmemlen(&fieldtype->nesttype_v1.p_name.namelen);
-			if(test_nested_type == 0 || test_nested_type == fieldtype->nesttype_v1.type)
-				nested_types++;
-			if(cmd == kCmdHasClassTypeEnum && p2ccmp(fieldtype->nesttype_v1.p_name, CLASSTYPEENUM_TYPE))
-				return true;
+			field.type = fieldtype->nesttype_v1.type;
+			field.tail = field.name = pos + sizeof(fieldtype->nesttype_v1) - sizeof(fieldtype->nesttype_v1.p_name);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_NESTTYPE_V2:
-			copylen = sizeof(dfieldtype->nesttype_v2) - sizeof(dfieldtype->nesttype_v2.p_name);
-			copylen += pstrmemlen(&fieldtype->nesttype_v2.p_name.namelen);
-			if(test_nested_type == 0 || test_nested_type == fieldtype->nesttype_v1.type)
-				nested_types++;
-			if(cmd == kCmdHasClassTypeEnum && p2ccmp(fieldtype->nesttype_v2.p_name, CLASSTYPEENUM_TYPE))
-				return true;
+			field.type = fieldtype->nesttype_v2.type;
+			field.tail = field.name = pos + sizeof(fieldtype->nesttype_v2) - sizeof(fieldtype->nesttype_v2.p_name);
+			field.len = field.name - pos + pstrmemlen(p + field.name);
 			break;
 
 		case LF_NESTTYPE_V3:
-			copylen = sizeof(dfieldtype->nesttype_v3) - sizeof(dfieldtype->nesttype_v3.name);
-			copylen += strlen(fieldtype->nesttype_v3.name) + 1;
-			if(test_nested_type == 0 || test_nested_type == fieldtype->nesttype_v1.type)
-				nested_types++;
-			if(cmd == kCmdHasClassTypeEnum && strcmp(fieldtype->nesttype_v3.name, CLASSTYPEENUM_TYPE) == 0)
-				return true;
+			field.type = fieldtype->nesttype_v3.type;
+			field.tail = field.name = pos + sizeof(fieldtype->nesttype_v3) - sizeof(fieldtype->nesttype_v3.name);
+			field.len = field.name - pos + strlen((const char*) p + field.name) + 1;
 			break;
 
 		case LF_VFUNCTAB_V1:
-			if (dp)
-			{
-				dfieldtype->vfunctab_v2.id = LF_VFUNCTAB_V2;
-				dfieldtype->vfunctab_v2.type = fieldtype->vfunctab_v1.type;
-				dfieldtype->vfunctab_v2._pad0 = 0;
-				dpos += sizeof(dfieldtype->vfunctab_v2);
-			}
-			pos  += sizeof(fieldtype->vfunctab_v1);
+			field.type = fieldtype->vfunctab_v1.type;
+			field.len = sizeof(fieldtype->vfunctab_v1);
+			field.tail = pos + field.len;
 			break;
 
 		case LF_VFUNCTAB_V2:
-			copylen = sizeof(dfieldtype->vfunctab_v2);
+			field.type = fieldtype->vfunctab_v2.type;
+			field.len = sizeof(fieldtype->vfunctab_v2);
+			field.tail = pos + field.len;
 			break;
 
 			// throw away friend function declarations, there is no v3 replacement and the debugger won't need them
@@ -594,97 +577,251 @@ int CV2PDB::_doFields(int cmd, codeview_reftype* dfieldlist, const codeview_reft
 			pos += sizeof(fieldtype->friendfcn_v1) + pstrmemlen(&fieldtype->friendfcn_v1.p_name.namelen) - 2;
 			continue;
 		case LF_FRIENDFCN_V2:
-			copylen = sizeof(fieldtype->friendfcn_v2) + pstrmemlen(&fieldtype->friendfcn_v2.p_name.namelen) - 2;
+			pos += sizeof(fieldtype->friendfcn_v2) + pstrmemlen(&fieldtype->friendfcn_v2.p_name.namelen) - 2;
 			continue;
 
 		case LF_FRIENDCLS_V1:
-			if(dp)
-			{
-				dfieldtype->friendcls_v2.id = LF_FRIENDCLS_V2;
-				dfieldtype->friendcls_v2._pad0 = 0;
-				dfieldtype->friendcls_v2.type = fieldtype->friendcls_v1.type;
-				dpos += sizeof(fieldtype->friendcls_v2);
-			}
-			pos += sizeof(fieldtype->friendcls_v1);
+			field.type = fieldtype->friendcls_v1.type;
+			field.len = sizeof(fieldtype->friendcls_v1);
+			field.tail = pos + field.len;
 			break;
 		case LF_FRIENDCLS_V2:
-			copylen = sizeof(fieldtype->friendcls_v2);
+			field.type = fieldtype->friendcls_v2.type;
+			field.len = sizeof(fieldtype->friendcls_v2);
+			field.tail = pos + field.len;
 			break;
 
-			// necessary to convert this info? no data associated with it, so it might not be used
 		case LF_VBCLASS_V1:
 		case LF_IVBCLASS_V1:
-			base_classes++;
-			if (dp)
-			{
-				dfieldtype->vbclass_v2.id = fieldtype->generic.id == LF_VBCLASS_V1 ? LF_VBCLASS_V2 : LF_IVBCLASS_V2;
-				dfieldtype->vbclass_v2.attribute = fieldtype->vbclass_v1.attribute;
-				dfieldtype->vbclass_v2.btype = fieldtype->vbclass_v1.btype;
-				dfieldtype->vbclass_v2.vbtype = fieldtype->vbclass_v1.vbtype;
-				dpos += sizeof(dfieldtype->vbclass_v2) - sizeof(dfieldtype->vbclass_v2.vbpoff);
-			}
-			pos += sizeof(fieldtype->vbclass_v1) - sizeof(fieldtype->vbclass_v1.vbpoff);
-			leaf_len = numeric_leaf(&value, &fieldtype->vbclass_v1.vbpoff);
+			field.attribute = fieldtype->vbclass_v1.attribute;
+			field.type = fieldtype->vbclass_v1.btype;
+			field.type2 = fieldtype->vbclass_v1.vbtype;
+			field.tail = pos + sizeof(fieldtype->vbclass_v1) - sizeof(fieldtype->vbclass_v1.vbpoff);
+			leaf_len = numeric_leaf(&field.offset, &fieldtype->vbclass_v1.vbpoff);
 			leaf_len += numeric_leaf(&value, (char*) &fieldtype->vbclass_v1.vbpoff + leaf_len);
-			copylen = leaf_len;
+			field.len = field.tail - pos + leaf_len;
 			break;
 
 		case LF_VBCLASS_V2:
 		case LF_IVBCLASS_V2:
-			base_classes++;
-			leaf_len = numeric_leaf(&value, &fieldtype->vbclass_v2.vbpoff);
+			field.attribute = fieldtype->vbclass_v2.attribute;
+			field.type = fieldtype->vbclass_v2.btype;
+			field.type2 = fieldtype->vbclass_v2.vbtype;
+			field.tail = pos + sizeof(fieldtype->vbclass_v2) - sizeof(fieldtype->vbclass_v2.vbpoff);
+			leaf_len = numeric_leaf(&field.offset, &fieldtype->vbclass_v2.vbpoff);
 			leaf_len += numeric_leaf(&value, (char*) &fieldtype->vbclass_v2.vbpoff + leaf_len);
-			copylen = sizeof(fieldtype->vbclass_v2) - sizeof(fieldtype->vbclass_v2.vbpoff) + leaf_len;
+			field.len = field.tail - pos + leaf_len;
 			break;
 
 		default:
-			setError("unsupported field entry");
+			return setError("unsupported field entry");
+		}
+
+		fields.push_back(field);
+		pos += field.len;
+	}
+	return !hadError();
+}
+
+// decodes the field lists of the global types once for the queries and the conversion of the types,
+// also remembers the global types that are nested into another type
+bool CV2PDB::decodeGlobalFieldLists()
+{
+	TraceSpan span("decodeGlobalFieldLists");
+	DWORD* offset = (DWORD*)(globalTypeHeader + 1);
+	BYTE* typeData = (BYTE*)(offset + globalTypeHeader->cTypes);
+
+	globalFieldLists.clear();
+	globalFieldLists.resize(globalTypeHeader->cTypes);
+	nestedGlobalTypes.assign(globalTypeHeader->cTypes, false);
+	for (unsigned int t = 0; t < globalTypeHeader->cTypes && !hadError(); t++)
+	{
+		const codeview_reftype* cvtype = (const codeview_reftype*)(typeData + offset[t]);
+		if (cvtype->generic.id != LF_FIELDLIST_V1 && cvtype->generic.id != LF_FIELDLIST_V2)
+			continue;
+
+		std::vector<FieldEntry>& fields = globalFieldLists[t];
+		decodeFields(cvtype, fields);
+		for (size_t f = 0; f < fields.size(); f++)
+			if (fields[f].kind == LF_NESTTYPE_V1 || fields[f].kind == LF_NESTTYPE_V2 || fields[f].kind == LF_NESTTYPE_V3)
+			{
+				unsigned int nested = fields[f].type - 0x1000;
+				if (nested < globalTypeHeader->cTypes)
+					nestedGlobalTypes[nested] = true;
+			}
+	}
+	return !hadError();
+}
+
+// the decoded field list of the global or user type with index type, the field lists of the global
+// types are decoded by decodeGlobalFieldLists, other field lists are decoded into buf
+const std::vector<CV2PDB::FieldEntry>& CV2PDB::getFields(int type, std::vector<FieldEntry>& buf)
+{
+	int t = type - 0x1000;
+	if (t >= 0 && t < (int) globalFieldLists.size())
+		return globalFieldLists[t];
+
+	buf.clear();
+	const codeview_reftype* fieldlist = (const codeview_reftype*) getTypeData(type);
+	if (fieldlist && (fieldlist->generic.id == LF_FIELDLIST_V1 || fieldlist->generic.id == LF_FIELDLIST_V2))
+		decodeFields(fieldlist, buf);
+	return buf;
+}
+
+// writes the decoded fields of fieldlist to dfieldlist, converting the V1 entries to V2 or V3
+int CV2PDB::addFields(codeview_reftype* dfieldlist, const codeview_reftype* fieldlist,
+                      const std::vector<FieldEntry>& fields, int maxdlen)
+{
+	const unsigned char* p = fieldlist->fieldlist.list;
+	unsigned char* dp = dfieldlist->fieldlist.list;
+	int dpos = 0;
+
+	for (size_t f = 0; f < fields.size(); f++)
+	{
+		const FieldEntry& field = fields[f];
+		codeview_fieldtype* dfieldtype = (codeview_fieldtype*)(dp + dpos);
+		int pos = field.tail; // the remainder of converted entries is copied or converted from here
+
+		switch (field.kind)
+		{
+		case LF_ENUMERATE_V1:
+			if (!v3)
+			{
+				pos = field.pos;
+				break;
+			}
+			dfieldtype->enumerate_v3.id = LF_ENUMERATE_V3;
+			dfieldtype->enumerate_v3.attribute = field.attribute;
+			dpos += sizeof(dfieldtype->enumerate_v3) - sizeof(dfieldtype->enumerate_v3.value);
+			break;
+
+		case LF_MEMBER_V1:
+			dfieldtype->member_v2.id = v3 ? LF_MEMBER_V3 : LF_MEMBER_V2;
+			dfieldtype->member_v2.attribute = field.attribute;
+			dfieldtype->member_v2.type = translateType(field.type);
+			dpos += sizeof(dfieldtype->member_v2.id) + sizeof(dfieldtype->member_v2.attribute) + sizeof(dfieldtype->member_v2.type);
+			break;
+
+		case LF_BCLASS_V1:
+			dfieldtype->bclass_v2.id = LF_BCLASS_V2;
+			dfieldtype->bclass_v2.attribute = field.attribute;
+			dfieldtype->bclass_v2.type = translateType(field.type);
+			dpos += sizeof(dfieldtype->bclass_v2) - sizeof(dfieldtype->bclass_v2.offset);
+			break;
+
+		case LF_METHOD_V1:
+			dfieldtype->method_v2.id = v3 ? LF_METHOD_V3 : LF_METHOD_V2;
+			dfieldtype->method_v2.count = field.type2;
+			dfieldtype->method_v2.mlist = field.type;
+			dpos += sizeof(dfieldtype->method_v2) - sizeof(dfieldtype->method_v2.p_name);
+			break;
+
+		case LF_STMEMBER_V1:
+			dfieldtype->stmember_v2.id = v3 ? LF_STMEMBER_V3 : LF_STMEMBER_V2;
+			dfieldtype->stmember_v2.attribute = field.attribute;
+			dfieldtype->stmember_v2.type = translateType(field.type);
+			dpos += sizeof(dfieldtype->stmember_v2) - sizeof(dfieldtype->stmember_v2.p_name);
+			break;
+
+		case LF_NESTTYPE_V1:
+			dfieldtype->nesttype_v2.id = v3 ? LF_NESTTYPE_V3 : LF_NESTTYPE_V2;
+			dfieldtype->nesttype_v2.type = translateType(field.type);
+			dfieldtype->nesttype_v2._pad0 = 0;
+			dpos += sizeof(dfieldtype->nesttype_v2) - sizeof(dfieldtype->nesttype_v2.p_name);
+			break;
+
+		case LF_VFUNCTAB_V1:
+			dfieldtype->vfunctab_v2.id = LF_VFUNCTAB_V2;
+			dfieldtype->vfunctab_v2.type = field.type;
+			dfieldtype->vfunctab_v2._pad0 = 0;
+			dpos += sizeof(dfieldtype->vfunctab_v2);
+			break;
+
+		case LF_FRIENDCLS_V1:
+			dfieldtype->friendcls_v2.id = LF_FRIENDCLS_V2;
+			dfieldtype->friendcls_v2._pad0 = 0;
+			dfieldtype->friendcls_v2.type = field.type;
+			dpos += sizeof(dfieldtype->friendcls_v2);
+			break;
+
+			// necessary to convert this info? no data associated with it, so it might not be used
+		case LF_VBCLASS_V1:
+		case LF_IVBCLASS_V1:
+			dfieldtype->vbclass_v2.id = field.kind == LF_VBCLASS_V1 ? LF_VBCLASS_V2 : LF_IVBCLASS_V2;
+			dfieldtype->vbclass_v2.attribute = field.attribute;
+			dfieldtype->vbclass_v2.btype = field.type;
+			dfieldtype->vbclass_v2.vbtype = field.type2;
+			dpos += sizeof(dfieldtype->vbclass_v2) - sizeof(dfieldtype->vbclass_v2.vbpoff);
+			break;
+
+		default: // already in the target format
+			pos = field.pos;
 			break;
 		}
 
-		if (dp)
+		if (v3 && field.name >= 0 && pos > field.pos)
 		{
+			// numeric leaf and name of converted entries
+			if (field.name > pos)
+				copy_leaf(dp, dpos, p, pos);
+			copy_p2dsym(dp, dpos, p, pos, maxdlen);
+		}
+		else
+		{
+			int copylen = field.pos + field.len - pos;
 			memcpy (dp + dpos, p + pos, copylen);
 			dpos += copylen;
-
-			for ( ; dpos & 3; dpos++)
-				dp[dpos] = 0xf4 - (dpos & 3);
 		}
-		pos += copylen;
-		cntFields++;
-	}
-	switch(cmd)
-	{
-	case kCmdAdd:
-		return dpos;
-	case kCmdCount:
-		return cntFields;
-	case kCmdNestedTypes:
-		return nested_types;
-	case kCmdCountBaseClasses:
-		return base_classes;
-	case kCmdOffsetFirstVirtualMethod:
-		return -1;
-	case kCmdHasClassTypeEnum:
-		return false;
-	}
 
-	return setError("_doFields: unknown command");
+		for ( ; dpos & 3; dpos++)
+			dp[dpos] = 0xf4 - (dpos & 3);
+	}
+	return dpos;
 }
 
-int CV2PDB::addFields(codeview_reftype* dfieldlist, const codeview_reftype* fieldlist, int maxdlen)
+int CV2PDB::countNestedTypes(const std::vector<FieldEntry>& fields, int type)
 {
-	return _doFields(kCmdAdd, dfieldlist, fieldlist, maxdlen);
+	int nested_types = 0;
+	for (size_t f = 0; f < fields.size(); f++)
+		if (fields[f].kind == LF_NESTTYPE_V1 || fields[f].kind == LF_NESTTYPE_V2 || fields[f].kind == LF_NESTTYPE_V3)
+			if (type == 0 || type == fields[f].type)
+				nested_types++;
+	return nested_types;
 }
 
-int CV2PDB::countFields(const codeview_reftype* fieldlist)
+int CV2PDB::countBaseClasses(const std::vector<FieldEntry>& fields)
 {
-	return _doFields(kCmdCount, 0, fieldlist, 0);
+	int base_classes = 0;
+	for (size_t f = 0; f < fields.size(); f++)
+		switch (fields[f].kind)
+		{
+		case LF_BCLASS_V1:
+		case LF_BCLASS_V2:
+		case LF_VBCLASS_V1:
+		case LF_IVBCLASS_V1:
+		case LF_VBCLASS_V2:
+		case LF_IVBCLASS_V2:
+			base_classes++;
+			break;
+		}
+	return base_classes;
 }
 
-int CV2PDB::countNestedTypes(const codeview_reftype* fieldlist, int type)
+// offset of the first virtual method in the vtable, -1 if there is none
+int CV2PDB::offsetFirstVirtualMethod(const std::vector<FieldEntry>& fields)
 {
-	return _doFields(kCmdNestedTypes, 0, fieldlist, type);
+	for (size_t f = 0; f < fields.size(); f++)
+		if (fields[f].kind == LF_METHOD_V1)
+			if (const codeview_type* cvtype = getTypeData(fields[f].type))
+				if (cvtype->generic.id == LF_METHODLIST_V1 && cvtype->generic.len > 2)
+				{
+					// just check the first entry
+					const unsigned short *pattr = (const unsigned short*)(&cvtype->generic + 1);
+					int mode =(*pattr >> 2) & 7;
+					if(mode == 4 || mode == 6)
+						return *(const unsigned*)(&pattr[2]);
+				}
+	return -1;
 }
 
 int CV2PDB::addAggregate(codeview_type* dtype, bool clss, int n_element, int fieldlist, int property,
@@ -812,6 +949,7 @@ void CV2PDB::checkUserTypeAlloc(int size, int add)
 {
 	if (cbUserTypes + size >= allocUserTypes)
 	{
+		memTrack(kMemUserTypes, allocUserTypes, allocUserTypes + size + add);
 		allocUserTypes += size + add;
 		userTypes = (BYTE*) realloc(userTypes, allocUserTypes);
 	}
@@ -831,6 +969,7 @@ void CV2PDB::checkGlobalTypeAlloc(int size, int add)
 {
 	if (cbGlobalTypes + size > allocGlobalTypes)
 	{
+		memTrack(kMemGlobalTypes, allocGlobalTypes, allocGlobalTypes + size + add);
 		allocGlobalTypes += size + add;
 		globalTypes = (unsigned char*) realloc(globalTypes, allocGlobalTypes);
 	}
@@ -873,6 +1012,8 @@ const codeview_type* CV2PDB::getConvertedTypeData(int type)
 	type -= 0x1000;
 	if (type < 0 || type >= nextUserType - 0x1000)
 		return 0;
+	if (!convertedTypeOffsets.empty())
+		return type < (int) convertedTypeOffsets.size() ? (codeview_type*)(globalTypes + convertedTypeOffsets[type]) : 0;
 
 	int pos = 4;
 	while(type > 0 && pos < cbGlobalTypes)
@@ -959,25 +1100,14 @@ int CV2PDB::findMemberFunctionType(codeview_symbol* lastGProcSym, int thisPtrTyp
 
 int CV2PDB::fixProperty(int type, int prop, int fieldType)
 {
-	const codeview_reftype* cv_fieldtype = (const codeview_reftype*) getTypeData(fieldType);
-	if(cv_fieldtype && countNestedTypes(cv_fieldtype, 0) > 0)
+	std::vector<FieldEntry> buf;
+	if(countNestedTypes(getFields(fieldType, buf), 0) > 0)
 		prop |= kPropHasNested;
 
-	// search types for field list with nested type
-	DWORD* offset = (DWORD*)(globalTypeHeader + 1);
-	BYTE* typeData = (BYTE*)(offset + globalTypeHeader->cTypes);
-	for (unsigned int t = 0; t < globalTypeHeader->cTypes; t++)
-	{
-		const codeview_reftype* cvtype = (const codeview_reftype*)(typeData + offset[t]);
-		if (cvtype->generic.id == LF_FIELDLIST_V1 || cvtype->generic.id == LF_FIELDLIST_V2)
-		{
-			if (countNestedTypes(cvtype, type) > 0)
-			{
-				prop |= kPropIsNested;
-				break;
-			}
-		}
-	}
+	// nested type in any field list of the global types
+	unsigned int t = type - 0x1000;
+	if (t < nestedGlobalTypes.size() && nestedGlobalTypes[t])
+		prop |= kPropIsNested;
 	return prop;
 }
 
@@ -1063,6 +1193,21 @@ int CV2PDB::sizeofType(int type)
 	if (type < 0x1000)
 		return sizeofBasicType(type);
 
+	if (const TypeProperties* props = typeProperties(type, false))
+		if (props->known & kTypeSize)
+			return props->size;
+
+	int size = _sizeofType(type);
+	if (TypeProperties* props = typeProperties(type, true))
+	{
+		props->size = size;
+		props->known |= kTypeSize;
+	}
+	return size;
+}
+
+int CV2PDB::_sizeofType(int type)
+{
 	const codeview_type* cvtype = getTypeData(type);
 	if (!cvtype)
 		return 4;
@@ -1080,6 +1225,21 @@ int CV2PDB::sizeofType(int type)
 
 // to be used when writing new type only to avoid double translation
 int CV2PDB::translateType(int type)
+{
+	if (const TypeProperties* props = typeProperties(type, false))
+		if (props->known & kTypeTranslated)
+			return props->translated;
+
+	int translated = _translateType(type);
+	if (TypeProperties* props = typeProperties(type, true))
+	{
+		props->translated = translated;
+		props->known |= kTypeTranslated;
+	}
+	return translated;
+}
+
+int CV2PDB::_translateType(int type)
 {
 	if (type < 0x1000)
 	{
@@ -1216,6 +1376,27 @@ bool CV2PDB::nameOfType(int type, char* name, int maxlen)
 	if(type < 0x1000)
 		return nameOfBasicType(type, name, maxlen);
 
+	if (const TypeProperties* props = typeProperties(type, false))
+		if (props->known & kTypeName)
+		{
+			int len = props->name.size() < (size_t) maxlen ? props->name.size() : maxlen - 1;
+			memcpy(name, props->name.c_str(), len);
+			name[len] = 0;
+			return true;
+		}
+
+	if (!_nameOfType(type, name, maxlen))
+		return false;
+	if (TypeProperties* props = typeProperties(type, true))
+	{
+		props->name = name;
+		props->known |= kTypeName;
+	}
+	return true;
+}
+
+bool CV2PDB::_nameOfType(int type, char* name, int maxlen)
+{
 	const codeview_type* ptype = getTypeData(type);
 	if(!ptype)
 		return setError("nameOfType: invalid type while retreiving name of type");
@@ -1404,17 +1585,44 @@ bool CV2PDB::nameOfOEMType(codeview_oem_type* oem, char* name, int maxlen)
 	return setError("nameOfOEMType: unknown OEM type record");
 }
 
-const char* CV2PDB::appendDynamicArray(int indexType, int elemType)
+int CV2PDB::findAppendedType(int kind, int type1, int type2, char* name)
+{
+	AppendedTypeKey key = { kind, type1, type2 };
+	std::map<AppendedTypeKey, AppendedType>::iterator it = appendedTypes.find(key);
+	if (it == appendedTypes.end())
+		return 0;
+	if (name)
+		strcpy(name, it->second.name.c_str());
+	return it->second.type;
+}
+
+void CV2PDB::addAppendedType(int kind, int type1, int type2, int type, const char* name)
+{
+	AppendedTypeKey key = { kind, type1, type2 };
+	AppendedType& appended = appendedTypes[key];
+	appended.type = type;
+	appended.name = name;
+}
+
+// ptype receives the type index of the array struct
+const char* CV2PDB::appendDynamicArray(int indexType, int elemType, int* ptype)
 {
 	indexType = translateType(indexType);
 	elemType = translateType(elemType);
 
+	static char name[kMaxNameLen];
+	if (int type = findAppendedType(kAppendedDynArray, indexType, elemType, name))
+	{
+		if (ptype)
+			*ptype = type;
+		return name;
+	}
+
 	codeview_reftype* rdtype;
 	codeview_type* dtype;
 
 	checkUserTypeAlloc();
 
-	static char name[kMaxNameLen];
 	nameOfDynamicArray(indexType, elemType, name, sizeof(name));
 
 	// nextUserType: pointer to elemType
@@ -1470,6 +1678,9 @@ const char* CV2PDB::appendDynamicArray(int indexType, int elemType)
 	int udType = nextUserType++;
 
 	addUdtSymbol(udType, name);
+	addAppendedType(kAppendedDynArray, indexType, elemType, udType, name);
+	if (ptype)
+		*ptype = udType;
 	return name;
 }
 
@@ -1487,20 +1698,23 @@ const char* CV2PDB::appendAssocArray(int keyType, int elemType)
 	keyType = translateType(keyType);
 	elemType = translateType(elemType);
 
+	static char name[kMaxNameLen];
+	if (findAppendedType(kAppendedAssocArray, keyType, elemType, name))
+		return name;
+
 	codeview_reftype* rdtype;
 	codeview_type* dtype;
 	codeview_fieldtype* dfieldtype;
 
 	checkUserTypeAlloc();
 
-	static char name[kMaxNameLen];
 #if 1
 	char keyname[kMaxNameLen];
 	char elemname[kMaxNameLen];
 	if(!nameOfType(keyType, keyname, sizeof(keyname)))
-		return false;
+		return 0;
 	if(!nameOfType(elemType, elemname, sizeof(elemname)))
-		return false;
+		return 0;
 
 	sprintf(name, "internal@aaA<%s,%s>", keyname, elemname);
 
@@ -1568,8 +1782,8 @@ const char* CV2PDB::appendAssocArray(int keyType, int elemType)
 	//    aaA*[] b;
 	//    size_t nodes;	// total number of aaA nodes
 	// };
-	const char* dynArray = appendDynamicArray(0x74, aaAPtrType);
-	int dynArrType = nextUserType - 1;
+	int dynArrType;
+	const char* dynArray = appendDynamicArray(0x74, aaAPtrType, &dynArrType);
 
 	// field list (aaA*[] b, size_t nodes)
 	rdtype = (codeview_reftype*) (userTypes + cbUserTypes);
@@ -1621,6 +1835,7 @@ const char* CV2PDB::appendAssocArray(int keyType, int elemType)
 	cbUserTypes += addClass(dtype, 1, aaFieldListType, 0, 0, 0, 4, name);
 
 	addUdtSymbol(nextUserType, name);
+	addAppendedType(kAppendedAssocArray, keyType, elemType, nextUserType, name);
 	nextUserType++;
 
 	return name;
@@ -1631,6 +1846,10 @@ const char* CV2PDB::appendDelegate(int thisType, int funcType)
 	thisType = translateType(thisType);
 	funcType = translateType(funcType);
 
+	static char name[kMaxNameLen];
+	if (findAppendedType(kAppendedDelegate, thisType, funcType, name))
+		return name;
+
 	codeview_reftype* rdtype;
 	codeview_type* dtype;
 
@@ -1662,7 +1881,6 @@ const char* CV2PDB::appendDelegate(int thisType, int funcType)
 	rdtype->fieldlist.len = len1 + len2 + 2;
 	cbUserTypes += rdtype->fieldlist.len + 2;
 
-	static char name[kMaxNameLen];
 	nameOfDelegate(thisType, funcType, name, sizeof(name));
 
 	// nextUserType + 3: struct delegate<>
@@ -1671,6 +1889,7 @@ const char* CV2PDB::appendDelegate(int thisType, int funcType)
 
 	nextUserType += thisTypeIsVoid ? 3 : 4;
 	addUdtSymbol(nextUserType - 1, name);
+	addAppendedType(kAppendedDelegate, thisType, funcType, nextUserType - 1, name);
 	return name;
 }
 
@@ -1750,21 +1969,30 @@ int CV2PDB::appendObjectType (int object_type, int enumType, const char* classSy
 
 int CV2PDB::appendPointerType(int pointedType, int attr)
 {
-	checkUserTypeAlloc();
+	if (int type = findAppendedType(kAppendedPointer, pointedType, attr))
+		return type;
+
+	checkUserTypeAlloc();
 
 	cbUserTypes += addPointerType(userTypes + cbUserTypes, pointedType, attr);
 	nextUserType++;
 
+	addAppendedType(kAppendedPointer, pointedType, attr, nextUserType - 1);
 	return nextUserType - 1;
 }
 
-int CV2PDB::appendModifierType(int type, int attr)
+int CV2PDB::appendModifierType(int type, int attr, bool shared)
 {
+	type = translateType(type);
+	if (shared)
+		if (int modType = findAppendedType(kAppendedModifier, type, attr))
+			return modType;
+
 	checkUserTypeAlloc();
 
 	codeview_type* dtype = (codeview_type*) (userTypes + cbUserTypes);
 	dtype->modifier_v2.id = LF_MODIFIER_V2;
-	dtype->modifier_v2.type = translateType(type);
+	dtype->modifier_v2.type = type;
 	dtype->modifier_v2.attribute = attr;
 	int len = sizeof(dtype->modifier_v2);
 	//for (; len & 3; len++)
@@ -1773,6 +2001,8 @@ int CV2PDB::appendModifierType(int type, int attr)
 	cbUserTypes += len;
 
 	nextUserType++;
+	if (shared)
+		addAppendedType(kAppendedModifier, type, attr, nextUserType - 1);
 	return nextUserType - 1;
 }
 
@@ -1811,6 +2041,7 @@ int CV2PDB::appendComplex(int cplxtype, int basetype, int elemsize, const char*
 	typedefs[cntTypedefs] = cplxtype;
 	translatedTypedefs[cntTypedefs] = classType;
 	cntTypedefs++;
+	invalidateTypeProperties(kTypeTranslated);
 
 	return classType;
 }
@@ -1842,77 +2073,184 @@ int CV2PDB::appendEnumerator(const char* typeName, const char* enumName, int enu
 	return enumType;
 }
 
-int CV2PDB::getBaseClass(const codeview_type* cvtype)
+// the cache entry of type or 0 if the type has none. Entries are only created and
+// returned for writing if write is set and no worker threads are reading them.
+CV2PDB::TypeProperties* CV2PDB::typeProperties(int type, bool write)
 {
-	if (getStructProperty(cvtype) & kPropIncomplete)
-		cvtype = findCompleteClassType(cvtype);
-
-	const codeview_reftype* fieldlist = (const codeview_reftype*) getConvertedTypeData(getStructFieldlist(cvtype));
-	if (!fieldlist || (fieldlist->generic.id != LF_FIELDLIST_V1 && fieldlist->generic.id != LF_FIELDLIST_V2))
+	if (!globalTypeHeader || type < 0 || type >= nextUserType)
+		return 0;
+	if (write && typePropsReadOnly)
 		return 0;
+	if (type >= (int) typeProps.size())
+	{
+		if (!write)
+			return 0;
+		typeProps.resize(nextUserType);
+	}
+	return &typeProps[type];
+}
 
-	codeview_fieldtype* fieldtype = (codeview_fieldtype*)(fieldlist->fieldlist.list);
-	if (fieldtype->generic.id == LF_BCLASS_V1)
-		return fieldtype->bclass_v1.type;
-	if (fieldtype->generic.id == LF_BCLASS_V2)
-		return fieldtype->bclass_v2.type;
-	return 0;
+// returns 1 if the flag prop is set for type, 0 if not and -1 if it has not been computed yet
+int CV2PDB::findTypeFlag(int type, int prop)
+{
+	const TypeProperties* props = typeProperties(type, false);
+	if (!props || !(props->known & prop))
+		return -1;
+	return (props->flags & prop) ? 1 : 0;
 }
 
-int CV2PDB::countBaseClasses(const codeview_type* cvtype)
+void CV2PDB::setTypeFlag(int type, int prop, bool set)
 {
-	if (getStructProperty(cvtype) & kPropIncomplete)
-		cvtype = findCompleteClassType(cvtype);
+	if (TypeProperties* props = typeProperties(type, true))
+	{
+		props->known |= prop;
+		if (set)
+			props->flags |= prop;
+		else
+			props->flags &= ~prop;
+	}
+}
 
-	const codeview_reftype* fieldlist = (const codeview_reftype*) getConvertedTypeData(getStructFieldlist(cvtype));
-	if (!fieldlist || (fieldlist->generic.id != LF_FIELDLIST_V1 && fieldlist->generic.id != LF_FIELDLIST_V2))
-		return 0;
+// forget the properties props of all types after the records they depend on have been changed
+void CV2PDB::invalidateTypeProperties(int props)
+{
+	for (size_t t = 0; t < typeProps.size(); t++)
+	{
+		typeProps[t].known &= ~props;
+		typeProps[t].flags &= ~props;
+	}
+}
 
-	return _doFields(kCmdCountBaseClasses, 0, fieldlist, 0);
+// computes the properties used when converting types and symbols on worker threads
+void CV2PDB::prepareTypeProperties()
+{
+	if (!globalTypeHeader)
+		return;
+	int globalTypesEnd = 0x1000 + globalTypeHeader->cTypes;
+	for (int t = 0; t < globalTypesEnd; t++)
+		translateType(t);
+	for (int t = 0x1000; t < globalTypesEnd; t++)
+		isClassType(t);
 }
 
-bool CV2PDB::derivesFromObject(const codeview_type* cvtype)
+int CV2PDB::getBaseClass(int type)
 {
-	if(cmpStructName(cvtype, (const BYTE*) OBJECT_SYMBOL, true))
-		return true;
+	if (const TypeProperties* props = typeProperties(type, false))
+		if (props->known & kTypeBaseClass)
+			return props->baseClass;
 
-	int baseType = getBaseClass(cvtype);
-	const codeview_type* basetype = getTypeData(baseType);
-	if(!basetype)
-		return false;
+	int baseClass = 0;
+	const codeview_type* cvtype = getTypeData(type);
+	if (cvtype && (getStructProperty(cvtype) & kPropIncomplete))
+		cvtype = findCompleteClassType(cvtype);
 
-	return derivesFromObject(basetype);
+	const codeview_reftype* fieldlist = cvtype ? (const codeview_reftype*) getConvertedTypeData(getStructFieldlist(cvtype)) : 0;
+	if (fieldlist && (fieldlist->generic.id == LF_FIELDLIST_V1 || fieldlist->generic.id == LF_FIELDLIST_V2))
+	{
+		codeview_fieldtype* fieldtype = (codeview_fieldtype*)(fieldlist->fieldlist.list);
+		if (fieldtype->generic.id == LF_BCLASS_V1)
+			baseClass = fieldtype->bclass_v1.type;
+		if (fieldtype->generic.id == LF_BCLASS_V2)
+			baseClass = fieldtype->bclass_v2.type;
+	}
+
+	if (TypeProperties* props = typeProperties(type, true))
+	{
+		props->baseClass = baseClass;
+		props->known |= kTypeBaseClass;
+	}
+	return baseClass;
 }
 
-bool CV2PDB::isCppInterface(const codeview_type* cvtype)
+int CV2PDB::countBaseClasses(int type)
 {
-	// check whether the first virtual function is at offset 0 (C++) or 4 (D)
+	if (const TypeProperties* props = typeProperties(type, false))
+		if (props->known & kTypeBaseClasses)
+			return props->baseClasses;
 
-	if (getStructProperty(cvtype) & kPropIncomplete)
+	int baseClasses = 0;
+	const codeview_type* cvtype = getTypeData(type);
+	if (cvtype && (getStructProperty(cvtype) & kPropIncomplete))
 		cvtype = findCompleteClassType(cvtype);
 
-	const codeview_reftype* fieldlist = (const codeview_reftype*) getTypeData(getStructFieldlist(cvtype));
-	if (!fieldlist || (fieldlist->generic.id != LF_FIELDLIST_V1 && fieldlist->generic.id != LF_FIELDLIST_V2))
-		return false;
+	const codeview_reftype* fieldlist = cvtype ? (const codeview_reftype*) getConvertedTypeData(getStructFieldlist(cvtype)) : 0;
+	if (fieldlist && (fieldlist->generic.id == LF_FIELDLIST_V1 || fieldlist->generic.id == LF_FIELDLIST_V2))
+	{
+		std::vector<FieldEntry> fields;
+		decodeFields(fieldlist, fields);
+		baseClasses = countBaseClasses(fields);
+	}
 
-	codeview_fieldtype* fieldtype = (codeview_fieldtype*)(fieldlist->fieldlist.list);
-	const codeview_type* basetype = 0;
-	if (fieldtype->generic.id == LF_BCLASS_V1)
-		basetype = getTypeData(fieldtype->bclass_v1.type);
-	if (fieldtype->generic.id == LF_BCLASS_V2)
-		basetype = getTypeData(fieldtype->bclass_v2.type);
-	if(basetype)
-		return isCppInterface(basetype);
+	if (TypeProperties* props = typeProperties(type, true))
+	{
+		props->baseClasses = baseClasses;
+		props->known |= kTypeBaseClasses;
+	}
+	return baseClasses;
+}
+
+bool CV2PDB::derivesFromObject(int type)
+{
+	int known = findTypeFlag(type, kTypeObject);
+	if (known >= 0)
+		return known != 0;
+
+	bool derives = false;
+	if (const codeview_type* cvtype = getTypeData(type))
+	{
+		if(cmpStructName(cvtype, (const BYTE*) OBJECT_SYMBOL, true))
+			derives = true;
+		else if (int baseType = getBaseClass(type))
+			derives = derivesFromObject(baseType);
+	}
+	setTypeFlag(type, kTypeObject, derives);
+	return derives;
+}
+
+bool CV2PDB::isCppInterface(int type)
+{
+	// check whether the first virtual function is at offset 0 (C++) or 4 (D)
+	int known = findTypeFlag(type, kTypeCppIface);
+	if (known >= 0)
+		return known != 0;
+
+	bool cppIface = false;
+	const codeview_type* cvtype = getTypeData(type);
+	if (cvtype && (getStructProperty(cvtype) & kPropIncomplete))
+		cvtype = findCompleteClassType(cvtype);
 
-	int off = _doFields(kCmdOffsetFirstVirtualMethod, 0, fieldlist, 0);
-	return off == 0;
+	int fieldlistType = cvtype ? getStructFieldlist(cvtype) : 0;
+	const codeview_reftype* fieldlist = (const codeview_reftype*) getTypeData(fieldlistType);
+	if (fieldlist && (fieldlist->generic.id == LF_FIELDLIST_V1 || fieldlist->generic.id == LF_FIELDLIST_V2))
+	{
+		codeview_fieldtype* fieldtype = (codeview_fieldtype*)(fieldlist->fieldlist.list);
+		int baseType = 0;
+		if (fieldtype->generic.id == LF_BCLASS_V1)
+			baseType = fieldtype->bclass_v1.type;
+		if (fieldtype->generic.id == LF_BCLASS_V2)
+			baseType = fieldtype->bclass_v2.type;
+		if (getTypeData(baseType))
+			cppIface = isCppInterface(baseType);
+		else
+		{
+			std::vector<FieldEntry> buf;
+			cppIface = offsetFirstVirtualMethod(getFields(fieldlistType, buf)) == 0;
+		}
+	}
+	setTypeFlag(type, kTypeCppIface, cppIface);
+	return cppIface;
 }
 
 bool CV2PDB::isClassType(int type)
 {
-	if(const codeview_type* cvt = getTypeData(type))
-		return isClass(cvt);
-	return false;
+	int known = findTypeFlag(type, kTypeClass);
+	if (known >= 0)
+		return known != 0;
+
+	const codeview_type* cvt = getTypeData(type);
+	bool cls = cvt && isClass(cvt);
+	setTypeFlag(type, kTypeClass, cls);
+	return cls;
 }
 
 void CV2PDB::ensureUDT(int type, const codeview_type* cvtype)
@@ -1988,13 +2326,14 @@ int CV2PDB::appendTypedef(int type, const char* name, bool saveTranslation)
 	}
 	else
 	{
-		typedefType = appendModifierType(type, 0);
+		typedefType = appendModifierType(type, 0, false);
 	}
 	if(saveTranslation)
 	{
 		typedefs[cntTypedefs] = type;
 		translatedTypedefs[cntTypedefs] = typedefType;
 		cntTypedefs++;
+		invalidateTypeProperties(kTypeTranslated);
 	}
 	return typedefType;
 }
@@ -2020,338 +2359,418 @@ void CV2PDB::appendTypedefs()
 	appendComplex(0x52, 0x42, 10, "creal");
 }
 
-bool CV2PDB::initGlobalTypes()
+// for debugging, cancel special processing after the limit
+static const unsigned int kGlobalTypeLimit = 0x7fffffff; // 0x1ddd; //
+
+// first pass over the global types, appending the user types and UDT symbols created for them.
+// This is done in type order so the type indices don't depend on the order the types are converted in.
+void CV2PDB::appendGlobalTypeUserTypes()
 {
-	int object_derived_type = 0;
-	for (int m = 0; m < countEntries; m++)
+	DWORD* offset = (DWORD*)(globalTypeHeader + 1);
+	BYTE* typeData = (BYTE*)(offset + globalTypeHeader->cTypes);
+
+	oemTypeName.assign(globalTypeHeader->cTypes, -1);
+	oemTypeNames.clear();
+	for (unsigned int t = 0; t < globalTypeHeader->cTypes && t <= kGlobalTypeLimit && !hadError(); t++)
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if(entry->SubSection == sstGlobalTypes)
+		const codeview_type* type = (codeview_type*)(typeData + offset[t]);
+		switch (type->generic.id)
+		{
+		case LF_OEM_V1:
 		{
-			globalTypeHeader = img.CVP<OMFGlobalTypes>(entry->lfo);
-			DWORD* offset = img.CVP<DWORD>(entry->lfo + sizeof(OMFGlobalTypes));
-			BYTE* typeData = img.CVP<BYTE>(entry->lfo + sizeof(OMFGlobalTypes) + 4*globalTypeHeader->cTypes);
+			codeview_oem_type* oem = (codeview_oem_type*)(&type->generic + 1);
+			const char* name = 0;
+			if (oem->generic.oemid == 0x42 && oem->generic.id == 1 && Dversion != 0)
+				name = appendDynamicArray(oem->d_dyn_array.index_type, oem->d_dyn_array.elem_type);
+			else if (oem->generic.oemid == 0x42 && oem->generic.id == 3)
+				name = appendDelegate(oem->d_delegate.this_type, oem->d_delegate.func_type);
+			else if (oem->generic.oemid == 0x42 && oem->generic.id == 2)
+				name = appendAssocArray(oem->d_assoc_array.key_type, oem->d_assoc_array.elem_type);
+			if (name)
+			{
+				oemTypeName[t] = oemTypeNames.size();
+				oemTypeNames.insert(oemTypeNames.end(), name, name + strlen(name) + 1);
+			}
+			break;
+		}
+		case LF_STRUCTURE_V1:
+		case LF_CLASS_V1:
+			ensureUDT(t, type);
+			break;
 
-			if (globalTypes)
-				return setError("only one global type entry expected");
+		case LF_POINTER_V1:
+			if (Dversion > 0 && thisIsNotRef && isClassType(type->pointer_v1.datatype)
+			                                 && (type->pointer_v1.attribute & 0xE0) == 0)
+				// const pointer for this
+				pointerTypes[t] = appendPointerType(type->pointer_v1.datatype,
+				                                    type->pointer_v1.attribute | 0x400);
+			break;
 
-			pointerTypes = new int[globalTypeHeader->cTypes];
-			memset(pointerTypes, 0, globalTypeHeader->cTypes * sizeof(*pointerTypes));
+		case LF_ENUM_V1:
+			if (type->enumeration_v1.fieldlist && v3 && !findUdtSymbol(t + 0x1000))
+			{
+				char name[kMaxNameLen];
+				pstrcpy_v(true, (BYTE*) name, (const BYTE*) &type->enumeration_v1.p_name);
+				addUdtSymbol(t + 0x1000, name);
+			}
+			break;
+		}
+	}
+}
 
-			globalTypes = (unsigned char*) malloc(entry->cb + 4);
-			allocGlobalTypes = entry->cb + 4;
-			if (!globalTypes)
-				return setError("Out of memory");
-			*(DWORD*) globalTypes = 4;
-			cbGlobalTypes = 4;
+// converts the global type t to dtype, returns the length including the padding.
+// Only reads the global and user types, so types can be converted on multiple threads.
+int CV2PDB::convertGlobalType(unsigned int t, codeview_type* dtype, int maxlen)
+{
+	DWORD* offset = (DWORD*)(globalTypeHeader + 1);
+	BYTE* typeData = (BYTE*)(offset + globalTypeHeader->cTypes);
 
-			nextUserType = globalTypeHeader->cTypes + 0x1000;
+	const codeview_type* type = (codeview_type*)(typeData + offset[t]);
+	const codeview_reftype* rtype = (codeview_reftype*)(typeData + offset[t]);
+	codeview_reftype* rdtype = (codeview_reftype*) dtype;
+	int leaf_len, value;
+	unsigned int clsstype;
 
-			appendTypedefs();
-			if(Dversion > 0)
-			{
-				if(addClassTypeEnum)
-				{
-					classEnumType    = appendEnumerator("__ClassType",    CLASSTYPEENUM_NAME, kClassTypeObject,   kPropIsNested);
-					ifaceEnumType    = appendEnumerator("__IfaceType",    CLASSTYPEENUM_NAME, kClassTypeIface,    kPropIsNested);
-					cppIfaceEnumType = appendEnumerator("__CppIfaceType", CLASSTYPEENUM_NAME, kClassTypeCppIface, kPropIsNested);
-					structEnumType   = appendEnumerator("__StructType",   CLASSTYPEENUM_NAME, kClassTypeStruct,   kPropIsNested);
+	int len = type->generic.len + 2;
+	if (t > kGlobalTypeLimit)
+	{
+		dtype->pointer_v2.id = LF_POINTER_V2;
+		dtype->pointer_v2.len = 10;
+		dtype->pointer_v2.datatype = 0x74;
+		dtype->pointer_v2.attribute = 0x800a;
+		return 12;
+	}
 
-					ifaceBaseType    = appendObjectType (kClassTypeIface,    ifaceEnumType, IFACE_SYMBOL);
-					cppIfaceBaseType = appendObjectType (kClassTypeCppIface, cppIfaceEnumType, CPPIFACE_SYMBOL);
-				}
-				classBaseType = appendObjectType (kClassTypeObject, classEnumType, OBJECT_SYMBOL);
-			}
+	switch (type->generic.id)
+	{
+	case LF_OEM_V1:
+	{
+		codeview_oem_type* oem = (codeview_oem_type*)(&type->generic + 1);
 
-			for (unsigned int t = 0; t < globalTypeHeader->cTypes && !hadError(); t++)
+		if (oem->generic.oemid == 0x42 && oem->generic.id == 1)
+		{
+			if(Dversion == 0) // in dmc, this is used for (u)int64
 			{
-				const codeview_type* type = (codeview_type*)(typeData + offset[t]);
-				const codeview_reftype* rtype = (codeview_reftype*)(typeData + offset[t]);
-				int leaf_len, value;
-
-				int len = type->generic.len + 2;
-				checkGlobalTypeAlloc(len + 1000);
-
-				unsigned int clsstype;
-				codeview_type* dtype = (codeview_type*) (globalTypes + cbGlobalTypes);
-				codeview_reftype* rdtype = (codeview_reftype*) (globalTypes + cbGlobalTypes);
+				dtype->modifier_v2.id = LF_MODIFIER_V2;
+				dtype->modifier_v2.attribute = 0;
+				dtype->modifier_v2.type = 0x13;
+				len = sizeof(dtype->modifier_v2);
+			}
+			else
+				len = addClass(dtype, 0, 0, kPropIncomplete, 0, 0, 0, &oemTypeNames[oemTypeName[t]]);
+		}
+		else if (oem->generic.oemid == 0x42 && (oem->generic.id == 2 || oem->generic.id == 3))
+			len = addClass(dtype, 0, 0, kPropIncomplete, 0, 0, 0, &oemTypeNames[oemTypeName[t]]);
+		else
+		{
+			dtype->pointer_v2.id = LF_POINTER_V2;
+			dtype->pointer_v2.len = 10;
+			dtype->pointer_v2.datatype = oem->d_dyn_array.elem_type;
+			dtype->pointer_v2.attribute = 0x800a;
+			len = 12;
+		}
+		break;
+	}
+	case LF_ARGLIST_V1:
+		rdtype->arglist_v2.id = LF_ARGLIST_V2;
+		rdtype->arglist_v2.num = rtype->arglist_v1.num;
+		for (int i = 0; i < rtype->arglist_v1.num; i++)
+			rdtype->arglist_v2.args [i] = translateType(rtype->arglist_v1.args [i]);
+		len = sizeof(rdtype->arglist_v2) + 4 * rdtype->arglist_v2.num - sizeof(rdtype->arglist_v2.args);
+		break;
 
-				// for debugging, cancel special processing after the limit
-				unsigned int typeLimit = 0x7fffffff; // 0x1ddd; //
-				if (t > typeLimit)
-				{
-					dtype->pointer_v2.id = LF_POINTER_V2;
-					dtype->pointer_v2.len = 10;
-					dtype->pointer_v2.datatype = 0x74;
-					dtype->pointer_v2.attribute = 0x800a;
-					cbGlobalTypes += 12;
-					continue;
-				}
+	case LF_PROCEDURE_V1:
+		dtype->procedure_v2.id = LF_PROCEDURE_V2;
+		dtype->procedure_v2.rvtype   = translateType(type->procedure_v1.rvtype);
+		dtype->procedure_v2.call     = type->procedure_v1.call;
+		dtype->procedure_v2.reserved = type->procedure_v1.reserved;
+		dtype->procedure_v2.params   = type->procedure_v1.params;
+		dtype->procedure_v2.arglist  = type->procedure_v1.arglist;
+		len = sizeof(dtype->procedure_v2);
+		break;
 
-				switch (type->generic.id)
-				{
-				case LF_OEM_V1:
+	case LF_STRUCTURE_V1:
+		dtype->struct_v2.id = v3 ? LF_STRUCTURE_V3 : LF_STRUCTURE_V2;
+		goto LF_CLASS_V1_struct;
+	case LF_CLASS_V1:
+		//dtype->struct_v2.id = v3 ? LF_STRUCTURE_V3 : LF_STRUCTURE_V2;
+		dtype->struct_v2.id = v3 ? LF_CLASS_V3 : LF_CLASS_V2;
+	LF_CLASS_V1_struct:
+		dtype->struct_v2.fieldlist = type->struct_v1.fieldlist;
+		dtype->struct_v2.n_element = type->struct_v1.n_element;
+		if(type->struct_v1.fieldlist != 0)
+			if(const codeview_type* td = getTypeData(type->struct_v1.fieldlist))
+				if(td->generic.id == LF_FIELDLIST_V1 || td->generic.id == LF_FIELDLIST_V2)
 				{
-					codeview_oem_type* oem = (codeview_oem_type*)(&type->generic + 1);
-
-					if (oem->generic.oemid == 0x42 && oem->generic.id == 1)
-					{
-						if(Dversion == 0) // in dmc, this is used for (u)int64
-						{
-							dtype->modifier_v2.id = LF_MODIFIER_V2;
-							dtype->modifier_v2.attribute = 0;
-							dtype->modifier_v2.type = 0x13;
-							len = sizeof(dtype->modifier_v2);
-						}
-						else
-						{
-							const char* name = appendDynamicArray(oem->d_dyn_array.index_type, oem->d_dyn_array.elem_type);
-							len = addClass(dtype, 0, 0, kPropIncomplete, 0, 0, 0, name);
-						}
-					}
-					else if (oem->generic.oemid == 0x42 && oem->generic.id == 3)
-					{
-						const char* name = appendDelegate(oem->d_delegate.this_type, oem->d_delegate.func_type);
-						len = addClass(dtype, 0, 0, kPropIncomplete, 0, 0, 0, name);
-					}
-					else if (oem->generic.oemid == 0x42 && oem->generic.id == 2)
-					{
-						const char* name = appendAssocArray(oem->d_assoc_array.key_type, oem->d_assoc_array.elem_type);
-						len = addClass(dtype, 0, 0, kPropIncomplete, 0, 0, 0, name);
-					}
-					else
-					{
-						dtype->pointer_v2.id = LF_POINTER_V2;
-						dtype->pointer_v2.len = 10;
-						dtype->pointer_v2.datatype = oem->d_dyn_array.elem_type;
-						dtype->pointer_v2.attribute = 0x800a;
-						len = 12;
-					}
-					break;
+					std::vector<FieldEntry> buf;
+					dtype->struct_v2.n_element = getFields(type->struct_v1.fieldlist, buf).size();
 				}
-				case LF_ARGLIST_V1:
-					rdtype->arglist_v2.id = LF_ARGLIST_V2;
-					rdtype->arglist_v2.num = rtype->arglist_v1.num;
-					for (int i = 0; i < rtype->arglist_v1.num; i++)
-						rdtype->arglist_v2.args [i] = translateType(rtype->arglist_v1.args [i]);
-					len = sizeof(rdtype->arglist_v2) + 4 * rdtype->arglist_v2.num - sizeof(rdtype->arglist_v2.args);
-					break;
-
-				case LF_PROCEDURE_V1:
-					dtype->procedure_v2.id = LF_PROCEDURE_V2;
-					dtype->procedure_v2.rvtype   = translateType(type->procedure_v1.rvtype);
-					dtype->procedure_v2.call     = type->procedure_v1.call;
-					dtype->procedure_v2.reserved = type->procedure_v1.reserved;
-					dtype->procedure_v2.params   = type->procedure_v1.params;
-					dtype->procedure_v2.arglist  = type->procedure_v1.arglist;
-					len = sizeof(dtype->procedure_v2);
-					break;
-
-				case LF_STRUCTURE_V1:
-					dtype->struct_v2.id = v3 ? LF_STRUCTURE_V3 : LF_STRUCTURE_V2;
-					goto LF_CLASS_V1_struct;
-				case LF_CLASS_V1:
-					//dtype->struct_v2.id = v3 ? LF_STRUCTURE_V3 : LF_STRUCTURE_V2;
-					dtype->struct_v2.id = v3 ? LF_CLASS_V3 : LF_CLASS_V2;
-				LF_CLASS_V1_struct:
-					dtype->struct_v2.fieldlist = type->struct_v1.fieldlist;
-					dtype->struct_v2.n_element = type->struct_v1.n_element;
-					if(type->struct_v1.fieldlist != 0)
-						if(const codeview_type* td = getTypeData(type->struct_v1.fieldlist))
-							if(td->generic.id == LF_FIELDLIST_V1 || td->generic.id == LF_FIELDLIST_V2)
-								dtype->struct_v2.n_element = countFields((const codeview_reftype*)td);
-					dtype->struct_v2.property = fixProperty(t + 0x1000, type->struct_v1.property,
-					                                        type->struct_v1.fieldlist) | kPropReserved2;
+		dtype->struct_v2.property = fixProperty(t + 0x1000, type->struct_v1.property,
+		                                        type->struct_v1.fieldlist) | kPropReserved2;
 #if REMOVE_LF_DERIVED
-					dtype->struct_v2.derived = 0;
+		dtype->struct_v2.derived = 0;
 #else
-					dtype->struct_v2.derived = type->struct_v1.derived;
+		dtype->struct_v2.derived = type->struct_v1.derived;
 #endif
-					dtype->struct_v2.vshape = type->struct_v1.vshape;
-					leaf_len = numeric_leaf(&value, &type->struct_v1.structlen);
-					memcpy (&dtype->struct_v2.structlen, &type->struct_v1.structlen, leaf_len);
-					len = pstrcpy_v(v3, (BYTE*)       &dtype->struct_v2.structlen + leaf_len,
-					                    (const BYTE*)  &type->struct_v1.structlen + leaf_len);
-					// alternate name can be added here?
+		dtype->struct_v2.vshape = type->struct_v1.vshape;
+		leaf_len = numeric_leaf(&value, &type->struct_v1.structlen);
+		memcpy (&dtype->struct_v2.structlen, &type->struct_v1.structlen, leaf_len);
+		len = pstrcpy_v(v3, (BYTE*)       &dtype->struct_v2.structlen + leaf_len,
+		                    (const BYTE*)  &type->struct_v1.structlen + leaf_len);
+		// alternate name can be added here?
 #if 0
-					if (dtype->struct_v2.id == LF_CLASS_V2)
-						len += pstrcpy((BYTE*)       &dtype->struct_v2.structlen + leaf_len + len,
-						               (const BYTE*)  &type->struct_v1.structlen + leaf_len);
+		if (dtype->struct_v2.id == LF_CLASS_V2)
+			len += pstrcpy((BYTE*)       &dtype->struct_v2.structlen + leaf_len + len,
+			               (const BYTE*)  &type->struct_v1.structlen + leaf_len);
 #endif
-					len += leaf_len + sizeof(dtype->struct_v2) - sizeof(type->struct_v2.structlen);
-
-					ensureUDT(t, type);
-					// remember type index of derived list for object.Object
-					if (Dversion > 0 && dtype->struct_v2.derived)
-						if (memcmp((char*) &type->struct_v1.structlen + leaf_len, "\x0dobject.Object", 14) == 0)
-							object_derived_type = type->struct_v1.derived;
-					break;
+		len += leaf_len + sizeof(dtype->struct_v2) - sizeof(type->struct_v2.structlen);
+		break;
 
-				case LF_UNION_V1:
-					dtype->union_v2.id = v3 ? LF_UNION_V3 : LF_UNION_V2;
-					dtype->union_v2.count = type->union_v1.count;
-					dtype->union_v2.fieldlist = type->struct_v1.fieldlist;
-					dtype->union_v2.property = fixProperty(t + 0x1000, type->struct_v1.property, type->struct_v1.fieldlist);
-					leaf_len = numeric_leaf(&value, &type->union_v1.un_len);
-					memcpy (&dtype->union_v2.un_len, &type->union_v1.un_len, leaf_len);
-					len = pstrcpy_v(v3, (BYTE*)      &dtype->union_v2.un_len + leaf_len,
-					                    (const BYTE*) &type->union_v1.un_len + leaf_len);
-					len += leaf_len + sizeof(dtype->union_v2) - sizeof(type->union_v2.un_len);
-					break;
+	case LF_UNION_V1:
+		dtype->union_v2.id = v3 ? LF_UNION_V3 : LF_UNION_V2;
+		dtype->union_v2.count = type->union_v1.count;
+		dtype->union_v2.fieldlist = type->struct_v1.fieldlist;
+		dtype->union_v2.property = fixProperty(t + 0x1000, type->struct_v1.property, type->struct_v1.fieldlist);
+		leaf_len = numeric_leaf(&value, &type->union_v1.un_len);
+		memcpy (&dtype->union_v2.un_len, &type->union_v1.un_len, leaf_len);
+		len = pstrcpy_v(v3, (BYTE*)      &dtype->union_v2.un_len + leaf_len,
+		                    (const BYTE*) &type->union_v1.un_len + leaf_len);
+		len += leaf_len + sizeof(dtype->union_v2) - sizeof(type->union_v2.un_len);
+		break;
 
-				case LF_POINTER_V1:
-					dtype->pointer_v2.id = LF_POINTER_V2;
-					dtype->pointer_v2.datatype = translateType(type->pointer_v1.datatype);
-					if (Dversion > 0 && isClassType(type->pointer_v1.datatype)
-					                 && (type->pointer_v1.attribute & 0xE0) == 0)
-					{
-						if (thisIsNotRef) // const pointer for this
-							pointerTypes[t] = appendPointerType(type->pointer_v1.datatype,
-							                                    type->pointer_v1.attribute | 0x400);
-						dtype->pointer_v2.attribute = type->pointer_v1.attribute | 0x20; // convert to reference
-					}
-					else
-						dtype->pointer_v2.attribute = type->pointer_v1.attribute;
-					len = 12; // ignore p_name field in type->pointer_v1/2
-					break;
+	case LF_POINTER_V1:
+		dtype->pointer_v2.id = LF_POINTER_V2;
+		dtype->pointer_v2.datatype = translateType(type->pointer_v1.datatype);
+		if (Dversion > 0 && isClassType(type->pointer_v1.datatype)
+		                 && (type->pointer_v1.attribute & 0xE0) == 0)
+			dtype->pointer_v2.attribute = type->pointer_v1.attribute | 0x20; // convert to reference
+		else
+			dtype->pointer_v2.attribute = type->pointer_v1.attribute;
+		len = 12; // ignore p_name field in type->pointer_v1/2
+		break;
 
-				case LF_ARRAY_V1:
-					dtype->array_v2.id = v3 ? LF_ARRAY_V3 : LF_ARRAY_V2;
-					dtype->array_v2.elemtype = translateType(type->array_v1.elemtype);
-					dtype->array_v2.idxtype = translateType(type->array_v1.idxtype);
-					leaf_len = numeric_leaf(&value, &type->array_v1.arrlen);
-					memcpy (&dtype->array_v2.arrlen, &type->array_v1.arrlen, leaf_len);
-					len = pstrcpy_v(v3, (BYTE*)      &dtype->array_v2.arrlen + leaf_len,
-					                    (const BYTE*) &type->array_v1.arrlen + leaf_len);
-					len += leaf_len + sizeof(dtype->array_v2) - sizeof(dtype->array_v2.arrlen);
-					// followed by name
-					break;
+	case LF_ARRAY_V1:
+		dtype->array_v2.id = v3 ? LF_ARRAY_V3 : LF_ARRAY_V2;
+		dtype->array_v2.elemtype = translateType(type->array_v1.elemtype);
+		dtype->array_v2.idxtype = translateType(type->array_v1.idxtype);
+		leaf_len = numeric_leaf(&value, &type->array_v1.arrlen);
+		memcpy (&dtype->array_v2.arrlen, &type->array_v1.arrlen, leaf_len);
+		len = pstrcpy_v(v3, (BYTE*)      &dtype->array_v2.arrlen + leaf_len,
+		                    (const BYTE*) &type->array_v1.arrlen + leaf_len);
+		len += leaf_len + sizeof(dtype->array_v2) - sizeof(dtype->array_v2.arrlen);
+		// followed by name
+		break;
 
-				case LF_MFUNCTION_V1:
-					dtype->mfunction_v2.id = LF_MFUNCTION_V2;
-					dtype->mfunction_v2.rvtype = translateType(type->mfunction_v1.rvtype);
-					clsstype = type->mfunction_v1.class_type;
-					dtype->mfunction_v2.class_type = translateType(clsstype);
-					if (clsstype >= 0x1000 && clsstype < 0x1000 + globalTypeHeader->cTypes)
-					{
-						// fix class_type to point to class, not pointer to class
-						codeview_type* ctype = (codeview_type*)(typeData + offset[clsstype - 0x1000]);
-						if (ctype->generic.id == LF_POINTER_V1)
-							dtype->mfunction_v2.class_type = translateType(ctype->pointer_v1.datatype);
-					}
-					dtype->mfunction_v2.this_type = translateType(type->mfunction_v1.this_type);
-					dtype->mfunction_v2.call = type->mfunction_v1.call;
-					dtype->mfunction_v2.reserved = type->mfunction_v1.reserved;
-					dtype->mfunction_v2.params = type->mfunction_v1.params;
-					dtype->mfunction_v2.arglist = type->mfunction_v1.arglist;
-					dtype->mfunction_v2.this_adjust = type->mfunction_v1.this_adjust;
-					len = sizeof(dtype->mfunction_v2);
-					break;
+	case LF_MFUNCTION_V1:
+		dtype->mfunction_v2.id = LF_MFUNCTION_V2;
+		dtype->mfunction_v2.rvtype = translateType(type->mfunction_v1.rvtype);
+		clsstype = type->mfunction_v1.class_type;
+		dtype->mfunction_v2.class_type = translateType(clsstype);
+		if (clsstype >= 0x1000 && clsstype < 0x1000 + globalTypeHeader->cTypes)
+		{
+			// fix class_type to point to class, not pointer to class
+			codeview_type* ctype = (codeview_type*)(typeData + offset[clsstype - 0x1000]);
+			if (ctype->generic.id == LF_POINTER_V1)
+				dtype->mfunction_v2.class_type = translateType(ctype->pointer_v1.datatype);
+		}
+		dtype->mfunction_v2.this_type = translateType(type->mfunction_v1.this_type);
+		dtype->mfunction_v2.call = type->mfunction_v1.call;
+		dtype->mfunction_v2.reserved = type->mfunction_v1.reserved;
+		dtype->mfunction_v2.params = type->mfunction_v1.params;
+		dtype->mfunction_v2.arglist = type->mfunction_v1.arglist;
+		dtype->mfunction_v2.this_adjust = type->mfunction_v1.this_adjust;
+		len = sizeof(dtype->mfunction_v2);
+		break;
 
-				case LF_ENUM_V1:
-					dtype->enumeration_v2.id = v3 ? LF_ENUM_V3 : LF_ENUM_V2;
-					dtype->enumeration_v2.count = type->enumeration_v1.count;
-					dtype->enumeration_v2.type = translateType(type->enumeration_v1.type);
-					dtype->enumeration_v2.fieldlist = type->enumeration_v1.fieldlist;
-					dtype->enumeration_v2.property = fixProperty(t + 0x1000, type->enumeration_v1.property, type->enumeration_v1.fieldlist);
-					len = pstrcpy_v (v3, (BYTE*) &dtype->enumeration_v2.p_name, (BYTE*) &type->enumeration_v1.p_name);
-					len += sizeof(dtype->enumeration_v2) - sizeof(dtype->enumeration_v2.p_name);
-					if(dtype->enumeration_v2.fieldlist && v3)
-						if(!findUdtSymbol(t + 0x1000))
-							addUdtSymbol(t + 0x1000, (char*) &dtype->enumeration_v2.p_name);
-					break;
+	case LF_ENUM_V1:
+		dtype->enumeration_v2.id = v3 ? LF_ENUM_V3 : LF_ENUM_V2;
+		dtype->enumeration_v2.count = type->enumeration_v1.count;
+		dtype->enumeration_v2.type = translateType(type->enumeration_v1.type);
+		dtype->enumeration_v2.fieldlist = type->enumeration_v1.fieldlist;
+		dtype->enumeration_v2.property = fixProperty(t + 0x1000, type->enumeration_v1.property, type->enumeration_v1.fieldlist);
+		len = pstrcpy_v (v3, (BYTE*) &dtype->enumeration_v2.p_name, (BYTE*) &type->enumeration_v1.p_name);
+		len += sizeof(dtype->enumeration_v2) - sizeof(dtype->enumeration_v2.p_name);
+		break;
 
-				case LF_FIELDLIST_V1:
-				case LF_FIELDLIST_V2:
-					rdtype->fieldlist.id = LF_FIELDLIST_V2;
-					len = addFields(rdtype, rtype, allocGlobalTypes - cbGlobalTypes) + 4;
-					break;
+	case LF_FIELDLIST_V1:
+	case LF_FIELDLIST_V2:
+		rdtype->fieldlist.id = LF_FIELDLIST_V2;
+		{
+			std::vector<FieldEntry> buf;
+			len = addFields(rdtype, rtype, getFields(t + 0x1000, buf), maxlen) + 4;
+		}
+		break;
 
-				case LF_DERIVED_V1:
+	case LF_DERIVED_V1:
 #if REMOVE_LF_DERIVED
-					rdtype->generic.id = LF_NULL_V1;
-					len = 4;
+		rdtype->generic.id = LF_NULL_V1;
+		len = 4;
 #else
-					rdtype->derived_v2.id = LF_DERIVED_V2;
-					rdtype->derived_v2.num = rtype->derived_v1.num;
-					for (int i = 0; i < rtype->derived_v1.num; i++)
-						if (rtype->derived_v1.drvdcls[i] < 0x1000) // + globalTypeHeader->cTypes)
-							rdtype->derived_v2.drvdcls[i] = translateType(rtype->derived_v1.drvdcls[i] + 0xfff);
-						else
-							rdtype->derived_v2.drvdcls[i] = translateType(rtype->derived_v1.drvdcls[i]);
-					len = sizeof(rdtype->derived_v2) + 4 * rdtype->derived_v2.num - sizeof(rdtype->derived_v2.drvdcls);
+		rdtype->derived_v2.id = LF_DERIVED_V2;
+		rdtype->derived_v2.num = rtype->derived_v1.num;
+		for (int i = 0; i < rtype->derived_v1.num; i++)
+			if (rtype->derived_v1.drvdcls[i] < 0x1000) // + globalTypeHeader->cTypes)
+				rdtype->derived_v2.drvdcls[i] = translateType(rtype->derived_v1.drvdcls[i] + 0xfff);
+			else
+				rdtype->derived_v2.drvdcls[i] = translateType(rtype->derived_v1.drvdcls[i]);
+		len = sizeof(rdtype->derived_v2) + 4 * rdtype->derived_v2.num - sizeof(rdtype->derived_v2.drvdcls);
 #endif
-					break;
+		break;
 
-				case LF_VTSHAPE_V1: // no alternate version known
-					len = ((short*)type)[2]; // number of nibbles following
-					len = 6 + (len + 1) / 2; // cut-off extra bytes
-					memcpy(dtype, type, len);
-					//*((char*)dtype + 6) = 0x50;
-					break;
+	case LF_VTSHAPE_V1: // no alternate version known
+		len = ((short*)type)[2]; // number of nibbles following
+		len = 6 + (len + 1) / 2; // cut-off extra bytes
+		memcpy(dtype, type, len);
+		//*((char*)dtype + 6) = 0x50;
+		break;
 
-				case LF_METHODLIST_V1:
-				{
-					dtype->generic.id = LF_METHODLIST_V2;
-					const unsigned short* pattr = (const unsigned short*)((const char*)type + 4);
-					unsigned* dpattr = (unsigned*)((char*)dtype + 4);
-					while ((const char*)pattr + 4 <= (const char*)type + type->generic.len + 2)
-					{
-						// type translation?
-						switch ((*pattr >> 2) & 7)
-						{
-						case 4:
-						case 6:
-							*dpattr++ = *pattr++;
-						default:
-							*dpattr++ = *pattr++;
-							*dpattr++ = *pattr++;
-							break;
-						}
-					}
-					len = (char*) dpattr - (char*)dtype;
-					break;
-				}
-				case LF_MODIFIER_V1:
-					dtype->modifier_v2.id = LF_MODIFIER_V2;
-					dtype->modifier_v2.attribute = type->modifier_v1.attribute;
-					dtype->modifier_v2.type = translateType(type->modifier_v1.type);
-					len = sizeof(dtype->modifier_v2);
-					break;
+	case LF_METHODLIST_V1:
+	{
+		dtype->generic.id = LF_METHODLIST_V2;
+		const unsigned short* pattr = (const unsigned short*)((const char*)type + 4);
+		unsigned* dpattr = (unsigned*)((char*)dtype + 4);
+		while ((const char*)pattr + 4 <= (const char*)type + type->generic.len + 2)
+		{
+			// type translation?
+			switch ((*pattr >> 2) & 7)
+			{
+			case 4:
+			case 6:
+				*dpattr++ = *pattr++;
+			default:
+				*dpattr++ = *pattr++;
+				*dpattr++ = *pattr++;
+				break;
+			}
+		}
+		len = (char*) dpattr - (char*)dtype;
+		break;
+	}
+	case LF_MODIFIER_V1:
+		dtype->modifier_v2.id = LF_MODIFIER_V2;
+		dtype->modifier_v2.attribute = type->modifier_v1.attribute;
+		dtype->modifier_v2.type = translateType(type->modifier_v1.type);
+		len = sizeof(dtype->modifier_v2);
+		break;
 
-				case LF_BITFIELD_V1:
-					rdtype->bitfield_v2.id = LF_BITFIELD_V2;
-					rdtype->bitfield_v2.nbits = rtype->bitfield_v1.nbits;
-					rdtype->bitfield_v2.bitoff = rtype->bitfield_v1.bitoff;
-					rdtype->bitfield_v2.type = translateType(rtype->bitfield_v1.type);
-					len = sizeof(rdtype->bitfield_v2);
-					break;
+	case LF_BITFIELD_V1:
+		rdtype->bitfield_v2.id = LF_BITFIELD_V2;
+		rdtype->bitfield_v2.nbits = rtype->bitfield_v1.nbits;
+		rdtype->bitfield_v2.bitoff = rtype->bitfield_v1.bitoff;
+		rdtype->bitfield_v2.type = translateType(rtype->bitfield_v1.type);
+		len = sizeof(rdtype->bitfield_v2);
+		break;
 
-				default:
-					memcpy(dtype, type, len);
-					break;
-				}
+	default:
+		memcpy(dtype, type, len);
+		break;
+	}
+
+	unsigned char* p = (unsigned char*) dtype;
+	for (; len & 3; len++)
+		p[len] = 0xf4 - (len & 3);
+	dtype->generic.len = len - 2;
+	return len;
+}
+
+bool CV2PDB::initGlobalTypes()
+{
+	TraceSpan span("initGlobalTypes");
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstGlobalTypes);
+	for (size_t e = 0; e < entries.size(); e++)
+	{
+		OMFDirEntry* entry = entries[e];
+		globalTypeHeader = img.CVP<OMFGlobalTypes>(entry->lfo);
+		DWORD* offset = img.CVP<DWORD>(entry->lfo + sizeof(OMFGlobalTypes));
+		BYTE* typeData = img.CVP<BYTE>(entry->lfo + sizeof(OMFGlobalTypes) + 4*globalTypeHeader->cTypes);
+
+		if (globalTypes)
+			return setError("only one global type entry expected");
+
+		pointerTypes = new int[globalTypeHeader->cTypes];
+		memset(pointerTypes, 0, globalTypeHeader->cTypes * sizeof(*pointerTypes));
+
+		if (!decodeGlobalFieldLists())
+			return false;
+
+		globalTypes = (unsigned char*) malloc(entry->cb + 4);
+		allocGlobalTypes = entry->cb + 4;
+		if (!globalTypes)
+			return setError("Out of memory");
+		memTrack(kMemGlobalTypes, 0, allocGlobalTypes);
+		*(DWORD*) globalTypes = 4;
+		cbGlobalTypes = 4;
+
+		nextUserType = globalTypeHeader->cTypes + 0x1000;
 
-				for (; len & 3; len++)
-					globalTypes[cbGlobalTypes + len] = 0xf4 - (len & 3);
-				dtype->generic.len = len - 2;
+		appendTypedefs();
+		if(Dversion > 0)
+		{
+			if(addClassTypeEnum)
+			{
+				classEnumType    = appendEnumerator("__ClassType",    CLASSTYPEENUM_NAME, kClassTypeObject,   kPropIsNested);
+				ifaceEnumType    = appendEnumerator("__IfaceType",    CLASSTYPEENUM_NAME, kClassTypeIface,    kPropIsNested);
+				cppIfaceEnumType = appendEnumerator("__CppIfaceType", CLASSTYPEENUM_NAME, kClassTypeCppIface, kPropIsNested);
+				structEnumType   = appendEnumerator("__StructType",   CLASSTYPEENUM_NAME, kClassTypeStruct,   kPropIsNested);
 
-				cbGlobalTypes += len;
+				ifaceBaseType    = appendObjectType (kClassTypeIface,    ifaceEnumType, IFACE_SYMBOL);
+				cppIfaceBaseType = appendObjectType (kClassTypeCppIface, cppIfaceEnumType, CPPIFACE_SYMBOL);
 			}
+			classBaseType = appendObjectType (kClassTypeObject, classEnumType, OBJECT_SYMBOL);
+		}
+
+		appendGlobalTypeUserTypes();
+
+		// the types are converted in chunks on worker threads and appended in type order
+		const unsigned int chunkTypes = 256;
+		int chunks = (globalTypeHeader->cTypes + chunkTypes - 1) / chunkTypes;
+		int slots = threads > 1 ? 2 * threads : 1;
+		std::vector<std::vector<unsigned char> > converted(slots);
+		std::vector<int> convertedBytes(slots);
+		auto convert = [&](int chunk, int slot) -> bool
+		{
+			std::vector<unsigned char>& buf = converted[slot];
+			size_t oldSize = buf.size();
+			int cb = 0;
+			unsigned int end = (chunk + 1) * chunkTypes;
+			if (end > globalTypeHeader->cTypes)
+				end = globalTypeHeader->cTypes;
+			for (unsigned int t = chunk * chunkTypes; t < end && !hadError(); t++)
+			{
+				int len = ((codeview_type*)(typeData + offset[t]))->generic.len + 2;
+				if (buf.size() < (size_t) cb + len + 1000)
+					buf.resize(cb + len + 1000 + buf.size() / 2);
+				cb += convertGlobalType(t, (codeview_type*) (buf.data() + cb), buf.size() - cb);
+			}
+			if (buf.size() != oldSize)
+				memTrack(kMemGlobalTypes, oldSize, buf.size());
+			convertedBytes[slot] = cb;
+			return !hadError();
+		};
+		auto append = [&](int chunk, int slot) -> bool
+		{
+			checkGlobalTypeAlloc(convertedBytes[slot]);
+			memcpy(globalTypes + cbGlobalTypes, converted[slot].data(), convertedBytes[slot]);
+			cbGlobalTypes += convertedBytes[slot];
+			return true;
+		};
+		prepareTypeProperties();
+		typePropsReadOnly = threads > 1;
+		bool rc = runOrdered(chunks, threads, slots, convert, append);
+		typePropsReadOnly = false;
+		for (int s = 0; s < slots; s++)
+			memTrack(kMemGlobalTypes, converted[s].size(), 0);
+		if (!rc)
+			return false;
 
-#if 0
-			if(Dversion > 0)
-				appendObjectType (object_derived_type, 0, OBJECT_SYMBOL);
-#endif
 #if 1
-			checkGlobalTypeAlloc(cbUserTypes);
+		checkGlobalTypeAlloc(cbUserTypes);
 
-			memcpy (globalTypes + cbGlobalTypes, userTypes, cbUserTypes);
-			cbGlobalTypes += cbUserTypes;
+		memcpy (globalTypes + cbGlobalTypes, userTypes, cbUserTypes);
+		cbGlobalTypes += cbUserTypes;
 #endif
-			if(addClassTypeEnum)
-				insertClassTypeEnums();
-		}
+		if(addClassTypeEnum)
+			insertClassTypeEnums();
 	}
 	return !hadError();
 }
@@ -2359,7 +2778,24 @@ bool CV2PDB::initGlobalTypes()
 bool CV2PDB::hasClassTypeEnum(const codeview_type* fieldlist)
 {
 	const codeview_reftype* rfieldlist = (const codeview_reftype*) fieldlist;
-	return _doFields(kCmdHasClassTypeEnum, 0, rfieldlist, 0) != 0;
+	std::vector<FieldEntry> fields;
+	decodeFields(rfieldlist, fields);
+
+	const BYTE* p = rfieldlist->fieldlist.list;
+	for (size_t f = 0; f < fields.size(); f++)
+	{
+		if (fields[f].kind == LF_NESTTYPE_V3)
+		{
+			if (strcmp((const char*) p + fields[f].name, CLASSTYPEENUM_TYPE) == 0)
+				return true;
+		}
+		else if (fields[f].kind == LF_NESTTYPE_V1 || fields[f].kind == LF_NESTTYPE_V2)
+		{
+			if (p2ccmp(p + fields[f].name, CLASSTYPEENUM_TYPE))
+				return true;
+		}
+	}
+	return false;
 }
 
 int CV2PDB::appendClassTypeEnum(const codeview_type* fieldlist, int type, const char* name)
@@ -2369,15 +2805,7 @@ int CV2PDB::appendClassTypeEnum(const codeview_type* fieldlist, int type, const
 
 	int fieldlen = fieldlist->generic.len + 2;
 	int off = (unsigned char*) fieldlist - globalTypes;
-	checkGlobalTypeAlloc(len);
-
-	int copyoff = off + fieldlen;
-	memmove(globalTypes + copyoff + len, globalTypes + copyoff, cbGlobalTypes - copyoff);
-	memcpy(globalTypes + copyoff, data, len);
-	cbGlobalTypes += len;
-
-	codeview_type* nfieldlist = (codeview_type*) (globalTypes + off);
-	nfieldlist->generic.len = fieldlen + len - 2;
+	addFieldListInsert(fieldlist, off + fieldlen, data, len);
 	return len;
 }
 
@@ -2393,22 +2821,67 @@ int CV2PDB::insertBaseClass(const codeview_type* fieldlist, int type)
 	for (; len & 3; len++)
 		p[len] = 0xf4 - (len & 3);
 
-	int fieldlen = fieldlist->generic.len + 2;
 	int off = (unsigned char*) fieldlist - globalTypes;
-	checkGlobalTypeAlloc(len);
+	addFieldListInsert(fieldlist, off + 4, &cvtype, len);
+	return len;
+}
 
-	int copyoff = off + 4;
-	memmove(globalTypes + copyoff + len, globalTypes + copyoff, cbGlobalTypes - copyoff);
-	memcpy(globalTypes + copyoff, &cvtype, len);
-	cbGlobalTypes += len;
+void CV2PDB::addFieldListInsert(const codeview_type* fieldlist, int pos, const void* data, int len)
+{
+	FieldListInsert ins;
+	ins.pos = pos;
+	ins.fieldlist = (unsigned char*) fieldlist - globalTypes;
+	ins.data = fieldListInsertData.size();
+	ins.len = len;
+	fieldListInserts.push_back(ins);
+	fieldListInsertData.insert(fieldListInsertData.end(), (const unsigned char*) data, (const unsigned char*) data + len);
+}
 
-	codeview_type* nfieldlist = (codeview_type*) (globalTypes + off);
-	nfieldlist->generic.len = fieldlen + len - 2;
-	return len;
+// insert the collected field list entries, moving every byte of globalTypes at most once
+void CV2PDB::applyFieldListInserts()
+{
+	if (fieldListInserts.empty())
+		return;
+
+	// entries inserted at the same position keep the order they were added in
+	std::stable_sort(fieldListInserts.begin(), fieldListInserts.end());
+
+	int total = 0;
+	for (size_t i = 0; i < fieldListInserts.size(); i++)
+	{
+		const FieldListInsert& ins = fieldListInserts[i];
+		codeview_type* fieldlist = (codeview_type*) (globalTypes + ins.fieldlist);
+		fieldlist->generic.len += ins.len;
+		total += ins.len;
+	}
+	checkGlobalTypeAlloc(total);
+
+	// move the data between the insertion points starting at the end, so nothing is overwritten before it is moved
+	int end = cbGlobalTypes;
+	int shift = total;
+	for (size_t i = fieldListInserts.size(); i-- > 0; )
+	{
+		const FieldListInsert& ins = fieldListInserts[i];
+		memmove(globalTypes + ins.pos + shift, globalTypes + ins.pos, end - ins.pos);
+		shift -= ins.len;
+		memcpy(globalTypes + ins.pos + shift, &fieldListInsertData[ins.data], ins.len);
+		end = ins.pos;
+	}
+	cbGlobalTypes += total;
+
+	fieldListInserts.clear();
+	fieldListInsertData.clear();
+	invalidateTypeProperties(kTypeBaseClass | kTypeBaseClasses | kTypeObject);
 }
 
 bool CV2PDB::insertClassTypeEnums()
 {
+	// the field lists are only extended after the scan, so the offsets of the types stay valid until then
+	convertedTypeOffsets.clear();
+	for (int pos = 4; pos < cbGlobalTypes; pos += ((codeview_type*)(globalTypes + pos))->generic.len + 2)
+		convertedTypeOffsets.push_back(pos);
+	std::vector<bool> extended(convertedTypeOffsets.size()); // field lists already getting a class type enum
+
 	int pos = 4; // skip prefix
 	for (unsigned int t = 0; pos < cbGlobalTypes && t < globalTypeHeader->cTypes; t++)
 	{
@@ -2423,8 +2896,10 @@ bool CV2PDB::insertClassTypeEnums()
 		case LF_CLASS_V2:
 			if(const codeview_type* fieldlist = getConvertedTypeData(type->struct_v2.fieldlist))
 			{
-				if(!hasClassTypeEnum(fieldlist))
+				int fl = type->struct_v2.fieldlist - 0x1000;
+				if(!extended[fl] && !hasClassTypeEnum(fieldlist))
 				{
+					extended[fl] = true;
 					int enumtype = 0;
 					int basetype = 0;
 					const char* name;
@@ -2435,13 +2910,13 @@ bool CV2PDB::insertClassTypeEnums()
 						basetype = structBaseType;
 						name = "__StructType";
 					}
-					else if(derivesFromObject(type))
+					else if(derivesFromObject(t + 0x1000))
 					{
 						enumtype = classEnumType;
 						basetype = classBaseType;
 						name = "__ClassType";
 					}
-					else if(isCppInterface(type))
+					else if(isCppInterface(t + 0x1000))
 					{
 						enumtype = cppIfaceEnumType;
 						basetype = cppIfaceBaseType;
@@ -2453,24 +2928,15 @@ bool CV2PDB::insertClassTypeEnums()
 						basetype = ifaceBaseType;
 						name = "__IfaceType";
 					}
-					if(basetype && !getBaseClass(type))
+					if(basetype && !getBaseClass(t + 0x1000))
 					{
 						type->struct_v2.n_element++;
-						// appending can realloc globalTypes, changing its address!
-						int flpos = (unsigned char*) fieldlist - globalTypes;
-						int len = insertBaseClass(fieldlist, basetype);
-						if(fieldlist < type)
-							pos += len;
-						type = (codeview_type*)(globalTypes + pos);
-						fieldlist = (codeview_type*)(globalTypes + flpos);
+						insertBaseClass(fieldlist, basetype);
 					}
 					if(enumtype)
 					{
 						type->struct_v2.n_element++;
-						// appending can realloc globalTypes, changing its address!
-						int len = appendClassTypeEnum(fieldlist, enumtype, name);
-						if(fieldlist < type)
-							pos += len;
+						appendClassTypeEnum(fieldlist, enumtype, name);
 					}
 				}
 			}
@@ -2478,35 +2944,39 @@ bool CV2PDB::insertClassTypeEnums()
 		}
 		pos += typelen;
 	}
+
+	convertedTypeOffsets.clear();
+	applyFieldListInserts();
 	return true;
 }
 
 bool CV2PDB::addTypes()
 {
+	TraceSpan span("addTypes");
 	if (!globalTypes)
 		return true;
 
 	if (useGlobalMod)
 	{
+		TraceSpan span("AddTypes");
 		int rc = globalMod()->AddTypes(globalTypes, cbGlobalTypes);
 		if (rc <= 0)
 			return setError("cannot add type info to module");
 		return true;
 	}
 
-	for (int m = 0; m < countEntries; m++)
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstSrcModule);
+	for (size_t e = 0; e < entries.size(); e++)
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if(entry->SubSection == sstSrcModule)
-		{
-			mspdb::Mod* mod = modules[entry->iMod];
-			if (!mod)
-				return setError("sstSrcModule for non-existing module");
+		OMFDirEntry* entry = entries[e];
+		mspdb::Mod* mod = modules[entry->iMod];
+		if (!mod)
+			return setError("sstSrcModule for non-existing module");
 
-			int rc = mod->AddTypes(globalTypes, cbGlobalTypes);
-			if (rc <= 0)
-				return setError("cannot add type info to module");
-		}
+		TraceSpan span("AddTypes");
+		int rc = mod->AddTypes(globalTypes, cbGlobalTypes);
+		if (rc <= 0)
+			return setError("cannot add type info to module");
 	}
 	return true;
 }
@@ -2538,61 +3008,62 @@ bool CV2PDB::createSrcLineBitmap()
 	for (int s = 0; s < segMap->cSeg; s++)
 	{
 		// cbSeg=-1 found in binary created by Metroworks CodeWarrior, so avoid new char[(size_t)-1]
-		if (segMapDesc[s].cbSeg <= LONG_MAX)
+		if (segMapDesc[s].cbSeg <= INT_MAX)
 		{
 			srcLineStart[s] = new char[segMapDesc[s].cbSeg];
 			memset(srcLineStart[s], 0, segMapDesc[s].cbSeg);
 		}
 	}
 
-	for (int m = 0; m < countEntries; m++)
+	// mark the beginning of each line
+	const std::vector<OMFDirEntry*>& srcModules = getCVEntries(sstSrcModule);
+	for (size_t e = 0; e < srcModules.size(); e++)
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if(entry->SubSection == sstSrcModule)
+		OMFDirEntry* entry = srcModules[e];
+		OMFSourceModule* sourceModule = img.CVP<OMFSourceModule>(entry->lfo);
+		int* segStartEnd = img.CVP<int>(entry->lfo + 4 + 4 * sourceModule->cFile);
+		short* seg = img.CVP<short>(entry->lfo + 4 + 4 * sourceModule->cFile + 8 * sourceModule->cSeg);
+
+		for (int f = 0; f < sourceModule->cFile; f++)
 		{
-			// mark the beginning of each line
-			OMFSourceModule* sourceModule = img.CVP<OMFSourceModule>(entry->lfo);
-			int* segStartEnd = img.CVP<int>(entry->lfo + 4 + 4 * sourceModule->cFile);
-			short* seg = img.CVP<short>(entry->lfo + 4 + 4 * sourceModule->cFile + 8 * sourceModule->cSeg);
+			int cvoff = entry->lfo + sourceModule->baseSrcFile[f];
+			OMFSourceFile* sourceFile = img.CVP<OMFSourceFile> (cvoff);
+			int* lnSegStartEnd = img.CVP<int>(cvoff + 4 + 4 * sourceFile->cSeg);
 
-			for (int f = 0; f < sourceModule->cFile; f++)
+			for (int s = 0; s < sourceFile->cSeg; s++)
 			{
-				int cvoff = entry->lfo + sourceModule->baseSrcFile[f];
-				OMFSourceFile* sourceFile = img.CVP<OMFSourceFile> (cvoff);
-				int* lnSegStartEnd = img.CVP<int>(cvoff + 4 + 4 * sourceFile->cSeg);
+				int lnoff = entry->lfo + sourceFile->baseSrcLn[s];
+				OMFSourceLine* sourceLine = img.CVP<OMFSourceLine> (lnoff);
+				short* lineNo = img.CVP<short> (lnoff + 4 + 4 * sourceLine->cLnOff);
 
-				for (int s = 0; s < sourceFile->cSeg; s++)
-				{
-					int lnoff = entry->lfo + sourceFile->baseSrcLn[s];
-					OMFSourceLine* sourceLine = img.CVP<OMFSourceLine> (lnoff);
-					short* lineNo = img.CVP<short> (lnoff + 4 + 4 * sourceLine->cLnOff);
+				int cnt = sourceLine->cLnOff;
+				int segIndex = segFrame2Index[sourceLine->Seg];
 
-					int cnt = sourceLine->cLnOff;
-					int segIndex = segFrame2Index[sourceLine->Seg];
+				 // also mark the start of the line info segment
+				if (!markSrcLineInBitmap(segIndex, lnSegStartEnd[2*s]))
+					return false;
 
-					 // also mark the start of the line info segment
-					if (!markSrcLineInBitmap(segIndex, lnSegStartEnd[2*s]))
+				for (int ln = 0; ln < cnt; ln++)
+					if (!markSrcLineInBitmap(segIndex, sourceLine->offset[ln]))
 						return false;
-
-					for (int ln = 0; ln < cnt; ln++)
-						if (!markSrcLineInBitmap(segIndex, sourceLine->offset[ln]))
-							return false;
-				}
 			}
 		}
-		if (entry->SubSection == sstModule)
-		{
-			// mark the beginning of each section
-			OMFModule* module   = img.CVP<OMFModule>(entry->lfo);
-			OMFSegDesc* segDesc = img.CVP<OMFSegDesc>(entry->lfo + sizeof(OMFModule));
+	}
 
-			for (int s = 0; s < module->cSeg; s++)
-			{
-				int seg = segDesc[s].Seg;
-				int segIndex = seg >= 0 && seg < segMap->cSeg ? segFrame2Index[seg] : -1;
-				if (!markSrcLineInBitmap(segIndex, segDesc[s].Off))
-					return false;
-			}
+	// mark the beginning of each section
+	const std::vector<OMFDirEntry*>& moduleEntries = getCVEntries(sstModule);
+	for (size_t e = 0; e < moduleEntries.size(); e++)
+	{
+		OMFDirEntry* entry = moduleEntries[e];
+		OMFModule* module   = img.CVP<OMFModule>(entry->lfo);
+		OMFSegDesc* segDesc = img.CVP<OMFSegDesc>(entry->lfo + sizeof(OMFModule));
+
+		for (int s = 0; s < module->cSeg; s++)
+		{
+			int seg = segDesc[s].Seg;
+			int segIndex = seg >= 0 && seg < segMap->cSeg ? segFrame2Index[seg] : -1;
+			if (!markSrcLineInBitmap(segIndex, segDesc[s].Off))
+				return false;
 		}
 	}
 
@@ -2609,7 +3080,7 @@ int CV2PDB::getNextSrcLine(int seg, unsigned int off)
 		return -1;
 
 	off -= segMapDesc[s].offset;
-	if (off < 0 || off >= segMapDesc[s].cbSeg || off > LONG_MAX)
+	if (off < 0 || off >= segMapDesc[s].cbSeg || off > INT_MAX)
 		return 0;
 
 	for (off++; off < segMapDesc[s].cbSeg; off++)
@@ -2621,98 +3092,139 @@ int CV2PDB::getNextSrcLine(int seg, unsigned int off)
 
 bool CV2PDB::addSrcLines()
 {
-	for (int m = 0; m < countEntries; m++)
+	TraceSpan span("addSrcLines");
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstSrcModule);
+
+	// line segments of a module, the line numbers of all segments are kept in one array per slot
+	struct LineSegment
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if(entry->SubSection == sstSrcModule)
+		const BYTE* pname;
+		int seg;
+		int segoff;
+		int seglength;
+		int firstLine;
+		size_t firstEntry;
+		int cnt;
+	};
+	int slots = threads > 1 ? 2 * threads : 1;
+	std::vector<std::vector<LineSegment> > segments(slots);
+	std::vector<std::vector<mspdb::LineInfoEntry> > lineInfos(slots);
+
+	createSrcLineBitmap(); // built on first use by getNextSrcLine, not thread safe
+
+	// the line tables are built on worker threads, but added to the PDB in module order
+	auto build = [&](int e, int slot) -> bool
+	{
+		OMFDirEntry* entry = entries[e];
+		std::vector<LineSegment>& segs = segments[slot];
+		std::vector<mspdb::LineInfoEntry>& lineInfo = lineInfos[slot];
+		size_t oldCapacity = lineInfo.capacity();
+		segs.clear();
+		lineInfo.clear();
+
+		OMFSourceModule* sourceModule = img.CVP<OMFSourceModule>(entry->lfo);
+		int* segStartEnd = img.CVP<int>(entry->lfo + 4 + 4 * sourceModule->cFile);
+		short* seg = img.CVP<short>(entry->lfo + 4 + 4 * sourceModule->cFile + 8 * sourceModule->cSeg);
+
+		for (int f = 0; f < sourceModule->cFile; f++)
 		{
-			mspdb::Mod* mod = useGlobalMod ? globalMod() : modules[entry->iMod];
-			if (!mod)
-				return setError("sstSrcModule for non-existing module");
-
-			OMFSourceModule* sourceModule = img.CVP<OMFSourceModule>(entry->lfo);
-			int* segStartEnd = img.CVP<int>(entry->lfo + 4 + 4 * sourceModule->cFile);
-			short* seg = img.CVP<short>(entry->lfo + 4 + 4 * sourceModule->cFile + 8 * sourceModule->cSeg);
+			int cvoff = entry->lfo + sourceModule->baseSrcFile[f];
+			OMFSourceFile* sourceFile = img.CVP<OMFSourceFile> (cvoff);
+			int* lnSegStartEnd = img.CVP<int>(cvoff + 4 + 4 * sourceFile->cSeg);
+			BYTE* pname = (BYTE*)(lnSegStartEnd + 2 * sourceFile->cSeg);
 
-			for (int f = 0; f < sourceModule->cFile; f++)
+			for (int s = 0; s < sourceFile->cSeg; s++)
 			{
-				int cvoff = entry->lfo + sourceModule->baseSrcFile[f];
-				OMFSourceFile* sourceFile = img.CVP<OMFSourceFile> (cvoff);
-				int* lnSegStartEnd = img.CVP<int>(cvoff + 4 + 4 * sourceFile->cSeg);
-				BYTE* pname = (BYTE*)(lnSegStartEnd + 2 * sourceFile->cSeg);
-				char* name = p2c (pname);
+				int lnoff = entry->lfo + sourceFile->baseSrcLn[s];
+				OMFSourceLine* sourceLine = img.CVP<OMFSourceLine> (lnoff);
+				unsigned short* lineNo = img.CVP<unsigned short> (lnoff + 4 + 4 * sourceLine->cLnOff);
 
-				for (int s = 0; s < sourceFile->cSeg; s++)
+				int seg = sourceLine->Seg;
+				int cnt = sourceLine->cLnOff;
+				if(cnt <= 0)
+					continue;
+				int segoff = lnSegStartEnd[2*s];
+				// lnSegStartEnd[2*s + 1] only spans until the first byte of the last source line
+				int segend = getNextSrcLine(seg, sourceLine->offset[cnt-1]);
+				int seglength = (segend >= 0 ? segend - 1 - segoff : lnSegStartEnd[2*s + 1] - segoff);
+
+				LineSegment segment = { pname, seg, segoff, seglength, lineNo[0], lineInfo.size(), cnt };
+				segs.push_back(segment);
+				for (int ln = 0; ln < cnt; ln++)
 				{
-					int lnoff = entry->lfo + sourceFile->baseSrcLn[s];
-					OMFSourceLine* sourceLine = img.CVP<OMFSourceLine> (lnoff);
-					unsigned short* lineNo = img.CVP<unsigned short> (lnoff + 4 + 4 * sourceLine->cLnOff);
-
-					int seg = sourceLine->Seg;
-					int cnt = sourceLine->cLnOff;
-					if(cnt <= 0)
-						continue;
-					int segoff = lnSegStartEnd[2*s];
-					// lnSegStartEnd[2*s + 1] only spans until the first byte of the last source line
-					int segend = getNextSrcLine(seg, sourceLine->offset[cnt-1]);
-					int seglength = (segend >= 0 ? segend - 1 - segoff : lnSegStartEnd[2*s + 1] - segoff);
-
-					mspdb::LineInfoEntry* lineInfo = new mspdb::LineInfoEntry[cnt];
-					for (int ln = 0; ln < cnt; ln++)
-					{
-						lineInfo[ln].offset = sourceLine->offset[ln] - segoff;
-						lineInfo[ln].line = lineNo[ln] - lineNo[0];
-					}
-					int rc = mod->AddLines(name, seg, segoff, seglength, segoff, lineNo[0],
-					                       (unsigned char*) lineInfo, cnt * sizeof(*lineInfo));
-					if (rc <= 0)
-						return setError("cannot add line number info to module");
-					delete [] lineInfo;
+					mspdb::LineInfoEntry info;
+					info.offset = sourceLine->offset[ln] - segoff;
+					info.line = lineNo[ln] - lineNo[0];
+					lineInfo.push_back(info);
 				}
 			}
 		}
-	}
-	return true;
+		if (lineInfo.capacity() != oldCapacity)
+			memTrack(kMemLineInfo, oldCapacity * sizeof(mspdb::LineInfoEntry), lineInfo.capacity() * sizeof(mspdb::LineInfoEntry));
+		return true;
+	};
+	auto add = [&](int e, int slot) -> bool
+	{
+		mspdb::Mod* mod = useGlobalMod ? globalMod() : modules[entries[e]->iMod];
+		if (!mod)
+			return setError("sstSrcModule for non-existing module");
+
+		const std::vector<LineSegment>& segs = segments[slot];
+		for (size_t s = 0; s < segs.size(); s++)
+		{
+			char* name = p2c (segs[s].pname);
+			TraceSpan span("AddLines", name);
+			int rc = mod->AddLines(name, segs[s].seg, segs[s].segoff, segs[s].seglength, segs[s].segoff, segs[s].firstLine,
+			                       (unsigned char*) &lineInfos[slot][segs[s].firstEntry], segs[s].cnt * sizeof(mspdb::LineInfoEntry));
+			if (rc <= 0)
+				return setError("cannot add line number info to module");
+		}
+		return true;
+	};
+	bool rc = runOrdered((int) entries.size(), threads, slots, build, add);
+
+	for (int s = 0; s < slots; s++)
+		memTrack(kMemLineInfo, lineInfos[s].capacity() * sizeof(mspdb::LineInfoEntry), 0);
+	return rc;
 }
 
 bool CV2PDB::addPublics()
 {
-	for (int m = 0; m < countEntries; m++)
+	TraceSpan span("addPublics");
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstGlobalPub);
+	for (size_t e = 0; e < entries.size(); e++)
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if(entry->SubSection == sstGlobalPub)
+		OMFDirEntry* entry = entries[e];
+		mspdb::Mod* mod = 0;
+		if (entry->iMod < countEntries)
+			mod = useGlobalMod ? globalMod() : modules[entry->iMod];
+
+		OMFSymHash* header = img.CVP<OMFSymHash>(entry->lfo);
+		BYTE* symbols = img.CVP<BYTE>(entry->lfo + sizeof(OMFSymHash));
+		int length;
+		for (unsigned int i = 0; i < header->cbSymbol; i += length)
 		{
-			mspdb::Mod* mod = 0;
-			if (entry->iMod < countEntries)
-				mod = useGlobalMod ? globalMod() : modules[entry->iMod];
-
-			OMFSymHash* header = img.CVP<OMFSymHash>(entry->lfo);
-			BYTE* symbols = img.CVP<BYTE>(entry->lfo + sizeof(OMFSymHash));
-			int length;
-			for (unsigned int i = 0; i < header->cbSymbol; i += length)
-			{
-				union codeview_symbol* sym = (union codeview_symbol*)(symbols + i);
-				length = sym->generic.len + 2;
-				if (!sym->generic.id || length < 4)
-					break;
+			union codeview_symbol* sym = (union codeview_symbol*)(symbols + i);
+			length = sym->generic.len + 2;
+			if (!sym->generic.id || length < 4)
+				break;
 
-				int rc;
-				switch (sym->generic.id)
-				{
-				case S_GDATA_V1:
-				case S_LDATA_V1:
-				case S_PUB_V1:
-					char symname[kMaxNameLen];
-					dsym2c((BYTE*)sym->data_v1.p_name.name, sym->data_v1.p_name.namelen, symname, sizeof(symname));
-					int type = translateType(sym->data_v1.symtype);
-					if (mod)
-						rc = mod->AddPublic2(symname, sym->data_v1.segment, sym->data_v1.offset, type);
-					else
-						rc = dbi->AddPublic2(symname, sym->data_v1.segment, sym->data_v1.offset, type);
-					if (rc <= 0)
-						return setError("cannot add public");
-					break;
-				}
+			int rc;
+			switch (sym->generic.id)
+			{
+			case S_GDATA_V1:
+			case S_LDATA_V1:
+			case S_PUB_V1:
+				char symname[kMaxNameLen];
+				dsym2c((BYTE*)sym->data_v1.p_name.name, sym->data_v1.p_name.namelen, symname, sizeof(symname));
+				int type = translateType(sym->data_v1.symtype);
+				if (mod)
+					rc = mod->AddPublic2(symname, sym->data_v1.segment, sym->data_v1.offset, type);
+				else
+					rc = dbi->AddPublic2(symname, sym->data_v1.segment, sym->data_v1.offset, type);
+				if (rc <= 0)
+					return setError("cannot add public");
+				break;
 			}
 		}
 	}
@@ -2721,23 +3233,22 @@ bool CV2PDB::addPublics()
 
 bool CV2PDB::initGlobalSymbols()
 {
-	for (int m = 0; m < countEntries; m++)
+	TraceSpan span("initGlobalSymbols");
+	const std::vector<OMFDirEntry*>& globalEntries = getCVEntries(sstGlobalSym);
+	if (!globalEntries.empty())
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		if (entry->SubSection == sstGlobalSym)
-		{
-			BYTE* symbols = img.CVP<BYTE>(entry->lfo);
-			OMFSymHash* header = (OMFSymHash*) symbols;
-			globalSymbols = symbols + sizeof(OMFSymHash);
-			cbGlobalSymbols = header->cbSymbol;
-		}
-		if (entry->SubSection == sstStaticSym)
-		{
-			BYTE* symbols = img.CVP<BYTE>(entry->lfo);
-			OMFSymHash* header = (OMFSymHash*) symbols;
-			staticSymbols = symbols + sizeof(OMFSymHash);
-			cbStaticSymbols = header->cbSymbol;
-		}
+		BYTE* symbols = img.CVP<BYTE>(globalEntries.back()->lfo);
+		OMFSymHash* header = (OMFSymHash*) symbols;
+		globalSymbols = symbols + sizeof(OMFSymHash);
+		cbGlobalSymbols = header->cbSymbol;
+	}
+	const std::vector<OMFDirEntry*>& staticEntries = getCVEntries(sstStaticSym);
+	if (!staticEntries.empty())
+	{
+		BYTE* symbols = img.CVP<BYTE>(staticEntries.back()->lfo);
+		OMFSymHash* header = (OMFSymHash*) symbols;
+		staticSymbols = symbols + sizeof(OMFSymHash);
+		cbStaticSymbols = header->cbSymbol;
 	}
 	return true;
 }
@@ -2763,9 +3274,7 @@ int CV2PDB::copySymbols(BYTE* srcSymbols, int srcSize, BYTE* destSymbols, int de
 		{
 		case S_UDT_V1:
 			dsym->udt_v1.type = translateType(sym->udt_v1.type);
-			for(int p = 0; p < dsym->udt_v1.p_name.namelen; p++)
-				if(dsym->udt_v1.p_name.name[p] == '.')
-					dsym->udt_v1.p_name.name[p] = '@';
+			dotcpy(dsym->udt_v1.p_name.name, sym->udt_v1.p_name.name, sym->udt_v1.p_name.namelen, '@');
 			//sym->udt_v1.type = 0x101e;
 			break;
 
@@ -3003,6 +3512,7 @@ void CV2PDB::checkUdtSymbolAlloc(int size, int add)
 {
 	if (cbUdtSymbols + size > allocUdtSymbols)
 	{
+		memTrack(kMemUdtSymbols, allocUdtSymbols, allocUdtSymbols + size + add);
 		allocUdtSymbols += size + add;
 		udtSymbols = (BYTE*) realloc(udtSymbols, allocUdtSymbols);
 	}
@@ -3029,11 +3539,13 @@ bool CV2PDB::addSymbols(mspdb::Mod* mod, BYTE* symbols, int cb, bool addGlobals)
 	int prefix = 4; // mod == globmod ? 3 : 4;
 	int words = (cb + cbGlobalSymbols + cbStaticSymbols + cbUdtSymbols + 3) / 4 + prefix;
 	DWORD* data = new DWORD[2 * words + 1000];
+	memTrack(kMemSymbols, 0, (2 * words + 1000) * sizeof(DWORD));
 
 	int databytes = copySymbols(symbols, cb, (BYTE*) (data + prefix), 0);
 
 	bool rc = writeSymbols(mod, data, databytes, prefix, addGlobals);
 	delete [] data;
+	memTrack(kMemSymbols, (2 * words + 1000) * sizeof(DWORD), 0);
 	return rc;
 }
 
@@ -3051,6 +3563,7 @@ bool CV2PDB::writeSymbols(mspdb::Mod* mod, DWORD* data, int databytes, int prefi
 	data[2] = databytes + 4 * (prefix - 3);
 	if (prefix > 3)
 		data[3] = 1;
+	TraceSpan span("AddSymbols");
 	int rc = mod->AddSymbols((BYTE*) data, ((databytes + 3) / 4 + prefix) * 4);
 	if (rc <= 0)
 		return setError(
@@ -3062,7 +3575,8 @@ bool CV2PDB::writeSymbols(mspdb::Mod* mod, DWORD* data, int databytes, int prefi
 	return true;
 }
 
-bool CV2PDB::addSymbols(int iMod, BYTE* symbols, int cb, bool addGlobals)
+// symbols already converted by copySymbols
+bool CV2PDB::addConvertedSymbols(int iMod, const BYTE* symbols, int databytes, bool addGlobals)
 {
 	mspdb::Mod* mod = 0;
 	if (iMod < countEntries)
@@ -3074,49 +3588,92 @@ bool CV2PDB::addSymbols(int iMod, BYTE* symbols, int cb, bool addGlobals)
 	if (!mod)
 		return setError("no module to set symbols");
 
-	return addSymbols(mod, symbols, cb, addGlobals);
+	int prefix = 4;
+	int words = (databytes + cbGlobalSymbols + cbStaticSymbols + cbUdtSymbols + 3) / 4 + prefix;
+	DWORD* data = new DWORD[2 * words + 1000];
+	memTrack(kMemSymbols, 0, (2 * words + 1000) * sizeof(DWORD));
+	memcpy(data + prefix, symbols, databytes);
+
+	bool rc = writeSymbols(mod, data, databytes, prefix, addGlobals);
+	delete [] data;
+	memTrack(kMemSymbols, (2 * words + 1000) * sizeof(DWORD), 0);
+	return rc;
+}
+
+bool CV2PDB::convertSymbols(const std::function<bool(int e, const BYTE* symbols, int databytes)>& submit)
+{
+	// sstStaticSym and sstGlobalSym are handled in initGlobalSymbols
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstAlignSym);
+
+	// the modules are converted on worker threads, the results are added to the PDB
+	// in module order, so the output does not depend on the number of threads
+	int slots = threads > 1 ? 2 * threads : 1;
+	std::vector<std::vector<DWORD> > converted(slots);
+	std::vector<int> convertedBytes(slots);
+	auto convert = [&](int e, int slot) -> bool
+	{
+		TraceSpan span("copySymbols");
+		OMFDirEntry* entry = entries[e];
+		BYTE* symbols = img.CVP<BYTE>(entry->lfo);
+		size_t size = 2 * entry->cb + 1000;
+		if (converted[slot].size() < size)
+		{
+			memTrack(kMemSymbols, converted[slot].size() * sizeof(DWORD), size * sizeof(DWORD));
+			converted[slot].resize(size);
+		}
+		convertedBytes[slot] = copySymbols(symbols + 4, entry->cb - 4, (BYTE*) converted[slot].data(), 0);
+		return true;
+	};
+	auto consume = [&](int e, int slot) -> bool
+	{
+		return submit(e, (const BYTE*) converted[slot].data(), convertedBytes[slot]);
+	};
+	prepareTypeProperties();
+	typePropsReadOnly = threads > 1;
+	bool rc = runOrdered((int) entries.size(), threads, slots, convert, consume);
+	typePropsReadOnly = false;
+
+	for (int s = 0; s < slots; s++)
+		memTrack(kMemSymbols, converted[s].size() * sizeof(DWORD), 0);
+	return rc;
 }
 
 bool CV2PDB::addSymbols()
 {
+	TraceSpan span("addSymbols");
 	int prefix = 4;
 	DWORD* data = 0;
 	int databytes = 0;
+	size_t dataSize = 0;
 	if (useGlobalMod)
+	{
 		data = new DWORD[2 * img.getCVSize() + 1000]; // enough for all symbols
+		dataSize = (2 * img.getCVSize() + 1000) * sizeof(DWORD);
+		memTrack(kMemSymbols, 0, dataSize);
+	}
 
-	bool addGlobals = true;
-	for (int m = 0; m < countEntries; m++)
+	const std::vector<OMFDirEntry*>& entries = getCVEntries(sstAlignSym);
+	bool rc = convertSymbols([&](int e, const BYTE* symbols, int cb) -> bool
 	{
-		OMFDirEntry* entry = img.getCVEntry(m);
-		mspdb::Mod* mod = 0;
-		BYTE* symbols = img.CVP<BYTE>(entry->lfo);
-
-		switch(entry->SubSection)
+		if (useGlobalMod)
 		{
-		case sstAlignSym:
-			if (useGlobalMod)
-				databytes = copySymbols(symbols + 4, entry->cb - 4, (BYTE*) (data + prefix), databytes);
-			else if (!addSymbols (entry->iMod, symbols + 4, entry->cb - 4, addGlobals))
-				return false;
-			addGlobals = false;
-			break;
-
-		case sstStaticSym:
-		case sstGlobalSym:
-			break; // handled in initGlobalSymbols
+			memcpy((BYTE*) (data + prefix) + databytes, symbols, cb);
+			databytes += cb;
+			return true;
 		}
-	}
-	bool rc = true;
-	if (useGlobalMod)
+		return addConvertedSymbols(entries[e]->iMod, symbols, cb, e == 0);
+	});
+	if (rc && useGlobalMod)
 		rc = writeSymbols (globalMod(), data, databytes, prefix, true);
 
 	delete [] data;
+	memTrack(kMemSymbols, dataSize, 0);
 	return rc;
 }
 
-bool CV2PDB::writeImage(const TCHAR* opath)
+bool CV2PDB::writeImage(const char* opath)
 {
+	TraceSpan span("writeImage");
 	int len = sizeof(*rsds) + strlen((char*)(rsds + 1)) + 1;
 	if (!img.replaceDebugSection(rsds, len, true))
 		return setError(img.getLastError());
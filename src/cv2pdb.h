@@ -11,9 +11,12 @@
 #include "mspdb.h"
 #include "readDwarf.h"
 
-#include <windows.h>
+#include "pecoff.h"
+#include <stdio.h>
+#include <functional>
 #include <map>
-#include <unordered_map>
+#include <string>
+#include <vector>
 
 extern "C" {
 	#include "mscvpdb.h"
@@ -31,28 +34,41 @@ public:
 	~CV2PDB();
 
 	bool cleanup(bool commit);
-	bool openPDB(const TCHAR* pdbname, const TCHAR* pdbref);
+	// file names are UTF-8
+	bool openPDB(const char* pdbname, const char* pdbref);
 
 	bool setError(const char* msg);
 	bool createModules();
 
 	bool initLibraries();
 	const BYTE* getLibrary(int i);
+
+	// CodeView directory entries bucketed by subsection once, in directory order
+	void indexCVEntries();
+	const std::vector<OMFDirEntry*>& getCVEntries(int subSection) const;
 	bool initSegMap();
 
-	enum
+	// entry of a field list, positions are relative to the start of the field list data
+	struct FieldEntry
 	{
-		kCmdAdd,
-		kCmdCount,
-		kCmdNestedTypes,
-		kCmdOffsetFirstVirtualMethod,
-		kCmdHasClassTypeEnum,
-		kCmdCountBaseClasses
+		int kind;      // leaf id
+		int attribute;
+		int type;      // type of members, base classes, nested types, vtables and friends, method list of methods
+		int type2;     // count of methods, virtual base pointer type of virtual base classes
+		int offset;    // numeric leaf: offset of members and base classes, value of enumerators
+		int pos;       // start of the entry
+		int tail;      // start of the numeric leaf or name following the fixed part of the entry
+		int name;      // start of the name, -1 if there is none
+		int len;       // length without padding
 	};
-	int _doFields(int cmd, codeview_reftype* dfieldlist, const codeview_reftype* fieldlist, int arg);
-	int addFields(codeview_reftype* dfieldlist, const codeview_reftype* fieldlist, int maxdlen);
-	int countFields(const codeview_reftype* fieldlist);
-	int countNestedTypes(const codeview_reftype* fieldlist, int type);
+	bool decodeFields(const codeview_reftype* fieldlist, std::vector<FieldEntry>& fields);
+	bool decodeGlobalFieldLists();
+	const std::vector<FieldEntry>& getFields(int type, std::vector<FieldEntry>& buf);
+	int addFields(codeview_reftype* dfieldlist, const codeview_reftype* fieldlist,
+	              const std::vector<FieldEntry>& fields, int maxdlen);
+	int countNestedTypes(const std::vector<FieldEntry>& fields, int type);
+	int countBaseClasses(const std::vector<FieldEntry>& fields);
+	int offsetFirstVirtualMethod(const std::vector<FieldEntry>& fields);
 
 	int addAggregate(codeview_type* dtype, bool clss, int n_element, int fieldlist, int property,
 	                 int derived, int vshape, int structlen, const char*name);
@@ -86,21 +102,32 @@ public:
 	int createEmptyFieldListType();
 
 	int fixProperty(int type, int prop, int fieldType);
-	bool derivesFromObject(const codeview_type* cvtype);
-	bool isCppInterface(const codeview_type* cvtype);
+	bool derivesFromObject(int type);
+	bool isCppInterface(int type);
 	bool isClassType(int type);
 
 	int sizeofClassType(const codeview_type* cvtype);
 	int sizeofBasicType(int type);
 	int sizeofType(int type);
+	int _sizeofType(int type);
 
 	// to be used when writing new type only to avoid double translation
 	int translateType(int type);
-	int getBaseClass(const codeview_type* cvtype);
-	int countBaseClasses(const codeview_type* cvtype);
+	int _translateType(int type);
+	int getBaseClass(int type);
+	int countBaseClasses(int type);
+
+	// properties of the types remembered by type index, see typeProps
+	struct TypeProperties;
+	TypeProperties* typeProperties(int type, bool write);
+	int findTypeFlag(int type, int prop);
+	void setTypeFlag(int type, int prop, bool set);
+	void invalidateTypeProperties(int props);
+	void prepareTypeProperties();
 
 	bool nameOfBasicType(int type, char* name, int maxlen);
 	bool nameOfType(int type, char* name, int maxlen);
+	bool _nameOfType(int type, char* name, int maxlen);
 	bool nameOfDynamicArray(int indexType, int elemType, char* name, int maxlen);
 	bool nameOfAssocArray(int indexType, int elemType, char* name, int maxlen);
 	bool nameOfDelegate(int thisType, int funcType, char* name, int maxlen);
@@ -110,12 +137,16 @@ public:
 	int numeric_leaf(int* value, const void* leaf);
 	int copy_leaf(unsigned char* dp, int& dpos, const unsigned char* p, int& pos);
 
-	const char* appendDynamicArray(int indexType, int elemType);
+	const char* appendDynamicArray(int indexType, int elemType, int* ptype = 0);
 	const char* appendAssocArray(int keyType, int elemType);
 	const char* appendDelegate(int thisType, int funcType);
 	int  appendObjectType (int object_derived_type, int enumType, const char* classSymbol);
 	int  appendPointerType(int pointedType, int attr);
-	int  appendModifierType(int type, int attr);
+	// shared = false for typedefs, they need a type of their own to find the name by the UDT symbol
+	int  appendModifierType(int type, int attr, bool shared = true);
+	// returns the type index of a type appended before or 0, its name is copied to name if not 0
+	int  findAppendedType(int kind, int type1, int type2, char* name = 0);
+	void addAppendedType(int kind, int type1, int type2, int type, const char* name = "");
 	int  appendTypedef(int type, const char* name, bool saveTranslation = true);
 	int  appendComplex(int cplxtype, int basetype, int elemsize, const char* name);
 	void appendTypedefs();
@@ -130,7 +161,11 @@ public:
 	bool hasClassTypeEnum(const codeview_type* fieldlist);
 	bool insertClassTypeEnums();
 	int  insertBaseClass(const codeview_type* fieldlist, int type);
+	void addFieldListInsert(const codeview_type* fieldlist, int pos, const void* data, int len);
+	void applyFieldListInserts();
 
+	void appendGlobalTypeUserTypes();
+	int  convertGlobalType(unsigned int t, codeview_type* dtype, int maxlen);
 	bool initGlobalTypes();
 	bool initGlobalSymbols();
 
@@ -148,14 +183,16 @@ public:
 
 	bool writeSymbols(mspdb::Mod* mod, DWORD* data, int databytes, int prefix, bool addGlobals);
 	bool addSymbols(mspdb::Mod* mod, BYTE* symbols, int cb, bool addGlobals);
-	bool addSymbols(int iMod, BYTE* symbols, int cb, bool addGlobals);
+	bool addConvertedSymbols(int iMod, const BYTE* symbols, int databytes, bool addGlobals);
+	// converts the symbols of the sstAlignSym entries, submit gets them in entry order
+	bool convertSymbols(const std::function<bool(int e, const BYTE* symbols, int databytes)>& submit);
 	bool addSymbols();
 
 	bool markSrcLineInBitmap(int segIndex, int adr);
 	bool createSrcLineBitmap();
 	int  getNextSrcLine(int seg, unsigned int off);
 
-	bool writeImage(const TCHAR* opath);
+	bool writeImage(const char* opath);
 
 	mspdb::Mod* globalMod();
 
@@ -164,22 +201,43 @@ public:
 	bool addDWARFTypes();
 	bool addDWARFLines();
 	bool addDWARFPublics();
-	bool writeDWARFImage(const TCHAR* opath);
+	// errors are reported to error, so they can run on a worker thread while the PDB thread reports to this
+	bool decodeDWARFLines(LastError& error);
+	bool buildCFIIndex(LastError& error);
+	bool writeDWARFImage(const char* opath);
 
+	mspdb::Mod* openDWARFModule(int unit, const char* name);
 	bool addDWARFSectionContrib(mspdb::Mod* mod, unsigned long pclo, unsigned long pchi);
+	bool addDWARFRanges(mspdb::Mod* mod, DWARF_CompilationUnit* cu, unsigned long ranges, unsigned long base);
+	bool addDWARFARanges();
 	bool addDWARFProc(DWARF_InfoData& id, DWARF_CompilationUnit* cu, DIECursor cursor);
 	int  addDWARFStructure(DWARF_InfoData& id, DWARF_CompilationUnit* cu, DIECursor cursor);
-	int  addDWARFArray(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu, DIECursor cursor);
+	int  addDWARFArray(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu, int die);
 	int  addDWARFBasicType(const char*name, int encoding, int byte_size);
 	int  getTypeByDWARFPtr(DWARF_CompilationUnit* cu, byte* ptr);
-	int  getDWARFTypeSize(DWARF_CompilationUnit* cu, byte* ptr);
-	int  getDWARFArrayBounds(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu, DIECursor cursor, int& upperBound);
-
-	bool mapTypes();
+	void addDWARFTypeFixup(unsigned char* CV2PDB::*buffer, const void* slot);
+	int  resolveDWARFTypeRef(int type);
+	bool fixupDWARFTypes();
+
+	struct SpillFile;
+	SpillFile& getSpillFile(unsigned char* CV2PDB::*buffer);
+	bool spillDWARFBuffer(unsigned char* CV2PDB::*buffer, int CV2PDB::*cb);
+	bool spillDWARFBuffers();
+	bool readSpillFile(SpillFile& spill, unsigned char* dest);
+	bool reloadDWARFBuffer(unsigned char* CV2PDB::*buffer, int CV2PDB::*cb, void (CV2PDB::*checkAlloc)(int, int));
+	int  getDWARFTypeSize(int die);
+	int  getDWARFArrayBounds(int die, int& upperBound);
+
+	// steps of createDWARFModules, initDWARFTypes doesn't need a PDB
+	bool initDWARFTypes();
+	bool addDWARFSections();
+	bool buildDIEIndex();
 	bool createTypes();
 
 // private:
 	BYTE* libraries;
+	std::vector<const BYTE*> libraryNames; // start of each name in libraries
+	std::map<int, std::vector<OMFDirEntry*> > cvEntries; // directory entries by subsection
 
 	PEImage& img;
 
@@ -203,11 +261,85 @@ public:
 	int cbGlobalTypes;
 	int allocGlobalTypes;
 
+	// additions to field lists collected by insertClassTypeEnums,
+	// applied to globalTypes in a single pass by applyFieldListInserts
+	struct FieldListInsert
+	{
+		int pos;       // offset in globalTypes to insert at
+		int fieldlist; // offset of the field list record growing by len
+		int data;      // offset of the inserted bytes in fieldListInsertData
+		int len;
+
+		bool operator<(const FieldListInsert& other) const { return pos < other.pos; }
+	};
+	std::vector<FieldListInsert> fieldListInserts;
+	std::vector<unsigned char> fieldListInsertData;
+	std::vector<int> convertedTypeOffsets; // offsets of the types in globalTypes while its layout is fixed, empty otherwise
+
+	// names of the user types appended for the D OEM types of the global types
+	std::vector<int> oemTypeName; // per global type, offset in oemTypeNames or -1
+	std::vector<char> oemTypeNames;
+
 	unsigned char* userTypes;
 	int* pointerTypes;
 	int cbUserTypes;
 	int allocUserTypes;
 
+	// user types appended for the D types, pointers and modifiers by the translated types they are made of,
+	// so that structurally identical types are only appended once
+	enum AppendedTypeKind { kAppendedPointer, kAppendedModifier, kAppendedDynArray, kAppendedAssocArray, kAppendedDelegate };
+	struct AppendedTypeKey
+	{
+		int kind;
+		int type1;
+		int type2; // or the attributes of pointers and modifiers
+
+		bool operator<(const AppendedTypeKey& other) const
+		{
+			if (kind != other.kind)
+				return kind < other.kind;
+			if (type1 != other.type1)
+				return type1 < other.type1;
+			return type2 < other.type2;
+		}
+	};
+	struct AppendedType
+	{
+		int type;
+		std::string name; // empty for pointers and modifiers
+	};
+	std::map<AppendedTypeKey, AppendedType> appendedTypes;
+
+	// properties of the global and user types computed on first use. Entries are only written
+	// by the calling thread, typePropsReadOnly is set while worker threads read them.
+	enum TypeProperty
+	{
+		kTypeTranslated  = 1 << 0,
+		kTypeSize        = 1 << 1,
+		kTypeName        = 1 << 2,
+		kTypeBaseClass   = 1 << 3,
+		kTypeBaseClasses = 1 << 4,
+		// flags, also set in TypeProperties::flags if true
+		kTypeClass       = 1 << 5,
+		kTypeObject      = 1 << 6,
+		kTypeCppIface    = 1 << 7,
+	};
+	struct TypeProperties
+	{
+		int known; // TypeProperty bits of the properties computed
+		int flags;
+		int translated;
+		int size;
+		int baseClass;
+		int baseClasses;
+		std::string name;
+	};
+	std::vector<TypeProperties> typeProps; // by type index, including the basic types
+	bool typePropsReadOnly;
+
+	std::vector<std::vector<FieldEntry> > globalFieldLists; // by global type, empty if not a field list
+	std::vector<bool> nestedGlobalTypes; // global types used as nested type in a global field list
+
 	unsigned char* globalSymbols;
 	int cbGlobalSymbols;
 
@@ -245,6 +377,7 @@ public:
 	bool addClassTypeEnum;
 	bool addStringViewHelper;
 	bool useGlobalMod;
+	int threads; // used to convert the symbols and line numbers of CodeView modules
 	bool thisIsNotRef;
 	bool v3;
 	bool debug;
@@ -257,7 +390,61 @@ public:
 
 	// DWARF
 	int codeSegOff;
-	std::unordered_map<byte*, int> mapOffsetToType;
+	DIEIndex dieIndex;
+	std::vector<int> dieCVType; // CodeView type per DIE in dieIndex, 0 if not a type
+
+	// type indices written before the referenced type was converted, patched by fixupDWARFTypes
+	struct DWARFTypeFixup
+	{
+		unsigned char* CV2PDB::*buffer;
+		int offset;
+	};
+	std::vector<DWARFTypeFixup> dwarfTypeFixups;
+
+	struct DWARFPublic
+	{
+		const char* name;
+		int seg;
+		unsigned long offset;
+		int type;
+
+		static bool lessName(const DWARFPublic& a, const DWARFPublic& b)
+		{
+			int cmp = strcmp(a.name, b.name);
+			if (cmp != 0)
+				return cmp < 0;
+			return a.seg < b.seg || (a.seg == b.seg && a.offset < b.offset);
+		}
+		static bool sameName(const DWARFPublic& a, const DWARFPublic& b) { return strcmp(a.name, b.name) == 0; }
+		static bool lessAddress(const DWARFPublic& a, const DWARFPublic& b)
+		{
+			return a.seg < b.seg || (a.seg == b.seg && a.offset < b.offset);
+		}
+	};
+	std::vector<DWARFPublic> dwarfPublics; // functions and global variables, added by addDWARFPublics
+
+	// prepared by decodeDWARFLines and buildCFIIndex, possibly concurrently with createDWARFModules
+	std::vector<DWARF_LineBlock> dwarfLineBlocks;
+	bool dwarfLinesDecoded;
+	CFIIndex cfiIndex;
+
+	// unless useGlobalMod, each compilation unit gets a module, modules is indexed like dwarfUnitOffsets
+	std::vector<unsigned long> dwarfUnitOffsets; // offset of the unit in .debug_info
+	std::vector<int> dwarfUnitSymbolEnd;         // end of the unit's symbols in udtSymbols
+	std::vector<bool> dwarfUnitContrib;          // section contribution found in the unit's DIE
+	std::map<unsigned long, int> dwarfLineUnits; // DW_AT_stmt_list -> unit
+
+	// --max-memory: converted records are moved to temporary files after a compilation unit
+	// if the buffers exceed a part of the limit, and read back when passed to the PDB
+	struct SpillFile
+	{
+		FILE* fp;
+		int cb; // bytes in fp, they precede the part of the buffer still in memory
+	};
+	size_t maxMemory; // 0 if not limited
+	SpillFile spillUserTypes;
+	SpillFile spillDwarfTypes;
+	SpillFile spillUdtSymbols;
 };
 
 #endif //__CV2PDB_H__
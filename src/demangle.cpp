@@ -12,171 +12,102 @@
  *	Frits van Bommel
  */
 
-#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
 
 #include "symutil.h"
+#include "demangle.h"
 
-#ifdef _M_X64
+#if defined(_M_X64)
 extern "C" void cvt80to64(void * in, long double * out);
+#elif !defined(_MSC_VER)
+#include <math.h>
+
+// value of an x87 80-bit extended real stored little endian, long double
+// can have any other format on this platform
+static long double cvt80(const unsigned char* p)
+{
+	unsigned long long mantissa = 0;
+	for (int i = 7; i >= 0; i--)
+		mantissa = (mantissa << 8) | p[i];
+	int exp = ((p[9] & 0x7f) << 8) | p[8];
+	long double r;
+	if (exp == 0x7fff)
+		r = (mantissa << 1) ? NAN : INFINITY;
+	else
+		r = ldexpl((long double) mantissa, (exp ? exp : 1) - 16383 - 63);
+	return p[9] & 0x80 ? -r : r;
+}
 #endif
 
-#define USE_STDSTRING 1
+typedef unsigned char ubyte;
+typedef long double real;
 
-#if USE_STDSTRING
-typedef std::string string; //using namespace std;
-#else
-static const int maxLen = 4096;
+#define size_t_max 0x7FFFFFFFU
 
-struct stringpool
+class MangleException
 {
-	stringpool() : _first(0) {}
-
-	char* get()
-	{
-		if(!_first)
-			return new char[maxLen];
-		char* p = _first;
-		_first = *(char**) _first;
-		return p;
-	}
-	void put(char* p)
-	{
-		*(char**)p = _first;
-		_first = p;
-	}
-	
-	char* _first;
+public:
+	virtual ~MangleException() {}
 };
-stringpool pool;
-
-#define string _string // fool debugger to not use visualizers for std::string
 
-struct string
+// output of the demangler, written to a buffer provided by the caller without allocating memory.
+// Parts of the result that are decoded out of order are moved into place by rotating the buffer.
+struct DemangleBuffer
 {
-	string() : _p(0), _len(0), _const(false) { _p = pool.get(); }
-	//string(const char* p) : _cp(p), _len(strlen(p)), _const(true) {}
-	//string(const string& s) : _p(s.p), _len(s._len), _const(true) {}
-	string(const char* p, size_t len) : _cp(p), _len(len), _const(true) {}
-	template<int N> string(const char (&p)[N]) : _cp(p), _len(N-1), _const(true) {}
-	~string() { if(!_const) pool.put(_p); }
-
-	size_t length() const { return _len; }
-
-	char operator[] (size_t idx) const
-	{ 
-		return _p[idx];
-	}
-	string substr(size_t pos, size_t len) const
-	{
-		return string(_p + pos, len);
-	}
+	char* buf;
+	size_t len;
+	size_t cap;
 
-	template<int N> string operator+(const char (&p)[N])
-	{
-		assert(!_const);
-		assert(_len + N-1 < maxLen);
+	DemangleBuffer(char* b, size_t c) : buf(b), len(0), cap(c) {}
 
-		memcpy(_p + _len, p, N-1);
-		return string(_p, _len + N-1);
-	}
-	string operator+(string s)
+	void put(const char* s, size_t n)
 	{
-		assert(!_const);
-		assert(_len + s._len < maxLen);
-
-		memcpy(_p + _len, s._p, s._len);
-		return string(_p, _len + s._len);
+		if (len + n > cap)
+			throw MangleException();
+		memcpy(buf + len, s, n);
+		len += n;
 	}
-	template<int N> string operator+=(const char (&p)[N])
+	void put(const char* s)
 	{
-		assert(!_const);
-		assert(_len + N-1 < maxLen);
-		memcpy(_p + _len, p, N-1);
-		_len += N - 1;
-		return *this;
+		put(s, strlen(s));
 	}
-	string operator+=(const string& s) 
-	{ 
-		assert(!_const);
-		assert(_len + s._len < maxLen);
-		memcpy(_p + _len, s._p, s._len);
-		_len += s._len;
-		return *this;
-	}
-	string operator+=(char c) 
-	{ 
-		assert(!_const);
-		assert(_len < maxLen);
-		_p[_len++] = c;
-		return *this;
-	}
-	template<int N>string operator=(const char (&p)[N]) 
+	void put(char c)
 	{
-		_len = N-1;
-		memcpy(_p, p, _len);
-		_const = true;
-		return *this;
+		put(&c, 1);
 	}
-	string operator=(const string& s) 
+	// append a copy of buf[from..to)
+	void copy(size_t from, size_t to)
 	{
-		assert(!_const);
-		_len = s._len;
-		memcpy(_p, s._p, _len);
-		return *this;
+		put(buf + from, to - from);
 	}
-	bool operator==(const string& s) const
+	// move buf[mid..len) in front of buf[from..mid)
+	void rotate(size_t from, size_t mid)
 	{
-		return _len == s._len && memcmp(_p, s._p, _len) == 0;
+		std::rotate(buf + from, buf + mid, buf + len);
 	}
-
-	const char* c_str()
+	void truncate(size_t pos)
 	{
-		assert(!_const);
-		assert(_len < maxLen);
-		_p[_len] = 0;
-		return _p;
+		len = pos;
 	}
-
-	union
-	{
-		const char* _cp;
-		char* _p;
-	};
-	size_t _len;
-	bool _const;
-};
-
-template<int N> string operator+(const char (&p)[N], string s)
-{
-	assert(!s._const);
-	assert(s._len + N-1 < maxLen);
-	memmove(s._p + N - 1, s._p, s._len);
-	memcpy(s._p, p, N-1);
-	return string(s._p, s._len + N-1);
-}
-#endif
-
-typedef unsigned char ubyte;
-typedef long double real;
-
-#define length length()
-
-#define size_t_max 0x7FFFFFFFU
-
-class MangleException
-{
-public:
-	virtual ~MangleException() {}
 };
 
 class Demangle
 {
 public:
 	size_t ni;
-	string name;
-	
+	const char* name;
+	size_t nameLen;
+	DemangleBuffer out;
+
+	Demangle(char* buf, size_t cap) : ni(0), name(0), nameLen(0), out(buf, cap) {}
+
 	static void error()
 	{
 		//writefln("error()");
@@ -197,7 +128,7 @@ public:
 		//writefln("parseNumber() %d", ni);
 		size_t result = 0;
 
-		while (ni < name.length && isdigit(name[ni]))
+		while (ni < nameLen && isdigit(name[ni]))
 		{
 			int i = name[ni] - '0';
 			if (result > (size_t_max - i) / 10)
@@ -208,13 +139,13 @@ public:
 		return result;
 	}
 
-	string parseSymbolName()
+	void parseSymbolName()
 	{
 		//writefln("parseSymbolName() %d", ni);
 		size_t i = parseNumber();
-		if (ni + i > name.length)
+		if (ni + i > nameLen)
 			error();
-		string result;
+		size_t outsave = out.len;
 		if (i >= 5 &&
 			name[ni] == '_' &&
 			name[ni + 1] == '_' &&
@@ -225,7 +156,7 @@ public:
 			ni += 3;
 			try
 			{
-				result = parseTemplateInstanceName();
+				parseTemplateInstanceName();
 				if (ni != nisave + i)
 					err = true;
 			}
@@ -239,80 +170,92 @@ public:
 			goto L2;
 		}
 	L1:
-		result = name.substr(ni, i);
+		out.truncate(outsave);
+		out.put(name + ni, i);
 	L2:
 		ni += i;
-		return result;
 	}
 
-	string parseQualifiedName()
+	void parseQualifiedName()
 	{
 		//writefln("parseQualifiedName() %d", ni);
-		string result;
+		size_t start = out.len;
 
-		while (ni < name.length && isdigit(name[ni]))
+		while (ni < nameLen && isdigit(name[ni]))
 		{
-			if (result.length)
-				result += ".";
-			result += parseSymbolName();
+			if (out.len > start)
+				out.put('.');
+			parseSymbolName();
 		}
-		return result;
 	}
 
-	string parseType(string identifier = string())
+	// the identifier is out.buf[idFrom..idTo), written before the type
+	void parseType(size_t idFrom = 0, size_t idTo = 0)
 	{
 		//writefln("parseType() %d", ni);
+		bool hasIdentifier = idTo > idFrom;
 		int isdelegate = 0;
 		bool hasthisptr = false; /// For function/delegate types: expects a 'this' pointer as last argument
 	Lagain:
-		if (ni >= name.length)
+		if (ni >= nameLen)
 			error();
-		string p;
+		const char* p;
 		switch (name[ni++])
 		{
-		case 'v':	p = "void";	goto L1;
-		case 'b':	p = "bool";	goto L1;
-		case 'g':	p = "byte";	goto L1;
-		case 'h':	p = "ubyte";	goto L1;
-		case 's':	p = "short";	goto L1;
-		case 't':	p = "ushort";	goto L1;
-		case 'i':	p = "int";	goto L1;
-		case 'k':	p = "uint";	goto L1;
-		case 'l':	p = "long";	goto L1;
-		case 'm':	p = "ulong";	goto L1;
-		case 'f':	p = "float";	goto L1;
-		case 'd':	p = "double";	goto L1;
-		case 'e':	p = "real";	goto L1;
-		case 'o':	p = "ifloat";	goto L1;
-		case 'p':	p = "idouble";	goto L1;
-		case 'j':	p = "ireal";	goto L1;
-		case 'q':	p = "cfloat";	goto L1;
-		case 'r':	p = "cdouble";	goto L1;
-		case 'c':	p = "creal";	goto L1;
-		case 'a':	p = "char";	goto L1;
-		case 'u':	p = "wchar";	goto L1;
-		case 'w':	p = "dchar";	goto L1;
+		case 'v':	p = "void";	goto L0;
+		case 'b':	p = "bool";	goto L0;
+		case 'g':	p = "byte";	goto L0;
+		case 'h':	p = "ubyte";	goto L0;
+		case 's':	p = "short";	goto L0;
+		case 't':	p = "ushort";	goto L0;
+		case 'i':	p = "int";	goto L0;
+		case 'k':	p = "uint";	goto L0;
+		case 'l':	p = "long";	goto L0;
+		case 'm':	p = "ulong";	goto L0;
+		case 'f':	p = "float";	goto L0;
+		case 'd':	p = "double";	goto L0;
+		case 'e':	p = "real";	goto L0;
+		case 'o':	p = "ifloat";	goto L0;
+		case 'p':	p = "idouble";	goto L0;
+		case 'j':	p = "ireal";	goto L0;
+		case 'q':	p = "cfloat";	goto L0;
+		case 'r':	p = "cdouble";	goto L0;
+		case 'c':	p = "creal";	goto L0;
+		case 'a':	p = "char";	goto L0;
+		case 'u':	p = "wchar";	goto L0;
+		case 'w':	p = "dchar";	goto L0;
 
 		case 'A':				// dynamic array
-			p = parseType() + "[]";
+			parseType();
+			out.put("[]");
 			goto L1;
 
 		case 'P':				// pointer
-			p = parseType() + "*";
+			parseType();
+			out.put("*");
 			goto L1;
 
 		case 'G':				// static array
 			{	size_t ns = ni;
 			parseNumber();
 			size_t ne = ni;
-			p = parseType() + "[" + name.substr(ns, ne-ns) + "]";
+			parseType();
+			out.put("[");
+			out.put(name + ns, ne - ns);
+			out.put("]");
 			goto L1;
 			}
 
-		case 'H':				// associative array
-			p = parseType();
-			p = parseType() + "[" + p + "]";
+		case 'H':				// associative array, the value type is mangled before the key type
+			{	size_t value = out.len;
+			parseType();
+			size_t key = out.len;
+			parseType();
+			out.put("[");
+			out.rotate(value, key);
+			out.put("]");
 			goto L1;
+			}
 
 		case 'D':				// delegate
 			isdelegate = 1;
@@ -323,15 +266,21 @@ public:
 			goto Lagain;
 
 		case 'y':
-			p = "immutable(" + parseType() + ")";
+			out.put("immutable(");
+			parseType();
+			out.put(")");
 			goto L1;
 
 		case 'x':
-			p = "const(" + parseType() + ")";
+			out.put("const(");
+			parseType();
+			out.put(")");
 			goto L1;
 
 		case 'O':
-			p = "shared(" + parseType() + ")";
+			out.put("shared(");
+			parseType();
+			out.put(")");
 			goto L1;
 
 		case 'F':				// D function
@@ -341,18 +290,16 @@ public:
 		case 'R':				// C++ function
 			{
 			char mc = name[ni - 1];
-			string args;
-			string prop;
 			while(name[ni] == 'N')
 			{
 				switch(name[ni+1])
 				{
-				case 'a': prop += "pure ";      break;
-				case 'b': prop += "nothrow ";   break;
-				case 'c': prop += "ref ";       break;
-				case 'd': prop += "@property "; break;
-				case 'e': prop += "@trusted ";  break;
-				case 'f': prop += "@safe ";     break;
+				case 'a': out.put("pure ");      break;
+				case 'b': out.put("nothrow ");   break;
+				case 'c': out.put("ref ");       break;
+				case 'd': out.put("@property "); break;
+				case 'e': out.put("@trusted ");  break;
+				case 'f': out.put("@safe ");     break;
 				default:
 					goto no_prop;
 				}
@@ -360,65 +307,75 @@ public:
 			}
 		no_prop:
 
+			// the arguments are mangled before the return type, which is moved in front of them
+			size_t args = out.len;
 			while (1)
 			{
-				if (ni >= name.length)
+				if (ni >= nameLen)
 					error();
 				char c = name[ni];
 				if (c == 'Z')
 					break;
 				if (c == 'X')
 				{
-					if (!args.length) error();
-					args += " ...";
+					if (out.len == args) error();
+					out.put(" ...");
 					break;
 				}
-				if (args.length)
-					args += ", ";
+				if (out.len > args)
+					out.put(", ");
 				switch (c)
 				{
 				case 'J':
-					args += "out ";
+					out.put("out ");
 					ni++;
 					goto Ldefault;
 
 				case 'K':
-					args += "ref ";
+					out.put("ref ");
 					ni++;
 					goto Ldefault;
 
 				case 'L':
-					args += "lazy ";
+					out.put("lazy ");
 					ni++;
 					goto Ldefault;
 
 				default:
 				Ldefault:
-					args += parseType();
+					parseType();
 					continue;
 
 				case 'Y':
-					args += "...";
+					out.put("...");
 					break;
 				}
 				break;
 			}
 			ni++;
-			if (!isdelegate && identifier.length)
+			size_t ret = out.len;
+			if (!isdelegate && hasIdentifier)
 			{
 				switch (mc)
 				{
-				case 'F': p = "";                  break; // D function
-				case 'U': p = "extern (C) ";       break; // C function
-				case 'W': p = "extern (Windows) "; break; // Windows function
-				case 'V': p = "extern (Pascal) ";  break; // Pascal function
+				case 'F':                              break; // D function
+				case 'U': out.put("extern (C) ");       break; // C function
+				case 'W': out.put("extern (Windows) "); break; // Windows function
+				case 'V': out.put("extern (Pascal) ");  break; // Pascal function
 				default:  assert(0);
 				}
-				p += parseType() + " " + identifier + "(" + args + ")";
-				return prop + p;
+				parseType();
+				out.put(" ");
+				out.copy(idFrom, idTo);
+				out.put("(");
+				out.rotate(args, ret);
+				out.put(")");
+				return;
 			}
-			p = prop + parseType() +
-				(isdelegate ? string(" delegate(") : string(" function(")) + args + ")";
+			parseType();
+			out.put(isdelegate ? " delegate(" : " function(");
+			out.rotate(args, ret);
+			out.put(")");
 			isdelegate = 0;
 			goto L1;
 			}
@@ -428,31 +385,36 @@ public:
 		case 'E':	p = "enum ";	goto L2;
 		case 'T':	p = "typedef ";	goto L2;
 
-	L2:	p += parseQualifiedName();
+	L2:	out.put(p);
+			parseQualifiedName();
 			goto L1;
 
+	L0:	out.put(p);
 	L1:
 			if (isdelegate)
 				error();		// 'D' must be followed by function
-			if (identifier.length)
-				p += " " + identifier;
-			return p;
+			if (hasIdentifier)
+			{
+				out.put(" ");
+				out.copy(idFrom, idTo);
+			}
+			return;
 
 		default:
 			size_t i = ni - 1;
-			ni = name.length;
-			p = name.substr(i, name.length-i);
+			ni = nameLen;
+			out.put(name + i, nameLen - i);
 			goto L1;
 		}
 	}
 
-	void getReal(string &result)
+	void getReal()
 	{
 		real r;
 		ubyte rdata[10];
 		ubyte *p = rdata;
 
-		if (ni + 10 * 2 > name.length)
+		if (ni + 10 * 2 > nameLen)
 			error();
 		for (size_t i = 0; i < 10; i++)
 		{
@@ -462,78 +424,83 @@ public:
 			p[i] = b;
 		}
 		// extract 10-byte double from rdata
-#ifdef _M_X64
+#if defined(_M_X64)
 		cvt80to64(rdata, &r);
-#else
+#elif defined(_MSC_VER)
 		__asm {
 			fld TBYTE PTR rdata;
 			fstp r;
 		}
+#else
+		r = cvt80(rdata);
 #endif
 
 		char num[30];
-		sprintf(num, "%g", r);
-		result += num; // format(r);
+		sprintf(num, "%g", (double) r);
+		out.put(num); // format(r);
 		ni += 10 * 2;
 	}
 
-	string parseTemplateInstanceName()
+	void parseTemplateInstanceName()
 	{
-		string result = parseSymbolName() + "!(";
+		parseSymbolName();
+		out.put("!(");
 		int nargs = 0;
 
 		while (1)
 		{
 			size_t i;
 
-			if (ni >= name.length)
+			if (ni >= nameLen)
 				error();
 			if (nargs && name[ni] != 'Z')
-				result += ", ";
+				out.put(", ");
 			nargs++;
 			switch (name[ni++])
 			{
 			case 'T':
-				result += parseType();
+				parseType();
 				continue;
 
 			case 'V':
 
-				result += parseType() + " ";
-				if (ni >= name.length)
+				parseType();
+				out.put(" ");
+				if (ni >= nameLen)
 					error();
 				switch (name[ni++])
 				{
 				case '0': case '1': case '2': case '3': case '4':
 				case '5': case '6': case '7': case '8': case '9':
 					i = ni - 1;
-					while (ni < name.length && isdigit(name[ni]))
+					while (ni < nameLen && isdigit(name[ni]))
 						ni++;
-					result += name.substr(i, ni - i);
+					out.put(name + i, ni - i);
 					break;
 
 				case 'N':
 					i = ni;
-					while (ni < name.length && isdigit(name[ni]))
+					while (ni < nameLen && isdigit(name[ni]))
 						ni++;
 					if (i == ni)
 						error();
-					result += "-" + name.substr(i, ni - i);
+					out.put("-");
+					out.put(name + i, ni - i);
 					break;
 
 				case 'n':
-					result += "null";
+					out.put("null");
 					break;
 
 				case 'e':
-					getReal(result);
+					getReal();
 					break;
 
 				case 'c':
-					getReal(result);
-					result += '+';
-					getReal(result);
-					result += 'i';
+					getReal();
+					out.put('+');
+					getReal();
+					out.put('i');
 					break;
 
 				case 'a':
@@ -543,20 +510,20 @@ public:
 					if (m == 'a')
 						m = 'c';
 					size_t n = parseNumber();
-					if (ni >= name.length || name[ni++] != '_' ||
-						ni + n * 2 > name.length)
+					if (ni >= nameLen || name[ni++] != '_' ||
+						ni + n * 2 > nameLen)
 						error();
-					result += '"';
+					out.put('"');
 					for (i = 0; i < n; i++)
 					{	char c;
 
 					c = (char)((ascii2hex(name[ni + i * 2]) << 4) +
 						ascii2hex(name[ni + i * 2 + 1]));
-					result += c;
+					out.put(c);
 					}
 					ni += n * 2;
-					result += '"';
-					result += m;
+					out.put('"');
+					out.put(m);
 					break;
 					}
 
@@ -567,7 +534,7 @@ public:
 				continue;
 
 			case 'S':
-				result += parseSymbolName();
+				parseSymbolName();
 				continue;
 
 			case 'Z':
@@ -578,79 +545,213 @@ public:
 			}
 			break;
 		}
-		result += ")";
-		return result;
+		out.put(")");
 	}
 
-	string demangle(string _name, bool plainName = false)
+	// demangle _name into out.buf[resultFrom..out.len), returns false if it is not a D mangled name
+	bool demangle(const char* _name, size_t _nameLen, bool plainName, size_t& resultFrom)
 	{
 		ni = 2;
 		name = _name;
+		nameLen = _nameLen;
+		out.truncate(0);
 
-		if (name.length < 3 ||
+		if (nameLen < 3 ||
 			name[0] != '_' ||
 			name[1] != 'D' ||
 			!isdigit(name[2]))
 		{
-			goto Lnot;
+			return false;
 		}
 
 		try
 		{
-			string result = parseQualifiedName();
-			string typed_result = parseType(result);
-			while(ni < name.length)
+			parseQualifiedName();
+			size_t result = out.len;
+			parseType(0, result);
+			while(ni < nameLen)
 			{
 				// throw away outer type (e.g. for local functions)
-				result = result + "." + parseQualifiedName();
-				typed_result = parseType(result);
+				out.truncate(result);
+				out.put(".");
+				parseQualifiedName();
+				result = out.len;
+				parseType(0, result);
 			}
-			if (!plainName)
-				result = typed_result;
 
-			if (ni != name.length)
-				goto Lnot;
-			return result;
+			if (ni != nameLen)
+				return false;
+			if (plainName)
+			{
+				out.truncate(result);
+				resultFrom = 0;
+			}
+			else
+				resultFrom = result;
+			return true;
 		}
 		catch (MangleException e)
 		{
 		}
 
-	Lnot:
-		// Not a recognized D mangled name; so return original
-		return name;
+		// Not a recognized D mangled name
+		return false;
 	}
 
 };
 
-void unittest()
+///////////////////////////////////////////////////////////////////////
+// demangled names by mangled name. The strings are copied to blocks of memory
+// released only by clear(), so that caching a name needs no allocation of its own.
+class DemangleCache
 {
-	// debug(demangle) printf("demangle.demangle.unittest\n");
+public:
+	DemangleCache() : blockPos(0), blockLeft(0) {}
+	~DemangleCache() { clear(); }
+
+	const char* find(const char* mangled, size_t len, bool plain, unsigned hash, size_t& resultLen) const
+	{
+		if (buckets.empty())
+			return 0;
+		for (int e = buckets[hash & (buckets.size() - 1)]; e >= 0; e = entries[e].next)
+		{
+			const Entry& entry = entries[e];
+			if (entry.hash == hash && entry.len == len && entry.plain == plain && memcmp(entry.mangled, mangled, len) == 0)
+			{
+				resultLen = entry.resultLen;
+				return entry.result;
+			}
+		}
+		return 0;
+	}
+
+	void add(const char* mangled, size_t len, bool plain, unsigned hash, const char* result, size_t resultLen)
+	{
+		if (entries.size() >= kMaxEntries)
+			clear();
+		if (entries.size() >= buckets.size())
+			rehash(buckets.empty() ? 1024 : buckets.size() * 2);
+
+		Entry entry;
+		entry.mangled = store(mangled, len);
+		entry.result = store(result, resultLen);
+		entry.len = len;
+		entry.resultLen = resultLen;
+		entry.hash = hash;
+		entry.plain = plain;
+		int& bucket = buckets[hash & (buckets.size() - 1)];
+		entry.next = bucket;
+		bucket = (int) entries.size();
+		entries.push_back(entry);
+	}
+
+	void clear()
+	{
+		for (size_t b = 0; b < blocks.size(); b++)
+			free(blocks[b]);
+		blocks.clear();
+		entries.clear();
+		buckets.clear();
+		blockPos = 0;
+		blockLeft = 0;
+	}
 
-	static string table[][2] = 
+	static unsigned hashName(const char* s, size_t len, bool plain)
 	{
-		{ "_D6object14_moduleTlsCtorUZv15_moduleTlsCtor2MFAPS6object10ModuleInfoiZv", "void object._moduleTlsCtor._moduleTlsCtor2(struct object.ModuleInfo*[], int)"},
-		{ "_D7dparser3dmd8Template21TemplateTypeParameter13overloadMatchMFC7dparser3dmd8Template17TemplateParameterZi", "int dparser.dmd.Template.TemplateTypeParameter.overloadMatch(class dparser.dmd.Template.TemplateParameter)"},
-		{ "printf",	"printf" },
-		{ "_foo",	"_foo" },
-		{ "_D88",	"_D88" }, // causes exception error, return symbol as is
-		{ "_D4test3fooAa", "char[] test.foo"},
-		{ "_D8demangle8demangleFAaZAa", "char[] demangle.demangle(char[])" },
-		{ "_D6object6Object8opEqualsFC6ObjectZi", "int object.Object.opEquals(class Object)" },
-		{ "_D4test2dgDFiYd", "double delegate(int, ...) test.dg" },
-		{ "_D4test58__T9factorialVde67666666666666860140VG5aa5_68656c6c6fVPvnZ9factorialf", "float test.factorial!(double 4.2, char[5] \"hello\"c, void* null).factorial" },
-		{ "_D4test101__T9factorialVde67666666666666860140Vrc9a999999999999d9014000000000000000c00040VG5aa5_68656c6c6fVPvnZ9factorialf", "float test.factorial!(double 4.2, cdouble 6.8+3i, char[5] \"hello\"c, void* null).factorial" },
-		{ "_D4test34__T3barVG3uw3_616263VG3wd3_646566Z1xi", "int test.bar!(wchar[3] \"abc\"w, dchar[3] \"def\"d).x" },
-		{ "_D8demangle4testFLC6ObjectLDFLiZiZi", "int demangle.test(lazy class Object, lazy int delegate(lazy int))"},
-		{ "_D8demangle4testFAiXi", "int demangle.test(int[] ...)"},
-		{ "_D8demangle4testFLAiXi", "int demangle.test(lazy int[] ...)"} ,
+		unsigned hash = plain ? 2166136261u : 2166136262u;
+		for (size_t i = 0; i < len; i++)
+			hash = (hash ^ (unsigned char) s[i]) * 16777619u;
+		return hash;
+	}
+
+private:
+	static const size_t kBlockSize = 0x10000;
+	static const size_t kMaxEntries = 0x100000;
+
+	struct Entry
+	{
+		const char* mangled;
+		const char* result;
+		size_t len;
+		size_t resultLen;
+		unsigned hash;
+		int next;
+		bool plain;
 	};
 
-	Demangle d;
-	for(int i = 0; i < sizeof(table)/sizeof(table[0]); i++)
+	void rehash(size_t size)
 	{
-		string r = d.demangle(table[i][0]);
-		assert(r == table[i][1]);
+		buckets.assign(size, -1);
+		for (size_t e = 0; e < entries.size(); e++)
+		{
+			int& bucket = buckets[entries[e].hash & (size - 1)];
+			entries[e].next = bucket;
+			bucket = (int) e;
+		}
+	}
+
+	const char* store(const char* s, size_t len)
+	{
+		if (len > blockLeft)
+		{
+			size_t size = len > kBlockSize ? len : kBlockSize;
+			blockPos = (char*) malloc(size);
+			blockLeft = size;
+			blocks.push_back(blockPos);
+		}
+		char* p = blockPos;
+		memcpy(p, s, len);
+		blockPos += len;
+		blockLeft -= len;
+		return p;
+	}
+
+	std::vector<int> buckets;
+	std::vector<Entry> entries;
+	std::vector<char*> blocks;
+	char* blockPos;
+	size_t blockLeft;
+};
+
+static DemangleCache demangleCache;
+static std::mutex demangleCacheMutex;
+
+void d_demangle_clear_cache()
+{
+	std::lock_guard<std::mutex> lock(demangleCacheMutex);
+	demangleCache.clear();
+}
+
+///////////////////////////////////////////////////////////////////////
+const DemangleTest demangleTests[] =
+{
+	{ "_D6object14_moduleTlsCtorUZv15_moduleTlsCtor2MFAPS6object10ModuleInfoiZv", "void object._moduleTlsCtor._moduleTlsCtor2(struct object.ModuleInfo*[], int)"},
+	{ "_D7dparser3dmd8Template21TemplateTypeParameter13overloadMatchMFC7dparser3dmd8Template17TemplateParameterZi", "int dparser.dmd.Template.TemplateTypeParameter.overloadMatch(class dparser.dmd.Template.TemplateParameter)"},
+	{ "printf",	"printf" },
+	{ "_foo",	"_foo" },
+	{ "_D88",	"_D88" }, // causes exception error, return symbol as is
+	{ "_D4test3fooAa", "char[] test.foo"},
+	{ "_D8demangle8demangleFAaZAa", "char[] demangle.demangle(char[])" },
+	{ "_D6object6Object8opEqualsFC6ObjectZi", "int object.Object.opEquals(class Object)" },
+	{ "_D4test2dgDFiYd", "double delegate(int, ...) test.dg" },
+	{ "_D4test58__T9factorialVde67666666666666860140VG5aa5_68656c6c6fVPvnZ9factorialf", "float test.factorial!(double 4.2, char[5] \"hello\"c, void* null).factorial" },
+	{ "_D4test101__T9factorialVde67666666666666860140Vrc9a999999999999d9014000000000000000c00040VG5aa5_68656c6c6fVPvnZ9factorialf", "float test.factorial!(double 4.2, cdouble 6.8+3i, char[5] \"hello\"c, void* null).factorial" },
+	{ "_D4test34__T3barVG3uw3_616263VG3wd3_646566Z1xi", "int test.bar!(wchar[3] \"abc\"w, dchar[3] \"def\"d).x" },
+	{ "_D8demangle4testFLC6ObjectLDFLiZiZi", "int demangle.test(lazy class Object, lazy int delegate(lazy int))"},
+	{ "_D8demangle4testFAiXi", "int demangle.test(int[] ...)"},
+	{ "_D8demangle4testFLAiXi", "int demangle.test(lazy int[] ...)"} ,
+};
+const int numDemangleTests = sizeof(demangleTests) / sizeof(demangleTests[0]);
+
+void unittest()
+{
+	// debug(demangle) printf("demangle.demangle.unittest\n");
+
+	char r[kMaxNameLen];
+	for(int i = 0; i < numDemangleTests; i++)
+	{
+		d_demangle(demangleTests[i].mangled, r, sizeof(r), false, false);
+		assert(strcmp(r, demangleTests[i].demangled) == 0);
 		//	"table entry #" + toString(i) + ": '" + name[0] + "' demangles as '" + r + "' but is expected to be '" + name[1] + "'");
 	}
 
@@ -659,17 +760,63 @@ void unittest()
 	dsym2c((const BYTE*) s, sizeof(s) - 1, buf, sizeof(buf));
 }
 
-bool d_demangle(const char* name, char* demangled, int maxlen, bool plain)
+// result truncated to maxlen - 1 characters and zero terminated, demangled can be the same as result
+static int copyResult(char* demangled, int maxlen, const char* result, size_t resultLen, char dotChar)
+{
+	int n = resultLen < (size_t) maxlen ? (int) resultLen : maxlen - 1;
+	dotcpy(demangled, result, n, dotChar);
+	demangled[n] = 0;
+	return n;
+}
+
+int d_demangle(const char* name, int len, char* demangled, int maxlen, bool plain, char dotChar, bool cached)
 {
 #ifdef _DEBUG
 	static bool once; if(!once) { once = true; unittest(); }
 #endif
 
-	Demangle d;
-	string nm(name, strlen(name));
-	string r = d.demangle(nm, plain);
-	if (r.length == 0)
+	if (maxlen <= 0)
+		return 0;
+
+	size_t resultLen = 0;
+	unsigned hash = 0;
+	if (cached)
+	{
+		hash = DemangleCache::hashName(name, len, plain);
+		std::lock_guard<std::mutex> lock(demangleCacheMutex);
+		// copied while locked, the cache might be cleared by another thread
+		if (const char* r = demangleCache.find(name, len, plain, hash, resultLen))
+			return copyResult(demangled, maxlen, r, resultLen, dotChar);
+	}
+
+	char buf[2 * kMaxNameLen];
+	const char* result;
+	Demangle d(buf, sizeof(buf));
+	size_t from;
+	if (d.demangle(name, len, plain, from))
+	{
+		result = buf + from;
+		resultLen = d.out.len - from;
+	}
+	else
+	{
+		// return the original name
+		result = name;
+		resultLen = len;
+	}
+	if (cached)
+	{
+		std::lock_guard<std::mutex> lock(demangleCacheMutex);
+		demangleCache.add(name, len, plain, hash, result, resultLen);
+	}
+	return copyResult(demangled, maxlen, result, resultLen, dotChar);
+}
+
+bool d_demangle(const char* name, char* demangled, int maxlen, bool plain, bool cached)
+{
+	int len = strlen(name);
+	if (len == 0)
 		return false;
-	strncpy(demangled, r.c_str(), maxlen);
+	d_demangle(name, len, demangled, maxlen, plain, '.', cached);
 	return true;
 }
@@ -7,6 +7,19 @@
 #ifndef __DEMANGLE_H__
 #define __DEMANGLE_H__
 
-bool d_demangle(const char* name, char* demangled, int maxlen, bool plain);
+// the result is remembered by mangled name if cached is set, name and demangled can be the same buffer
+bool d_demangle(const char* name, char* demangled, int maxlen, bool plain, bool cached = true);
+// demangles name[0..len) replacing '.' with dotChar, returns the length of the zero terminated result
+int d_demangle(const char* name, int len, char* demangled, int maxlen, bool plain, char dotChar, bool cached = true);
+void d_demangle_clear_cache();
 
-#endif //__DEMANGLE_H__
\ No newline at end of file
+// mangled names checked by the unit test, also used as the corpus of the demangler benchmark
+struct DemangleTest
+{
+	const char* mangled;
+	const char* demangled;
+};
+extern const DemangleTest demangleTests[];
+extern const int numDemangleTests;
+
+#endif //__DEMANGLE_H__
@@ -14,10 +14,14 @@
 #include "PEImage.h"
 #include "symutil.h"
 #include "cvutil.h"
+#include "memreport.h"
+#include "trace.h"
 
 #include "dwarf.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -27,10 +31,15 @@ void CV2PDB::checkDWARFTypeAlloc(int size, int add)
 	if (cbDwarfTypes + size > allocDwarfTypes)
 	{
 		//allocDwarfTypes += size + add;
+		memTrack(kMemDwarfTypes, allocDwarfTypes, allocDwarfTypes + allocDwarfTypes/2 + size + add);
 		allocDwarfTypes += allocDwarfTypes/2 + size + add;
 		dwarfTypes = (BYTE*) realloc(dwarfTypes, allocDwarfTypes);
 		if (dwarfTypes == nullptr)
+#ifdef _MSC_VER
 			__debugbreak();
+#else
+			abort();
+#endif
 	}
 }
 
@@ -447,6 +456,15 @@ public:
 	Location cfa;
 };
 
+static Location evalCFA(const CFIEntry& entry, unsigned int pclo)
+{
+	CFACursor cfa(entry, pclo);
+	while(cfa.processNext()) {}
+	cfa.setInstructions(entry.instructions, entry.instructions_length);
+	while(!cfa.beforeRestore() && cfa.processNext()) {}
+	return cfa.cfa;
+}
+
 Location findBestCFA(const PEImage& img, unsigned int pclo, unsigned int pchi)
 {
 	bool x64 = img.isX64();
@@ -461,16 +479,79 @@ Location findBestCFA(const PEImage& img, unsigned int pclo, unsigned int pchi)
 		if (entry.type == CFIEntry::FDE &&
 			entry.initial_location <= pclo && entry.initial_location + entry.address_range >= pchi)
 		{
-			CFACursor cfa(entry, pclo);
-			while(cfa.processNext()) {}
-			cfa.setInstructions(entry.instructions, entry.instructions_length);
-			while(!cfa.beforeRestore() && cfa.processNext()) {}
-			return cfa.cfa;
+			return evalCFA(entry, pclo);
 		}
 	}
 	return ebp;
 }
 
+// same as above, but looking up the FDE in the index
+Location findBestCFA(const PEImage& img, const CFIIndex& index, unsigned int pclo, unsigned int pchi)
+{
+	bool x64 = img.isX64();
+	Location ebp = { Location::RegRel, x64 ? 6 : 5, x64 ? 16 : 8 };
+	long off = index.find(pclo, pchi);
+	if (!img.debug_frame || off < 0)
+		return ebp;
+
+	CFIEntry entry;
+	CFICursor cursor(img);
+	cursor.ptr = cursor.beg + off;
+	if (!cursor.readNext(entry))
+		return ebp;
+	return evalCFA(entry, pclo);
+}
+
+bool CFIIndex::build(const PEImage& img)
+{
+	clear();
+	if (img.debug_frame)
+	{
+		// stops at the same entry as the scan in findBestCFA
+		CFIEntry entry;
+		CFICursor cursor(img);
+		while(cursor.readNext(entry))
+		{
+			if (entry.type == CFIEntry::FDE)
+			{
+				Range r = { entry.initial_location, entry.initial_location + entry.address_range,
+				            (unsigned long) (entry.ptr - cursor.beg) };
+				ranges.push_back(r);
+			}
+		}
+		std::stable_sort(ranges.begin(), ranges.end());
+
+		maxEnd.resize(ranges.size());
+		for (size_t i = 0; i < ranges.size(); i++)
+			maxEnd[i] = i > 0 && maxEnd[i - 1] > ranges[i].end ? maxEnd[i - 1] : ranges[i].end;
+	}
+	built = true;
+	return true;
+}
+
+void CFIIndex::clear()
+{
+	std::vector<Range>().swap(ranges);
+	std::vector<unsigned long>().swap(maxEnd);
+	built = false;
+}
+
+long CFIIndex::find(unsigned long pclo, unsigned long pchi) const
+{
+	Range key = { pclo, 0, 0 };
+	size_t i = std::upper_bound(ranges.begin(), ranges.end(), key) - ranges.begin();
+
+	// all ranges before i start at or below pclo, stop once none of them reaches pchi
+	long best = -1;
+	while (i > 0 && maxEnd[i - 1] >= pchi)
+	{
+		i--;
+		if (ranges[i].end >= pchi && (best < 0 || ranges[i].offset < (unsigned long) best))
+			best = ranges[i].offset;
+	}
+	return best;
+}
+
 // Location list entry
 class LOCEntry
 {
@@ -569,6 +650,7 @@ void CV2PDB::appendStackVar(const char* name, int type, Location& loc, Location&
 		cvs->stack_v2.id = v3 ? S_BPREL_V3 : S_BPREL_V2;
 		cvs->stack_v2.offset = off;
 		cvs->stack_v2.symtype = type;
+		addDWARFTypeFixup(&CV2PDB::udtSymbols, &cvs->stack_v2.symtype);
 		len = cstrcpy_v(v3, (BYTE*)&cvs->stack_v2.p_name, name);
 		len += (BYTE*)&cvs->stack_v2.p_name - (BYTE*)cvs;
 	}
@@ -578,6 +660,7 @@ void CV2PDB::appendStackVar(const char* name, int type, Location& loc, Location&
 		cvs->regrel_v3.reg = baseReg;
 		cvs->regrel_v3.offset = off;
 		cvs->regrel_v3.symtype = type;
+		addDWARFTypeFixup(&CV2PDB::udtSymbols, &cvs->regrel_v3.symtype);
 		len = cstrcpy_v(true, (BYTE*)cvs->regrel_v3.name, name);
 		len += (BYTE*)&cvs->regrel_v3.name - (BYTE*)cvs;
 	}
@@ -602,6 +685,7 @@ void CV2PDB::appendGlobalVar(const char* name, int type, int seg, int offset)
 	cvs->data_v2.id = v3 ? S_GDATA_V3 : S_GDATA_V2;
 	cvs->data_v2.offset = offset;
 	cvs->data_v2.symtype = type;
+	addDWARFTypeFixup(&CV2PDB::udtSymbols, &cvs->data_v2.symtype);
 	cvs->data_v2.segment = seg;
 	len = cstrcpy_v (v3, (BYTE*) &cvs->data_v2.p_name, name);
 	len += (BYTE*) &cvs->data_v2.p_name - (BYTE*) cvs;
@@ -707,7 +791,7 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 	if (frameBase.is_abs()) // pointer into location list in .debug_loc? assume CFA
 		frameBase = findBestFBLoc(img, cu, frameBase.off);
 
-    Location cfa = findBestCFA(img, procid.pclo, procid.pchi);
+    Location cfa = findBestCFA(img, cfiIndex, procid.pclo, procid.pchi);
 
 	if (cu)
 	{
@@ -716,7 +800,7 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 		int off = 8;
 
 		DIECursor prev = cursor;
-		while (cursor.readNext(id, true) && id.tag == DW_TAG_formal_parameter)
+		while (cursor.readNext(id, true, kDIEName | kDIEType | kDIELocation) && id.tag == DW_TAG_formal_parameter)
 		{
 			if (id.tag == DW_TAG_formal_parameter)
 			{
@@ -739,7 +823,7 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 			cursor = lexicalBlocks.back();
 			lexicalBlocks.pop_back();
 
-			while (cursor.readNext(id))
+			while (cursor.readNext(id, false, kDIEName | kDIEType | kDIELocation | kDIEPC))
 			{
 				if (id.tag == DW_TAG_lexical_block)
 				{
@@ -808,7 +892,7 @@ int CV2PDB::addDWARFStructure(DWARF_InfoData& structid, DWARF_CompilationUnit* c
         // cursor points to the first member
 		DWARF_InfoData id;
 		int len = 0;
-		while (cursor.readNext(id, true))
+		while (cursor.readNext(id, true, kDIEName | kDIEType | kDIEMemberLocation))
 		{
 			int cvid = -1;
 			if (id.tag == DW_TAG_member && id.name)
@@ -830,6 +914,7 @@ int CV2PDB::addDWARFStructure(DWARF_InfoData& structid, DWARF_CompilationUnit* c
 					checkDWARFTypeAlloc(kMaxNameLen + 100);
 					codeview_fieldtype* dfieldtype = (codeview_fieldtype*) (dwarfTypes + cbDwarfTypes);
 					cbDwarfTypes += addFieldMember(dfieldtype, 0, off, getTypeByDWARFPtr(cu, id.type), id.name);
+					addDWARFTypeFixup(&CV2PDB::dwarfTypes, &dfieldtype->member_v2.type);
 					nfields++;
 				}
 			}
@@ -849,6 +934,7 @@ int CV2PDB::addDWARFStructure(DWARF_InfoData& structid, DWARF_CompilationUnit* c
 					bc->bclass_v2.offset = off;
 					bc->bclass_v2.type = getTypeByDWARFPtr(cu, id.type);
 					bc->bclass_v2.attribute = 3; // public
+					addDWARFTypeFixup(&CV2PDB::dwarfTypes, &bc->bclass_v2.type);
 					cbDwarfTypes += sizeof(bc->bclass_v2);
 					for (; cbDwarfTypes & 3; cbDwarfTypes++)
 						dwarfTypes[cbDwarfTypes] = 0xf4 - (cbDwarfTypes & 3);
@@ -868,6 +954,7 @@ int CV2PDB::addDWARFStructure(DWARF_InfoData& structid, DWARF_CompilationUnit* c
 	const char* name = (structid.name ? structid.name : "__noname");
 	int attr = fieldlistType ? 0 : kPropIncomplete;
 	int len = addAggregate(cvt, false, nfields, fieldlistType, attr, 0, 0, structid.byte_size, name);
+	addDWARFTypeFixup(&CV2PDB::userTypes, &cvt->struct_v2.fieldlist);
 	cbUserTypes += len;
 
 	//ensureUDT()?
@@ -876,41 +963,39 @@ int CV2PDB::addDWARFStructure(DWARF_InfoData& structid, DWARF_CompilationUnit* c
 	return cvtype;
 }
 
-int CV2PDB::getDWARFArrayBounds(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu,
-								DIECursor cursor, int& upperBound)
+int CV2PDB::getDWARFArrayBounds(int die, int& upperBound)
 {
 	int lowerBound = 0;
 
-	if (cu)
+	for (int child = dieIndex.firstChild[die]; child >= 0; child = dieIndex.nextSibling[child])
 	{
-		DWARF_InfoData id;
-		while (cursor.readNext(id, true))
+		if (dieIndex.tag[child] == DW_TAG_subrange_type)
 		{
-			int cvid = -1;
-			if (id.tag == DW_TAG_subrange_type)
+			DWARF_InfoData id;
+			DIECursor cursor = dieIndex.getCursor(child);
+			if (cursor.readNext(id, false, kDIEBounds))
 			{
 				lowerBound = id.lower_bound;
 				upperBound = id.upper_bound;
 			}
-			cursor.gotoSibling();
 		}
 	}
 	return lowerBound;
 }
 
-int CV2PDB::addDWARFArray(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu,
-						  DIECursor cursor)
+int CV2PDB::addDWARFArray(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu, int die)
 {
-	int upperBound, lowerBound = getDWARFArrayBounds(arrayid, cu, cursor, upperBound);
+	int upperBound = 0, lowerBound = getDWARFArrayBounds(die, upperBound);
 
 	checkUserTypeAlloc(kMaxNameLen + 100);
 	codeview_type* cvt = (codeview_type*) (userTypes + cbUserTypes);
 
 	cvt->array_v2.id = v3 ? LF_ARRAY_V3 : LF_ARRAY_V2;
 	cvt->array_v2.elemtype = getTypeByDWARFPtr(cu, arrayid.type);
+	addDWARFTypeFixup(&CV2PDB::userTypes, &cvt->array_v2.elemtype);
 	cvt->array_v2.idxtype = 0x74;
 	int len = (BYTE*)&cvt->array_v2.arrlen - (BYTE*)cvt;
-	int size = (upperBound - lowerBound + 1) * getDWARFTypeSize(cu, arrayid.type);
+	int size = (upperBound - lowerBound + 1) * getDWARFTypeSize(dieIndex.type[die]);
 	len += write_numeric_leaf(size, &cvt->array_v2.arrlen);
 	((BYTE*)cvt)[len++] = 0; // empty name
 	for (; len & 3; len++)
@@ -925,10 +1010,13 @@ int CV2PDB::addDWARFArray(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu,
 
 bool CV2PDB::addDWARFTypes()
 {
+	TraceSpan span("addDWARFTypes");
+	if (!reloadDWARFBuffer(&CV2PDB::udtSymbols, &CV2PDB::cbUdtSymbols, &CV2PDB::checkUdtSymbolAlloc))
+		return false;
 	checkUdtSymbolAlloc(100);
 
 	int prefix = 4;
-	DWORD* ddata = new DWORD [img.debug_info_length/4]; // large enough
+	DWORD ddata[64]; // large enough for the search and compiland symbols
 	unsigned char *data = (unsigned char*) (ddata + prefix);
 	unsigned int off = 0;
 	unsigned int len;
@@ -966,9 +1054,46 @@ bool CV2PDB::addDWARFTypes()
 #endif
 
 	//////////////////////////
-	mspdb::Mod* mod = globalMod();
-	//return writeSymbols (mod, ddata, off, prefix, true);
-	return addSymbols (mod, data, off, true);
+	if (useGlobalMod)
+	{
+		mspdb::Mod* mod = globalMod();
+		//return writeSymbols (mod, ddata, off, prefix, true);
+		return addSymbols (mod, data, off, true);
+	}
+
+	// the symbols of each compilation unit go to its module, behind the search and compiland symbols
+	std::vector<unsigned char> unitData;
+	int begin = 0;
+	for (int m = 0; m < countEntries; m++)
+	{
+		int end = m + 1 < countEntries ? dwarfUnitSymbolEnd[m] : cbUdtSymbols;
+		if (modules[m])
+		{
+			unitData.assign(data, data + off);
+			unitData.insert(unitData.end(), udtSymbols + begin, udtSymbols + end);
+			if (!addSymbols (modules[m], unitData.data(), unitData.size(), false))
+				return false;
+		}
+		begin = end;
+	}
+	return true;
+}
+
+mspdb::Mod* CV2PDB::openDWARFModule(int unit, const char* name)
+{
+	if (!modules[unit])
+	{
+		char unitName[32];
+		if (!name)
+		{
+			sprintf(unitName, "unit%d", unit);
+			name = unitName;
+		}
+		int rc = dbi->OpenMod(name, name, &modules[unit]);
+		if (rc <= 0 || !modules[unit])
+			setError("cannot create mod");
+	}
+	return modules[unit];
 }
 
 bool CV2PDB::addDWARFSectionContrib(mspdb::Mod* mod, unsigned long pclo, unsigned long pchi)
@@ -976,14 +1101,89 @@ bool CV2PDB::addDWARFSectionContrib(mspdb::Mod* mod, unsigned long pclo, unsigne
 	int segIndex = img.findSection(pclo);
 	if(segIndex >= 0)
 	{
+		unsigned long segStart = img.getImageBase() + img.getSection(segIndex).VirtualAddress;
 		int segFlags = 0x60101020; // 0x40401040, 0x60500020; // TODO
-		int rc = mod->AddSecContrib(segIndex, pclo, pchi - pclo, segFlags);
+		int rc = mod->AddSecContrib(segIndex + 1, pclo - segStart, pchi - pclo, segFlags);
 		if (rc <= 0)
 			return setError("cannot add section contribution to module");
 	}
 	return true;
 }
 
+// address ranges in .debug_ranges are relative to the base address of the compilation unit
+bool CV2PDB::addDWARFRanges(mspdb::Mod* mod, DWARF_CompilationUnit* cu, unsigned long ranges, unsigned long base)
+{
+	byte* r = (byte*)img.debug_ranges + ranges;
+	byte* rend = (byte*)img.debug_ranges + img.debug_ranges_length;
+	int addrSize = cu->address_size;
+	unsigned long long baseSelection = addrSize == 8 ? ~0ULL : 0xffffffff;
+	while (r + 2 * addrSize <= rend)
+	{
+		unsigned long long pclo = RDsize(r, addrSize);
+		unsigned long long pchi = RDsize(r, addrSize);
+		if (pclo == 0 && pchi == 0)
+			break;
+		if (pclo == baseSelection)
+			base = (unsigned long) pchi;
+		else if (!addDWARFSectionContrib(mod, base + (unsigned long) pclo, base + (unsigned long) pchi))
+			return false;
+	}
+	return true;
+}
+
+// section contributions of the compilation units without address range in their DIE
+bool CV2PDB::addDWARFARanges()
+{
+	if (!img.debug_aranges)
+		return true;
+
+	byte* p = (byte*)img.debug_aranges;
+	byte* end = p + img.debug_aranges_length;
+	while (p + 4 <= end)
+	{
+		byte* set = p;
+		unsigned long long length = RDsize(p, 4);
+		int offsetSize = 4;
+		if (length == 0xffffffff)
+		{
+			length = RDsize(p, 8);
+			offsetSize = 8;
+		}
+		byte* setEnd = p + length;
+		if (setEnd > end)
+			break;
+
+		p += 2; // version
+		unsigned long info = (unsigned long) RDsize(p, offsetSize);
+		int addrSize = *p++;
+		int segSize = *p++;
+		int tupleSize = segSize + 2 * addrSize;
+		if (tupleSize > 0)
+			p = set + (p - set + tupleSize - 1) / tupleSize * tupleSize;
+
+		std::vector<unsigned long>::iterator it = std::lower_bound(dwarfUnitOffsets.begin(), dwarfUnitOffsets.end(), info);
+		int unit = it != dwarfUnitOffsets.end() && *it == info ? it - dwarfUnitOffsets.begin() : -1;
+		if (unit >= 0 && !dwarfUnitContrib[unit])
+		{
+			mspdb::Mod* mod = openDWARFModule(unit, 0);
+			if (!mod)
+				return false;
+			while (tupleSize > 0 && p + tupleSize <= setEnd)
+			{
+				p += segSize;
+				unsigned long pclo = (unsigned long) RDsize(p, addrSize);
+				unsigned long len = (unsigned long) RDsize(p, addrSize);
+				if (pclo == 0 && len == 0)
+					break;
+				if (!addDWARFSectionContrib(mod, pclo, pclo + len))
+					return false;
+			}
+		}
+		p = setEnd;
+	}
+	return true;
+}
+
 int CV2PDB::addDWARFBasicType(const char*name, int encoding, int byte_size)
 {
 	int type = 0, mode = 0, size = 0;
@@ -1050,108 +1250,194 @@ int CV2PDB::addDWARFBasicType(const char*name, int encoding, int byte_size)
 	return cvtype;
 }
 
+// placeholders for type indices not known yet while converting the DWARF types: forward
+// references to DIEs and field lists, which are numbered after all user types
+static const int kDWARFFieldListRef = 0x20000000;
+static const int kDWARFTypeRef = 0x40000000;
+
 int CV2PDB::getTypeByDWARFPtr(DWARF_CompilationUnit* cu, byte* ptr)
 {
-	std::unordered_map<byte*, int>::iterator it = mapOffsetToType.find(ptr);
-	if(it == mapOffsetToType.end())
+	int die = dieIndex.find(ptr);
+	if(die < 0)
 		return 0x03; // void
-	return it->second;
+	if(dieCVType[die] == 0)
+		return kDWARFTypeRef + die; // patched by fixupDWARFTypes
+	return dieCVType[die];
+}
+
+// remember a type index written to buffer if it has to be patched after createTypes
+void CV2PDB::addDWARFTypeFixup(unsigned char* CV2PDB::*buffer, const void* slot)
+{
+	int type = *(const int*) slot;
+	if (type >= kDWARFFieldListRef)
+	{
+		int offset = getSpillFile(buffer).cb + (int) ((const unsigned char*) slot - this->*buffer);
+		DWARFTypeFixup fixup = { buffer, offset };
+		dwarfTypeFixups.push_back(fixup);
+	}
+}
+
+int CV2PDB::resolveDWARFTypeRef(int type)
+{
+	if (type >= kDWARFTypeRef)
+	{
+		int cvtype = dieCVType[type - kDWARFTypeRef];
+		return cvtype ? cvtype : 0x03; // void if the DIE is not a type
+	}
+	if (type >= kDWARFFieldListRef)
+		return nextUserType + type - kDWARFFieldListRef;
+	return type;
 }
 
-int CV2PDB::getDWARFTypeSize(DWARF_CompilationUnit* cu, byte* typePtr)
+bool CV2PDB::fixupDWARFTypes()
 {
-	DWARF_InfoData id;
-	DIECursor cursor(cu, typePtr);
+	TraceSpan span("fixupDWARFTypes");
+	for (size_t i = 0; i < dwarfTypeFixups.size(); i++)
+	{
+		const DWARFTypeFixup& fixup = dwarfTypeFixups[i];
+		SpillFile& spill = getSpillFile(fixup.buffer);
+		if (fixup.offset >= spill.cb)
+		{
+			int* slot = (int*) ((this->*fixup.buffer) + fixup.offset - spill.cb);
+			*slot = resolveDWARFTypeRef(*slot);
+		}
+		else
+		{
+			// patch the record in the temporary file
+			int type;
+			if (fseek(spill.fp, fixup.offset, SEEK_SET) != 0 || fread(&type, sizeof(type), 1, spill.fp) != 1)
+				return setError("cannot read temporary file");
+			type = resolveDWARFTypeRef(type);
+			if (fseek(spill.fp, fixup.offset, SEEK_SET) != 0 || fwrite(&type, sizeof(type), 1, spill.fp) != 1)
+				return setError("cannot write temporary file");
+		}
+	}
+	std::vector<DWARFTypeFixup>().swap(dwarfTypeFixups);
+
+	for (size_t i = 0; i < dwarfPublics.size(); i++)
+		dwarfPublics[i].type = resolveDWARFTypeRef(dwarfPublics[i].type);
+
+	// field lists in dwarfTypes are appended after the user types
+	nextDwarfType = nextUserType + nextDwarfType - kDWARFFieldListRef;
+	return true;
+}
+
+CV2PDB::SpillFile& CV2PDB::getSpillFile(unsigned char* CV2PDB::*buffer)
+{
+	if (buffer == &CV2PDB::userTypes)
+		return spillUserTypes;
+	if (buffer == &CV2PDB::dwarfTypes)
+		return spillDwarfTypes;
+	assert(buffer == &CV2PDB::udtSymbols);
+	return spillUdtSymbols;
+}
+
+// move the records in buffer to its temporary file, the allocation is kept for the next records
+bool CV2PDB::spillDWARFBuffer(unsigned char* CV2PDB::*buffer, int CV2PDB::*cb)
+{
+	SpillFile& spill = getSpillFile(buffer);
+	if (this->*cb == 0)
+		return true;
+	if (!spill.fp)
+		spill.fp = tmpfile();
+	if (!spill.fp)
+		return setError("cannot create temporary file");
+	if (fseek(spill.fp, 0, SEEK_END) != 0 || fwrite(this->*buffer, 1, this->*cb, spill.fp) != (size_t) (this->*cb))
+		return setError("cannot write temporary file");
+	spill.cb += this->*cb;
+	this->*cb = 0;
+	return true;
+}
+
+// called after each compilation unit with --max-memory
+bool CV2PDB::spillDWARFBuffers()
+{
+	// a quarter of the limit for the converted records, the rest is left to the image and the DIE index
+	if ((size_t) cbUserTypes + cbDwarfTypes + cbUdtSymbols < maxMemory / 4)
+		return true;
+
+	TraceSpan span("spillDWARFBuffers");
+	return spillDWARFBuffer(&CV2PDB::userTypes, &CV2PDB::cbUserTypes)
+	    && spillDWARFBuffer(&CV2PDB::dwarfTypes, &CV2PDB::cbDwarfTypes)
+	    && spillDWARFBuffer(&CV2PDB::udtSymbols, &CV2PDB::cbUdtSymbols);
+}
+
+bool CV2PDB::readSpillFile(SpillFile& spill, unsigned char* dest)
+{
+	if (!spill.fp)
+		return true;
+	bool ok = fseek(spill.fp, 0, SEEK_SET) == 0 && fread(dest, 1, spill.cb, spill.fp) == (size_t) spill.cb;
+	fclose(spill.fp);
+	spill.fp = 0;
+	spill.cb = 0;
+	return ok ? true : setError("cannot read temporary file");
+}
+
+// put the spilled records back in front of the records still in memory
+bool CV2PDB::reloadDWARFBuffer(unsigned char* CV2PDB::*buffer, int CV2PDB::*cb, void (CV2PDB::*checkAlloc)(int, int))
+{
+	SpillFile& spill = getSpillFile(buffer);
+	if (!spill.fp)
+		return true;
 
-	if (!cursor.readNext(id))
+	TraceSpan span("reloadDWARFBuffer");
+	(this->*checkAlloc)(spill.cb, 0);
+	memmove(this->*buffer + spill.cb, this->*buffer, this->*cb);
+	this->*cb += spill.cb;
+	return readSpillFile(spill, this->*buffer);
+}
+
+int CV2PDB::getDWARFTypeSize(int die)
+{
+	if (die < 0)
 		return 0;
 
-	if(id.byte_size > 0)
-		return id.byte_size;
+	if(dieIndex.byteSize[die] > 0)
+		return dieIndex.byteSize[die];
 
-	switch(id.tag)
+	switch(dieIndex.tag[die])
 	{
 		case DW_TAG_ptr_to_member_type:
 		case DW_TAG_reference_type:
 		case DW_TAG_pointer_type:
-			return cu->address_size;
+			return dieIndex.getCU(die)->address_size;
 		case DW_TAG_array_type:
 		{
-			int upperBound, lowerBound = getDWARFArrayBounds(id, cu, cursor, upperBound);
-			return (upperBound + lowerBound + 1) * getDWARFTypeSize(cu, id.type);
+			int upperBound = 0, lowerBound = getDWARFArrayBounds(die, upperBound);
+			return (upperBound + lowerBound + 1) * getDWARFTypeSize(dieIndex.type[die]);
 		}
 		default:
-			if(id.type)
-				return getDWARFTypeSize(cu, id.type);
-			break;
+			return getDWARFTypeSize(dieIndex.type[die]);
 	}
 	return 0;
 }
 
-bool CV2PDB::mapTypes()
+bool CV2PDB::buildDIEIndex()
 {
-	int typeID = nextUserType;
-	unsigned long off = 0;
-	while (off < img.debug_info_length)
-	{
-		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+	TraceSpan span("buildDIEIndex");
+	if (!dieIndex.build(img))
+		return setError("cannot index .debug_info section");
 
-		DIECursor cursor(cu, (byte*)cu + sizeof(DWARF_CompilationUnit));
-		DWARF_InfoData id;
-		while (cursor.readNext(id))
-		{
-			//printf("0x%08x, level = %d, id.code = %d, id.tag = %d\n",
-			//    (unsigned char*)cu + id.entryOff - (unsigned char*)img.debug_info, cursor.level, id.code, id.tag);
-			switch (id.tag)
-			{
-				case DW_TAG_base_type:
-				case DW_TAG_typedef:
-				case DW_TAG_pointer_type:
-				case DW_TAG_subroutine_type:
-				case DW_TAG_array_type:
-				case DW_TAG_const_type:
-				case DW_TAG_structure_type:
-				case DW_TAG_reference_type:
-
-				case DW_TAG_class_type:
-				case DW_TAG_enumeration_type:
-				case DW_TAG_string_type:
-				case DW_TAG_union_type:
-				case DW_TAG_ptr_to_member_type:
-				case DW_TAG_set_type:
-				case DW_TAG_subrange_type:
-				case DW_TAG_file_type:
-				case DW_TAG_packed_type:
-				case DW_TAG_thrown_type:
-				case DW_TAG_volatile_type:
-				case DW_TAG_restrict_type: // DWARF3
-				case DW_TAG_interface_type:
-				case DW_TAG_unspecified_type:
-				case DW_TAG_mutable_type: // withdrawn
-				case DW_TAG_shared_type:
-				case DW_TAG_rvalue_reference_type:
-					mapOffsetToType.insert(std::make_pair(id.entryPtr, typeID));
-					typeID++;
-			}
-		}
-
-		off += sizeof(cu->unit_length) + cu->unit_length;
-	}
-
-	nextDwarfType = typeID;
+	dieCVType.assign(dieIndex.count(), 0);
 	return true;
 }
 
 bool CV2PDB::createTypes()
 {
-	mspdb::Mod* mod = globalMod();
-	int typeID = nextUserType;
+	TraceSpan span("createTypes");
 	int pointerAttr = img.isX64() ? 0x1000C : 0x800A;
 
+	// types are converted in a single pass, references to types not converted yet
+	// and to field lists get placeholders that are patched by fixupDWARFTypes
+	nextDwarfType = kDWARFFieldListRef;
+	int die = -1; // DIEs are read in the same order as indexed by buildDIEIndex
+	int unit = -1;
 	unsigned long off = 0;
 	while (off < img.debug_info_length)
 	{
 		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+		TraceSpan cuSpan("compilation unit");
+		unit++;
 
 		DIECursor cursor(cu, (byte*)cu + sizeof(DWARF_CompilationUnit));
 		DWARF_InfoData id;
@@ -1159,10 +1445,13 @@ bool CV2PDB::createTypes()
 		{
 			//printf("0x%08x, level = %d, id.code = %d, id.tag = %d\n",
 			//    (unsigned char*)cu + id.entryOff - (unsigned char*)img.debug_info, cursor.level, id.code, id.tag);
+			die++;
+			assert(dieIndex.getPtr(die) == id.entryPtr);
 
-			if (id.specification)
+			int spec = id.specification ? dieIndex.find(id.specification) : -1;
+			if (spec >= 0)
 			{
-				DIECursor specCursor(cu, id.specification);
+				DIECursor specCursor = dieIndex.getCursor(spec);
 				DWARF_InfoData idspec;
 				specCursor.readNext(idspec);
                 //assert seems invalid, combination DW_TAG_member and DW_TAG_variable found in the wild
@@ -1171,23 +1460,31 @@ bool CV2PDB::createTypes()
 			}
 
 			int cvtype = -1;
+			int typeOff = cbUserTypes; // position of the type record appended for this DIE
 			switch (id.tag)
 			{
 			case DW_TAG_base_type:
 				cvtype = addDWARFBasicType(id.name, id.encoding, id.byte_size);
 				break;
 			case DW_TAG_typedef:
-				cvtype = appendModifierType(getTypeByDWARFPtr(cu, id.type), 0);
+				cvtype = appendModifierType(getTypeByDWARFPtr(cu, id.type), 0, false);
+				addDWARFTypeFixup(&CV2PDB::userTypes, &((codeview_type*)(userTypes + typeOff))->modifier_v2.type);
 				addUdtSymbol(cvtype, id.name);
 				break;
 			case DW_TAG_pointer_type:
 				cvtype = appendPointerType(getTypeByDWARFPtr(cu, id.type), pointerAttr);
+				if (cbUserTypes > typeOff) // not shared with an identical pointer type
+					addDWARFTypeFixup(&CV2PDB::userTypes, &((codeview_type*)(userTypes + typeOff))->pointer_v2.datatype);
 				break;
 			case DW_TAG_const_type:
 				cvtype = appendModifierType(getTypeByDWARFPtr(cu, id.type), 1);
+				if (cbUserTypes > typeOff)
+					addDWARFTypeFixup(&CV2PDB::userTypes, &((codeview_type*)(userTypes + typeOff))->modifier_v2.type);
 				break;
 			case DW_TAG_reference_type:
 				cvtype = appendPointerType(getTypeByDWARFPtr(cu, id.type), pointerAttr | 0x20);
+				if (cbUserTypes > typeOff)
+					addDWARFTypeFixup(&CV2PDB::userTypes, &((codeview_type*)(userTypes + typeOff))->pointer_v2.datatype);
 				break;
 
 			case DW_TAG_class_type:
@@ -1196,7 +1493,7 @@ bool CV2PDB::createTypes()
 				cvtype = addDWARFStructure(id, cu, cursor.getSubtreeCursor());
 				break;
 			case DW_TAG_array_type:
-				cvtype = addDWARFArray(id, cu, cursor.getSubtreeCursor());
+				cvtype = addDWARFArray(id, cu, die);
 				break;
 			case DW_TAG_subroutine_type:
 			case DW_TAG_subrange_type:
@@ -1222,37 +1519,35 @@ bool CV2PDB::createTypes()
 				if (id.name && id.pclo && id.pchi)
 				{
 					addDWARFProc(id, cu, cursor.getSubtreeCursor());
-					int rc = mod->AddPublic2(id.name, img.codeSegment + 1, id.pclo - codeSegOff, 0);
+					DWARFPublic pub = { id.linkage_name ? id.linkage_name : id.name, img.codeSegment + 1, id.pclo - codeSegOff, 0 };
+					dwarfPublics.push_back(pub);
 				}
 				break;
 
 			case DW_TAG_compile_unit:
-#if !FULL_CONTRIB
-				if (id.dir && id.name)
+				if (!useGlobalMod)
 				{
+					mspdb::Mod* unitMod = openDWARFModule(unit, id.name);
+					if (!unitMod)
+						return false;
+					if (id.hasStmtList)
+						dwarfLineUnits[id.stmt_list] = unit;
+
 					if (id.ranges > 0 && id.ranges < img.debug_ranges_length)
 					{
-						unsigned char* r = (unsigned char*)img.debug_ranges + id.ranges;
-						unsigned char* rend = (unsigned char*)img.debug_ranges + img.debug_ranges_length;
-						while (r < rend)
-						{
-							unsigned long pclo = RD4(r);
-							unsigned long pchi = RD4(r);
-							if (pclo == 0 && pchi == 0)
-								break;
-							//printf("%s %s %x - %x\n", dir, name, pclo, pchi);
-							if (!addDWARFSectionContrib(mod, pclo, pchi))
-								return false;
-						}
+						//printf("%s %s ranges %x\n", dir, name, id.ranges);
+						if (!addDWARFRanges(unitMod, cu, id.ranges, id.pclo))
+							return false;
+						dwarfUnitContrib[unit] = true;
 					}
-					else
+					else if (id.pclo && id.pchi > id.pclo)
 					{
 						//printf("%s %s %x - %x\n", dir, name, pclo, pchi);
-						if (!addDWARFSectionContrib(mod, id.pclo, id.pchi))
+						if (!addDWARFSectionContrib(unitMod, id.pclo, id.pchi))
 							return false;
+						dwarfUnitContrib[unit] = true;
 					}
 				}
-#endif
 				break;
 
 			case DW_TAG_variable:
@@ -1279,7 +1574,8 @@ bool CV2PDB::createTypes()
 					{
 						int type = getTypeByDWARFPtr(cu, id.type);
 						appendGlobalVar(id.name, type, seg + 1, segOff);
-						int rc = mod->AddPublic2(id.name, seg + 1, segOff, type);
+						DWARFPublic pub = { id.linkage_name ? id.linkage_name : id.name, seg + 1, segOff, type };
+						dwarfPublics.push_back(pub);
 					}
 				}
 				break;
@@ -1293,47 +1589,64 @@ bool CV2PDB::createTypes()
 				break;
 			}
 
+			// identical pointer and modifier types share the type appended first
 			if (cvtype >= 0)
-			{
-				assert(cvtype == typeID); typeID++;
-				assert(mapOffsetToType[id.entryPtr] == cvtype);
-			}
+				dieCVType[die] = cvtype;
 		}
 
 		off += sizeof(cu->unit_length) + cu->unit_length;
+
+		if (!useGlobalMod)
+		{
+			// symbols appended by this unit, a unit without DW_TAG_compile_unit still needs a module for them
+			dwarfUnitSymbolEnd[unit] = spillUdtSymbols.cb + cbUdtSymbols;
+			int begin = unit > 0 ? dwarfUnitSymbolEnd[unit - 1] : 0;
+			if (dwarfUnitSymbolEnd[unit] > begin && !openDWARFModule(unit, 0))
+				return false;
+		}
+
+		if (maxMemory && !spillDWARFBuffers())
+			return false;
 	}
 
+	if (!fixupDWARFTypes())
+		return false;
+
+	if (maxMemory)
+	{
+		// the DIE index and the type map are not needed anymore, release them
+		// before the spilled records are read back
+		dieIndex.clear();
+		std::vector<int>().swap(dieCVType);
+	}
 	return true;
 }
 
-bool CV2PDB::createDWARFModules()
+bool CV2PDB::initDWARFTypes()
 {
 	if(!img.debug_info)
 		return setError("no .debug_info section found");
 
 	codeSegOff = img.getImageBase() + img.getSection(img.codeSegment).VirtualAddress;
 
-	mspdb::Mod* mod = globalMod();
-	for (int s = 0; s < img.countSections(); s++)
+	if (useGlobalMod)
+		countEntries = 0;
+	else
 	{
-		const IMAGE_SECTION_HEADER& sec = img.getSection(s);
-		int rc = dbi->AddSec(s + 1, 0x10d, 0, sec.SizeOfRawData);
-		if (rc <= 0)
-			return setError("cannot add section");
+		// one module per compilation unit, opened by createTypes
+		for (unsigned long off = 0; off < img.debug_info_length; )
+		{
+			DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+			dwarfUnitOffsets.push_back(off);
+			off += sizeof(cu->unit_length) + cu->unit_length;
+		}
+		countEntries = dwarfUnitOffsets.size();
+		modules = new mspdb::Mod* [countEntries];
+		memset (modules, 0, countEntries * sizeof(*modules));
+		dwarfUnitSymbolEnd.assign(countEntries, 0);
+		dwarfUnitContrib.assign(countEntries, false);
 	}
 
-#define FULL_CONTRIB 1
-#if FULL_CONTRIB
-	// we use a single global module, so we can simply add the whole text segment
-	int segFlags = 0x60101020; // 0x40401040, 0x60500020; // TODO
-	int s = img.codeSegment;
-	int pclo = 0; // img.getImageBase() + img.getSection(s).VirtualAddress;
-	int pchi = pclo + img.getSection(s).Misc.VirtualSize;
-	int rc = mod->AddSecContrib(s + 1, pclo, pchi - pclo, segFlags);
-	if (rc <= 0)
-		return setError("cannot add section contribution to module");
-#endif
-
 	checkUserTypeAlloc();
 	*(DWORD*) userTypes = 4;
 	cbUserTypes = 4;
@@ -1347,12 +1660,48 @@ bool CV2PDB::createDWARFModules()
 	}
 
 	DIECursor::setContext(&img);
+	return true;
+}
 
-	countEntries = 0;
-	if (!mapTypes())
+bool CV2PDB::addDWARFSections()
+{
+	for (int s = 0; s < img.countSections(); s++)
+	{
+		const IMAGE_SECTION_HEADER& sec = img.getSection(s);
+		int rc = dbi->AddSec(s + 1, 0x10d, 0, sec.SizeOfRawData);
+		if (rc <= 0)
+			return setError("cannot add section");
+	}
+
+	if (useGlobalMod)
+	{
+		// we use a single global module, so we can simply add the whole text segment
+		int segFlags = 0x60101020; // 0x40401040, 0x60500020; // TODO
+		int s = img.codeSegment;
+		int pclo = 0; // img.getImageBase() + img.getSection(s).VirtualAddress;
+		int pchi = pclo + img.getSection(s).Misc.VirtualSize;
+		int rc = globalMod()->AddSecContrib(s + 1, pclo, pchi - pclo, segFlags);
+		if (rc <= 0)
+			return setError("cannot add section contribution to module");
+	}
+	return true;
+}
+
+bool CV2PDB::createDWARFModules()
+{
+	TraceSpan span("createDWARFModules");
+	if (!initDWARFTypes())
+		return false;
+	if (!addDWARFSections())
+		return false;
+	if (!cfiIndex.isBuilt() && !buildCFIIndex(*this))
+		return false;
+	if (!buildDIEIndex())
 		return false;
 	if (!createTypes())
 		return false;
+	if (!useGlobalMod && !addDWARFARanges())
+		return false;
 
 	/*
 	if(!iterateDWARFDebugInfo(kOpMapTypes))
@@ -1361,56 +1710,143 @@ bool CV2PDB::createDWARFModules()
 		return false;
 	*/
 
-#if 0
-	modules = new mspdb::Mod* [countEntries];
-	memset (modules, 0, countEntries * sizeof(*modules));
-
-	for (int m = 0; m < countEntries; m++)
-	{
-		mspdb::Mod* mod = globalMod();
-	}
-#endif
+	if (!reloadDWARFBuffer(&CV2PDB::userTypes, &CV2PDB::cbUserTypes, &CV2PDB::checkUserTypeAlloc))
+		return false;
 
-	if(cbUserTypes > 0 || cbDwarfTypes)
+	if(cbUserTypes > 0 || cbDwarfTypes || spillDwarfTypes.cb)
 	{
 		if(dwarfTypes)
 		{
-			checkUserTypeAlloc(cbDwarfTypes);
+			// spilled field lists are read directly behind the user types
+			checkUserTypeAlloc(spillDwarfTypes.cb + cbDwarfTypes);
+			int cbSpilled = spillDwarfTypes.cb;
+			if (!readSpillFile(spillDwarfTypes, userTypes + cbUserTypes))
+				return false;
+			cbUserTypes += cbSpilled;
 			memcpy(userTypes + cbUserTypes, dwarfTypes, cbDwarfTypes);
 			cbUserTypes += cbDwarfTypes;
 			cbDwarfTypes = 0;
 		}
-		int rc = mod->AddTypes(userTypes, cbUserTypes);
-		if (rc <= 0)
-			return setError("cannot add type info to module");
+		// as with CodeView input, every module gets all types
+		for (int m = 0; m < (useGlobalMod ? 1 : countEntries); m++)
+		{
+			mspdb::Mod* mod = useGlobalMod ? globalMod() : modules[m];
+			if (!mod)
+				continue;
+			TraceSpan span("AddTypes");
+			int rc = mod->AddTypes(userTypes, cbUserTypes);
+			if (rc <= 0)
+				return setError("cannot add type info to module");
+		}
+	}
+
+	if (maxMemory)
+	{
+		// the PDB has a copy of the types now
+		memTrack(kMemUserTypes, allocUserTypes, 0);
+		memTrack(kMemDwarfTypes, allocDwarfTypes, 0);
+		free(userTypes);
+		free(dwarfTypes);
+		userTypes = dwarfTypes = 0;
+		cbUserTypes = allocUserTypes = 0;
+		cbDwarfTypes = allocDwarfTypes = 0;
 	}
 	return true;
 }
 
 bool CV2PDB::addDWARFLines()
 {
+	TraceSpan span("addDWARFLines");
 	if(!img.debug_line)
 		return setError("no .debug_line section found");
 
+	if (!useGlobalMod)
+	{
+		// the lines go to the module of the compilation unit referring to their line number program
+		if (!dwarfLinesDecoded && !decodeDWARFLines(*this))
+			return false;
+		std::vector<mspdb::Mod*> blockMods(dwarfLineBlocks.size());
+		for (size_t b = 0; b < dwarfLineBlocks.size(); b++)
+		{
+			std::map<unsigned long, int>::iterator it = dwarfLineUnits.find(dwarfLineBlocks[b].unit);
+			blockMods[b] = it != dwarfLineUnits.end() && modules[it->second] ? modules[it->second] : globalMod();
+		}
+		if (!addDWARFLineBlocks(0, dwarfLineBlocks, blockMods.data()))
+			return setError("cannot add line number info to module");
+		return true;
+	}
+
+	if (dwarfLinesDecoded)
+	{
+		if (!addDWARFLineBlocks(globalMod(), dwarfLineBlocks))
+			return setError("cannot add line number info to module");
+		std::vector<DWARF_LineBlock>().swap(dwarfLineBlocks);
+		return true;
+	}
+
     if (!interpretDWARFLines(img, globalMod()))
 		return setError("cannot add line number info to module");
 
     return true;
 }
 
+bool CV2PDB::decodeDWARFLines(LastError& error)
+{
+	TraceSpan span("decodeDWARFLines");
+	if(!img.debug_line)
+		return error.setError("no .debug_line section found");
+
+	dwarfLineBlocks.clear();
+	if (!interpretDWARFLines(img, 0, &dwarfLineBlocks))
+		return error.setError("cannot decode line number info");
+	dwarfLinesDecoded = true;
+	return true;
+}
+
+bool CV2PDB::buildCFIIndex(LastError& error)
+{
+	TraceSpan span("buildCFIIndex");
+	if (!cfiIndex.build(img))
+		return error.setError("cannot index .debug_frame");
+	return true;
+}
+
 bool CV2PDB::addDWARFPublics()
 {
-	mspdb::Mod* mod = globalMod();
+	TraceSpan span("addDWARFPublics");
+	mspdb::Mod* mod = useGlobalMod ? globalMod() : 0;
 
-	int type = 0;
-	int rc = mod->AddPublic2("public_all", img.codeSegment + 1, 0, 0x1000);
-	if (rc <= 0)
-		return setError("cannot add public");
+	if (dwarfPublics.empty())
+	{
+		int rc = mod ? mod->AddPublic2("public_all", img.codeSegment + 1, 0, 0x1000)
+		             : dbi->AddPublic2("public_all", img.codeSegment + 1, 0, 0x1000);
+		if (rc <= 0)
+			return setError("cannot add public");
+		return true;
+	}
+
+	// a name is only added once, at its lowest address, e.g. for functions emitted by multiple units
+	std::sort(dwarfPublics.begin(), dwarfPublics.end(), DWARFPublic::lessName);
+	std::vector<DWARFPublic>::iterator last = std::unique(dwarfPublics.begin(), dwarfPublics.end(), DWARFPublic::sameName);
+	dwarfPublics.erase(last, dwarfPublics.end());
+
+	// added in address order, the address map of the publics is sorted that way
+	std::sort(dwarfPublics.begin(), dwarfPublics.end(), DWARFPublic::lessAddress);
+	for (size_t i = 0; i < dwarfPublics.size(); i++)
+	{
+		const DWARFPublic& pub = dwarfPublics[i];
+		int rc = mod ? mod->AddPublic2(pub.name, pub.seg, pub.offset, pub.type)
+		             : dbi->AddPublic2(pub.name, pub.seg, pub.offset, pub.type);
+		if (rc <= 0)
+			return setError("cannot add public");
+	}
+	std::vector<DWARFPublic>().swap(dwarfPublics);
 	return true;
 }
 
-bool CV2PDB::writeDWARFImage(const TCHAR* opath)
+bool CV2PDB::writeDWARFImage(const char* opath)
 {
+	TraceSpan span("writeDWARFImage");
 	int len = sizeof(*rsds) + strlen((char*)(rsds + 1)) + 1;
 	if (!img.replaceDebugSection(rsds, len, false))
 		return setError(img.getLastError());
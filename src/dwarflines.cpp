@@ -9,6 +9,7 @@
 #include "mspdb.h"
 #include "dwarf.h"
 #include "readDwarf.h"
+#include "trace.h"
 
 bool isRelativePath(const std::string& s)
 {
@@ -42,7 +43,124 @@ bool printLines(char const *fname, unsigned short sec, char const *secname,
 }
 
 
-bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& state)
+// read the opcode lengths, include directories and file names following the line program header
+static unsigned char* readLineProgramHeader(DWARF_LineNumberProgramHeader* hdr, unsigned char* end,
+                                            std::vector<unsigned int>& opcode_lengths, DWARF_LineState& state)
+{
+	unsigned char* p = (unsigned char*) (hdr + 1);
+
+	opcode_lengths.resize(hdr->opcode_base);
+	if (hdr->opcode_base > 0)
+	{
+		opcode_lengths[0] = 0;
+		for(int o = 1; o < hdr->opcode_base && p < end; o++)
+			opcode_lengths[o] = LEB128(p);
+	}
+
+	// dirs
+	while(p < end)
+	{
+		if(*p == 0)
+			break;
+		state.include_dirs.push_back((const char*) p);
+		p += strlen((const char*) p) + 1;
+	}
+	p++;
+
+	// files
+	DWARF_FileName fname;
+	while(p < end && *p)
+	{
+		fname.read(p);
+		state.files.push_back(fname);
+	}
+	p++;
+	return p;
+}
+
+// file name with the include directory prepended and backslashes as separators
+static std::string fullFileName(const DWARF_LineState& state, const DWARF_FileName* dfn)
+{
+	std::string fname = dfn->file_name;
+	
+	if(isRelativePath(fname) && 
+	   dfn->dir_index > 0 && dfn->dir_index <= state.include_dirs.size())
+	{
+		std::string dir = state.include_dirs[dfn->dir_index - 1];
+		if(dir.length() > 0 && dir[dir.length() - 1] != '/' && dir[dir.length() - 1] != '\\')
+			dir.append("\\");
+		fname = dir + fname;
+	}
+	for(size_t i = 0; i < fname.length(); i++)
+		if(fname[i] == '/')
+			fname[i] = '\\';
+	return fname;
+}
+
+bool readDWARFLineFiles(const PEImage& img, unsigned long unit, std::vector<std::string>& files)
+{
+	files.clear();
+	if(unit >= img.debug_line_length)
+		return false;
+
+	DWARF_LineNumberProgramHeader* hdr = (DWARF_LineNumberProgramHeader*) (img.debug_line + unit);
+	int length = hdr->unit_length;
+	if(length < 0 || unit + length + sizeof(length) > img.debug_line_length)
+		return false;
+	unsigned char* end = (unsigned char*) hdr + length + sizeof(length);
+
+	std::vector<unsigned int> opcode_lengths;
+	DWARF_LineState state;
+	readLineProgramHeader(hdr, end, opcode_lengths, state);
+
+	files.reserve(state.files.size());
+	for(size_t f = 0; f < state.files.size(); f++)
+		files.push_back(fullFileName(state, &state.files[f]));
+	return true;
+}
+
+// pass the lines to the PDB, or collect them in blocks if given
+static int addLines(mspdb::Mod* mod, std::vector<DWARF_LineBlock>* blocks, unsigned long unit, const std::string& fname, unsigned short seg,
+                    unsigned int firstAddr, unsigned int length, unsigned int firstLine,
+                    const mspdb::LineInfoEntry* lines, size_t count)
+{
+	if (!blocks)
+	{
+		TraceSpan span("AddLines", fname.c_str());
+		return mod->AddLines(fname.c_str(), seg, firstAddr, length, firstAddr, firstLine,
+		                     (unsigned char*) lines, count * sizeof(*lines));
+	}
+
+	blocks->push_back(DWARF_LineBlock());
+	DWARF_LineBlock& block = blocks->back();
+	block.unit = unit;
+	block.fname = fname;
+	block.seg = seg;
+	block.firstAddr = firstAddr;
+	block.length = length;
+	block.firstLine = firstLine;
+	block.endSequence = false;
+	block.lines.assign(lines, lines + count);
+	memTrack(kMemLineInfo, 0, count * sizeof(*lines));
+	return 1;
+}
+
+bool addDWARFLineBlocks(mspdb::Mod* mod, std::vector<DWARF_LineBlock>& blocks, mspdb::Mod* const* blockMods)
+{
+	bool ok = true;
+	for (size_t b = 0; b < blocks.size() && ok; b++)
+	{
+		const DWARF_LineBlock& block = blocks[b];
+		ok = addLines(blockMods ? blockMods[b] : mod, 0, block.unit, block.fname, block.seg, block.firstAddr, block.length, block.firstLine,
+		              block.lines.data(), block.lines.size()) > 0;
+	}
+	for (size_t b = 0; b < blocks.size(); b++)
+		memTrack(kMemLineInfo, blocks[b].lines.size() * sizeof(mspdb::LineInfoEntry), 0);
+	std::vector<DWARF_LineBlock>().swap(blocks);
+	return ok;
+}
+
+bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, std::vector<DWARF_LineBlock>* blocks, DWARF_LineState& state)
 {
 	if(state.lineInfo.size() == 0)
 		return true;
@@ -70,27 +188,16 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 		dfn = &state.files[state.file - 1];
 	else
 		return false;
-	std::string fname = dfn->file_name;
-	
-	if(isRelativePath(fname) && 
-	   dfn->dir_index > 0 && dfn->dir_index <= state.include_dirs.size())
-	{
-		std::string dir = state.include_dirs[dfn->dir_index - 1];
-		if(dir.length() > 0 && dir[dir.length() - 1] != '/' && dir[dir.length() - 1] != '\\')
-			dir.append("\\");
-		fname = dir + fname;
-	}
-	for(size_t i = 0; i < fname.length(); i++)
-		if(fname[i] == '/')
-			fname[i] = '\\';
+	std::string fname = fullFileName(state, dfn);
 
-    if (!mod)
+    if (!mod && !blocks)
     {
         printLines(fname.c_str(), segIndex, img.findSectionSymbolName(segIndex),
                    state.lineInfo.data(), state.lineInfo.size());
 		state.lineInfo.resize(0);
 		return true;
     }
+
 #if 1
 	bool dump = false; // (fname == "cvtest.d");
 	//qsort(&state.lineInfo[0], state.lineInfo.size(), sizeof(state.lineInfo[0]), cmpAdr);
@@ -114,9 +221,8 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 				unsigned int length = state.lineInfo[entry-1].offset + 1; // firstAddr has been subtracted before
 				if(dump)
 					printf("AddLines(%08x+%04x, Line=%4d+%3d, %s)\n", firstAddr, length, firstLine, entry - firstEntry, fname.c_str());
-				rc = mod->AddLines(fname.c_str(), segIndex + 1, firstAddr, length, firstAddr, firstLine,
-									(unsigned char*) &state.lineInfo[firstEntry], 
-									(ln - firstEntry) * sizeof(state.lineInfo[0]));
+				rc = addLines(mod, blocks, state.unit, fname, segIndex + 1, firstAddr, length, firstLine,
+				              &state.lineInfo[firstEntry], ln - firstEntry);
 				firstLine = state.lineInfo[ln].line;
 				firstAddr = state.lineInfo[ln].offset;
 				firstEntry = entry;
@@ -131,9 +237,10 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 	unsigned int length = eaddr - firstAddr;
 	if(dump)
 		printf("AddLines(%08x+%04x, Line=%4d+%3d, %s)\n", firstAddr, length, firstLine, entry - firstEntry, fname.c_str());
-	rc = mod->AddLines(fname.c_str(), segIndex + 1, firstAddr, length, firstAddr, firstLine,
-					    (unsigned char*) &state.lineInfo[firstEntry], 
-					    (entry - firstEntry) * sizeof(state.lineInfo[0]));
+	rc = addLines(mod, blocks, state.unit, fname, segIndex + 1, firstAddr, length, firstLine,
+	              &state.lineInfo[firstEntry], entry - firstEntry);
+	if(blocks && rc > 0)
+		blocks->back().endSequence = state.end_sequence;
 
 #else
 	unsigned int firstLine = 0;
@@ -146,49 +253,28 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 	return rc > 0;
 }
 
-bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
+bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod, std::vector<DWARF_LineBlock>* blocks)
 {
+	bool dumpOnly = !mod && !blocks;
 	for(unsigned long off = 0; off < img.debug_line_length; )
 	{
 		DWARF_LineNumberProgramHeader* hdr = (DWARF_LineNumberProgramHeader*) (img.debug_line + off);
+		TraceSpan span("line program");
 		int length = hdr->unit_length;
 		if(length < 0)
 			break;
 		length += sizeof(length);
 
-		unsigned char* p = (unsigned char*) (hdr + 1);
 		unsigned char* end = (unsigned char*) hdr + length;
 
-		std::vector<unsigned int> opcode_lengths;
-		opcode_lengths.resize(hdr->opcode_base);
-		if (hdr->opcode_base > 0)
-		{
-			opcode_lengths[0] = 0;
-			for(int o = 1; o < hdr->opcode_base && p < end; o++)
-				opcode_lengths[o] = LEB128(p);
-		}
-
 		DWARF_LineState state;
+		state.unit = off;
 		state.seg_offset = img.getImageBase() + img.getSection(img.codeSegment).VirtualAddress;
 
-		// dirs
-		while(p < end)
-		{
-			if(*p == 0)
-				break;
-			state.include_dirs.push_back((const char*) p);
-			p += strlen((const char*) p) + 1;
-		}
-		p++;
+		std::vector<unsigned int> opcode_lengths;
+		unsigned char* p = readLineProgramHeader(hdr, end, opcode_lengths, state);
 
-		// files
 		DWARF_FileName fname;
-		while(p < end && *p)
-		{
-			fname.read(p);
-			state.files.push_back(fname);
-		}
-		p++;
 
 		state.init(hdr);
 		while(p < end)
@@ -227,16 +313,16 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 						state.end_sequence = true;
 						state.last_addr = state.address;
 						state.addLineInfo();
-						if(!_flushDWARFLines(img, mod, state))
+						if(!_flushDWARFLines(img, mod, blocks, state))
 							return false;
 						state.init(hdr);
 						break;
 					case DW_LNE_set_address:
-                        if (!mod && state.section == -1)
+                        if (dumpOnly && state.section == -1)
                             state.section = img.getRelocationInLineSegment((char*)p - img.debug_line);
 						if(unsigned long adr = RD4(p))
 							state.address = adr;
-						else if (!mod)
+						else if (dumpOnly)
 							state.address = adr;
                         else
 							state.address = state.last_addr; // strange adr 0 for templates?
@@ -268,7 +354,7 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 					state.line += SLEB128(p);
 					break;
 				case DW_LNS_set_file:
-					if(!_flushDWARFLines(img, mod, state))
+					if(!_flushDWARFLines(img, mod, blocks, state))
 						return false;
 					state.file = LEB128(p);
 					break;
@@ -305,7 +391,7 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 				}
 			}
 		}
-		if(!_flushDWARFLines(img, mod, state))
+		if(!_flushDWARFLines(img, mod, blocks, state))
 			return false;
 
 		off += length;
@@ -0,0 +1,67 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "fileio.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <share.h>
+#include <vector>
+
+static std::vector<wchar_t> wideFileName(const char* fname)
+{
+	int len = MultiByteToWideChar(CP_UTF8, 0, fname, -1, 0, 0);
+	std::vector<wchar_t> wname(len > 0 ? len : 1, 0);
+	if (len > 0)
+		MultiByteToWideChar(CP_UTF8, 0, fname, -1, wname.data(), len);
+	return wname;
+}
+
+std::string utf8FileName(const wchar_t* fname)
+{
+	int len = WideCharToMultiByte(CP_UTF8, 0, fname, -1, 0, 0, 0, 0);
+	std::vector<char> name(len > 0 ? len : 1, 0);
+	if (len > 0)
+		WideCharToMultiByte(CP_UTF8, 0, fname, -1, name.data(), len, 0, 0);
+	return name.data();
+}
+
+int openFileRead(const char* fname)
+{
+	return _wsopen(wideFileName(fname).data(), O_RDONLY | O_BINARY, SH_DENYWR);
+}
+
+int openFileWrite(const char* fname, bool executable)
+{
+	int mode = S_IREAD | S_IWRITE | (executable ? S_IEXEC : 0);
+	return _wopen(wideFileName(fname).data(), O_WRONLY | O_CREAT | O_BINARY | O_TRUNC, mode);
+}
+
+FILE* openFileStream(const char* fname, const char* mode)
+{
+	return _wfopen(wideFileName(fname).data(), wideFileName(mode).data());
+}
+
+#else
+
+int openFileRead(const char* fname)
+{
+	return open(fname, O_RDONLY);
+}
+
+int openFileWrite(const char* fname, bool executable)
+{
+	mode_t mode = executable ? 0777 : 0666; // restricted by the umask
+	return open(fname, O_WRONLY | O_CREAT | O_TRUNC, mode);
+}
+
+FILE* openFileStream(const char* fname, const char* mode)
+{
+	return fopen(fname, mode);
+}
+
+#endif
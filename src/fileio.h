@@ -0,0 +1,36 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __FILEIO_H__
+#define __FILEIO_H__
+
+// file access of the conversion core. File names are UTF-8 on all platforms,
+// the descriptors are used with the POSIX read, write and close.
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <string>
+#else
+#include <unistd.h>
+#define O_BINARY 0
+#endif
+
+// returns -1 if the file cannot be opened
+int openFileRead(const char* fname);
+// creates or truncates the file, returns -1 if that fails
+int openFileWrite(const char* fname, bool executable = false);
+FILE* openFileStream(const char* fname, const char* mode);
+
+#ifdef _WIN32
+// file name of a wide command line argument as expected by the core
+std::string utf8FileName(const wchar_t* fname);
+#endif
+
+#endif //__FILEIO_H__
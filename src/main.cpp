@@ -7,8 +7,14 @@
 #include "PEImage.h"
 #include "cv2pdb.h"
 #include "symutil.h"
+#include "memreport.h"
+#include "trace.h"
+#include "taskgraph.h"
+#include "symbolize.h"
+#include "fileio.h"
 
 #include <direct.h>
+#include <thread>
 
 double
 #include "../VERSION"
@@ -21,10 +27,12 @@ double
 #define T_strcpy	wcscpy
 #define T_strcat	wcscat
 #define T_strstr	wcsstr
+#define T_strncmp	wcsncmp
 #define T_strtod	wcstod
 #define T_strrchr	wcsrchr
 #define T_unlink	_wremove
 #define T_main		wmain
+#define T_fname(s)	utf8FileName(s).c_str()
 #define SARG		"%S"
 #else
 #define T_toupper	toupper
@@ -33,10 +41,12 @@ double
 #define T_strcpy	strcpy
 #define T_strcat	strcat
 #define T_strstr	strstr
+#define T_strncmp	strncmp
 #define T_strtod	strtod
 #define T_strrchr	strrchr
 #define T_unlink	unlink
 #define T_main		main
+#define T_fname(s)	(s)
 #define SARG		"%s"
 #endif
 
@@ -50,6 +60,45 @@ void fatal(const char *message, ...)
 	exit(1);
 }
 
+// reads hexadecimal addresses from stdin and prints the functions and source lines at them
+static int symbolizeAddresses(PEImage& img, const TCHAR* exe)
+{
+	if (!img.hasDWARF())
+		fatal(SARG ": no DWARF debug information found", exe);
+	if (!img.relocateDebugLineInfo(0x400000))
+		fatal(SARG ": %s", exe, img.getLastError());
+
+	DWARFSymbolizer symbolizer;
+	if (!symbolizer.build(img))
+		fatal(SARG ": %s", exe, symbolizer.getLastError());
+
+	std::vector<unsigned long> addrs;
+	char buf[256];
+	while (fgets(buf, sizeof(buf), stdin))
+	{
+		char* end;
+		unsigned long addr = strtoul(buf, &end, 16);
+		if (end != buf)
+			addrs.push_back(addr);
+	}
+
+	std::vector<SymbolizedFrame> frames;
+	std::vector<size_t> first;
+	symbolizer.symbolize(addrs.data(), addrs.size(), frames, first);
+
+	for (size_t i = 0; i < addrs.size(); i++)
+	{
+		printf("0x%08lx\n", addrs[i]);
+		for (size_t f = first[i]; f < first[i + 1]; f++)
+		{
+			printf("%s%s\n", frames[f].function ? frames[f].function : "??", frames[f].inlined ? " (inlined)" : "");
+			printf("%s:%u\n", frames[f].file ? frames[f].file : "??", frames[f].line);
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
 void makefullpath(TCHAR* pdbname)
 {
 	TCHAR* pdbstart = pdbname;
@@ -108,11 +157,51 @@ int T_main(int argc, TCHAR* argv[])
 	double Dversion = 2.043;
 	const TCHAR* pdbref = 0;
 	bool debug = false;
+	bool timing = false;
+	const TCHAR* traceFile = 0;
+	const TCHAR* memReportFile = 0;
+	double maxMemoryMB = 0;
+	bool globalModule = true;
+	bool symbolize = false;
 
 	while (argc > 1 && argv[1][0] == '-')
 	{
 		argv++;
 		argc--;
+		if (T_strncmp(argv[0], TEXT("--trace="), 8) == 0)
+		{
+			traceFile = argv[0] + 8;
+			continue;
+		}
+		if (T_strncmp(argv[0], TEXT("--mem-report"), 12) == 0 && (argv[0][12] == 0 || argv[0][12] == '='))
+		{
+			memReportEnabled = true;
+			if (argv[0][12] == '=')
+				memReportFile = argv[0] + 13;
+			continue;
+		}
+		if (T_strncmp(argv[0], TEXT("--max-memory="), 13) == 0)
+		{
+			maxMemoryMB = T_strtod(argv[0] + 13, 0);
+			if (maxMemoryMB <= 0)
+				fatal("invalid memory limit: " SARG, argv[0]);
+			continue;
+		}
+		if (T_strncmp(argv[0], TEXT("--global-module"), 15) == 0 && argv[0][15] == 0)
+		{
+			globalModule = true;
+			continue;
+		}
+		if (T_strncmp(argv[0], TEXT("--module-per-unit"), 17) == 0 && argv[0][17] == 0)
+		{
+			globalModule = false;
+			continue;
+		}
+		if (T_strncmp(argv[0], TEXT("--symbolize"), 11) == 0 && argv[0][11] == 0)
+		{
+			symbolize = true;
+			continue;
+		}
 		if (argv[0][1] == '-')
 			break;
 		if (argv[0][1] == 'D')
@@ -125,6 +214,8 @@ int T_main(int argc, TCHAR* argv[])
 			useTypedefEnum = true;
 		else if (argv[0][1] == 'd' && argv[0][2] == 'e' && argv[0][3] == 'b') // deb[ug]
 			debug = true;
+		else if (argv[0][1] == 't' && argv[0][2] == 'i' && argv[0][3] == 'm') // tim[e]
+			timing = true;
 		else if (argv[0][1] == 's' && argv[0][2])
 			dotReplacementChar = (char)argv[0][2];
 		else if (argv[0][1] == 'p' && argv[0][2])
@@ -141,19 +232,28 @@ int T_main(int argc, TCHAR* argv[])
 		printf("License for redistribution is given by the Artistic License 2.0\n");
 		printf("see file LICENSE for further details\n");
 		printf("\n");
-		printf("usage: " SARG " [-Dversion|-C|-n|-e|-sC|-pembedded-pdb] <exe-file> [new-exe-file] [pdb-file]\n", argv[0]);
+		printf("usage: " SARG " [-Dversion|-C|-n|-e|-sC|-pembedded-pdb|-time|--trace=file.json|--mem-report[=file.json]|--max-memory=MB|--module-per-unit] <exe-file> [new-exe-file] [pdb-file]\n", argv[0]);
+		printf("       " SARG " --symbolize <exe-file> < addresses\n", argv[0]);
 		return -1;
 	}
 
+	traceEnabled = timing || traceFile;
+
 	PEImage img;
-	if (!img.loadExe(argv[1]))
-		fatal(SARG ": %s", argv[1], img.getLastError());
+	{
+		TraceSpan span("loadExe");
+		if (!img.loadExe(T_fname(argv[1])))
+			fatal(SARG ": %s", argv[1], img.getLastError());
+	}
+	if (symbolize)
+		return symbolizeAddresses(img, argv[1]);
 	if (img.countCVEntries() == 0 && !img.hasDWARF())
 		fatal(SARG ": no codeview debug entries found", argv[1]);
 
 	CV2PDB cv2pdb(img);
 	cv2pdb.Dversion = Dversion;
 	cv2pdb.debug = debug;
+	cv2pdb.maxMemory = (size_t) (maxMemoryMB * 1024 * 1024);
 	cv2pdb.initLibraries();
 
 	TCHAR* outname = argv[1];
@@ -176,28 +276,58 @@ int T_main(int argc, TCHAR* argv[])
 
 	T_unlink(pdbname);
 
-	if(!cv2pdb.openPDB(pdbname, pdbref))
+	if(!cv2pdb.openPDB(T_fname(pdbname), pdbref ? T_fname(pdbref) : 0))
 		fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
 
 	if(img.hasDWARF())
 	{
-		if(!img.relocateDebugLineInfo(0x400000))
-			fatal(SARG ": %s", argv[1], cv2pdb.getLastError());
-
-		if(!cv2pdb.createDWARFModules())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if(!cv2pdb.addDWARFTypes())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if(!cv2pdb.addDWARFLines())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.addDWARFPublics())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.writeDWARFImage(outname))
-			fatal(SARG ": %s", outname, cv2pdb.getLastError());
+		cv2pdb.useGlobalMod = globalModule;
+
+		// decoding the line number program and indexing .debug_frame don't touch the PDB,
+		// so they run on worker threads while the types are converted. They report errors
+		// to their own LastError, only the tasks on the PDB thread use the one of cv2pdb.
+		TaskGraph graph;
+		const TCHAR* taskFile[8];
+		const LastError* taskError[8];
+		LastError linesError, cfiError;
+		int reloc = graph.addTask("relocateDebugLineInfo", [&]() { return img.relocateDebugLineInfo(0x400000); }, false);
+		taskFile[reloc] = argv[1];
+		taskError[reloc] = &img;
+		int lines = graph.addTask("decodeDWARFLines", [&]() { return cv2pdb.decodeDWARFLines(linesError); }, false);
+		taskFile[lines] = pdbname;
+		taskError[lines] = &linesError;
+		int cfi = graph.addTask("buildCFIIndex", [&]() { return cv2pdb.buildCFIIndex(cfiError); }, false);
+		taskFile[cfi] = argv[1];
+		taskError[cfi] = &cfiError;
+		int modules = graph.addTask("createDWARFModules", [&]() { return cv2pdb.createDWARFModules(); }, true);
+		taskFile[modules] = pdbname;
+		taskError[modules] = &cv2pdb;
+		int types = graph.addTask("addDWARFTypes", [&]() { return cv2pdb.addDWARFTypes(); }, true);
+		taskFile[types] = pdbname;
+		taskError[types] = &cv2pdb;
+		int addLines = graph.addTask("addDWARFLines", [&]() { return cv2pdb.addDWARFLines(); }, true);
+		taskFile[addLines] = pdbname;
+		taskError[addLines] = &cv2pdb;
+		int publics = graph.addTask("addDWARFPublics", [&]() { return cv2pdb.addDWARFPublics(); }, true);
+		taskFile[publics] = pdbname;
+		taskError[publics] = &cv2pdb;
+		int write = graph.addTask("writeDWARFImage", [&]() { return cv2pdb.writeDWARFImage(T_fname(outname)); }, true);
+		taskFile[write] = outname;
+		taskError[write] = &cv2pdb;
+
+		graph.addDependency(lines, reloc);
+		graph.addDependency(modules, cfi);
+		graph.addDependency(types, modules);
+		graph.addDependency(addLines, types);
+		graph.addDependency(addLines, lines);
+		graph.addDependency(publics, addLines);
+		graph.addDependency(write, publics);
+
+		if (!graph.run(std::thread::hardware_concurrency()))
+		{
+			int failed = graph.failedTask();
+			fatal(SARG ": %s", taskFile[failed], taskError[failed]->getLastError());
+		}
 	}
 	else
 	{
@@ -225,9 +355,28 @@ int T_main(int argc, TCHAR* argv[])
 		if (!cv2pdb.addPublics())
 			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
 
-		if (!cv2pdb.writeImage(outname))
+		if (!cv2pdb.writeImage(T_fname(outname)))
 			fatal(SARG ": %s", outname, cv2pdb.getLastError());
 	}
 
+	{
+		TraceSpan span("cleanup");
+		cv2pdb.cleanup(true);
+	}
+
+	if (timing)
+		tracePrintPhases();
+	if (traceFile && !traceWriteJSON(T_fname(traceFile)))
+		fatal(SARG ": cannot write trace", traceFile);
+	if (memReportFile)
+	{
+		if (!memWriteJSON(T_fname(memReportFile)))
+			fatal(SARG ": cannot write memory report", memReportFile);
+	}
+	else if (memReportEnabled)
+		memPrintReport();
+	if (maxMemoryMB > 0)
+		printf("peak working set: %.1f MB, limit %g MB\n", memPeakRSS() / (1024.0 * 1024.0), maxMemoryMB);
+
 	return 0;
 }
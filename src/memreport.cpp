@@ -0,0 +1,108 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "memreport.h"
+#include "fileio.h"
+
+#include <stdio.h>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+bool memReportEnabled = false;
+
+struct MemStats
+{
+	size_t current;
+	size_t peak;
+	unsigned int allocs;
+	unsigned int reallocs;
+	unsigned long long copied; // upper bound, realloc might grow in place
+};
+
+static std::mutex memMutex; // buffers are also resized by the phases running on worker threads
+static MemStats stats[kMemBuffers];
+static size_t totalCurrent;
+static size_t totalPeak;
+
+static const char* const bufferNames[kMemBuffers] =
+{
+	"image",
+	"globalTypes",
+	"userTypes",
+	"dwarfTypes",
+	"udtSymbols",
+	"symbols",
+	"dieIndex",
+	"lineInfo",
+};
+
+void memTrackResize(MemBuffer buf, size_t oldSize, size_t newSize)
+{
+	std::lock_guard<std::mutex> lock(memMutex);
+	MemStats& s = stats[buf];
+	if (oldSize == 0 && newSize > 0)
+		s.allocs++;
+	else if (oldSize > 0 && newSize > 0)
+	{
+		s.reallocs++;
+		s.copied += oldSize < newSize ? oldSize : newSize;
+	}
+
+	s.current += newSize - oldSize;
+	if (s.current > s.peak)
+		s.peak = s.current;
+
+	totalCurrent += newSize - oldSize;
+	if (totalCurrent > totalPeak)
+		totalPeak = totalCurrent;
+}
+
+size_t memPeakRSS()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize;
+#else
+	rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return (size_t) ru.ru_maxrss * 1024; // kilobytes on Linux
+#endif
+}
+
+void memPrintReport()
+{
+	printf("%-16s %12s %12s %8s %8s %14s\n", "buffer", "current", "peak", "allocs", "reallocs", "realloc copy");
+	for (int b = 0; b < kMemBuffers; b++)
+		printf("%-16s %12llu %12llu %8u %8u %14llu\n", bufferNames[b], (unsigned long long) stats[b].current,
+		       (unsigned long long) stats[b].peak, stats[b].allocs, stats[b].reallocs, stats[b].copied);
+	printf("%-16s %12llu %12llu\n", "total", (unsigned long long) totalCurrent, (unsigned long long) totalPeak);
+	printf("peak RSS: %llu bytes\n", (unsigned long long) memPeakRSS());
+}
+
+bool memWriteJSON(const char* fname)
+{
+	FILE* fp = openFileStream(fname, "w");
+	if (!fp)
+		return false;
+
+	fprintf(fp, "{\"buffers\":[\n");
+	for (int b = 0; b < kMemBuffers; b++)
+		fprintf(fp, "{\"name\":\"%s\",\"current\":%llu,\"peak\":%llu,\"allocs\":%u,\"reallocs\":%u,\"reallocCopied\":%llu}%s\n",
+		        bufferNames[b], (unsigned long long) stats[b].current, (unsigned long long) stats[b].peak,
+		        stats[b].allocs, stats[b].reallocs, stats[b].copied, b + 1 < kMemBuffers ? "," : "");
+	fprintf(fp, "],\"totalPeak\":%llu,\"peakRSS\":%llu}\n", (unsigned long long) totalPeak, (unsigned long long) memPeakRSS());
+	return fclose(fp) == 0;
+}
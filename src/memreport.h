@@ -0,0 +1,42 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __MEMREPORT_H__
+#define __MEMREPORT_H__
+
+#include <stddef.h>
+
+// named buffers accounted for by --mem-report
+enum MemBuffer
+{
+	kMemImage,       // PEImage::dump_base
+	kMemGlobalTypes, // CV2PDB::globalTypes
+	kMemUserTypes,   // CV2PDB::userTypes
+	kMemDwarfTypes,  // CV2PDB::dwarfTypes
+	kMemUdtSymbols,  // CV2PDB::udtSymbols
+	kMemSymbols,     // symbol buffer passed to AddSymbols
+	kMemDIEIndex,    // DIEIndex arrays
+	kMemLineInfo,    // line number entries passed to AddLines
+
+	kMemBuffers
+};
+
+extern bool memReportEnabled;
+
+void memTrackResize(MemBuffer buf, size_t oldSize, size_t newSize);
+
+// record a buffer changing size from oldSize to newSize bytes, 0 meaning not allocated
+inline void memTrack(MemBuffer buf, size_t oldSize, size_t newSize)
+{
+	if (memReportEnabled)
+		memTrackResize(buf, oldSize, newSize);
+}
+
+size_t memPeakRSS();
+void memPrintReport();
+bool memWriteJSON(const char* fname);
+
+#endif //__MEMREPORT_H__
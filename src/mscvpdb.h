@@ -96,7 +96,7 @@
  * types, they are not completely linked together.
  */
 
-#include "pshpack1.h"
+#pragma pack(push, 1)
 
 /* ======================================== *
  *             Type information
@@ -2027,7 +2027,7 @@ typedef struct _PDB_FPO_DATA
     DWORD       flags;
 } PDB_FPO_DATA;
 
-#include "poppack.h"
+#pragma pack(pop)
 
 /* ----------------------------------------------
  * Information used for parsing
@@ -2079,7 +2079,7 @@ extern BOOL coff_process_info(const struct msc_debug_info* msc_dbg);
 typedef struct OMFSignature
 {
     char        Signature[4];
-    long        filepos;
+    int         filepos;
 } OMFSignature;
 
 typedef struct OMFSignatureRSDS
@@ -2093,7 +2093,7 @@ typedef struct OMFSignatureRSDS
 typedef struct _CODEVIEW_PDB_DATA
 {
     char        Signature[4];
-    long        filepos;
+    int         filepos;
     DWORD       timestamp;
     DWORD       age;
     CHAR        name[1];
@@ -2155,9 +2155,9 @@ typedef struct OMFSymHash
 {
     unsigned short  symhash;
     unsigned short  addrhash;
-    unsigned long   cbSymbol;
-    unsigned long   cbHSym;
-    unsigned long   cbHAddr;
+    unsigned int    cbSymbol;
+    unsigned int    cbHSym;
+    unsigned int    cbHAddr;
 } OMFSymHash;
 
 /* sstSegMap section */
@@ -2170,8 +2170,8 @@ typedef struct OMFSegMapDesc
     unsigned short  frame;
     unsigned short  iSegName;
     unsigned short  iClassName;
-    unsigned long   offset;
-    unsigned long   cbSeg;
+    unsigned int    offset;
+    unsigned int    cbSeg;
 } OMFSegMapDesc;
 
 typedef struct OMFSegMap
@@ -2188,7 +2188,7 @@ typedef struct OMFSourceLine
 {
     unsigned short  Seg;
     unsigned short  cLnOff;
-    unsigned long   offset[1];
+    unsigned int    offset[1];
     unsigned short  lineNbr[1];
 } OMFSourceLine;
 
@@ -2196,7 +2196,7 @@ typedef struct OMFSourceFile
 {
     unsigned short  cSeg;
     unsigned short  reserved;
-    unsigned long   baseSrcLn[1];
+    unsigned int    baseSrcLn[1];
     unsigned short  cFName;
     char            Name;
 } OMFSourceFile;
@@ -2205,5 +2205,5 @@ typedef struct OMFSourceModule
 {
     unsigned short  cFile;
     unsigned short  cSeg;
-    unsigned long   baseSrcFile[1];
+    unsigned int    baseSrcFile[1];
 } OMFSourceModule;
@@ -6,6 +6,8 @@
 
 #include "mspdb.h"
 
+#ifdef _WIN32
+
 #include <windows.h>
 
 #pragma comment(lib, "rpcrt4.lib")
@@ -224,3 +226,48 @@ mspdb::PDB* CreatePDB(const wchar_t* pdbname)
 
 	return pdb;
 }
+
+#else
+
+// mspdb*.dll only exists on Windows, the conversion still runs without writing a PDB
+int mspdb::vsVersion = 8;
+
+bool initMsPdb()
+{
+	return false;
+}
+
+bool exitMsPdb()
+{
+	return true;
+}
+
+mspdb::PDB* CreatePDB(const wchar_t* pdbname)
+{
+	return 0;
+}
+
+// the wrappers in mspdb.h call these directly, they are never reached without a PDB
+namespace mspdb
+{
+long PDB_part1::QueryLastError(char * const) { return 0; }
+unsigned long PDB_part1::QueryAge(void) { return 0; }
+int PDB_part1::CreateDBI(char const *,struct DBI * *) { return 0; }
+int PDB_part1::OpenTpi(char const *,struct TPI * *) { return 0; }
+template<class BASE> int PDB_part2<BASE>::Commit(void) { return 0; }
+template<class BASE> int PDB_part2<BASE>::Close(void) { return 0; }
+template<class BASE> int PDB_part2<BASE>::QuerySignature2(struct _GUID *) { return 0; }
+template int PDB_part2<PDB_part1>::Commit(void);
+template int PDB_part2<PDB_part1>::Close(void);
+template int PDB_part2<PDB_part1>::QuerySignature2(struct _GUID *);
+
+int DBI_part1::OpenMod(char const *,char const *,struct Mod * *) { return 0; }
+int DBI_part1::AddSec(unsigned short,unsigned short,long,long) { return 0; }
+int DBI_part1::Close(void) { return 0; }
+template<class BASE> int DBI_BASE<BASE>::AddPublic2(char const *,unsigned short,long,unsigned long) { return 0; }
+template<class BASE> void DBI_BASE<BASE>::SetMachineType(unsigned short) {}
+template int DBI_BASE<DBI_part1>::AddPublic2(char const *,unsigned short,long,unsigned long);
+template void DBI_BASE<DBI_part1>::SetMachineType(unsigned short);
+}
+
+#endif // _WIN32
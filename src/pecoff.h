@@ -0,0 +1,314 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __PECOFF_H__
+#define __PECOFF_H__
+
+// basic types and PE/COFF file structures used by the conversion core. They come
+// from the Windows SDK on Windows, other platforms get definitions with the same layout.
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t  BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t  LONG;
+typedef uint32_t ULONG;
+typedef int16_t  SHORT;
+typedef uint16_t USHORT;
+typedef char     CHAR;
+typedef uint8_t  UCHAR;
+typedef int      BOOL;
+typedef int64_t  LONGLONG;
+typedef uint64_t ULONGLONG;
+
+typedef struct _GUID
+{
+	DWORD Data1;
+	WORD  Data2;
+	WORD  Data3;
+	BYTE  Data4[8];
+} GUID, CLSID;
+
+inline bool operator==(const GUID& g1, const GUID& g2) { return memcmp(&g1, &g2, sizeof(GUID)) == 0; }
+inline bool operator!=(const GUID& g1, const GUID& g2) { return !(g1 == g2); }
+
+#define IMAGE_DOS_SIGNATURE                 0x5A4D     // MZ
+#define IMAGE_NT_SIGNATURE                  0x00004550 // PE00
+
+#define IMAGE_FILE_MACHINE_UNKNOWN          0
+#define IMAGE_FILE_MACHINE_I386             0x014c
+#define IMAGE_FILE_MACHINE_IA64             0x0200
+#define IMAGE_FILE_MACHINE_AMD64            0x8664
+
+#define IMAGE_NT_OPTIONAL_HDR32_MAGIC       0x10b
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC       0x20b
+#define IMAGE_NUMBEROF_DIRECTORY_ENTRIES    16
+#define IMAGE_DIRECTORY_ENTRY_DEBUG         6
+#define IMAGE_DEBUG_TYPE_CODEVIEW           2
+
+#define IMAGE_SIZEOF_SHORT_NAME             8
+#define IMAGE_SIZEOF_SYMBOL                 18
+#define IMAGE_SYM_CLASS_EXTERNAL            2
+#define IMAGE_SYM_CLASS_STATIC              3
+
+#define IMAGE_SCN_CNT_CODE                  0x00000020
+#define IMAGE_SCN_CNT_INITIALIZED_DATA      0x00000040
+#define IMAGE_SCN_LNK_COMDAT                0x00001000
+#define IMAGE_SCN_MEM_DISCARDABLE           0x02000000
+#define IMAGE_SCN_MEM_READ                  0x40000000
+#define IMAGE_SCN_MEM_WRITE                 0x80000000
+
+#define IMAGE_REL_I386_DIR32                0x0006
+#define IMAGE_COMDAT_SELECT_ANY             2
+
+#pragma pack(push, 4)
+
+struct IMAGE_DOS_HEADER
+{
+	WORD e_magic;
+	WORD e_cblp;
+	WORD e_cp;
+	WORD e_crlc;
+	WORD e_cparhdr;
+	WORD e_minalloc;
+	WORD e_maxalloc;
+	WORD e_ss;
+	WORD e_sp;
+	WORD e_csum;
+	WORD e_ip;
+	WORD e_cs;
+	WORD e_lfarlc;
+	WORD e_ovno;
+	WORD e_res[4];
+	WORD e_oemid;
+	WORD e_oeminfo;
+	WORD e_res2[10];
+	LONG e_lfanew;
+};
+
+struct IMAGE_FILE_HEADER
+{
+	WORD  Machine;
+	WORD  NumberOfSections;
+	DWORD TimeDateStamp;
+	DWORD PointerToSymbolTable;
+	DWORD NumberOfSymbols;
+	WORD  SizeOfOptionalHeader;
+	WORD  Characteristics;
+};
+
+struct IMAGE_DATA_DIRECTORY
+{
+	DWORD VirtualAddress;
+	DWORD Size;
+};
+
+struct IMAGE_OPTIONAL_HEADER32
+{
+	WORD  Magic;
+	BYTE  MajorLinkerVersion;
+	BYTE  MinorLinkerVersion;
+	DWORD SizeOfCode;
+	DWORD SizeOfInitializedData;
+	DWORD SizeOfUninitializedData;
+	DWORD AddressOfEntryPoint;
+	DWORD BaseOfCode;
+	DWORD BaseOfData;
+	DWORD ImageBase;
+	DWORD SectionAlignment;
+	DWORD FileAlignment;
+	WORD  MajorOperatingSystemVersion;
+	WORD  MinorOperatingSystemVersion;
+	WORD  MajorImageVersion;
+	WORD  MinorImageVersion;
+	WORD  MajorSubsystemVersion;
+	WORD  MinorSubsystemVersion;
+	DWORD Win32VersionValue;
+	DWORD SizeOfImage;
+	DWORD SizeOfHeaders;
+	DWORD CheckSum;
+	WORD  Subsystem;
+	WORD  DllCharacteristics;
+	DWORD SizeOfStackReserve;
+	DWORD SizeOfStackCommit;
+	DWORD SizeOfHeapReserve;
+	DWORD SizeOfHeapCommit;
+	DWORD LoaderFlags;
+	DWORD NumberOfRvaAndSizes;
+	IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+};
+
+struct IMAGE_OPTIONAL_HEADER64
+{
+	WORD      Magic;
+	BYTE      MajorLinkerVersion;
+	BYTE      MinorLinkerVersion;
+	DWORD     SizeOfCode;
+	DWORD     SizeOfInitializedData;
+	DWORD     SizeOfUninitializedData;
+	DWORD     AddressOfEntryPoint;
+	DWORD     BaseOfCode;
+	ULONGLONG ImageBase;
+	DWORD     SectionAlignment;
+	DWORD     FileAlignment;
+	WORD      MajorOperatingSystemVersion;
+	WORD      MinorOperatingSystemVersion;
+	WORD      MajorImageVersion;
+	WORD      MinorImageVersion;
+	WORD      MajorSubsystemVersion;
+	WORD      MinorSubsystemVersion;
+	DWORD     Win32VersionValue;
+	DWORD     SizeOfImage;
+	DWORD     SizeOfHeaders;
+	DWORD     CheckSum;
+	WORD      Subsystem;
+	WORD      DllCharacteristics;
+	ULONGLONG SizeOfStackReserve;
+	ULONGLONG SizeOfStackCommit;
+	ULONGLONG SizeOfHeapReserve;
+	ULONGLONG SizeOfHeapCommit;
+	DWORD     LoaderFlags;
+	DWORD     NumberOfRvaAndSizes;
+	IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+};
+
+struct IMAGE_NT_HEADERS32
+{
+	DWORD Signature;
+	IMAGE_FILE_HEADER FileHeader;
+	IMAGE_OPTIONAL_HEADER32 OptionalHeader;
+};
+
+struct IMAGE_NT_HEADERS64
+{
+	DWORD Signature;
+	IMAGE_FILE_HEADER FileHeader;
+	IMAGE_OPTIONAL_HEADER64 OptionalHeader;
+};
+
+struct IMAGE_SECTION_HEADER
+{
+	BYTE Name[IMAGE_SIZEOF_SHORT_NAME];
+	union
+	{
+		DWORD PhysicalAddress;
+		DWORD VirtualSize;
+	} Misc;
+	DWORD VirtualAddress;
+	DWORD SizeOfRawData;
+	DWORD PointerToRawData;
+	DWORD PointerToRelocations;
+	DWORD PointerToLinenumbers;
+	WORD  NumberOfRelocations;
+	WORD  NumberOfLinenumbers;
+	DWORD Characteristics;
+};
+
+struct IMAGE_DEBUG_DIRECTORY
+{
+	DWORD Characteristics;
+	DWORD TimeDateStamp;
+	WORD  MajorVersion;
+	WORD  MinorVersion;
+	DWORD Type;
+	DWORD SizeOfData;
+	DWORD AddressOfRawData;
+	DWORD PointerToRawData;
+};
+
+// header of object files with more than 65279 sections (/bigobj)
+struct ANON_OBJECT_HEADER_BIGOBJ
+{
+	WORD  Sig1;            // IMAGE_FILE_MACHINE_UNKNOWN
+	WORD  Sig2;            // 0xffff
+	WORD  Version;         // >= 2
+	WORD  Machine;
+	DWORD TimeDateStamp;
+	CLSID ClassID;
+	DWORD SizeOfData;
+	DWORD Flags;
+	DWORD MetaDataSize;
+	DWORD MetaDataOffset;
+	DWORD NumberOfSections;
+	DWORD PointerToSymbolTable;
+	DWORD NumberOfSymbols;
+};
+
+#pragma pack(pop)
+
+#pragma pack(push, 2)
+
+struct IMAGE_SYMBOL
+{
+	union
+	{
+		BYTE  ShortName[8];
+		struct
+		{
+			DWORD Short; // 0 if the name is in the string table
+			DWORD Long;  // offset into the string table
+		} Name;
+		DWORD LongName[2];
+	} N;
+	DWORD Value;
+	SHORT SectionNumber;
+	WORD  Type;
+	BYTE  StorageClass;
+	BYTE  NumberOfAuxSymbols;
+};
+
+// symbol of a /bigobj object file
+struct IMAGE_SYMBOL_EX
+{
+	union
+	{
+		BYTE  ShortName[8];
+		struct
+		{
+			DWORD Short;
+			DWORD Long;
+		} Name;
+		DWORD LongName[2];
+	} N;
+	DWORD Value;
+	LONG  SectionNumber;
+	WORD  Type;
+	BYTE  StorageClass;
+	BYTE  NumberOfAuxSymbols;
+};
+
+struct IMAGE_RELOCATION
+{
+	union
+	{
+		DWORD VirtualAddress;
+		DWORD RelocCount;
+	};
+	DWORD SymbolTableIndex;
+	WORD  Type;
+};
+
+#pragma pack(pop)
+
+#define IMAGE_FIRST_SECTION(ntheader) ((IMAGE_SECTION_HEADER*) ((BYTE*) (ntheader) + \
+	offsetof(IMAGE_NT_HEADERS32, OptionalHeader) + (ntheader)->FileHeader.SizeOfOptionalHeader))
+
+static_assert(sizeof(IMAGE_NT_HEADERS32) == 248 && sizeof(IMAGE_NT_HEADERS64) == 264, "unexpected PE header size");
+static_assert(sizeof(IMAGE_SYMBOL) == IMAGE_SIZEOF_SYMBOL && sizeof(IMAGE_SYMBOL_EX) == 20, "unexpected COFF symbol size");
+static_assert(sizeof(IMAGE_RELOCATION) == 10, "unexpected COFF relocation size");
+
+#endif // _WIN32
+
+#endif //__PECOFF_H__
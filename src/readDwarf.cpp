@@ -2,7 +2,7 @@
 #include <assert.h>
 #include <unordered_map>
 #include <array>
-#include <windows.h>
+#include <algorithm>
 
 #include "PEImage.h"
 #include "dwarf.h"
@@ -304,12 +304,46 @@ namespace std
 typedef std::unordered_map<std::pair<unsigned, unsigned>, byte*> abbrevMap_t;
 
 static PEImage* img;
-static abbrevMap_t abbrevMap;
+static abbrevMap_t abbrevMap; // only read after setContext, so cursors can be used on several threads
+
+// skip the attribute specifications of an abbreviation declaration
+static byte* skipAbbrevAttributes(byte* p, byte* end)
+{
+	int attr, form;
+	do
+	{
+		attr = LEB128(p);
+		form = LEB128(p);
+	} while ((attr || form) && p < end);
+	return p;
+}
 
 void DIECursor::setContext(PEImage* img_)
 {
 	img = img_;
 	abbrevMap.clear();
+	if (!img->debug_abbrev)
+		return;
+
+	// index the declarations of all abbreviation tables up front instead of on first use
+	byte* base = (byte*)img->debug_abbrev;
+	byte* end = base + img->debug_abbrev_length;
+	byte* p = base;
+	unsigned table = 0;
+	while (p < end)
+	{
+		unsigned code = LEB128(p);
+		if (code == 0)
+		{
+			table = p - base; // the next table starts after the terminating 0
+			continue;
+		}
+		abbrevMap.insert(std::make_pair(std::make_pair(table, code), p));
+
+		LEB128(p); // tag
+		p++;       // children
+		p = skipAbbrevAttributes(p, end);
+	}
 }
 
 
@@ -320,6 +354,20 @@ DIECursor::DIECursor(DWARF_CompilationUnit* cu_, byte* ptr_)
 	level = 0;
 	hasChild = false;
 	sibling = 0;
+	readAttrs = selectReader(cu);
+}
+
+// the attribute reader is chosen once per compilation unit, so that decoding addresses
+// and section offsets needs no checks of the sizes for every attribute
+DIECursor::ReadAttributesFn DIECursor::selectReader(DWARF_CompilationUnit* cu)
+{
+	bool dwarf64 = cu && cu->isDWARF64();
+	int addrSize = cu ? cu->address_size : 0;
+	if (addrSize == 4)
+		return dwarf64 ? &DIECursor::readAttributes<4, 8> : &DIECursor::readAttributes<4, 4>;
+	if (addrSize == 8)
+		return dwarf64 ? &DIECursor::readAttributes<8, 8> : &DIECursor::readAttributes<8, 4>;
+	return dwarf64 ? &DIECursor::readAttributes<0, 8> : &DIECursor::readAttributes<0, 4>;
 }
 
 
@@ -340,7 +388,7 @@ void DIECursor::gotoSibling()
 		DWARF_InfoData dummy;
 		// read untill we pop back to the level we were at
 		while (level > currLevel)
-			readNext(dummy);
+			readNext(dummy, false, 0);
 	}
 }
 
@@ -367,7 +415,89 @@ DIECursor DIECursor::getSubtreeCursor()
 	}
 }
 
-bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
+// bit in DIEAttrMask for the attributes stored in DWARF_InfoData, 0 for all others
+static unsigned attrMaskBit(int attr)
+{
+	switch (attr)
+	{
+		case DW_AT_name:                 return kDIEName;
+		case DW_AT_MIPS_linkage_name:    return kDIELinkageName;
+		case DW_AT_comp_dir:             return kDIECompDir;
+		case DW_AT_byte_size:            return kDIEByteSize;
+		case DW_AT_encoding:             return kDIEEncoding;
+		case DW_AT_low_pc:
+		case DW_AT_high_pc:              return kDIEPC;
+		case DW_AT_ranges:               return kDIERanges;
+		case DW_AT_type:                 return kDIEType;
+		case DW_AT_containing_type:      return kDIEContainingType;
+		case DW_AT_specification:        return kDIESpecification;
+		case DW_AT_inline:               return kDIEInline;
+		case DW_AT_external:             return kDIEExternal;
+		case DW_AT_location:             return kDIELocation;
+		case DW_AT_data_member_location: return kDIEMemberLocation;
+		case DW_AT_frame_base:           return kDIEFrameBase;
+		case DW_AT_lower_bound:
+		case DW_AT_upper_bound:          return kDIEBounds;
+		case DW_AT_sibling:              return kDIESibling;
+		case DW_AT_stmt_list:            return kDIEStmtList;
+		case DW_AT_abstract_origin:      return kDIEAbstractOrigin;
+		case DW_AT_call_file:
+		case DW_AT_call_line:            return kDIECallSite;
+		default:                         return 0;
+	}
+}
+
+// address of AddrSize bytes, 0 if the size is only known at runtime
+template<int AddrSize>
+inline unsigned long long RDaddr(byte* &p, int /*size*/)
+{
+	return RDfixed<AddrSize>(p);
+}
+
+template<>
+inline unsigned long long RDaddr<0>(byte* &p, int size)
+{
+	return RDsize(p, size);
+}
+
+// advance ptr over an attribute value without decoding it
+template<int AddrSize, int OffsetSize>
+bool DIECursor::skipForm(int form)
+{
+	unsigned len;
+	switch (form)
+	{
+		case DW_FORM_addr:           ptr += AddrSize ? AddrSize : cu->address_size; break;
+		case DW_FORM_block:          len = LEB128(ptr); ptr += len; break;
+		case DW_FORM_block1:         len = *ptr++;      ptr += len; break;
+		case DW_FORM_block2:         len = RD2(ptr);    ptr += len; break;
+		case DW_FORM_block4:         len = RD4(ptr);    ptr += len; break;
+		case DW_FORM_exprloc:        len = LEB128(ptr); ptr += len; break;
+		case DW_FORM_data1:
+		case DW_FORM_ref1:
+		case DW_FORM_flag:           ptr += 1; break;
+		case DW_FORM_data2:
+		case DW_FORM_ref2:           ptr += 2; break;
+		case DW_FORM_data4:
+		case DW_FORM_ref4:           ptr += 4; break;
+		case DW_FORM_data8:
+		case DW_FORM_ref8:
+		case DW_FORM_ref_sig8:       ptr += 8; break;
+		case DW_FORM_sdata:          SLEB128(ptr); break;
+		case DW_FORM_udata:
+		case DW_FORM_ref_udata:      LEB128(ptr); break;
+		case DW_FORM_string:         ptr += strlen((const char*)ptr) + 1; break;
+		case DW_FORM_strp:
+		case DW_FORM_ref_addr:
+		case DW_FORM_sec_offset:     ptr += OffsetSize; break;
+		case DW_FORM_flag_present:   break;
+		case DW_FORM_indirect:
+		default: assert(false && "Unsupported DWARF attribute form"); return false;
+	}
+	return true;
+}
+
+bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull, unsigned attrs)
 {
 	id.clear();
 
@@ -406,8 +536,21 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 
 	id.abbrev = abbrev;
 	id.tag = LEB128(abbrev);
-	id.hasChild = *abbrev++;
+	id.hasChild = *abbrev++ != 0;
+
+	if (!(this->*readAttrs)(id, abbrev, attrs))
+		return false;
+
+	hasChild = id.hasChild;
+	sibling = id.sibling;
 
+	return true;
+}
+
+template<int AddrSize, int OffsetSize>
+bool DIECursor::readAttributes(DWARF_InfoData& id, byte* abbrev, unsigned attrs)
+{
+	attrs |= kDIESibling;
 	int attr, form;
 	for (;;)
 	{
@@ -420,10 +563,17 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 		while (form == DW_FORM_indirect)
 			form = LEB128(ptr);
 
+		if (!(attrs & attrMaskBit(attr)))
+		{
+			if (!skipForm<AddrSize, OffsetSize>(form))
+				return false;
+			continue;
+		}
+
 		DWARF_Attribute a;
 		switch (form)
 		{
-			case DW_FORM_addr:           a.type = Addr; a.addr = (unsigned long)RDsize(ptr, cu->address_size); break;
+			case DW_FORM_addr:           a.type = Addr; a.addr = (unsigned long)RDaddr<AddrSize>(ptr, cu->address_size); break;
 			case DW_FORM_block:          a.type = Block; a.block.len = LEB128(ptr); a.block.ptr = ptr; ptr += a.block.len; break;
 			case DW_FORM_block1:         a.type = Block; a.block.len = *ptr++;      a.block.ptr = ptr; ptr += a.block.len; break;
 			case DW_FORM_block2:         a.type = Block; a.block.len = RD2(ptr);   a.block.ptr = ptr; ptr += a.block.len; break;
@@ -435,7 +585,7 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 			case DW_FORM_sdata:          a.type = Const; a.cons = SLEB128(ptr); break;
 			case DW_FORM_udata:          a.type = Const; a.cons = LEB128(ptr); break;
 			case DW_FORM_string:         a.type = String; a.string = (const char*)ptr; ptr += strlen(a.string) + 1; break;
-            case DW_FORM_strp:           a.type = String; a.string = (const char*)(img->debug_str + RDsize(ptr, cu->isDWARF64() ? 8 : 4)); break;
+            case DW_FORM_strp:           a.type = String; a.string = (const char*)(img->debug_str + RDfixed<OffsetSize>(ptr)); break;
 			case DW_FORM_flag:           a.type = Flag; a.flag = (*ptr++ != 0); break;
 			case DW_FORM_flag_present:   a.type = Flag; a.flag = true; break;
 			case DW_FORM_ref1:           a.type = Ref; a.ref = (byte*)cu + *ptr++; break;
@@ -443,10 +593,10 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 			case DW_FORM_ref4:           a.type = Ref; a.ref = (byte*)cu + RD4(ptr); break;
 			case DW_FORM_ref8:           a.type = Ref; a.ref = (byte*)cu + RD8(ptr); break;
 			case DW_FORM_ref_udata:      a.type = Ref; a.ref = (byte*)cu + LEB128(ptr); break;
-			case DW_FORM_ref_addr:       a.type = Ref; a.ref = (byte*)img->debug_info + (cu->isDWARF64() ? RD8(ptr) : RD4(ptr)); break;
+			case DW_FORM_ref_addr:       a.type = Ref; a.ref = (byte*)img->debug_info + RDfixed<OffsetSize>(ptr); break;
 			case DW_FORM_ref_sig8:       a.type = Invalid; ptr += 8;  break;
 			case DW_FORM_exprloc:        a.type = ExprLoc; a.expr.len = LEB128(ptr); a.expr.ptr = ptr; ptr += a.expr.len; break;
-			case DW_FORM_sec_offset:     a.type = SecOffset;  a.sec_offset = cu->isDWARF64() ? RD8(ptr) : RD4(ptr); break;
+			case DW_FORM_sec_offset:     a.type = SecOffset;  a.sec_offset = (unsigned long)RDfixed<OffsetSize>(ptr); break;
 			case DW_FORM_indirect:
 			default: assert(false && "Unsupported DWARF attribute form"); return false;
 		}
@@ -495,15 +645,24 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 				break;
 			case DW_AT_containing_type: assert(a.type == Ref); id.containing_type = a.ref; break;
 			case DW_AT_specification: assert(a.type == Ref); id.specification = a.ref; break;
+			case DW_AT_abstract_origin: assert(a.type == Ref); id.abstract_origin = a.ref; break;
+			case DW_AT_call_file: assert(a.type == Const); id.call_file = a.cons; break;
+			case DW_AT_call_line: assert(a.type == Const); id.call_line = a.cons; break;
 			case DW_AT_data_member_location: id.member_location = a; break;
 			case DW_AT_location: id.location = a; break;
 			case DW_AT_frame_base: id.frame_base = a; break;
+			case DW_AT_stmt_list:
+				if (a.type == SecOffset)
+					id.stmt_list = a.sec_offset;
+				else if (a.type == Const)
+					id.stmt_list = a.cons;
+				else
+					assert(false);
+				id.hasStmtList = true;
+				break;
 		}
 	}
 
-	hasChild = id.hasChild != 0;
-	sibling = id.sibling;
-
 	return true;
 }
 
@@ -513,35 +672,119 @@ byte* DIECursor::getDWARFAbbrev(unsigned off, unsigned findcode)
 		return 0;
 
 	std::pair<unsigned, unsigned> key = std::make_pair(off, findcode);
-	abbrevMap_t::iterator it = abbrevMap.find(key);
+	abbrevMap_t::const_iterator it = abbrevMap.find(key);
 	if (it != abbrevMap.end())
 	{
 		return it->second;
 	}
 
+	// offset not at the start of a table, scan without modifying the shared map
 	byte* p = (byte*)img->debug_abbrev + off;
 	byte* end = (byte*)img->debug_abbrev + img->debug_abbrev_length;
 	while (p < end)
 	{
 		int code = LEB128(p);
 		if (code == findcode)
-		{
-			abbrevMap.insert(std::make_pair(key, p));
 			return p;
-		}
 		if (code == 0)
 			return 0;
 
-		int tag = LEB128(p);
-		int hasChild = *p++;
+		LEB128(p); // tag
+		p++;       // children
+		p = skipAbbrevAttributes(p, end);
+	}
+	return 0;
+}
 
-		// skip attributes
-		int attr, form;
-		do
+///////////////////////////////////////////////////////////////////////////////
+bool DIEIndex::build(const PEImage& img)
+{
+	clear();
+	if (!img.debug_info)
+		return false;
+
+	base = (byte*) img.debug_info;
+
+	std::vector<unsigned int> typeOff; // resolved once all DIEs are known
+	std::vector<int> lastAtLevel;      // last DIE seen on each level of the current path
+	unsigned long off = 0;
+	while (off < img.debug_info_length)
+	{
+		DWARF_CompilationUnit* cunit = (DWARF_CompilationUnit*)(img.debug_info + off);
+		int cuIndex = cus.size();
+		cus.push_back(cunit);
+		lastAtLevel.clear();
+
+		DIECursor cursor(cunit, (byte*)cunit + sizeof(DWARF_CompilationUnit));
+		DWARF_InfoData id;
+		while (cursor.readNext(id, false, kDIEType | kDIEByteSize))
 		{
-			attr = LEB128(p);
-			form = LEB128(p);
-		} while (attr || form);
+			int level = cursor.level;
+			if (level < 0 || level > (int) lastAtLevel.size())
+				return false;
+
+			int die = offset.size();
+			int prev = level < (int) lastAtLevel.size() ? lastAtLevel[level] : -1;
+			int par = level > 0 ? lastAtLevel[level - 1] : -1;
+			if (prev >= 0)
+				nextSibling[prev] = die;
+			if (par >= 0 && firstChild[par] < 0)
+				firstChild[par] = die;
+			lastAtLevel.resize(level + 1);
+			lastAtLevel[level] = die;
+
+			offset.push_back(id.entryPtr - base);
+			tag.push_back(id.tag);
+			code.push_back(id.code);
+			parent.push_back(par);
+			firstChild.push_back(-1);
+			nextSibling.push_back(-1);
+			typeOff.push_back(id.type ? id.type - base : 0);
+			byteSize.push_back(id.byte_size);
+			cu.push_back(cuIndex);
+		}
+		off += sizeof(cunit->unit_length) + cunit->unit_length;
 	}
-	return 0;
+
+	// offset 0 is a compilation unit header, so it never refers to a DIE
+	type.resize(offset.size());
+	for (size_t die = 0; die < offset.size(); die++)
+		type[die] = typeOff[die] ? find(typeOff[die]) : -1;
+
+	memTrack(kMemDIEIndex, 0, memoryUsage());
+	return true;
+}
+
+void DIEIndex::clear()
+{
+	memTrack(kMemDIEIndex, memoryUsage(), 0);
+
+	std::vector<unsigned int>().swap(offset);
+	std::vector<unsigned short>().swap(tag);
+	std::vector<unsigned int>().swap(code);
+	std::vector<int>().swap(parent);
+	std::vector<int>().swap(firstChild);
+	std::vector<int>().swap(nextSibling);
+	std::vector<int>().swap(type);
+	std::vector<unsigned int>().swap(byteSize);
+	std::vector<int>().swap(cu);
+	std::vector<DWARF_CompilationUnit*>().swap(cus);
+	base = 0;
+}
+
+int DIEIndex::find(unsigned int off) const
+{
+	std::vector<unsigned int>::const_iterator it = std::lower_bound(offset.begin(), offset.end(), off);
+	if (it == offset.end() || *it != off)
+		return -1;
+	return it - offset.begin();
+}
+
+size_t DIEIndex::memoryUsage() const
+{
+	return offset.capacity() * sizeof(offset[0]) + tag.capacity() * sizeof(tag[0])
+	     + code.capacity() * sizeof(code[0]) + parent.capacity() * sizeof(parent[0])
+	     + firstChild.capacity() * sizeof(firstChild[0]) + nextSibling.capacity() * sizeof(nextSibling[0])
+	     + type.capacity() * sizeof(type[0]) + byteSize.capacity() * sizeof(byteSize[0])
+	     + cu.capacity() * sizeof(cu[0]) + cus.capacity() * sizeof(cus[0]);
 }
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include "mspdb.h"
+#include "memreport.h"
 
 typedef unsigned char byte;
 
@@ -64,6 +65,16 @@ inline unsigned long long RD8(byte* &p)
 	return x;
 }
 
+// little endian value of a size known at compile time, a single unaligned load on x86 and x64
+template<int Size>
+inline unsigned long long RDfixed(byte* &p)
+{
+	unsigned long long x = 0;
+	memcpy(&x, p, Size);
+	p += Size;
+	return x;
+}
+
 inline unsigned long long RDsize(byte* &p, int size)
 {
 	if (size > 8)
@@ -105,7 +116,7 @@ struct DWARF_Attribute
 
 ///////////////////////////////////////////////////////////////////////////////
 
-#include "pshpack1.h"
+#pragma pack(push, 1)
 
 struct DWARF_CompilationUnit
 {
@@ -135,62 +146,74 @@ struct DWARF_FileName
 	}
 };
 
+// attributes stored into DWARF_InfoData by DIECursor::readNext, other attributes
+// are skipped by the size of their form. DW_AT_sibling is always read.
+enum DIEAttrMask
+{
+	kDIEName           = 1 << 0,  // DW_AT_name
+	kDIELinkageName    = 1 << 1,  // DW_AT_MIPS_linkage_name
+	kDIECompDir        = 1 << 2,  // DW_AT_comp_dir
+	kDIEByteSize       = 1 << 3,  // DW_AT_byte_size
+	kDIEEncoding       = 1 << 4,  // DW_AT_encoding
+	kDIEPC             = 1 << 5,  // DW_AT_low_pc, DW_AT_high_pc
+	kDIERanges         = 1 << 6,  // DW_AT_ranges
+	kDIEType           = 1 << 7,  // DW_AT_type
+	kDIEContainingType = 1 << 8,  // DW_AT_containing_type
+	kDIESpecification  = 1 << 9,  // DW_AT_specification
+	kDIEInline         = 1 << 10, // DW_AT_inline
+	kDIEExternal       = 1 << 11, // DW_AT_external
+	kDIELocation       = 1 << 12, // DW_AT_location
+	kDIEMemberLocation = 1 << 13, // DW_AT_data_member_location
+	kDIEFrameBase      = 1 << 14, // DW_AT_frame_base
+	kDIEBounds         = 1 << 15, // DW_AT_lower_bound, DW_AT_upper_bound
+	kDIESibling        = 1 << 16, // DW_AT_sibling
+	kDIEStmtList       = 1 << 17, // DW_AT_stmt_list
+	kDIEAbstractOrigin = 1 << 18, // DW_AT_abstract_origin
+	kDIECallSite       = 1 << 19, // DW_AT_call_file, DW_AT_call_line
+
+	kDIEAllAttrs       = (1 << 20) - 1
+};
+
+// members are grouped by size to keep the structure small, all are zero (or Invalid) after clear()
 struct DWARF_InfoData
 {
 	byte* entryPtr;
+	byte* abbrev;
 	unsigned entryOff; // offset in the cu
 	int code;
-	byte* abbrev;
-	int tag;
-	int hasChild;
+	unsigned short tag;
+	bool hasChild;
+	bool external;
+	bool hasStmtList;
 
 	const char* name;
 	const char* linkage_name;
 	const char* dir;
-	unsigned long byte_size;
 	byte* sibling;
+	byte* type;
+	byte* containing_type;
+	byte* specification;
+	byte* abstract_origin;
+
+	unsigned long byte_size;
 	unsigned long encoding;
 	unsigned long pclo;
 	unsigned long pchi;
 	unsigned long ranges;
-	byte* type;
-	byte* containing_type;
-	byte* specification;
+	unsigned long stmt_list;
+	unsigned long call_file;
+	unsigned long call_line;
 	unsigned long inlined;
-	bool external;
+	long upper_bound;
+	long lower_bound;
+
 	DWARF_Attribute location;
 	DWARF_Attribute member_location;
 	DWARF_Attribute frame_base;
-	long upper_bound;
-	long lower_bound;
 
 	void clear()
 	{
-		entryPtr = 0;
-		code = 0;
-		abbrev = 0;
-		tag = 0;
-		hasChild = 0;
-
-		name = 0;
-		linkage_name = 0;
-		dir = 0;
-		byte_size = 0;
-		sibling = 0;
-		encoding = 0;
-		pclo = 0;
-		pchi = 0;
-		ranges = 0;
-		type = 0;
-		containing_type = 0;
-		specification = 0;
-		inlined = 0;
-		external = 0;
-		member_location.type = Invalid;
-		location.type = Invalid;
-		frame_base.type = Invalid;
-		upper_bound = 0;
-		lower_bound = 0;
+		memset(this, 0, sizeof(*this));
 	}
 
 	void merge(const DWARF_InfoData& id)
@@ -255,6 +278,7 @@ struct DWARF_LineState
 
 	// not part of the "documented" state
 	DWARF_FileName* file_ptr;
+	unsigned long unit; // offset of the line number program in .debug_line
 	unsigned long seg_offset;
 	unsigned long section;
 	unsigned long last_addr;
@@ -265,6 +289,10 @@ struct DWARF_LineState
 		seg_offset = 0x400000;
 		init(0);
 	}
+	~DWARF_LineState()
+	{
+		memTrack(kMemLineInfo, lineInfo.capacity() * sizeof(mspdb::LineInfoEntry), 0);
+	}
 
 	void init(DWARF_LineNumberProgramHeader* hdr)
 	{
@@ -301,11 +329,14 @@ struct DWARF_LineState
 		mspdb::LineInfoEntry entry;
 		entry.offset = address - seg_offset;
 		entry.line = line;
+		size_t capacity = lineInfo.capacity();
 		lineInfo.push_back(entry);
+		if (lineInfo.capacity() != capacity)
+			memTrack(kMemLineInfo, capacity * sizeof(entry), lineInfo.capacity() * sizeof(entry));
 	}
 };
 
-#include "poppack.h"
+#pragma pack(pop)
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -350,8 +381,18 @@ public:
 
 	byte* getDWARFAbbrev(unsigned off, unsigned findcode);
 
+	// attribute decoding specialized for the address size and the DWARF32/DWARF64 offset size
+	typedef bool (DIECursor::*ReadAttributesFn)(DWARF_InfoData& id, byte* abbrev, unsigned attrs);
+	ReadAttributesFn readAttrs;
+
+	static ReadAttributesFn selectReader(DWARF_CompilationUnit* cu);
+	template<int AddrSize, int OffsetSize> bool readAttributes(DWARF_InfoData& id, byte* abbrev, unsigned attrs);
+	template<int AddrSize, int OffsetSize> bool skipForm(int form);
+
 public:
 
+	// indexes the abbreviations of img_, call it before reading DIEs and not while cursors are used
+	// on other threads. Afterwards cursors of the image only read shared state.
 	static void setContext(PEImage* img_);
 
 	// Create a new DIECursor
@@ -370,11 +411,97 @@ public:
 	// Reads the next DIE in physical order, returns 'true' if succeeds.
 	// If stopAtNull is true, readNext() will stop upon reaching a null DIE (end of the current tree level).
 	// Otherwise, it will skip null DIEs and stop only at the end of the subtree for which this DIECursor was created.
-	bool readNext(DWARF_InfoData& id, bool stopAtNull = false);
+	// Only the attributes in the DIEAttrMask attrs are stored into id.
+	bool readNext(DWARF_InfoData& id, bool stopAtNull = false, unsigned attrs = kDIEAllAttrs);
+};
+
+// Flat index of all DIEs in .debug_info, built in a single pass over all compilation units.
+// DIEs are numbered in physical order, links to other DIEs are indices (-1 if none).
+class DIEIndex
+{
+public:
+	DIEIndex() : base(0) {}
+
+	bool build(const PEImage& img);
+	void clear();
+
+	int count() const { return offset.size(); }
+
+	// index of the DIE at the given offset into .debug_info, -1 if there is none
+	int find(unsigned int off) const;
+	int find(byte* ptr) const { return ptr && base ? find(ptr - base) : -1; }
+
+	byte* getPtr(int die) const { return base + offset[die]; }
+	DWARF_CompilationUnit* getCU(int die) const { return cus[cu[die]]; }
+
+	// cursor reading the attributes of the DIE, continuing in physical order
+	DIECursor getCursor(int die) const { return DIECursor(getCU(die), getPtr(die)); }
+
+	std::vector<unsigned int> offset;   // offset into .debug_info
+	std::vector<unsigned short> tag;
+	std::vector<unsigned int> code;     // abbreviation code
+	std::vector<int> parent;
+	std::vector<int> firstChild;
+	std::vector<int> nextSibling;
+	std::vector<int> type;              // DIE referenced by DW_AT_type
+	std::vector<unsigned int> byteSize; // DW_AT_byte_size, 0 if not given
+	std::vector<int> cu;                // index into the compilation units
+
+private:
+	size_t memoryUsage() const;
+
+	byte* base;
+	std::vector<DWARF_CompilationUnit*> cus;
+};
+
+// FDEs in .debug_frame sorted by address, so the FDE covering a function
+// is found without scanning the section
+class CFIIndex
+{
+public:
+	CFIIndex() : built(false) {}
+
+	bool build(const PEImage& img);
+	void clear();
+	bool isBuilt() const { return built; }
+
+	// offset into .debug_frame of the first FDE covering pclo..pchi, -1 if there is none
+	long find(unsigned long pclo, unsigned long pchi) const;
+
+private:
+	struct Range
+	{
+		unsigned long start;
+		unsigned long end;
+		unsigned long offset;
+		bool operator<(const Range& other) const { return start < other.start; }
+	};
+	std::vector<Range> ranges;         // sorted by start
+	std::vector<unsigned long> maxEnd; // maximum end of ranges[0] to ranges[i]
+	bool built;
+};
+
+// lines of one AddLines call, decoded from the line number program before they are passed to the PDB
+struct DWARF_LineBlock
+{
+	unsigned long unit; // offset of the line number program in .debug_line
+	std::string fname;
+	unsigned short seg;
+	unsigned int firstAddr;
+	unsigned int length;
+	unsigned int firstLine;
+	bool endSequence; // the last line marks the end of the sequence, not a statement
+	std::vector<mspdb::LineInfoEntry> lines;
 };
 
 // iterate over DWARF debug_line information
-// if mod is null, print them out, otherwise add to module
-bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod);
+// if mod and blocks are null, print them out, otherwise add to module or collect them in blocks
+bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod, std::vector<DWARF_LineBlock>* blocks = 0);
+
+// passes the collected lines to mod, or to blockMods[b] for block b if given
+bool addDWARFLineBlocks(mspdb::Mod* mod, std::vector<DWARF_LineBlock>& blocks, mspdb::Mod* const* blockMods = 0);
+
+// full names of the files in the header of the line number program at offset unit in .debug_line
+bool readDWARFLineFiles(const PEImage& img, unsigned long unit, std::vector<std::string>& files);
 
 #endif
@@ -0,0 +1,321 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "symbolize.h"
+#include "PEImage.h"
+#include "readDwarf.h"
+#include "memreport.h"
+#include "trace.h"
+
+#include "dwarf.h"
+
+#include <algorithm>
+
+bool DWARFSymbolizer::build(PEImage& img)
+{
+	TraceSpan span("DWARFSymbolizer::build");
+	nodes.clear();
+	ranges.clear();
+	lines.clear();
+	units.clear();
+	files.clear();
+	fileMap.clear();
+
+	if (!img.hasDWARF())
+		return setError("no DWARF debug information found");
+
+	DIECursor::setContext(&img);
+	return buildFunctions(img) && buildLines(img);
+}
+
+int DWARFSymbolizer::fileIndex(const std::string& fname)
+{
+	std::map<std::string, int>::iterator it = fileMap.find(fname);
+	if (it != fileMap.end())
+		return it->second;
+	int idx = (int) files.size();
+	files.push_back(fname);
+	fileMap[fname] = idx;
+	return idx;
+}
+
+// compilation unit containing the DIE at ptr, references with DW_FORM_ref_addr can point into other units
+DWARF_CompilationUnit* DWARFSymbolizer::unitOf(byte* ptr) const
+{
+	std::vector<DWARF_CompilationUnit*>::const_iterator it = std::upper_bound(units.begin(), units.end(), (DWARF_CompilationUnit*) ptr);
+	if (it == units.begin())
+		return 0;
+	DWARF_CompilationUnit* cu = it[-1];
+	if (ptr >= (byte*) cu + sizeof(cu->unit_length) + cu->unit_length)
+		return 0;
+	return cu;
+}
+
+// name of a subprogram or inlined subroutine, following the references to the abstract
+// instance or the declaration if the DIE has none
+const char* DWARFSymbolizer::functionName(DWARF_CompilationUnit* cu, const DWARF_InfoData& id) const
+{
+	const char* linkage_name = id.linkage_name;
+	DWARF_InfoData origin = id;
+	for (int ref = 0; ref < 4 && !origin.name; ref++)
+	{
+		byte* ptr = origin.abstract_origin ? origin.abstract_origin : origin.specification;
+		if (!ptr || !(cu = unitOf(ptr)))
+			break;
+		DIECursor cursor(cu, ptr);
+		if (!cursor.readNext(origin, true, kDIEName | kDIELinkageName | kDIESpecification | kDIEAbstractOrigin))
+			break;
+		if (!linkage_name)
+			linkage_name = origin.linkage_name;
+	}
+	return origin.name ? origin.name : linkage_name;
+}
+
+// same encoding as CV2PDB::addDWARFRanges, the ranges are added to the last node
+void DWARFSymbolizer::addRanges(const PEImage& img, DWARF_CompilationUnit* cu, unsigned long off, unsigned long base)
+{
+	byte* r = (byte*)img.debug_ranges + off;
+	byte* rend = (byte*)img.debug_ranges + img.debug_ranges_length;
+	int addrSize = cu->address_size;
+	unsigned long long baseSelection = addrSize == 8 ? ~0ULL : 0xffffffff;
+	while (r + 2 * addrSize <= rend)
+	{
+		unsigned long long pclo = RDsize(r, addrSize);
+		unsigned long long pchi = RDsize(r, addrSize);
+		if (pclo == 0 && pchi == 0)
+			break;
+		if (pclo == baseSelection)
+			base = (unsigned long) pchi;
+		else if (pchi > pclo)
+		{
+			Range range = { base + (unsigned long) pclo, base + (unsigned long) pchi, 0, (int) nodes.size() - 1 };
+			ranges.push_back(range);
+		}
+	}
+}
+
+bool DWARFSymbolizer::buildFunctions(PEImage& img)
+{
+	TraceSpan span("symbolizer functions");
+	const unsigned attrs = kDIEName | kDIELinkageName | kDIEPC | kDIERanges | kDIESpecification |
+	                       kDIEAbstractOrigin | kDIECallSite | kDIEStmtList;
+
+	// references can point to any unit, so all of them are known before the DIEs are read
+	for (unsigned long off = 0; off < img.debug_info_length; )
+	{
+		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+		units.push_back(cu);
+		off += sizeof(cu->unit_length) + cu->unit_length;
+	}
+
+	std::vector<std::string> unitFiles;
+	std::vector<std::pair<int, int> > scopes; // level and node of the enclosing functions
+	for (unsigned long off = 0; off < img.debug_info_length; )
+	{
+		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+		unsigned long base = 0;
+		unitFiles.clear();
+		scopes.clear();
+
+		DIECursor cursor(cu, (byte*)cu + sizeof(DWARF_CompilationUnit));
+		DWARF_InfoData id;
+		while (cursor.readNext(id, false, attrs))
+		{
+			while (!scopes.empty() && scopes.back().first >= cursor.level)
+				scopes.pop_back();
+
+			if (id.tag == DW_TAG_compile_unit)
+			{
+				base = id.pclo;
+				if (id.hasStmtList)
+					readDWARFLineFiles(img, id.stmt_list, unitFiles);
+				continue;
+			}
+			if (id.tag != DW_TAG_subprogram && id.tag != DW_TAG_inlined_subroutine)
+				continue;
+
+			Node node;
+			node.name = functionName(cu, id);
+			// nested functions are not inlined into their parent
+			node.parent = id.tag == DW_TAG_inlined_subroutine && !scopes.empty() ? scopes.back().second : -1;
+			node.depth = node.parent >= 0 ? nodes[node.parent].depth + 1 : 0;
+			node.callFile = -1;
+			node.callLine = 0;
+			if (id.tag == DW_TAG_inlined_subroutine)
+			{
+				if (id.call_file > 0 && id.call_file <= unitFiles.size())
+					node.callFile = fileIndex(unitFiles[id.call_file - 1]);
+				node.callLine = id.call_line;
+			}
+			size_t firstRange = ranges.size();
+			nodes.push_back(node);
+
+			if (id.ranges > 0 && id.ranges < img.debug_ranges_length)
+				addRanges(img, cu, id.ranges, base);
+			else if (id.pclo && id.pchi > id.pclo)
+			{
+				Range range = { id.pclo, id.pchi, 0, (int) nodes.size() - 1 };
+				ranges.push_back(range);
+			}
+
+			if (ranges.size() == firstRange)
+			{
+				// declaration or abstract instance without code
+				nodes.pop_back();
+				continue;
+			}
+			if (id.hasChild)
+				scopes.push_back(std::make_pair(cursor.level, (int) nodes.size() - 1));
+		}
+
+		off += sizeof(cu->unit_length) + cu->unit_length;
+	}
+
+	std::stable_sort(ranges.begin(), ranges.end());
+	for (size_t r = 0; r < ranges.size(); r++)
+		ranges[r].maxHi = r > 0 && ranges[r - 1].maxHi > ranges[r].hi ? ranges[r - 1].maxHi : ranges[r].hi;
+	return true;
+}
+
+bool DWARFSymbolizer::buildLines(PEImage& img)
+{
+	TraceSpan span("symbolizer lines");
+	std::vector<DWARF_LineBlock> blocks;
+	if (!interpretDWARFLines(img, 0, &blocks))
+		return setError("cannot decode line number info");
+
+	unsigned long segOff = img.getImageBase() + img.getSection(img.codeSegment).VirtualAddress;
+	size_t count = 0;
+	for (size_t b = 0; b < blocks.size(); b++)
+		count += blocks[b].lines.size();
+	lines.reserve(count);
+
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		const DWARF_LineBlock& block = blocks[b];
+		int file = fileIndex(block.fname);
+		for (size_t e = 0; e < block.lines.size(); e++)
+		{
+			Line line = { segOff + block.firstAddr + block.lines[e].offset, file, block.firstLine + block.lines[e].line };
+			lines.push_back(line);
+		}
+		if (block.endSequence && !block.lines.empty())
+			lines.back().file = -1;
+		memTrack(kMemLineInfo, block.lines.size() * sizeof(mspdb::LineInfoEntry), 0);
+	}
+
+	// a row is valid up to the next row, the end of a sequence goes first if another one starts at the same address
+	struct LessLine
+	{
+		bool operator()(const Line& l1, const Line& l2) const
+		{
+			if (l1.addr != l2.addr)
+				return l1.addr < l2.addr;
+			return l1.file < 0 && l2.file >= 0;
+		}
+	};
+	std::stable_sort(lines.begin(), lines.end(), LessLine());
+	return true;
+}
+
+// rangeHint and lineHint are positions in ranges and lines not beyond addr,
+// they are advanced for the next lookup with an address not below addr
+int DWARFSymbolizer::lookup(unsigned long addr, std::vector<SymbolizedFrame>& frames, size_t& rangeHint, size_t& lineHint) const
+{
+	struct AddrLess
+	{
+		bool operator()(unsigned long addr, const Range& r) const { return addr < r.lo; }
+		bool operator()(unsigned long addr, const Line& l) const { return addr < l.addr; }
+	};
+
+	std::vector<Line>::const_iterator lit = std::upper_bound(lines.begin() + lineHint, lines.end(), addr, AddrLess());
+	lineHint = lit - lines.begin();
+	const char* file = 0;
+	unsigned int line = 0;
+	if (lit != lines.begin() && lit[-1].file >= 0)
+	{
+		file = files[lit[-1].file].c_str();
+		line = lit[-1].line;
+	}
+
+	// ranges of inlined functions need not nest like their DIEs, so all ranges containing addr are
+	// checked for the innermost function, the walk stops where no preceding range reaches addr
+	std::vector<Range>::const_iterator rit = std::upper_bound(ranges.begin() + rangeHint, ranges.end(), addr, AddrLess());
+	rangeHint = rit - ranges.begin();
+	int node = -1;
+	for ( ; rit != ranges.begin() && rit[-1].maxHi > addr; --rit)
+		if (addr < rit[-1].hi && (node < 0 || nodes[rit[-1].node].depth > nodes[node].depth))
+			node = rit[-1].node;
+
+	SymbolizedFrame frame;
+	if (node < 0)
+	{
+		frame.function = 0;
+		frame.file = file;
+		frame.line = line;
+		frame.inlined = false;
+		frames.push_back(frame);
+		return 1;
+	}
+
+	int cnt = 0;
+	for ( ; node >= 0; node = nodes[node].parent, cnt++)
+	{
+		const Node& n = nodes[node];
+		frame.function = n.name;
+		frame.file = file;
+		frame.line = line;
+		frame.inlined = n.parent >= 0;
+		frames.push_back(frame);
+
+		// the caller continues at the call site
+		file = n.callFile >= 0 ? files[n.callFile].c_str() : 0;
+		line = n.callLine;
+	}
+	return cnt;
+}
+
+int DWARFSymbolizer::symbolize(unsigned long addr, std::vector<SymbolizedFrame>& frames) const
+{
+	size_t rangeHint = 0, lineHint = 0;
+	return lookup(addr, frames, rangeHint, lineHint);
+}
+
+void DWARFSymbolizer::symbolize(const unsigned long* addrs, size_t count,
+                                std::vector<SymbolizedFrame>& frames, std::vector<size_t>& first) const
+{
+	// look up in order of increasing address, so every search starts at the result of the previous one
+	std::vector<size_t> order(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = i;
+	struct AddrOrder
+	{
+		const unsigned long* addrs;
+		bool operator()(size_t i1, size_t i2) const { return addrs[i1] < addrs[i2]; }
+	} cmp = { addrs };
+	std::stable_sort(order.begin(), order.end(), cmp);
+
+	std::vector<SymbolizedFrame> sorted;
+	std::vector<size_t> sortedFirst(count);
+	std::vector<int> sortedCount(count);
+	size_t rangeHint = 0, lineHint = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		sortedFirst[order[i]] = sorted.size();
+		sortedCount[order[i]] = lookup(addrs[order[i]], sorted, rangeHint, lineHint);
+	}
+
+	// restore the order of the input
+	frames.clear();
+	frames.reserve(sorted.size());
+	first.resize(count + 1);
+	for (size_t i = 0; i < count; i++)
+	{
+		first[i] = frames.size();
+		frames.insert(frames.end(), sorted.begin() + sortedFirst[i], sorted.begin() + sortedFirst[i] + sortedCount[i]);
+	}
+	first[count] = frames.size();
+}
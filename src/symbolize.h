@@ -0,0 +1,91 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __SYMBOLIZE_H__
+#define __SYMBOLIZE_H__
+
+#include "LastError.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class PEImage;
+struct DWARF_CompilationUnit;
+struct DWARF_InfoData;
+
+// one function at an address, inlined frames come before the function they are inlined into
+struct SymbolizedFrame
+{
+	const char* function; // 0 if unknown
+	const char* file;     // 0 if unknown
+	unsigned int line;
+	bool inlined;
+};
+
+// maps addresses to functions, inlined functions and source lines from .debug_info and .debug_line
+// without creating a PDB. The image must stay loaded while the symbolizer is used and the
+// line number program must have been relocated (see PEImage::relocateDebugLineInfo).
+class DWARFSymbolizer : public LastError
+{
+public:
+	bool build(PEImage& img);
+
+	// frames at the virtual address addr, innermost first, returns the number of frames added
+	int symbolize(unsigned long addr, std::vector<SymbolizedFrame>& frames) const;
+
+	// symbolizes count addresses in order of increasing address, the frames of addrs[i]
+	// are frames[first[i]] to frames[first[i+1]-1]
+	void symbolize(const unsigned long* addrs, size_t count,
+	               std::vector<SymbolizedFrame>& frames, std::vector<size_t>& first) const;
+
+	size_t countFunctions() const { return nodes.size(); }
+	size_t countLines() const { return lines.size(); }
+
+private:
+	bool buildFunctions(PEImage& img);
+	bool buildLines(PEImage& img);
+	void addRanges(const PEImage& img, DWARF_CompilationUnit* cu, unsigned long ranges, unsigned long base);
+	const char* functionName(DWARF_CompilationUnit* cu, const DWARF_InfoData& id) const;
+	DWARF_CompilationUnit* unitOf(unsigned char* ptr) const;
+	int fileIndex(const std::string& fname);
+	int lookup(unsigned long addr, std::vector<SymbolizedFrame>& frames, size_t& rangeHint, size_t& lineHint) const;
+
+	// subprogram or inlined subroutine
+	struct Node
+	{
+		const char* name;
+		int parent;            // function the node is inlined into, -1 for subprograms
+		int depth;             // number of functions the node is inlined into
+		int callFile;          // index in files of the call site of an inlined function, -1 if unknown
+		unsigned int callLine;
+	};
+	struct Range
+	{
+		unsigned long lo;
+		unsigned long hi;
+		unsigned long maxHi; // maximum hi of this and all preceding ranges
+		int node;
+
+		bool operator<(const Range& other) const { return lo < other.lo; }
+	};
+	struct Line
+	{
+		unsigned long addr;
+		int file; // -1 for the end of a sequence
+		unsigned int line;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Range> ranges;     // all ranges sorted by lo
+	std::vector<Line> lines;       // sorted by address
+	std::vector<DWARF_CompilationUnit*> units; // in order of their offset in .debug_info
+
+	std::vector<std::string> files;
+	std::map<std::string, int> fileMap;
+};
+
+#endif //__SYMBOLIZE_H__
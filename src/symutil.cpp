@@ -12,16 +12,52 @@ extern "C" {
 }
 
 #include <assert.h>
+#include <ctype.h>
 
 char dotReplacementChar = '@';
 bool demangleSymbols = true;
 bool useTypedefEnum = false;
 
+void dotcpy(char* d, const char* s, int len, char dotChar)
+{
+	if (dotChar == '.')
+	{
+		memmove(d, s, len);
+		return;
+	}
+	while (len > 0)
+	{
+		const char* dot = (const char*) memchr(s, '.', len);
+		int n = dot ? dot - s : len;
+		memmove(d, s, n);
+		if (!dot)
+			break;
+		d[n] = dotChar;
+		d += n + 1;
+		s += n + 1;
+		len -= n + 1;
+	}
+}
+
+// copy a back reference of the symbol name compression, it can overlap the copied characters
+static void copyBackRef(char* cname, int cpos, int zpos, int zlen)
+{
+	if (zpos >= zlen)
+		memcpy(cname + cpos, cname + cpos - zpos, zlen);
+	else
+		for (int z = 0; z < zlen; z++)
+			cname[cpos + z] = cname[cpos - zpos + z];
+}
+
 int dsym2c(const BYTE* p, int len, char* cname, int maxclen)
 {
 	const BYTE* end = p + len;
 	int zlen, zpos, cpos = 0;
 
+	// names to be demangled keep their dots until then, all others are replaced while decompressing
+	bool demangle = demangleSymbols && len >= 3 && p[0] == '_' && p[1] == 'D' && isdigit(p[2]);
+	char dotChar = demangle ? '.' : dotReplacementChar;
+
 	// decompress symbol
 	while (p < end)
 	{
@@ -36,8 +72,7 @@ int dsym2c(const BYTE* p, int len, char* cname, int maxclen)
 				break;
 			if (cpos + zlen >= maxclen)
 				break;
-			for (int z = 0; z < zlen; z++)
-				cname[cpos + z] = cname[cpos - zpos + z];
+			copyBackRef(cname, cpos, zpos, zlen);
 			cpos += zlen;
 		}
 		else if (ch >= 0x80)
@@ -54,8 +89,7 @@ int dsym2c(const BYTE* p, int len, char* cname, int maxclen)
 				break;
 			if (cpos + zlen >= maxclen)
 				break;
-			for(int z = 0; z < zlen; z++)
-				cname[cpos + z] = cname[cpos - zpos + z];
+			copyBackRef(cname, cpos, zpos, zlen);
 			cpos += zlen;
 		}
 #if 0
@@ -83,19 +117,26 @@ int dsym2c(const BYTE* p, int len, char* cname, int maxclen)
 		}
 #endif
 		else
-			cname[cpos++] = ch;
+		{
+			// run of uncompressed characters
+			const BYTE* run = p - 1;
+			while (p < end && *p && *p < 0x80)
+				p++;
+			int n = p - run;
+			bool truncated = cpos + n >= maxclen;
+			if (truncated)
+				n = maxclen - 1 - cpos;
+			dotcpy(cname + cpos, (const char*) run, n, dotChar);
+			cpos += n;
+			if (truncated)
+				break;
+		}
 	}
 
 	cname[cpos] = 0;
 	if(demangleSymbols)
 		if (cname[0] == '_' && cname[1] == 'D' && isdigit(cname[2]))
-			d_demangle(cname, cname, maxclen, true);
-
-#if 1
-	for(int i = 0; i < cpos; i++)
-		if (cname[i] == '.')
-			cname[i] = dotReplacementChar;
-#endif
+			cpos = d_demangle(cname, cpos, cname, maxclen, true, dotReplacementChar);
 
 	return cpos;
 }
@@ -267,11 +308,8 @@ int cstrcpy_v(bool v3, BYTE* d, const char* s)
 		*d++ = len;
 	}
 
-	memcpy(d, s, len + 1);
-
-	for(int i = 0; i < len; i++)
-		if (d[i] == '.')
-			d[i] = dotReplacementChar;
+	dotcpy((char*) d, s, len, dotReplacementChar);
+	d[len] = 0;
 
 	return len + 1;
 }
@@ -7,13 +7,16 @@
 #ifndef __SYMUTIL_H__
 #define __SYMUTIL_H__
 
-#include <windows.h>
+#include "pecoff.h"
 
 struct p_string;
 
 static const int kMaxNameLen = 4096;
 
+// decompress, demangle and replace dots in a single pass, returns the length of the zero terminated result
 int dsym2c(const BYTE* p, int len, char* cname, int maxclen);
+// copy len characters replacing '.' with dotChar, d can be the same as s
+void dotcpy(char* d, const char* s, int len, char dotChar);
 
 int pstrmemlen(const BYTE* p);
 int pstrlen(const BYTE* &p);
@@ -0,0 +1,1204 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "synthimage.h"
+#include "dwarf.h"
+#include "fileio.h"
+
+extern "C" {
+#include "mscvpdb.h"
+}
+
+#include <stdio.h>
+#include <string.h>
+
+typedef SynthImage::Buffer Buffer;
+
+static const unsigned int kFileAlign = 0x200;
+static const unsigned int kSectAlign = 0x1000;
+
+static unsigned int alignUp(unsigned int x, unsigned int align)
+{
+	return (x + align - 1) & ~(align - 1);
+}
+
+static void put1(Buffer& b, unsigned int x)
+{
+	b.push_back((unsigned char) x);
+}
+
+static void put2(Buffer& b, unsigned int x)
+{
+	put1(b, x);
+	put1(b, x >> 8);
+}
+
+static void put4(Buffer& b, unsigned int x)
+{
+	put2(b, x);
+	put2(b, x >> 16);
+}
+
+static void patch2(Buffer& b, size_t pos, unsigned int x)
+{
+	b[pos] = (unsigned char) x;
+	b[pos + 1] = (unsigned char) (x >> 8);
+}
+
+static void patch4(Buffer& b, size_t pos, unsigned int x)
+{
+	patch2(b, pos, x);
+	patch2(b, pos + 2, x >> 16);
+}
+
+static void putLEB128(Buffer& b, unsigned int x)
+{
+	do
+	{
+		unsigned char c = x & 0x7f;
+		x >>= 7;
+		if (x)
+			c |= 0x80;
+		b.push_back(c);
+	} while (x);
+}
+
+static void putSLEB128(Buffer& b, int x)
+{
+	for (;;)
+	{
+		unsigned char c = x & 0x7f;
+		x >>= 7; // arithmetic shift
+		if ((x == 0 && !(c & 0x40)) || (x == -1 && (c & 0x40)))
+		{
+			b.push_back(c);
+			break;
+		}
+		b.push_back(c | 0x80);
+	}
+}
+
+static void putString(Buffer& b, const char* s)
+{
+	b.insert(b.end(), s, s + strlen(s) + 1);
+}
+
+static void putPString(Buffer& b, const char* s)
+{
+	size_t len = strlen(s);
+	if (len > 255)
+		len = 255;
+	put1(b, len);
+	b.insert(b.end(), s, s + len);
+}
+
+static void putBytes(Buffer& b, const void* data, size_t len)
+{
+	b.insert(b.end(), (const unsigned char*) data, (const unsigned char*) data + len);
+}
+
+// pad CodeView record starting at pos to 4 bytes and write its length
+static void endCVRecord(Buffer& b, size_t pos)
+{
+	while ((b.size() - pos) & 3)
+		put1(b, 0xf4 - ((b.size() - pos) & 3));
+	patch2(b, pos, b.size() - pos - 2);
+}
+
+///////////////////////////////////////////////////////////////////////
+enum
+{
+	kAbbrevCompileUnit = 1,
+	kAbbrevBaseType,
+	kAbbrevPointerType,
+	kAbbrevStructType,
+	kAbbrevMember,
+	kAbbrevSubprogramLoc, // frame base is a location list
+	kAbbrevSubprogram,    // frame base is an expression
+	kAbbrevParameter,
+	kAbbrevVariable,
+	kAbbrevGlobalVariable,
+	kAbbrevTypedef,
+	kAbbrevArrayType,
+	kAbbrevSubrangeType,
+	kAbbrevLexicalBlock,
+	kAbbrevVolatileType,
+	kAbbrevAbstractSubprogram, // abstract instance of an inlined function
+	kAbbrevInlined,            // origin in the same compilation unit
+	kAbbrevInlinedAddr,        // origin in another compilation unit
+
+	kAbbrevSecondTable = 0x40, // added to the codes of the table used by odd compilation units
+};
+
+// labels of DIEs referenced within a compilation unit
+enum
+{
+	kLabelInt,
+	kLabelChar,
+	kLabelDouble,
+	kLabelFirstType,
+
+	kLabelStruct = 0,
+	kLabelPointer,
+	kLabelArray,
+	kLabelTypedef,
+	kLabelsPerType
+};
+
+// collects DW_FORM_ref4 references until all DIEs of the compilation unit are placed
+struct DIERefs
+{
+	size_t cuStart;
+	std::vector<unsigned int> labels;
+	std::vector<std::pair<size_t, int> > refs;
+
+	void setLabel(Buffer& b, int label)
+	{
+		if (label >= (int) labels.size())
+			labels.resize(label + 1);
+		labels[label] = b.size() - cuStart;
+	}
+	void putRef(Buffer& b, int label)
+	{
+		refs.push_back(std::make_pair(b.size(), label));
+		put4(b, 0);
+	}
+	void resolve(Buffer& b)
+	{
+		for (size_t r = 0; r < refs.size(); r++)
+			patch4(b, refs[r].first, labels[refs[r].second]);
+		refs.clear();
+		labels.clear();
+	}
+};
+
+static int typeLabel(int t, int kind)
+{
+	return kLabelFirstType + t * kLabelsPerType + kind;
+}
+
+// inlined functions with odd index have their abstract instance in the previous compilation unit
+static bool originInPreviousUnit(int f, int cu)
+{
+	return cu > 0 && (f & 1) != 0;
+}
+
+static void putAbstractSubprogram(Buffer& b, int code0, int f)
+{
+	char name[32];
+	sprintf(name, "i%d", f);
+	putLEB128(b, code0 + kAbbrevAbstractSubprogram);
+	putString(b, name);
+	put1(b, DW_INL_declared_inlined);
+}
+
+static void putAbbrev(Buffer& b, int code, int tag, int children, const int* attrForms)
+{
+	putLEB128(b, code);
+	putLEB128(b, tag);
+	put1(b, children);
+	for (; attrForms[0]; attrForms += 2)
+	{
+		putLEB128(b, attrForms[0]);
+		putLEB128(b, attrForms[1]);
+	}
+	putLEB128(b, 0);
+	putLEB128(b, 0);
+}
+
+///////////////////////////////////////////////////////////////////////
+SynthImage::SynthImage(const SynthParams& params)
+: p(params)
+{
+	if (p.cus < 1)
+		p.cus = 1;
+}
+
+void SynthImage::genDebugAbbrev(Buffer& abbrev, int code0)
+{
+	static const int cu[] = { DW_AT_name, DW_FORM_string, DW_AT_comp_dir, DW_FORM_string,
+	                          DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_addr,
+	                          DW_AT_stmt_list, DW_FORM_data4, 0 };
+	static const int basetype[] = { DW_AT_name, DW_FORM_string, DW_AT_encoding, DW_FORM_data1,
+	                                DW_AT_byte_size, DW_FORM_data1, 0 };
+	static const int pointer[] = { DW_AT_type, DW_FORM_ref4, DW_AT_byte_size, DW_FORM_data1, 0 };
+	static const int structure[] = { DW_AT_name, DW_FORM_string, DW_AT_byte_size, DW_FORM_data2, 0 };
+	static const int member[] = { DW_AT_name, DW_FORM_string, DW_AT_type, DW_FORM_ref4,
+	                              DW_AT_data_member_location, DW_FORM_block1, 0 };
+	static const int subprogramLoc[] = { DW_AT_name, DW_FORM_string, DW_AT_external, DW_FORM_flag,
+	                                     DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_addr,
+	                                     DW_AT_frame_base, DW_FORM_data4, 0 };
+	static const int subprogram[] = { DW_AT_name, DW_FORM_string, DW_AT_external, DW_FORM_flag,
+	                                  DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_addr,
+	                                  DW_AT_frame_base, DW_FORM_block1, 0 };
+	static const int variable[] = { DW_AT_name, DW_FORM_string, DW_AT_type, DW_FORM_ref4,
+	                                DW_AT_location, DW_FORM_block1, 0 };
+	static const int globalvar[] = { DW_AT_name, DW_FORM_string, DW_AT_type, DW_FORM_ref4,
+	                                 DW_AT_external, DW_FORM_flag, DW_AT_MIPS_linkage_name, DW_FORM_string, 0 };
+	static const int typedf[] = { DW_AT_name, DW_FORM_string, DW_AT_type, DW_FORM_ref4, 0 };
+	static const int array[] = { DW_AT_type, DW_FORM_ref4, 0 };
+	static const int subrange[] = { DW_AT_upper_bound, DW_FORM_data1, 0 };
+	static const int block[] = { DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_addr, 0 };
+	static const int modifier[] = { DW_AT_type, DW_FORM_ref4, 0 };
+	static const int abstract[] = { DW_AT_name, DW_FORM_string, DW_AT_inline, DW_FORM_data1, 0 };
+	static const int inlined[] = { DW_AT_abstract_origin, DW_FORM_ref4, DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_addr,
+	                               DW_AT_call_file, DW_FORM_data1, DW_AT_call_line, DW_FORM_data1, 0 };
+	static const int inlinedAddr[] = { DW_AT_abstract_origin, DW_FORM_ref_addr, DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_addr,
+	                                   DW_AT_call_file, DW_FORM_data1, DW_AT_call_line, DW_FORM_data1, 0 };
+
+	putAbbrev(abbrev, code0 + kAbbrevCompileUnit,    DW_TAG_compile_unit,     DW_CHILDREN_yes, cu);
+	putAbbrev(abbrev, code0 + kAbbrevBaseType,       DW_TAG_base_type,        DW_CHILDREN_no,  basetype);
+	putAbbrev(abbrev, code0 + kAbbrevPointerType,    DW_TAG_pointer_type,     DW_CHILDREN_no,  pointer);
+	putAbbrev(abbrev, code0 + kAbbrevStructType,     DW_TAG_structure_type,   DW_CHILDREN_yes, structure);
+	putAbbrev(abbrev, code0 + kAbbrevMember,         DW_TAG_member,           DW_CHILDREN_no,  member);
+	putAbbrev(abbrev, code0 + kAbbrevSubprogramLoc,  DW_TAG_subprogram,       DW_CHILDREN_yes, subprogramLoc);
+	putAbbrev(abbrev, code0 + kAbbrevSubprogram,     DW_TAG_subprogram,       DW_CHILDREN_yes, subprogram);
+	putAbbrev(abbrev, code0 + kAbbrevParameter,      DW_TAG_formal_parameter, DW_CHILDREN_no,  variable);
+	putAbbrev(abbrev, code0 + kAbbrevVariable,       DW_TAG_variable,         DW_CHILDREN_no,  variable);
+	putAbbrev(abbrev, code0 + kAbbrevGlobalVariable, DW_TAG_variable,         DW_CHILDREN_no,  globalvar);
+	putAbbrev(abbrev, code0 + kAbbrevTypedef,        DW_TAG_typedef,          DW_CHILDREN_no,  typedf);
+	putAbbrev(abbrev, code0 + kAbbrevArrayType,      DW_TAG_array_type,       DW_CHILDREN_yes, array);
+	putAbbrev(abbrev, code0 + kAbbrevSubrangeType,   DW_TAG_subrange_type,    DW_CHILDREN_no,  subrange);
+	putAbbrev(abbrev, code0 + kAbbrevLexicalBlock,   DW_TAG_lexical_block,    DW_CHILDREN_yes, block);
+	putAbbrev(abbrev, code0 + kAbbrevVolatileType,   DW_TAG_volatile_type,    DW_CHILDREN_no,  modifier);
+	putAbbrev(abbrev, code0 + kAbbrevAbstractSubprogram, DW_TAG_subprogram,   DW_CHILDREN_no,  abstract);
+	putAbbrev(abbrev, code0 + kAbbrevInlined,        DW_TAG_inlined_subroutine, DW_CHILDREN_no, inlined);
+	putAbbrev(abbrev, code0 + kAbbrevInlinedAddr,    DW_TAG_inlined_subroutine, DW_CHILDREN_no, inlinedAddr);
+	put1(abbrev, 0);
+}
+
+void SynthImage::genDebugInfo(Buffer& info, const std::vector<unsigned int>& abbrevOffsets,
+                              const std::vector<unsigned int>& lineOffsets, const std::vector<unsigned int>& locOffsets)
+{
+	char name[64];
+	DIERefs refs;
+	std::vector<unsigned int> originOffsets(p.funcs); // of the abstract instances in .debug_info
+	for (int c = 0; c < p.cus; c++)
+	{
+		int t0 = firstOf(p.types, c),   t1 = firstOf(p.types, c + 1);
+		int f0 = firstOf(p.funcs, c),   f1 = firstOf(p.funcs, c + 1);
+		int g0 = firstOf(p.globals, c), g1 = firstOf(p.globals, c + 1);
+		int f2 = c + 1 < p.cus ? firstOf(p.funcs, c + 2) : f1;
+
+		// odd units use the second abbreviation table, so DIEs are only decoded with the unit they belong to
+		int code0 = (c & 1) ? kAbbrevSecondTable : 0;
+		refs.cuStart = info.size();
+		put4(info, 0); // unit_length
+		put2(info, 2); // version
+		put4(info, abbrevOffsets[c & 1]); // debug_abbrev_offset
+		put1(info, 4); // address_size
+
+		sprintf(name, "mod%d.d", c);
+		putLEB128(info, code0 + kAbbrevCompileUnit);
+		putString(info, name);
+		putString(info, "c:\\synth");
+		put4(info, funcAddr(f0));
+		put4(info, funcAddr(f1));
+		put4(info, lineOffsets[c]);
+
+		refs.setLabel(info, kLabelInt);
+		putLEB128(info, code0 + kAbbrevBaseType);
+		putString(info, "int");
+		put1(info, DW_ATE_signed);
+		put1(info, 4);
+		refs.setLabel(info, kLabelChar);
+		putLEB128(info, code0 + kAbbrevBaseType);
+		putString(info, "char");
+		put1(info, DW_ATE_unsigned_char);
+		put1(info, 1);
+		refs.setLabel(info, kLabelDouble);
+		putLEB128(info, code0 + kAbbrevBaseType);
+		putString(info, "double");
+		put1(info, DW_ATE_float);
+		put1(info, 8);
+
+		// identical DIEs as emitted for separate declarations, converted to the same CodeView type
+		for (int d = 0; d < 2; d++)
+		{
+			putLEB128(info, code0 + kAbbrevPointerType);
+			refs.putRef(info, kLabelInt);
+			put1(info, 4);
+			putLEB128(info, code0 + kAbbrevVolatileType);
+			refs.putRef(info, kLabelInt);
+		}
+
+		for (int t = t0; t < t1; t++)
+		{
+			int lt = t - t0;
+			// struct S { int a; S* next; char[8] buf; }, "next" refers forward to the next struct
+			refs.setLabel(info, typeLabel(lt, kLabelStruct));
+			putLEB128(info, code0 + kAbbrevStructType);
+			sprintf(name, "S%d", t);
+			putString(info, name);
+			put2(info, 16);
+
+			static const struct { const char* name; int kind; int off; } members[] =
+			{
+				{ "a", -1, 0 }, { "next", kLabelPointer, 4 }, { "buf", kLabelArray, 8 }
+			};
+			for (int m = 0; m < 3; m++)
+			{
+				putLEB128(info, code0 + kAbbrevMember);
+				putString(info, members[m].name);
+				if (members[m].kind < 0)
+					refs.putRef(info, kLabelInt);
+				else if (members[m].kind == kLabelPointer)
+					refs.putRef(info, typeLabel(t + 1 < t1 ? lt + 1 : lt, kLabelPointer));
+				else
+					refs.putRef(info, typeLabel(lt, members[m].kind));
+				put1(info, 2);
+				put1(info, DW_OP_plus_uconst);
+				put1(info, members[m].off);
+			}
+			put1(info, 0);
+
+			refs.setLabel(info, typeLabel(lt, kLabelPointer));
+			putLEB128(info, code0 + kAbbrevPointerType);
+			refs.putRef(info, typeLabel(lt, kLabelStruct));
+			put1(info, 4);
+
+			refs.setLabel(info, typeLabel(lt, kLabelArray));
+			putLEB128(info, code0 + kAbbrevArrayType);
+			refs.putRef(info, kLabelChar);
+			putLEB128(info, code0 + kAbbrevSubrangeType);
+			put1(info, 7);
+			put1(info, 0);
+
+			refs.setLabel(info, typeLabel(lt, kLabelTypedef));
+			putLEB128(info, code0 + kAbbrevTypedef);
+			sprintf(name, "T%d", t);
+			putString(info, name);
+			refs.putRef(info, typeLabel(lt, kLabelPointer));
+		}
+
+		for (int g = g0; g < g1; g++)
+		{
+			putLEB128(info, code0 + kAbbrevGlobalVariable);
+			sprintf(name, "g%d", g);
+			putString(info, name);
+			refs.putRef(info, kLabelInt);
+			put1(info, 1);
+			putString(info, name);
+		}
+
+		for (int f = f1; f < f2 && f < p.inlines; f++)
+			if (originInPreviousUnit(f, c + 1))
+			{
+				originOffsets[f] = info.size();
+				putAbstractSubprogram(info, code0, f);
+			}
+
+		for (int f = f0; f < f1; f++)
+		{
+			bool inlines = f < p.inlines;
+			if (inlines && !originInPreviousUnit(f, c))
+			{
+				originOffsets[f] = info.size();
+				putAbstractSubprogram(info, code0, f);
+			}
+
+			bool useLoc = f < (int) locOffsets.size();
+			putLEB128(info, code0 + (useLoc ? kAbbrevSubprogramLoc : kAbbrevSubprogram));
+			sprintf(name, "f%d", f);
+			putString(info, name);
+			put1(info, 1);
+			put4(info, funcAddr(f));
+			put4(info, funcAddr(f + 1));
+			if (useLoc)
+				put4(info, locOffsets[f]);
+			else
+			{
+				put1(info, 2);
+				put1(info, DW_OP_breg5); // ebp
+				putSLEB128(info, 8);
+			}
+
+			putLEB128(info, code0 + kAbbrevParameter);
+			putString(info, "a");
+			refs.putRef(info, kLabelInt);
+			put1(info, 2);
+			put1(info, DW_OP_fbreg);
+			putSLEB128(info, 8);
+
+			putLEB128(info, code0 + kAbbrevLexicalBlock);
+			put4(info, funcAddr(f) + 4);
+			put4(info, funcAddr(f + 1) - 4);
+			putLEB128(info, code0 + kAbbrevVariable);
+			putString(info, "x");
+			refs.putRef(info, t1 > t0 ? typeLabel((f - f0) % (t1 - t0), kLabelStruct) : kLabelDouble);
+			put1(info, 2);
+			put1(info, DW_OP_fbreg);
+			putSLEB128(info, -16);
+			put1(info, 0); // end of lexical block
+
+			// two calls of i<f>, the second one is not nested in the DIE of the first,
+			// but its code is: a sibling with a range inside the range of the first call
+			static const struct { unsigned int lo, hi, line; } calls[] = { { 8, 24, 10 }, { 12, 16, 20 } };
+			for (int i = 0; inlines && i < 2; i++)
+			{
+				if (originInPreviousUnit(f, c))
+				{
+					putLEB128(info, code0 + kAbbrevInlinedAddr);
+					put4(info, originOffsets[f]);
+				}
+				else
+				{
+					putLEB128(info, code0 + kAbbrevInlined);
+					put4(info, originOffsets[f] - refs.cuStart);
+				}
+				put4(info, funcAddr(f) + calls[i].lo);
+				put4(info, funcAddr(f) + calls[i].hi);
+				put1(info, 1);
+				put1(info, calls[i].line);
+			}
+
+			put1(info, 0); // end of subprogram
+		}
+		put1(info, 0); // end of compile unit
+
+		patch4(info, refs.cuStart, info.size() - refs.cuStart - 4);
+		refs.resolve(info);
+	}
+}
+
+void SynthImage::genDebugLine(Buffer& line, std::vector<unsigned int>& lineOffsets)
+{
+	static const int kLineBase = -5;
+	static const int kLineRange = 14;
+	static const int kOpcodeBase = 13;
+	static const unsigned char opcodeLengths[kOpcodeBase - 1] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+
+	char name[64];
+	for (int c = 0; c < p.cus; c++)
+	{
+		int f0 = firstOf(p.funcs, c), f1 = firstOf(p.funcs, c + 1);
+
+		size_t start = line.size();
+		lineOffsets.push_back(start);
+		put4(line, 0); // unit_length
+		put2(line, 2); // version
+		put4(line, 0); // header_length
+		size_t hdrstart = line.size();
+		put1(line, 1); // minimum_instruction_length
+		put1(line, 1); // default_is_stmt
+		put1(line, kLineBase);
+		put1(line, kLineRange);
+		put1(line, kOpcodeBase);
+		putBytes(line, opcodeLengths, sizeof(opcodeLengths));
+		putString(line, "src");
+		put1(line, 0);
+		sprintf(name, "mod%d.d", c);
+		putString(line, name);
+		putLEB128(line, 1); // dir_index
+		putLEB128(line, 0); // lastModification
+		putLEB128(line, 0); // fileLength
+		put1(line, 0);
+		patch4(line, start + 6, line.size() - hdrstart);
+
+		int curLine = 1;
+		unsigned int addr = funcAddr(f0);
+		for (int f = f0; f < f1; f++)
+		{
+			int rows = (int) ((long long) p.lines * (f + 1) / p.funcs - (long long) p.lines * f / p.funcs);
+
+			addr = funcAddr(f);
+			put1(line, 0);
+			putLEB128(line, 5);
+			put1(line, DW_LNE_set_address);
+			put4(line, addr);
+			put1(line, DW_LNS_advance_line);
+			putSLEB128(line, 2);
+			curLine += 2;
+			put1(line, DW_LNS_copy);
+
+			for (int r = 1; r < rows; r++)
+			{
+				int adv = r * kFuncSize / rows - (r - 1) * kFuncSize / rows;
+				if (adv > (255 - kOpcodeBase - (1 - kLineBase)) / kLineRange)
+				{
+					put1(line, DW_LNS_advance_pc);
+					putLEB128(line, adv);
+					addr += adv;
+					adv = 0;
+				}
+				put1(line, (1 - kLineBase) + kLineRange * adv + kOpcodeBase);
+				addr += adv;
+				curLine++;
+			}
+		}
+		if (f1 > f0)
+		{
+			put1(line, DW_LNS_advance_pc);
+			putLEB128(line, funcAddr(f1) - addr);
+		}
+		put1(line, 0);
+		putLEB128(line, 1);
+		put1(line, DW_LNE_end_sequence);
+
+		patch4(line, start, line.size() - start - 4);
+	}
+}
+
+void SynthImage::genDebugFrame(Buffer& frame)
+{
+	// CIE: cfa = esp+4, return address at cfa-4
+	put4(frame, 0);
+	put4(frame, 0xffffffff);
+	put1(frame, 1);  // version
+	put1(frame, 0);  // augmentation
+	putLEB128(frame, 1);
+	putSLEB128(frame, -4);
+	putLEB128(frame, 8); // eip
+	put1(frame, DW_CFA_def_cfa);
+	putLEB128(frame, 4);
+	putLEB128(frame, 4);
+	put1(frame, DW_CFA_offset | 8);
+	putLEB128(frame, 1);
+	while (frame.size() & 3)
+		put1(frame, DW_CFA_nop);
+	patch4(frame, 0, frame.size() - 4);
+
+	// FDEs for "push ebp; mov ebp,esp", extra FDEs cover addresses past the last function
+	for (int i = 0; i < p.fdes; i++)
+	{
+		size_t start = frame.size();
+		put4(frame, 0);
+		put4(frame, 0); // CIE_pointer
+		put4(frame, funcAddr(i));
+		put4(frame, kFuncSize);
+		put1(frame, DW_CFA_advance_loc | 1);
+		put1(frame, DW_CFA_def_cfa_offset);
+		putLEB128(frame, 8);
+		put1(frame, DW_CFA_offset | 5);
+		putLEB128(frame, 2);
+		put1(frame, DW_CFA_advance_loc | 2);
+		put1(frame, DW_CFA_def_cfa_register);
+		putLEB128(frame, 5);
+		while ((frame.size() - start) & 3)
+			put1(frame, DW_CFA_nop);
+		patch4(frame, start, frame.size() - start - 4);
+	}
+}
+
+void SynthImage::genDebugLoc(Buffer& loc, std::vector<unsigned int>& locOffsets)
+{
+	// frame base moves from esp to ebp during the prolog, offsets relative to the CU base address
+	int n = p.locs < p.funcs ? p.locs : p.funcs;
+	for (int c = 0; c < p.cus; c++)
+	{
+		int f0 = firstOf(p.funcs, c), f1 = firstOf(p.funcs, c + 1);
+		for (int f = f0; f < f1 && f < n; f++)
+		{
+			locOffsets.push_back(loc.size());
+			unsigned int base = funcAddr(f) - funcAddr(f0);
+			static const struct { unsigned int beg, end; int reg, off; } ranges[] =
+			{
+				{ 0, 1, 4, 4 }, { 1, 3, 4, 8 }, { 3, kFuncSize, 5, 8 }
+			};
+			for (int r = 0; r < 3; r++)
+			{
+				put4(loc, base + ranges[r].beg);
+				put4(loc, base + ranges[r].end);
+				Buffer expr;
+				put1(expr, DW_OP_breg0 + ranges[r].reg);
+				putSLEB128(expr, ranges[r].off);
+				put2(loc, expr.size());
+				putBytes(loc, expr.data(), expr.size());
+			}
+			put4(loc, 0);
+			put4(loc, 0);
+		}
+	}
+}
+
+void SynthImage::genCOFFSymbols(Buffer& symbols, Buffer& strings, std::vector<Section>& sections)
+{
+	strings.clear();
+	put4(strings, 0);
+
+	char name[64];
+	for (size_t s = 0; s < sections.size(); s++)
+		if (sections[s].name.length() > IMAGE_SIZEOF_SHORT_NAME)
+		{
+			sprintf(name, "/%d", (int) strings.size());
+			putString(strings, sections[s].name.c_str());
+			sections[s].name = name;
+		}
+
+	// external symbols in .data (section 2) and .text (section 1)
+	for (int i = 0; i < p.globals + p.funcs; i++)
+	{
+		IMAGE_SYMBOL sym;
+		memset(&sym, 0, sizeof(sym));
+		if (i < p.globals)
+		{
+			sprintf(name, "_g%d", i);
+			sym.Value = i * 4;
+			sym.SectionNumber = 2;
+		}
+		else
+		{
+			sprintf(name, "_f%d", i - p.globals);
+			sym.Value = (i - p.globals) * kFuncSize;
+			sym.SectionNumber = 1;
+		}
+		sym.N.Name.Short = 0;
+		sym.N.Name.Long = strings.size();
+		sym.StorageClass = IMAGE_SYM_CLASS_EXTERNAL;
+		putString(strings, name);
+		putBytes(symbols, &sym, IMAGE_SIZEOF_SYMBOL);
+	}
+	patch4(strings, 0, strings.size());
+}
+
+///////////////////////////////////////////////////////////////////////
+void SynthImage::genCodeView(Buffer& cv)
+{
+	std::vector<OMFDirEntry> dir;
+	OMFDirEntry entry;
+	char name[64];
+
+	putBytes(cv, "NB09", 4);
+	put4(cv, 0); // filepos of directory
+
+	// sstModule
+	for (int m = 0; m < p.cus; m++)
+	{
+		int f0 = firstOf(p.funcs, m), f1 = firstOf(p.funcs, m + 1);
+		entry.SubSection = sstModule;
+		entry.iMod = m + 1;
+		entry.lfo = cv.size();
+		put2(cv, 0); // ovlNumber
+		put2(cv, 0); // iLib
+		put2(cv, 1); // cSeg
+		putBytes(cv, "CV", 2);
+		put2(cv, 1); // Seg
+		put2(cv, 0);
+		put4(cv, f0 * kFuncSize);
+		put4(cv, (f1 - f0) * kFuncSize);
+		sprintf(name, "mod%d.obj", m);
+		putPString(cv, name);
+		entry.cb = cv.size() - entry.lfo;
+		dir.push_back(entry);
+		while (cv.size() & 3)
+			put1(cv, 0);
+	}
+
+	// sstAlignSym: procedures with a parameter and a local, UDTs with D style dotted names
+	for (int m = 0; m < p.cus; m++)
+	{
+		int t0 = firstOf(p.types, m), t1 = firstOf(p.types, m + 1);
+		int f0 = firstOf(p.funcs, m), f1 = firstOf(p.funcs, m + 1);
+		entry.SubSection = sstAlignSym;
+		entry.iMod = m + 1;
+		entry.lfo = cv.size();
+		put4(cv, 1); // signature
+
+		for (int t = t0; t < t1; t++)
+		{
+			size_t pos = cv.size();
+			put2(cv, 0);
+			put2(cv, S_UDT_V1);
+			put2(cv, 0x1000 + 4 * t + 1);
+			sprintf(name, "mod%d.S%d", m, t);
+			putPString(cv, name);
+			endCVRecord(cv, pos);
+		}
+		for (int f = f0; f < f1; f++)
+		{
+			size_t pos = cv.size();
+			put2(cv, 0);
+			put2(cv, S_GPROC_V1);
+			put4(cv, 0); // pparent
+			put4(cv, 0); // pend
+			put4(cv, 0); // next
+			put4(cv, kFuncSize);
+			put4(cv, 3); // debug_start
+			put4(cv, kFuncSize - 1);
+			put4(cv, f * kFuncSize);
+			put2(cv, 1); // segment
+			put2(cv, 0); // proctype
+			put1(cv, 0); // flags
+			sprintf(name, "mod%d.f%d", m, f);
+			putPString(cv, name);
+			endCVRecord(cv, pos);
+
+			pos = cv.size();
+			put2(cv, 0);
+			put2(cv, S_BPREL_V1);
+			put4(cv, 8);
+			put2(cv, 0x74); // int
+			putPString(cv, "a");
+			endCVRecord(cv, pos);
+
+			pos = cv.size();
+			put2(cv, 0);
+			put2(cv, S_BPREL_V1);
+			put4(cv, -16);
+			put2(cv, t1 > t0 ? 0x1000 + 4 * (t0 + (f - f0) % (t1 - t0)) + 2 : 0x74);
+			putPString(cv, "x");
+			endCVRecord(cv, pos);
+
+			put2(cv, 2);
+			put2(cv, S_END_V1);
+		}
+		entry.cb = cv.size() - entry.lfo;
+		dir.push_back(entry);
+	}
+
+	// sstGlobalTypes: field list, struct, pointer to struct and D dynamic array of struct per type
+	entry.SubSection = sstGlobalTypes;
+	entry.iMod = 0xffff;
+	entry.lfo = cv.size();
+	put4(cv, 0x01000000); // flags
+	put4(cv, 4 * p.types + 2 * p.classes);
+	size_t offsets = cv.size();
+	cv.resize(cv.size() + 16 * p.types + 8 * p.classes);
+	size_t typeBase = cv.size();
+	for (int t = 0; t < p.types; t++)
+	{
+		int m = 0;
+		while (firstOf(p.types, m + 1) <= t)
+			m++;
+		int fieldlist = 0x1000 + 4 * t;
+
+		patch4(cv, offsets + 16 * t, cv.size() - typeBase);
+		size_t pos = cv.size();
+		put2(cv, 0);
+		put2(cv, LF_FIELDLIST_V1);
+		static const struct { const char* name; int type; int off; } members[] =
+		{
+			{ "a", 0x74, 0 }, { "next", -1, 4 }, { "len", 0x74, 8 }, { "ptr", 0x470, 12 }
+		};
+		for (int i = 0; i < 4; i++)
+		{
+			put2(cv, LF_MEMBER_V1);
+			put2(cv, members[i].type < 0 ? fieldlist + 2 : members[i].type);
+			put2(cv, 3); // public
+			put2(cv, members[i].off);
+			putPString(cv, members[i].name);
+			while ((cv.size() - pos) & 3)
+				put1(cv, 0xf4 - ((cv.size() - pos) & 3));
+		}
+		endCVRecord(cv, pos);
+
+		patch4(cv, offsets + 16 * t + 4, cv.size() - typeBase);
+		pos = cv.size();
+		put2(cv, 0);
+		put2(cv, LF_STRUCTURE_V1);
+		put2(cv, 4); // n_element
+		put2(cv, fieldlist);
+		put2(cv, 0); // property
+		put2(cv, 0); // derived
+		put2(cv, 0); // vshape
+		put2(cv, 16);
+		sprintf(name, "mod%d.S%d", m, t);
+		putPString(cv, name);
+		endCVRecord(cv, pos);
+
+		patch4(cv, offsets + 16 * t + 8, cv.size() - typeBase);
+		pos = cv.size();
+		put2(cv, 0);
+		put2(cv, LF_POINTER_V1);
+		put2(cv, 0x800a);
+		put2(cv, fieldlist + 1);
+		endCVRecord(cv, pos);
+
+		patch4(cv, offsets + 16 * t + 12, cv.size() - typeBase);
+		pos = cv.size();
+		put2(cv, 0);
+		put2(cv, LF_OEM_V1);
+		put2(cv, 0x42); // oemid
+		put2(cv, 1);    // dynamic array
+		put2(cv, 2);    // count
+		put2(cv, 0x75); // index type
+		put2(cv, fieldlist + 1);
+		endCVRecord(cv, pos);
+	}
+
+	// field list and class per D class: object.Object, then repeating a class deriving from Object,
+	// an interface, a class sharing the field list of the class two before and a class deriving
+	// from the previous one
+	int classBase = 0x1000 + 4 * p.types;
+	for (int c = 0; c < p.classes; c++)
+	{
+		int fieldlist = classBase + 2 * c;
+
+		patch4(cv, offsets + 16 * p.types + 8 * c, cv.size() - typeBase);
+		size_t pos = cv.size();
+		put2(cv, 0);
+		put2(cv, LF_FIELDLIST_V1);
+		int n_element = 1;
+		if (c > 0 && c % 4 != 2)
+		{
+			put2(cv, LF_BCLASS_V1);
+			put2(cv, c % 4 == 0 ? fieldlist - 1 : classBase + 1);
+			put2(cv, 3); // public
+			put2(cv, 0); // offset
+			n_element++;
+		}
+		put2(cv, LF_MEMBER_V1);
+		put2(cv, 0x74);
+		put2(cv, 3); // public
+		put2(cv, 8); // after vtbl and monitor
+		putPString(cv, "m");
+		endCVRecord(cv, pos);
+
+		patch4(cv, offsets + 16 * p.types + 8 * c + 4, cv.size() - typeBase);
+		pos = cv.size();
+		put2(cv, 0);
+		put2(cv, LF_CLASS_V1);
+		put2(cv, n_element);
+		put2(cv, c % 4 == 3 ? fieldlist - 4 : fieldlist);
+		put2(cv, 0); // property
+		put2(cv, 0); // derived
+		put2(cv, 0); // vshape
+		put2(cv, 12);
+		if (c == 0)
+			strcpy(name, "object.Object");
+		else
+			sprintf(name, c % 4 == 2 ? "I%d" : "C%d", c);
+		putPString(cv, name);
+		endCVRecord(cv, pos);
+	}
+	entry.cb = cv.size() - entry.lfo;
+	dir.push_back(entry);
+
+	// empty sstGlobalSym and sstStaticSym
+	for (int i = 0; i < 2; i++)
+	{
+		entry.SubSection = i ? sstStaticSym : sstGlobalSym;
+		entry.iMod = 0xffff;
+		entry.lfo = cv.size();
+		put2(cv, 10); // symhash
+		put2(cv, 12); // addrhash
+		put4(cv, 0);  // cbSymbol
+		put4(cv, 0);  // cbHSym
+		put4(cv, 0);  // cbHAddr
+		entry.cb = cv.size() - entry.lfo;
+		dir.push_back(entry);
+	}
+
+	// sstSegMap for .text and .data
+	entry.SubSection = sstSegMap;
+	entry.iMod = 0xffff;
+	entry.lfo = cv.size();
+	put2(cv, 2);
+	put2(cv, 2);
+	for (int s = 0; s < 2; s++)
+	{
+		put2(cv, s ? 0x10b : 0x10d); // flags
+		put2(cv, 0);      // ovl
+		put2(cv, 0);      // group
+		put2(cv, s + 1);  // frame
+		put2(cv, 0xffff); // iSegName
+		put2(cv, 0xffff); // iClassName
+		put4(cv, 0);
+		put4(cv, s ? 4 * p.globals + 4 : p.funcs * kFuncSize);
+	}
+	entry.cb = cv.size() - entry.lfo;
+	dir.push_back(entry);
+
+	// directory
+	patch4(cv, 4, cv.size());
+	put2(cv, sizeof(OMFDirHeader));
+	put2(cv, sizeof(OMFDirEntry));
+	put4(cv, dir.size());
+	put4(cv, 0); // lfoNextDir
+	put4(cv, 0); // flags
+	for (size_t d = 0; d < dir.size(); d++)
+	{
+		put2(cv, dir[d].SubSection);
+		put2(cv, dir[d].iMod);
+		put4(cv, dir[d].lfo);
+		put4(cv, dir[d].cb);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+void SynthImage::layoutSections(std::vector<Section>& sections)
+{
+	unsigned int hdrsize = 0x80 + sizeof(IMAGE_NT_HEADERS32) + sections.size() * sizeof(IMAGE_SECTION_HEADER);
+	unsigned int raw = alignUp(hdrsize, kFileAlign);
+	unsigned int va = kTextRVA;
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		sections[s].virtualAddress = va;
+		sections[s].rawPointer = raw;
+		raw += alignUp(sections[s].data.size(), kFileAlign);
+		va += alignUp(sections[s].data.size() ? sections[s].data.size() : 1, kSectAlign);
+	}
+}
+
+bool SynthImage::writeImage(const char* fname, std::vector<Section>& sections,
+                           const Buffer& symbols, const Buffer& strings, int debugSection)
+{
+	Buffer img;
+	img.resize(alignUp(0x80 + sizeof(IMAGE_NT_HEADERS32) + sections.size() * sizeof(IMAGE_SECTION_HEADER), kFileAlign));
+
+	IMAGE_DOS_HEADER* dos = (IMAGE_DOS_HEADER*) img.data();
+	dos->e_magic = IMAGE_DOS_SIGNATURE;
+	dos->e_lfanew = 0x80;
+
+	const Section& last = sections.back();
+	unsigned int rawend = last.rawPointer + alignUp(last.data.size(), kFileAlign);
+
+	IMAGE_NT_HEADERS32* hdr = (IMAGE_NT_HEADERS32*) (img.data() + 0x80);
+	hdr->Signature = IMAGE_NT_SIGNATURE;
+	hdr->FileHeader.Machine = IMAGE_FILE_MACHINE_I386;
+	hdr->FileHeader.NumberOfSections = sections.size();
+	hdr->FileHeader.PointerToSymbolTable = symbols.size() ? rawend : 0;
+	hdr->FileHeader.NumberOfSymbols = symbols.size() / IMAGE_SIZEOF_SYMBOL;
+	hdr->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER32);
+	hdr->FileHeader.Characteristics = 0x0102; // executable, 32-bit
+	hdr->OptionalHeader.Magic = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+	hdr->OptionalHeader.AddressOfEntryPoint = kTextRVA;
+	hdr->OptionalHeader.BaseOfCode = kTextRVA;
+	hdr->OptionalHeader.ImageBase = kImageBase;
+	hdr->OptionalHeader.SectionAlignment = kSectAlign;
+	hdr->OptionalHeader.FileAlignment = kFileAlign;
+	hdr->OptionalHeader.MajorOperatingSystemVersion = 4;
+	hdr->OptionalHeader.MajorSubsystemVersion = 4;
+	hdr->OptionalHeader.SizeOfImage = alignUp(last.virtualAddress + last.data.size(), kSectAlign);
+	hdr->OptionalHeader.SizeOfHeaders = img.size();
+	hdr->OptionalHeader.Subsystem = 3; // console
+	hdr->OptionalHeader.NumberOfRvaAndSizes = 16;
+	if (debugSection >= 0)
+	{
+		hdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress = sections[debugSection].virtualAddress;
+		hdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_DEBUG].Size = sizeof(IMAGE_DEBUG_DIRECTORY);
+	}
+
+	IMAGE_SECTION_HEADER* sec = (IMAGE_SECTION_HEADER*) (hdr + 1);
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		strncpy((char*) sec[s].Name, sections[s].name.c_str(), IMAGE_SIZEOF_SHORT_NAME);
+		sec[s].Misc.VirtualSize = sections[s].data.size();
+		sec[s].VirtualAddress = sections[s].virtualAddress;
+		sec[s].SizeOfRawData = alignUp(sections[s].data.size(), kFileAlign);
+		sec[s].PointerToRawData = sections[s].rawPointer;
+		sec[s].Characteristics = sections[s].characteristics;
+	}
+
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		putBytes(img, sections[s].data.data(), sections[s].data.size());
+		img.resize(alignUp(img.size(), kFileAlign));
+	}
+	putBytes(img, symbols.data(), symbols.size());
+	if (symbols.size())
+		putBytes(img, strings.data(), strings.size());
+
+	int fd = openFileWrite(fname);
+	if (fd == -1)
+		return setError("Can't create file");
+	bool ok = write(fd, img.data(), img.size()) == (int) img.size();
+	close(fd);
+	if (!ok)
+		return setError("Cannot write file");
+	return true;
+}
+
+static SynthImage::Section mkSection(const char* name, unsigned int characteristics)
+{
+	SynthImage::Section s;
+	s.name = name;
+	s.characteristics = characteristics;
+	s.virtualAddress = 0;
+	s.rawPointer = 0;
+	return s;
+}
+
+static const unsigned int kTextFlags  = IMAGE_SCN_CNT_CODE | 0x20000000 | IMAGE_SCN_MEM_READ; // execute
+static const unsigned int kDataFlags  = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE;
+static const unsigned int kDebugFlags = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_DISCARDABLE;
+
+bool SynthImage::writeDWARF(const char* fname)
+{
+	std::vector<Section> sections;
+	sections.push_back(mkSection(".text", kTextFlags));
+	sections.back().data.resize(p.funcs * kFuncSize, 0xcc);
+	sections.push_back(mkSection(".data", kDataFlags));
+	sections.back().data.resize(4 * p.globals + 4);
+
+	std::vector<unsigned int> lineOffsets, locOffsets;
+	Buffer abbrev, info, line, frame, loc;
+	std::vector<unsigned int> abbrevOffsets;
+	for (int t = 0; t < 2; t++)
+	{
+		abbrevOffsets.push_back(abbrev.size());
+		genDebugAbbrev(abbrev, t * kAbbrevSecondTable);
+	}
+	genDebugLine(line, lineOffsets);
+	genDebugLoc(loc, locOffsets);
+	genDebugFrame(frame);
+	genDebugInfo(info, abbrevOffsets, lineOffsets, locOffsets);
+
+	const char* names[] = { ".debug_abbrev", ".debug_info", ".debug_line", ".debug_frame", ".debug_loc" };
+	Buffer* data[] = { &abbrev, &info, &line, &frame, &loc };
+	for (int s = 0; s < 5; s++)
+	{
+		sections.push_back(mkSection(names[s], kDebugFlags));
+		sections.back().data.swap(*data[s]);
+	}
+
+	Buffer symbols, strings;
+	genCOFFSymbols(symbols, strings, sections);
+	layoutSections(sections);
+	return writeImage(fname, sections, symbols, strings, -1);
+}
+
+bool SynthImage::writeCV(const char* fname)
+{
+	std::vector<Section> sections;
+	sections.push_back(mkSection(".text", kTextFlags));
+	sections.back().data.resize(p.funcs * kFuncSize, 0xcc);
+	sections.push_back(mkSection(".data", kDataFlags));
+	sections.back().data.resize(4 * p.globals + 4);
+
+	Buffer cv;
+	genCodeView(cv);
+
+	sections.push_back(mkSection(".debug", kDebugFlags));
+	Section& debug = sections.back();
+	debug.data.resize(sizeof(IMAGE_DEBUG_DIRECTORY));
+	putBytes(debug.data, cv.data(), cv.size());
+	layoutSections(sections);
+
+	IMAGE_DEBUG_DIRECTORY* dbgDir = (IMAGE_DEBUG_DIRECTORY*) debug.data.data();
+	memset(dbgDir, 0, sizeof(*dbgDir));
+	dbgDir->Type = IMAGE_DEBUG_TYPE_CODEVIEW;
+	dbgDir->SizeOfData = cv.size();
+	dbgDir->AddressOfRawData = debug.virtualAddress + sizeof(IMAGE_DEBUG_DIRECTORY);
+	dbgDir->PointerToRawData = debug.rawPointer + sizeof(IMAGE_DEBUG_DIRECTORY);
+
+	Buffer symbols, strings;
+	return writeImage(fname, sections, symbols, strings, sections.size() - 1);
+}
+
+// .text$f<n> has 1 to 4 times the function size, so the sections overlapping at address 0 differ in size
+static unsigned int objFuncSize(int f)
+{
+	return (1 + f % 4) * 32;
+}
+
+bool SynthImage::writeObj(const char* fname)
+{
+	char name[64];
+	std::vector<Section> sections;
+	sections.push_back(mkSection(".data", kDataFlags));
+	sections.back().data.resize(4 * p.funcs); // pointer to each function
+	for (int f = 0; f < p.funcs; f++)
+	{
+		sprintf(name, ".text$f%d", f);
+		sections.push_back(mkSection(name, kTextFlags | IMAGE_SCN_LNK_COMDAT));
+		sections.back().data.resize(objFuncSize(f), 0xcc);
+	}
+
+	// section names are longer than 8 characters, so all names are in the string table
+	Buffer symbols, strings;
+	put4(strings, 0);
+	std::vector<unsigned int> nameOffsets;
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		nameOffsets.push_back(strings.size());
+		putString(strings, sections[s].name.c_str());
+		sprintf(name, "/%d", nameOffsets.back());
+		sections[s].name = name;
+	}
+
+	// _table in .data, then per function the section symbol with its COMDAT auxiliary record and _f<n>
+	IMAGE_SYMBOL sym;
+	memset(&sym, 0, sizeof(sym));
+	sym.N.Name.Long = strings.size();
+	sym.SectionNumber = 1;
+	sym.StorageClass = IMAGE_SYM_CLASS_EXTERNAL;
+	putString(strings, "_table");
+	putBytes(symbols, &sym, IMAGE_SIZEOF_SYMBOL);
+	for (int f = 0; f < p.funcs; f++)
+	{
+		memset(&sym, 0, sizeof(sym));
+		sym.N.Name.Long = nameOffsets[f + 1];
+		sym.SectionNumber = f + 2;
+		sym.StorageClass = IMAGE_SYM_CLASS_STATIC;
+		sym.NumberOfAuxSymbols = 1;
+		putBytes(symbols, &sym, IMAGE_SIZEOF_SYMBOL);
+
+		Buffer aux;
+		put4(aux, objFuncSize(f)); // Length
+		put2(aux, 0); // NumberOfRelocations
+		put2(aux, 0); // NumberOfLinenumbers
+		put4(aux, 0); // CheckSum
+		put2(aux, 0); // Number
+		put1(aux, IMAGE_COMDAT_SELECT_ANY);
+		aux.resize(IMAGE_SIZEOF_SYMBOL);
+		putBytes(symbols, aux.data(), aux.size());
+
+		memset(&sym, 0, sizeof(sym));
+		sprintf(name, "_f%d", f);
+		sym.N.Name.Long = strings.size();
+		sym.SectionNumber = f + 2;
+		sym.StorageClass = IMAGE_SYM_CLASS_EXTERNAL;
+		putString(strings, name);
+		putBytes(symbols, &sym, IMAGE_SIZEOF_SYMBOL);
+	}
+	patch4(strings, 0, strings.size());
+
+	// relocations of the pointer table in reverse order, against _f<n> at symbol index 3 + 3 * n
+	Buffer relocs;
+	for (int f = p.funcs; f-- > 0; )
+	{
+		put4(relocs, 4 * f);
+		put4(relocs, 3 + 3 * f);
+		put2(relocs, IMAGE_REL_I386_DIR32);
+	}
+
+	Buffer obj;
+	obj.resize(sizeof(IMAGE_FILE_HEADER) + sections.size() * sizeof(IMAGE_SECTION_HEADER));
+	unsigned int raw = obj.size();
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		sections[s].rawPointer = raw;
+		raw += sections[s].data.size();
+		if (s == 0)
+			raw += relocs.size();
+	}
+
+	IMAGE_FILE_HEADER* hdr = (IMAGE_FILE_HEADER*) obj.data();
+	hdr->Machine = IMAGE_FILE_MACHINE_I386;
+	hdr->NumberOfSections = sections.size();
+	hdr->PointerToSymbolTable = raw;
+	hdr->NumberOfSymbols = symbols.size() / IMAGE_SIZEOF_SYMBOL;
+
+	IMAGE_SECTION_HEADER* sec = (IMAGE_SECTION_HEADER*) (hdr + 1);
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		strncpy((char*) sec[s].Name, sections[s].name.c_str(), IMAGE_SIZEOF_SHORT_NAME);
+		sec[s].SizeOfRawData = sections[s].data.size();
+		sec[s].PointerToRawData = sections[s].rawPointer;
+		sec[s].Characteristics = sections[s].characteristics;
+	}
+	sec[0].PointerToRelocations = sections[0].rawPointer + sections[0].data.size();
+	sec[0].NumberOfRelocations = p.funcs;
+
+	for (size_t s = 0; s < sections.size(); s++)
+	{
+		putBytes(obj, sections[s].data.data(), sections[s].data.size());
+		if (s == 0)
+			putBytes(obj, relocs.data(), relocs.size());
+	}
+	putBytes(obj, symbols.data(), symbols.size());
+	putBytes(obj, strings.data(), strings.size());
+
+	int fd = openFileWrite(fname);
+	if (fd == -1)
+		return setError("Can't create file");
+	bool ok = write(fd, obj.data(), obj.size()) == (int) obj.size();
+	close(fd);
+	if (!ok)
+		return setError("Cannot write file");
+	return true;
+}
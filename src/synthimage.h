@@ -0,0 +1,81 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __SYNTHIMAGE_H__
+#define __SYNTHIMAGE_H__
+
+#include "LastError.h"
+#include "pecoff.h"
+
+#include <string>
+#include <vector>
+
+// sizes of the synthetic debug information, distributed evenly over the compilation units
+struct SynthParams
+{
+	int cus;     // compilation units (DWARF) or modules (CodeView)
+	int types;   // struct types, each with a pointer, an array and a typedef
+	int funcs;   // functions, each with a parameter and a local in a lexical block
+	int lines;   // line number rows
+	int fdes;    // frame description entries in .debug_frame
+	int locs;    // functions using a location list in .debug_loc as frame base
+	int globals; // external variables found through the COFF symbol table
+	int inlines; // functions with two inlined calls, every other abstract instance is in the previous unit
+	int classes; // D classes in the CodeView image: object.Object, derived classes, interfaces and shared field lists
+
+	SynthParams()
+	: cus(10), types(1000), funcs(1000), lines(20000), fdes(1000), locs(100), globals(100), inlines(100), classes(100) {}
+};
+
+// writes PE images with generated DWARF sections or NB09 CodeView data
+class SynthImage : public LastError
+{
+public:
+	SynthImage(const SynthParams& params);
+
+	bool writeDWARF(const char* fname);
+	bool writeCV(const char* fname);
+	// COFF object with a COMDAT section per function, all sections start at address 0
+	bool writeObj(const char* fname);
+
+	// virtual address of the generated function f in .text
+	unsigned int funcAddr(int f) const { return kImageBase + kTextRVA + f * kFuncSize; }
+
+	typedef std::vector<unsigned char> Buffer;
+
+	struct Section
+	{
+		std::string name;
+		Buffer data;
+		unsigned int characteristics;
+		unsigned int virtualAddress; // assigned by layoutSections
+		unsigned int rawPointer;     // assigned by layoutSections
+	};
+
+private:
+	int firstOf(int total, int cu) const { return (int)((long long) total * cu / p.cus); }
+
+	void genDebugInfo(Buffer& info, const std::vector<unsigned int>& abbrevOffsets,
+	                  const std::vector<unsigned int>& lineOffsets, const std::vector<unsigned int>& locOffsets);
+	void genDebugAbbrev(Buffer& abbrev, int code0);
+	void genDebugLine(Buffer& line, std::vector<unsigned int>& lineOffsets);
+	void genDebugFrame(Buffer& frame);
+	void genDebugLoc(Buffer& loc, std::vector<unsigned int>& locOffsets);
+	void genCOFFSymbols(Buffer& symbols, Buffer& strings, std::vector<Section>& sections);
+	void genCodeView(Buffer& cv);
+
+	void layoutSections(std::vector<Section>& sections);
+	bool writeImage(const char* fname, std::vector<Section>& sections,
+	                const Buffer& symbols, const Buffer& strings, int debugSection);
+
+	SynthParams p;
+
+	static const unsigned int kImageBase = 0x400000;
+	static const unsigned int kTextRVA = 0x1000;
+	static const unsigned int kFuncSize = 32;
+};
+
+#endif //__SYNTHIMAGE_H__
@@ -0,0 +1,178 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "taskgraph.h"
+
+#include <thread>
+
+int TaskGraph::addTask(const char* name, const Function& fn, bool usesPDB)
+{
+	Task task;
+	task.name = name;
+	task.fn = fn;
+	task.usesPDB = usesPDB;
+	task.waitingFor = 0;
+	tasks.push_back(task);
+	return tasks.size() - 1;
+}
+
+void TaskGraph::addDependency(int task, int dependsOn)
+{
+	tasks[dependsOn].dependents.push_back(task);
+	tasks[task].waitingFor++;
+}
+
+bool TaskGraph::run(int threads)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	finished = 0;
+	failed = -1;
+	int independent = 0;
+	for (size_t t = 0; t < tasks.size(); t++)
+	{
+		if (tasks[t].waitingFor == 0)
+			(tasks[t].usesPDB ? readyPDB : readyAny).push_back(t);
+		if (!tasks[t].usesPDB)
+			independent++;
+	}
+
+	// more threads than tasks not calling into the PDB would stay idle
+	if (threads > independent + 1)
+		threads = independent + 1;
+
+	std::vector<std::thread> workers;
+	for (int w = 1; w < threads; w++)
+		workers.push_back(std::thread(&TaskGraph::work, this, false));
+	lock.unlock();
+
+	work(true);
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+	return failed < 0;
+}
+
+void TaskGraph::work(bool callingThread)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		int task = -1;
+		while (task < 0)
+		{
+			if (failed >= 0 || finished == tasks.size())
+				return;
+			if (callingThread && !readyPDB.empty())
+			{
+				task = readyPDB.front();
+				readyPDB.erase(readyPDB.begin());
+			}
+			else if (!readyAny.empty())
+			{
+				task = readyAny.front();
+				readyAny.erase(readyAny.begin());
+			}
+			else
+				cond.wait(lock);
+		}
+
+		lock.unlock();
+		bool ok = tasks[task].fn();
+		lock.lock();
+
+		if (!ok)
+		{
+			if (failed < 0)
+				failed = task;
+		}
+		else
+		{
+			finished++;
+			const std::vector<int>& dependents = tasks[task].dependents;
+			for (size_t d = 0; d < dependents.size(); d++)
+				if (--tasks[dependents[d]].waitingFor == 0)
+					(tasks[dependents[d]].usesPDB ? readyPDB : readyAny).push_back(dependents[d]);
+		}
+		cond.notify_all();
+	}
+}
+
+bool runOrdered(int count, int threads, int slots,
+                const std::function<bool(int item, int slot)>& produce,
+                const std::function<bool(int item, int slot)>& consume)
+{
+	if (threads > count)
+		threads = count;
+	if (slots < 1)
+		slots = 1;
+	if (threads <= 1 || slots == 1)
+	{
+		for (int i = 0; i < count; i++)
+			if (!produce(i, 0) || !consume(i, 0))
+				return false;
+		return true;
+	}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<char> produced(count, 0);
+	int next = 0;     // next item to produce
+	int consumed = 0; // items passed to consume
+	bool failed = false;
+
+	// called with the mutex locked, returns false if there was no item with a free slot
+	auto produceNext = [&](std::unique_lock<std::mutex>& lock) -> bool
+	{
+		if (failed || next >= count || next >= consumed + slots)
+			return false;
+		int item = next++;
+		lock.unlock();
+		bool ok = produce(item, item % slots);
+		lock.lock();
+		if (ok)
+			produced[item] = 1;
+		else
+			failed = true;
+		cond.notify_all();
+		return true;
+	};
+
+	auto work = [&]()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!failed && next < count)
+			if (!produceNext(lock))
+				cond.wait(lock);
+	};
+
+	std::vector<std::thread> workers;
+	for (int w = 1; w < threads; w++)
+		workers.push_back(std::thread(work));
+
+	// the calling thread helps producing while the next item to consume is not ready
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!failed && consumed < count)
+	{
+		if (!produced[consumed])
+		{
+			if (!produceNext(lock))
+				cond.wait(lock);
+			continue;
+		}
+		lock.unlock();
+		bool ok = consume(consumed, consumed % slots);
+		lock.lock();
+		if (ok)
+			consumed++;
+		else
+			failed = true;
+		cond.notify_all();
+	}
+	lock.unlock();
+
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+	return !failed;
+}
@@ -0,0 +1,66 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __TASKGRAPH_H__
+#define __TASKGRAPH_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// conversion phases with their dependencies, run on a pool of threads.
+// Phases calling into the PDB library are only run on the thread calling run(),
+// one at a time, so the PDB is never accessed concurrently.
+class TaskGraph
+{
+public:
+	typedef std::function<bool()> Function;
+
+	TaskGraph() : finished(0), failed(-1) {}
+
+	int addTask(const char* name, const Function& fn, bool usesPDB);
+	void addDependency(int task, int dependsOn);
+
+	// runs all tasks on at most threads threads including the calling one,
+	// returns false if a task failed, no further tasks are started then
+	bool run(int threads);
+
+	int failedTask() const { return failed; }
+	const char* getName(int task) const { return tasks[task].name; }
+
+private:
+	struct Task
+	{
+		const char* name;
+		Function fn;
+		bool usesPDB;
+		int waitingFor;              // unfinished dependencies
+		std::vector<int> dependents;
+	};
+
+	void work(bool callingThread);
+
+	std::vector<Task> tasks;
+	std::vector<int> readyPDB;      // tasks for the calling thread
+	std::vector<int> readyAny;
+	size_t finished;
+	int failed;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+};
+
+// runs produce(item, slot) for the items 0 to count-1 on at most threads threads including
+// the calling one, and consume(item, slot) on the calling thread in the order of the items,
+// e.g. to pass the results to the PDB library. At most slots items are produced ahead of
+// consume, item uses slot item % slots, so the caller can reuse a buffer per slot.
+// returns false if produce or consume failed, no further items are started then
+bool runOrdered(int count, int threads, int slots,
+                const std::function<bool(int item, int slot)>& produce,
+                const std::function<bool(int item, int slot)>& consume);
+
+#endif //__TASKGRAPH_H__
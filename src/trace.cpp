@@ -0,0 +1,223 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "trace.h"
+#include "fileio.h"
+
+#include <stdio.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool traceEnabled = false;
+
+struct TraceEvent
+{
+	const char* name;
+	std::string detail;
+	long long start, end;                 // performance counter ticks
+	unsigned long long cpuStart, cpuEnd;  // process time in 100ns units
+	int depth;
+	unsigned long tid;
+};
+
+// spans can be opened by the phases running concurrently on different threads
+static std::mutex traceMutex;
+static std::vector<TraceEvent> events;
+static std::map<unsigned long, std::vector<size_t> > openEvents; // per thread
+
+#ifdef _WIN32
+
+static long long ticksNow()
+{
+	LARGE_INTEGER cnt;
+	QueryPerformanceCounter(&cnt);
+	return cnt.QuadPart;
+}
+
+static double ticksToMicroSeconds(long long ticks)
+{
+	static LONGLONG freq = 0;
+	if (freq == 0)
+	{
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		freq = f.QuadPart;
+	}
+	return ticks * 1e6 / freq;
+}
+
+static unsigned long long cpuNow()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return k.QuadPart + u.QuadPart;
+}
+
+static unsigned long currentThreadId()
+{
+	return GetCurrentThreadId();
+}
+
+static unsigned long currentProcessId()
+{
+	return GetCurrentProcessId();
+}
+
+#else
+
+// ticks are nanoseconds of the monotonic clock
+static long long ticksNow()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double ticksToMicroSeconds(long long ticks)
+{
+	return ticks / 1e3;
+}
+
+static unsigned long long cpuNow()
+{
+	rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 10000000ULL + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 10ULL;
+}
+
+static unsigned long currentThreadId()
+{
+#ifdef SYS_gettid
+	return syscall(SYS_gettid);
+#else
+	return (unsigned long) pthread_self();
+#endif
+}
+
+static unsigned long currentProcessId()
+{
+	return getpid();
+}
+
+#endif
+
+void traceBegin(const char* name, const char* detail)
+{
+	TraceEvent ev;
+	ev.name = name;
+	if (detail)
+		ev.detail = detail;
+	ev.tid = currentThreadId();
+	ev.cpuStart = ev.cpuEnd = cpuNow();
+	ev.start = ev.end = ticksNow();
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+	std::vector<size_t>& open = openEvents[ev.tid];
+	ev.depth = open.size();
+	open.push_back(events.size());
+	events.push_back(ev);
+}
+
+void traceEnd()
+{
+	long long end = ticksNow();
+	unsigned long long cpuEnd = cpuNow();
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+	std::vector<size_t>& open = openEvents[currentThreadId()];
+	if (open.empty())
+		return;
+	TraceEvent& ev = events[open.back()];
+	ev.end = end;
+	ev.cpuEnd = cpuEnd;
+	open.pop_back();
+}
+
+void tracePrintPhases()
+{
+	printf("%-28s %12s %12s\n", "phase", "wall [ms]", "cpu [ms]");
+	// phases can overlap, so the total is measured from the first start to the last end
+	long long start = 0, end = 0;
+	unsigned long long cpuStart = 0, cpuEnd = 0;
+	bool first = true;
+	for (size_t e = 0; e < events.size(); e++)
+		if (events[e].depth == 0)
+		{
+			double w = ticksToMicroSeconds(events[e].end - events[e].start) / 1000;
+			double c = (events[e].cpuEnd - events[e].cpuStart) / 10000.0;
+			printf("%-28s %12.3f %12.3f\n", events[e].name, w, c);
+			if (first || events[e].start < start)
+				start = events[e].start, cpuStart = events[e].cpuStart;
+			if (first || events[e].end > end)
+				end = events[e].end, cpuEnd = events[e].cpuEnd;
+			first = false;
+		}
+	printf("%-28s %12.3f %12.3f\n", "total", ticksToMicroSeconds(end - start) / 1000, (cpuEnd - cpuStart) / 10000.0);
+}
+
+static void writeJSONString(FILE* fp, const char* s)
+{
+	fputc('"', fp);
+	for (; *s; s++)
+	{
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+bool traceWriteJSON(const char* fname)
+{
+	FILE* fp = openFileStream(fname, "w");
+	if (!fp)
+		return false;
+
+	long long base = events.empty() ? 0 : events[0].start;
+	unsigned long pid = currentProcessId();
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (size_t e = 0; e < events.size(); e++)
+	{
+		const TraceEvent& ev = events[e];
+		fprintf(fp, "{\"name\":");
+		writeJSONString(fp, ev.name);
+		fprintf(fp, ",\"cat\":\"cv2pdb\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu",
+		        ticksToMicroSeconds(ev.start - base), ticksToMicroSeconds(ev.end - ev.start),
+		        (unsigned long) pid, (unsigned long) ev.tid);
+		fprintf(fp, ",\"args\":{\"cpu_ms\":%.3f", (ev.cpuEnd - ev.cpuStart) / 10000.0);
+		if (!ev.detail.empty())
+		{
+			fprintf(fp, ",\"detail\":");
+			writeJSONString(fp, ev.detail.c_str());
+		}
+		fprintf(fp, "}}%s\n", e + 1 < events.size() ? "," : "");
+	}
+	fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,39 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// nested timing spans, reported as a phase summary (-time) or
+// written as Chrome trace events (--trace=file.json)
+extern bool traceEnabled;
+
+// name must be a string literal, detail is copied
+void traceBegin(const char* name, const char* detail = 0);
+void traceEnd();
+
+void tracePrintPhases();
+bool traceWriteJSON(const char* fname);
+
+class TraceSpan
+{
+public:
+	TraceSpan(const char* name, const char* detail = 0) : active(traceEnabled)
+	{
+		if (active)
+			traceBegin(name, detail);
+	}
+	~TraceSpan()
+	{
+		if (active)
+			traceEnd();
+	}
+
+private:
+	bool active;
+};
+
+#endif //__TRACE_H__
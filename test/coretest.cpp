@@ -0,0 +1,650 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+// checks the conversion core without a PDB: images with generated DWARF and
+// CodeView data are written, loaded and decoded, failures set the exit code
+
+#include "PEImage.h"
+#include "cv2pdb.h"
+#include "readDwarf.h"
+#include "symbolize.h"
+#include "synthimage.h"
+#include "symutil.h"
+#include "demangle.h"
+#include "dwarf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+
+static int failures = 0;
+
+static void check(bool cond, const char* what)
+{
+	if (cond)
+		return;
+	printf("FAILED: %s\n", what);
+	failures++;
+}
+
+static void testDemangle()
+{
+	char r[kMaxNameLen];
+	for (int i = 0; i < numDemangleTests; i++)
+	{
+		d_demangle(demangleTests[i].mangled, r, sizeof(r), false, false);
+		if (strcmp(r, demangleTests[i].demangled) != 0)
+		{
+			printf("FAILED: %s demangles as '%s', expected '%s'\n", demangleTests[i].mangled, r, demangleTests[i].demangled);
+			failures++;
+		}
+	}
+}
+
+static void testSymutil()
+{
+	char cname[kMaxNameLen];
+	const char plain[] = "std.stdio.File";
+	int len = dsym2c((const BYTE*) plain, sizeof(plain) - 1, cname, sizeof(cname));
+	check(len == 14 && strcmp(cname, "std@stdio@File") == 0, "dsym2c replaces dots");
+
+	BYTE pname[256];
+	check(c2p("module.name", pname) == 12, "c2p length");
+	check(p2ccmp(pname, "module.name"), "p2ccmp after c2p");
+	check(strcmp(p2c(pname), "module.name") == 0, "p2c after c2p");
+}
+
+static void testDWARF(const SynthParams& params, const std::string& exe)
+{
+	SynthImage synth(params);
+	if (!synth.writeDWARF(exe.c_str()))
+	{
+		check(false, synth.getLastError());
+		return;
+	}
+
+	PEImage img;
+	if (!img.loadExe(exe.c_str()))
+	{
+		check(false, img.getLastError());
+		return;
+	}
+	check(img.hasDWARF(), "DWARF sections found");
+	DIECursor::setContext(&img);
+
+	DIEIndex index;
+	check(index.build(img), "DIEIndex::build");
+	int subprograms = 0;
+	for (int die = 0; die < index.count(); die++)
+		if (index.tag[die] == DW_TAG_subprogram)
+			subprograms++;
+	check(subprograms == params.funcs + params.inlines, "one DW_TAG_subprogram per function and abstract instance");
+
+	check(img.relocateDebugLineInfo((unsigned int) img.getImageBase()), "relocateDebugLineInfo");
+	std::vector<DWARF_LineBlock> blocks;
+	check(interpretDWARFLines(img, 0, &blocks), "interpretDWARFLines");
+	size_t lines = 0;
+	for (size_t b = 0; b < blocks.size(); b++)
+		lines += blocks[b].lines.size();
+	check(lines >= (size_t) params.lines, "all line number rows decoded");
+
+	DWARFSymbolizer symbolizer;
+	if (!symbolizer.build(img))
+	{
+		check(false, symbolizer.getLastError());
+		return;
+	}
+	check(symbolizer.countFunctions() == (size_t) (params.funcs + 2 * params.inlines), "symbolizer functions and inlined calls");
+	char name[32];
+	for (int f = 0; f < params.funcs; f++)
+	{
+		std::vector<SymbolizedFrame> frames;
+		sprintf(name, "f%d", f);
+		if (symbolizer.symbolize(synth.funcAddr(f) + 1, frames) != 1
+		    || !frames[0].function || strcmp(frames[0].function, name) != 0
+		    || !frames[0].file || frames[0].line == 0)
+		{
+			printf("FAILED: symbolize %s\n", name);
+			failures++;
+		}
+	}
+
+	// f<n> calls i<n> from line 10 at offsets 8 to 24 and from line 20 at offsets 12 to 16, the second
+	// call is a sibling of the first in .debug_info. Odd functions after the first compilation unit
+	// refer to an abstract instance in the previous one.
+	static const struct { unsigned int off; unsigned int callLine; } calls[] = { { 8, 10 }, { 20, 10 }, { 12, 20 }, { 15, 20 } };
+	char inlined[32];
+	for (int f = 0; f < params.inlines; f++)
+	{
+		sprintf(name, "f%d", f);
+		sprintf(inlined, "i%d", f);
+		for (int c = 0; c < 4; c++)
+		{
+			std::vector<SymbolizedFrame> frames;
+			if (symbolizer.symbolize(synth.funcAddr(f) + calls[c].off, frames) != 2
+			    || !frames[0].function || strcmp(frames[0].function, inlined) != 0 || !frames[0].inlined
+			    || !frames[1].function || strcmp(frames[1].function, name) != 0 || frames[1].inlined
+			    || !frames[1].file || frames[1].line != calls[c].callLine)
+			{
+				printf("FAILED: symbolize %s inlined into %s at offset %d\n", inlined, name, calls[c].off);
+				failures++;
+			}
+		}
+	}
+}
+
+// checks that DIEs with the given tag referring to the same base type are converted to the same CodeView type
+static void checkSharedType(CV2PDB& cv2pdb, int tag, int expected, const char* what)
+{
+	const DIEIndex& index = cv2pdb.dieIndex;
+	std::map<int, int> cvtypes; // by referenced DIE
+	int dies = 0, shared = 0;
+	for (int die = 0; die < index.count(); die++)
+	{
+		int type = index.type[die];
+		if (index.tag[die] != tag || type < 0 || index.tag[type] != DW_TAG_base_type)
+			continue;
+		dies++;
+		std::map<int, int>::iterator it = cvtypes.find(type);
+		if (it == cvtypes.end())
+			cvtypes[type] = cv2pdb.dieCVType[die];
+		else if (it->second > 0 && it->second == cv2pdb.dieCVType[die])
+			shared++;
+	}
+	if (dies != expected || shared != expected / 2)
+	{
+		printf("FAILED: %s, %d DIEs, %d shared\n", what, dies, shared);
+		failures++;
+	}
+}
+
+static void testTypes(const SynthParams& params, const std::string& exe)
+{
+	PEImage img;
+	if (!img.loadExe(exe.c_str()))
+	{
+		check(false, img.getLastError());
+		return;
+	}
+
+	// with the global module, the types are converted without a PDB
+	CV2PDB cv2pdb(img);
+	cv2pdb.useGlobalMod = true;
+	if (!cv2pdb.initDWARFTypes() || !cv2pdb.buildDIEIndex() || !cv2pdb.createTypes())
+	{
+		check(false, cv2pdb.getLastError());
+		return;
+	}
+
+	// each compilation unit has two int* and two volatile int
+	checkSharedType(cv2pdb, DW_TAG_pointer_type, 2 * params.cus, "identical pointer types");
+	checkSharedType(cv2pdb, DW_TAG_volatile_type, 2 * params.cus, "identical volatile types");
+}
+
+// linear scans of the section table, as PEImage did before the interval table
+static char* scanRVA(PEImage& img, unsigned int rva, int len)
+{
+	for (int s = 0; s < img.countSections(); s++)
+	{
+		const IMAGE_SECTION_HEADER& sec = img.getSection(s);
+		if (rva >= sec.VirtualAddress && rva + len <= sec.VirtualAddress + sec.SizeOfRawData)
+			return img.DPV<char>(sec.PointerToRawData + rva - sec.VirtualAddress, len);
+	}
+	return 0;
+}
+
+static int scanSection(PEImage& img, unsigned int off)
+{
+	off -= (unsigned int) img.getImageBase();
+	for (int s = 0; s < img.countSections(); s++)
+	{
+		const IMAGE_SECTION_HEADER& sec = img.getSection(s);
+		if (sec.VirtualAddress <= off && off < sec.VirtualAddress + sec.Misc.VirtualSize)
+			return s;
+	}
+	return -1;
+}
+
+static void checkRVA(PEImage& img, unsigned int rva, int len)
+{
+	if (img.RVA<char>(rva, len) != scanRVA(img, rva, len))
+	{
+		printf("FAILED: RVA(0x%x, %d)\n", rva, len);
+		failures++;
+	}
+}
+
+static void testImageSymbols(const SynthParams& params, const std::string& exe)
+{
+	SynthImage synth(params);
+	PEImage img;
+	if (!synth.writeDWARF(exe.c_str()) || !img.loadExe(exe.c_str()))
+	{
+		check(false, "cannot create image with COFF symbols");
+		return;
+	}
+
+	// _g<n> in .data and _f<n> in .text, found with and without the leading underscore
+	unsigned long off = 0;
+	check(img.findSymbol("_g3", off) == 2 && off == 12, "findSymbol _g3");
+	check(img.findSymbol("g3", off) == 2 && off == 12, "findSymbol g3 matches _g3");
+	check(img.findSymbol("f7", off) == 1 && off == 7 * 32, "findSymbol f7 matches _f7");
+	check(img.findSymbol("_f7", off) == 1 && off == 7 * 32, "findSymbol _f7");
+	check(img.findSymbol("f", off) < 0 && img.findSymbol("f7x", off) < 0 && img.findSymbol("__f7", off) < 0, "findSymbol of unknown names");
+	char name[32];
+	for (int f = 0; f < params.funcs; f++)
+	{
+		sprintf(name, "f%d", f);
+		if (img.findSymbol(name, off) != 1 || off != (unsigned long) f * 32)
+		{
+			printf("FAILED: findSymbol %s\n", name);
+			failures++;
+		}
+	}
+
+	// section lookups at the bounds of each section and in the gaps between them
+	unsigned int base = (unsigned int) img.getImageBase();
+	for (int s = 0; s < img.countSections(); s++)
+	{
+		const IMAGE_SECTION_HEADER& sec = img.getSection(s);
+		unsigned int bounds[] = { sec.VirtualAddress - 1, sec.VirtualAddress, sec.VirtualAddress + 1,
+		                          sec.VirtualAddress + sec.Misc.VirtualSize - 1, sec.VirtualAddress + sec.Misc.VirtualSize,
+		                          sec.VirtualAddress + sec.SizeOfRawData - 1, sec.VirtualAddress + sec.SizeOfRawData };
+		for (int b = 0; b < 7; b++)
+		{
+			if (img.findSection(base + bounds[b]) != scanSection(img, base + bounds[b]))
+			{
+				printf("FAILED: findSection(0x%x)\n", base + bounds[b]);
+				failures++;
+			}
+			checkRVA(img, bounds[b], 1);
+			checkRVA(img, bounds[b], 4);
+		}
+	}
+	check(img.findSection(synth.funcAddr(params.funcs - 1)) == 0, "findSection of the last function");
+}
+
+static void testObjectFile(const SynthParams& params, const std::string& obj)
+{
+	SynthImage synth(params);
+	if (!synth.writeObj(obj.c_str()))
+	{
+		check(false, synth.getLastError());
+		return;
+	}
+	PEImage img;
+	if (!img.loadObj(obj.c_str()))
+	{
+		check(false, img.getLastError());
+		return;
+	}
+	check(img.countSections() == params.funcs + 1, "sections of the object file");
+
+	unsigned long off = 1;
+	check(img.findSymbol("_table", off) == 1 && off == 0, "findSymbol _table");
+	char name[32];
+	for (int f = 0; f < params.funcs; f++)
+	{
+		sprintf(name, "_f%d", f);
+		const char* comdat = img.findSectionSymbolName(f + 2);
+		if (!comdat || strcmp(comdat, name) != 0 || img.findSymbol(name + 1, off) != f + 2 || off != 0)
+		{
+			printf("FAILED: symbol of section %d\n", f + 2);
+			failures++;
+		}
+		// .data has a pointer to each function, the relocations are not sorted by address
+		if (img.getRelocationInSegment(0, 4 * f) != f + 2 || img.getRelocationInSegment(0, 4 * f + 1) >= 0)
+		{
+			printf("FAILED: relocation of the pointer to %s\n", name);
+			failures++;
+		}
+	}
+	check(img.getRelocationInSegment(0, 4 * params.funcs) < 0, "no relocation past the pointer table");
+	check(img.getRelocationInSegment(1, 0) < 0, "no relocations in the function sections");
+
+	// all sections start at address 0, the first one in the table large enough is found
+	unsigned int maxSize = 0;
+	for (int s = 0; s < img.countSections(); s++)
+		if (img.getSection(s).SizeOfRawData > maxSize)
+			maxSize = img.getSection(s).SizeOfRawData;
+	for (unsigned int rva = 0; rva <= maxSize + 1; rva++)
+	{
+		checkRVA(img, rva, 1);
+		checkRVA(img, 0, rva + 1);
+	}
+}
+
+static void testCV(const SynthParams& params, const std::string& exe)
+{
+	SynthImage synth(params);
+	if (!synth.writeCV(exe.c_str()))
+	{
+		check(false, synth.getLastError());
+		return;
+	}
+
+	PEImage img;
+	if (!img.loadExe(exe.c_str()))
+	{
+		check(false, img.getLastError());
+		return;
+	}
+	check(!img.hasDWARF(), "no DWARF sections in the CodeView image");
+
+	// sstModule and sstAlignSym per module, sstGlobalTypes, sstGlobalSym, sstStaticSym and sstSegMap
+	check(img.countCVEntries() == 2 * params.cus + 4, "CodeView directory entries");
+	int modules = 0, symbols = 0;
+	for (int i = 0; i < img.countCVEntries(); i++)
+	{
+		OMFDirEntry* entry = img.getCVEntry(i);
+		if (entry->SubSection == sstModule)
+			modules++;
+		else if (entry->SubSection == sstAlignSym)
+			symbols++;
+	}
+	check(modules == params.cus && symbols == params.cus, "module and symbol subsections");
+}
+
+// the global types and module symbols converted on worker threads must be identical to the serial conversion
+static void testCVThreads(SynthParams params, const std::string& exe)
+{
+	params.types = 200; // several chunks of types
+	SynthImage synth(params);
+	if (!synth.writeCV(exe.c_str()))
+	{
+		check(false, synth.getLastError());
+		return;
+	}
+
+	PEImage img;
+	if (!img.loadExe(exe.c_str()))
+	{
+		check(false, img.getLastError());
+		return;
+	}
+
+	CV2PDB serial(img), parallel(img);
+	serial.threads = 1;
+	parallel.threads = 4;
+	CV2PDB* conv[2] = { &serial, &parallel };
+	for (int i = 0; i < 2; i++)
+		if (!conv[i]->initGlobalSymbols() || !conv[i]->initGlobalTypes())
+		{
+			check(false, conv[i]->getLastError());
+			return;
+		}
+
+	check(serial.cbGlobalTypes == parallel.cbGlobalTypes
+	      && memcmp(serial.globalTypes, parallel.globalTypes, serial.cbGlobalTypes) == 0, "global types with 4 threads");
+	check(serial.cbUdtSymbols == parallel.cbUdtSymbols
+	      && memcmp(serial.udtSymbols, parallel.udtSymbols, serial.cbUdtSymbols) == 0, "UDT symbols with 4 threads");
+	int cTypes = serial.globalTypeHeader->cTypes;
+	check(cTypes == 4 * params.types + 2 * params.classes
+	      && memcmp(serial.pointerTypes, parallel.pointerTypes, cTypes * sizeof(*serial.pointerTypes)) == 0, "pointer types with 4 threads");
+
+	// the converted symbols of every sstAlignSym entry, submitted in entry order
+	std::vector<std::string> symbols[2];
+	for (int i = 0; i < 2; i++)
+	{
+		bool rc = conv[i]->convertSymbols([&](int e, const BYTE* sym, int cb) -> bool
+		{
+			if (e != (int) symbols[i].size())
+				return false;
+			symbols[i].push_back(std::string((const char*) sym, cb));
+			return true;
+		});
+		check(rc, "convertSymbols submits in entry order");
+	}
+	check(symbols[0].size() == (size_t) params.cus && !symbols[0][0].empty(), "converted symbols per module");
+	check(symbols[0] == symbols[1], "module symbols with 4 threads");
+}
+
+// name of a decoded field list entry, CodeView 3 entries have C strings, older ones Pascal strings
+static std::string fieldName(const codeview_reftype* fieldlist, const CV2PDB::FieldEntry& field)
+{
+	if (field.name < 0)
+		return std::string();
+	const char* p = (const char*) fieldlist->fieldlist.list + field.name;
+	switch (field.kind)
+	{
+	case LF_ENUMERATE_V3:
+	case LF_MEMBER_V3:
+	case LF_STMEMBER_V3:
+	case LF_METHOD_V3:
+	case LF_NESTTYPE_V3:
+		return p;
+	}
+	return std::string(p + 1, (unsigned char) p[0]);
+}
+
+static void put(std::vector<unsigned char>& b, unsigned int x, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		b.push_back((unsigned char) (x >> (8 * i)));
+}
+
+static void putPString(std::vector<unsigned char>& b, const char* s)
+{
+	put(b, strlen(s), 1);
+	b.insert(b.end(), s, s + strlen(s));
+}
+
+static void padField(std::vector<unsigned char>& b)
+{
+	while ((b.size() - 4) & 3)
+		put(b, 0xf4 - ((b.size() - 4) & 3), 1);
+}
+
+// friend functions are skipped, numeric leaves are decoded at the end of the fixed part of the entry
+static void testDecodeFields()
+{
+	std::vector<unsigned char> b;
+	put(b, 0, 2);
+	put(b, LF_FIELDLIST_V2, 2);
+	put(b, LF_MEMBER_V2, 2);   // pos 0
+	put(b, 3, 2);              // public
+	put(b, 0x74, 4);
+	put(b, 0x10, 2);           // offset
+	putPString(b, "a");
+	padField(b);
+	put(b, LF_FRIENDFCN_V2, 2); // pos 12
+	put(b, 0, 2);
+	put(b, 0x1001, 4);
+	putPString(b, "f");
+	padField(b);
+	put(b, LF_MEMBER_V2, 2);   // pos 24
+	put(b, 3, 2);
+	put(b, 0x1002, 4);
+	put(b, LF_ULONG, 2);
+	put(b, 0x12345, 4);
+	putPString(b, "long");
+	padField(b);
+	put(b, LF_FRIENDFCN_V1, 2); // pos 44
+	put(b, 0x1001, 2);
+	putPString(b, "g");
+	padField(b);
+	put(b, LF_BCLASS_V2, 2);   // pos 52
+	put(b, 3, 2);
+	put(b, 0x1003, 4);
+	put(b, 4, 2);              // offset
+	padField(b);
+	b[0] = (unsigned char) (b.size() - 2);
+
+	PEImage img;
+	CV2PDB cv2pdb(img);
+	std::vector<CV2PDB::FieldEntry> fields;
+	const codeview_reftype* fieldlist = (const codeview_reftype*) b.data();
+	check(cv2pdb.decodeFields(fieldlist, fields), cv2pdb.getLastError());
+	check(fields.size() == 3, "friend functions are skipped");
+	if (fields.size() != 3)
+		return;
+
+	check(fields[0].kind == LF_MEMBER_V2 && fields[0].pos == 0 && fields[0].type == 0x74 && fields[0].offset == 0x10
+	      && fields[0].len == 12 && fieldName(fieldlist, fields[0]) == "a", "LF_MEMBER_V2 with a short offset");
+	check(fields[1].kind == LF_MEMBER_V2 && fields[1].pos == 24 && fields[1].type == 0x1002 && fields[1].offset == 0x12345
+	      && fields[1].tail == 32 && fields[1].len == 19 && fieldName(fieldlist, fields[1]) == "long", "LF_MEMBER_V2 with a numeric leaf");
+	check(fields[2].kind == LF_BCLASS_V2 && fields[2].pos == 52 && fields[2].type == 0x1003 && fields[2].offset == 4
+	      && fields[2].len == 10 && fields[2].name < 0, "LF_BCLASS_V2 after the friend functions");
+}
+
+// the field lists of the D structs and classes get the nested class type enum and a base class
+// if they have none, a field list shared by two classes is only extended once
+static void testClassTypeEnums(const SynthParams& params, const std::string& exe)
+{
+	SynthImage synth(params);
+	if (!synth.writeCV(exe.c_str()))
+	{
+		check(false, synth.getLastError());
+		return;
+	}
+
+	PEImage img;
+	if (!img.loadExe(exe.c_str()))
+	{
+		check(false, img.getLastError());
+		return;
+	}
+
+	CV2PDB cv2pdb(img);
+	cv2pdb.addClassTypeEnum = true;
+	if (!cv2pdb.initGlobalSymbols() || !cv2pdb.initGlobalTypes())
+	{
+		check(false, cv2pdb.getLastError());
+		return;
+	}
+
+	// the inserted entries shift the types behind them
+	int types = 0, pos = 4;
+	for (; pos < cv2pdb.cbGlobalTypes; types++)
+		pos += ((const codeview_type*) (cv2pdb.globalTypes + pos))->generic.len + 2;
+	check(pos == cv2pdb.cbGlobalTypes && types == cv2pdb.nextUserType - 0x1000, "type records after the field list inserts");
+
+	std::vector<CV2PDB::FieldEntry> fields;
+	bool structsOk = true;
+	for (int t = 0; t < params.types; t++)
+	{
+		const codeview_type* cvtype = cv2pdb.getConvertedTypeData(0x1000 + 4 * t + 1);
+		const codeview_reftype* fieldlist = (const codeview_reftype*) cv2pdb.getConvertedTypeData(0x1000 + 4 * t);
+		structsOk = structsOk && cvtype->generic.id == LF_STRUCTURE_V3 && cvtype->struct_v3.fieldlist == 0x1000 + 4 * t
+		            && cv2pdb.decodeFields(fieldlist, fields) && fields.size() == 5 && cvtype->struct_v3.n_element == 5
+		            && fields[0].kind == LF_MEMBER_V3 && fields[3].kind == LF_MEMBER_V3 && fieldName(fieldlist, fields[3]) == "ptr"
+		            && fields[4].kind == LF_NESTTYPE_V3 && fields[4].type == cv2pdb.structEnumType
+		            && fieldName(fieldlist, fields[4]) == "__StructType";
+	}
+	check(structsOk, "struct field lists with __StructType");
+
+	int classBase = 0x1000 + 4 * params.types;
+	bool classesOk = true;
+	for (int c = 0; c < params.classes; c++)
+	{
+		// see SynthImage::genCodeView
+		int shared = c % 4 == 3 ? c - 2 : c;
+		int base = 0;
+		const char* enumName = "__ClassType";
+		int enumType = cv2pdb.classEnumType;
+		if (c == 0)
+			base = cv2pdb.classBaseType;
+		else if (shared % 4 == 1)
+			base = classBase + 1;
+		else if (c % 4 == 2)
+		{
+			base = cv2pdb.ifaceBaseType;
+			enumName = "__IfaceType";
+			enumType = cv2pdb.ifaceEnumType;
+		}
+		else
+			base = classBase + 2 * c - 1;
+
+		const codeview_type* cvtype = cv2pdb.getConvertedTypeData(classBase + 2 * c + 1);
+		const codeview_reftype* fieldlist = (const codeview_reftype*) cv2pdb.getConvertedTypeData(classBase + 2 * shared);
+		classesOk = classesOk && cvtype->generic.id == LF_CLASS_V3 && cvtype->struct_v3.fieldlist == classBase + 2 * shared
+		            && cv2pdb.decodeFields(fieldlist, fields) && fields.size() == 3
+		            && (shared != c || cvtype->struct_v3.n_element == 3)
+		            && fields[0].kind == LF_BCLASS_V2 && fields[0].type == base
+		            && fields[1].kind == LF_MEMBER_V3 && fieldName(fieldlist, fields[1]) == "m" && fields[1].offset == 8
+		            && fields[2].kind == LF_NESTTYPE_V3 && fields[2].type == enumType && fieldName(fieldlist, fields[2]) == enumName;
+
+		// the field list not used by the class sharing the one of the class two before is unchanged
+		if (shared != c)
+		{
+			fieldlist = (const codeview_reftype*) cv2pdb.getConvertedTypeData(classBase + 2 * c);
+			classesOk = classesOk && cv2pdb.decodeFields(fieldlist, fields) && fields.size() == 2
+			            && fields[0].kind == LF_BCLASS_V2 && fields[1].kind == LF_MEMBER_V3;
+		}
+	}
+	check(params.classes >= 4 && cv2pdb.classBaseType && cv2pdb.ifaceBaseType, "D classes in the CodeView image");
+	check(classesOk, "class field lists with base class and class type enum");
+
+	// the cached type properties must match a run without the cache after the base classes were inserted
+	std::vector<int> cached, uncached;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		std::vector<int>& props = pass ? uncached : cached;
+		if (pass)
+		{
+			cv2pdb.typeProps.clear();
+			cv2pdb.typePropsReadOnly = true;
+		}
+		for (int t = 0; t < cv2pdb.nextUserType; t++)
+		{
+			props.push_back(cv2pdb.translateType(t));
+			if (t < 0x1000)
+				continue;
+			props.push_back(cv2pdb.isClassType(t));
+			props.push_back(cv2pdb.getBaseClass(t));
+			props.push_back(cv2pdb.countBaseClasses(t));
+			props.push_back(cv2pdb.derivesFromObject(t));
+		}
+	}
+	cv2pdb.typePropsReadOnly = false;
+	check(cv2pdb.getBaseClass(classBase + 1) == cv2pdb.classBaseType, "inserted base class of object.Object");
+	check(cached == uncached, "cached type properties after insertClassTypeEnums");
+}
+
+int main(int argc, char* argv[])
+{
+	// generated images are written to the directory given as argument
+	std::string dir = argc > 1 ? std::string(argv[1]) + "/" : std::string();
+	std::string dwarfExe = dir + "coretest_dwarf.exe";
+	std::string cvExe = dir + "coretest_cv.exe";
+	std::string obj = dir + "coretest.obj";
+
+	SynthParams params;
+	params.cus = 4;
+	params.types = 20;
+	params.funcs = 40;
+	params.lines = 400;
+	params.fdes = 40;
+	params.locs = 10;
+	params.globals = 10;
+	params.inlines = 30;
+	params.classes = 12;
+
+	testDemangle();
+	testSymutil();
+	testDecodeFields();
+	testDWARF(params, dwarfExe);
+	testTypes(params, dwarfExe);
+	testImageSymbols(params, dwarfExe);
+	testObjectFile(params, obj);
+	testCV(params, cvExe);
+	testCVThreads(params, cvExe);
+	testClassTypeEnums(params, cvExe);
+
+	remove(dwarfExe.c_str());
+	remove(cvExe.c_str());
+	remove(obj.c_str());
+
+	if (failures)
+	{
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}